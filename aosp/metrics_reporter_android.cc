@@ -160,6 +160,12 @@ void MetricsReporterAndroid::ReportUpdateAttemptDownloadMetrics(
             << payload_bytes_downloaded / kNumBytesInOneMiB << " bytes data";
 }
 
+void MetricsReporterAndroid::ReportUpdateAttemptConnectionMetrics(
+    int num_connections) {
+  LOG(INFO) << "Current update attempt opened " << num_connections
+            << " connection(s)";
+}
+
 void MetricsReporterAndroid::ReportSuccessfulUpdateMetrics(
     int attempt_count,
     int /* updates_abandoned_count */,
@@ -63,6 +63,8 @@ class MetricsReporterAndroid : public MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) override;
 
+  void ReportUpdateAttemptConnectionMetrics(int num_connections) override;
+
   void ReportAbnormallyTerminatedUpdateAttemptMetrics() override;
 
   void ReportSuccessfulUpdateMetrics(
@@ -16,6 +16,8 @@
 
 #include "update_engine/aosp/update_attempter_android.h"
 
+#include <unistd.h>
+
 #include <algorithm>
 #include <map>
 #include <memory>
@@ -80,6 +82,11 @@ namespace {
 const double kBroadcastThresholdProgress = 0.01;  // 1%
 const int kBroadcastThresholdSeconds = 10;
 
+// How many partitions may be hashed at once after the update is applied, and
+// how much memory their read buffers may use.
+const size_t kMaxVerifyParallelism = 4;
+const size_t kVerifyMemoryBudget = 4 * 1024 * 1024;  // 4 MiB
+
 const char* const kErrorDomain = "update_engine";
 // TODO(deymo): Convert the different errors to a numeric value to report them
 // back on the service error.
@@ -130,6 +137,11 @@ string GetPayloadId(const std::map<string, string>& headers) {
               : "");
 }
 
+size_t GetVerifyParallelism() {
+  return std::min<size_t>(kMaxVerifyParallelism,
+                          std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L));
+}
+
 }  // namespace
 
 UpdateAttempterAndroid::UpdateAttempterAndroid(
@@ -287,6 +299,12 @@ bool UpdateAttempterAndroid::ApplyPayload(
   install_plan_.run_post_install =
       GetHeaderAsBool(headers[kPayloadPropertyRunPostInstall], true);
 
+  install_plan_.hash_written_data =
+      GetHeaderAsBool(headers[kPayloadPropertyHashWrittenData], false);
+
+  install_plan_.parallel_apply =
+      GetHeaderAsBool(headers[kPayloadPropertyParallelApply], false);
+
   // Skip writing verity if we're resuming and verity has already been written.
   install_plan_.write_verity = true;
   if (install_plan_.is_resume && prefs_->Exists(kPrefsVerityWritten)) {
@@ -314,6 +332,16 @@ bool UpdateAttempterAndroid::ApplyPayload(
     }
   }
 
+  prefetch_buffer_size_ = 0;
+  if (!headers[kPayloadPropertyPrefetchBufferSize].empty() &&
+      !base::StringToSizeT(headers[kPayloadPropertyPrefetchBufferSize],
+                           &prefetch_buffer_size_)) {
+    return LogAndSetError(error,
+                          FROM_HERE,
+                          "Invalid prefetch buffer size: " +
+                              headers[kPayloadPropertyPrefetchBufferSize]);
+  }
+
   LOG(INFO) << "Using this install plan:";
   install_plan_.Dump();
 
@@ -635,6 +663,11 @@ void UpdateAttempterAndroid::ActionCompleted(ActionProcessor* processor,
   // download_progress_ is actually used by other actions, such as
   // filesystem_verify_action. Therefore we always clear it.
   download_progress_ = 0;
+  if (type == DownloadAction::StaticType()) {
+    // Count the connections of the download whether or not it succeeded.
+    auto download_action = static_cast<DownloadAction*>(action);
+    num_connects_ += download_action->http_fetcher()->GetNumConnects();
+  }
   if (type == PostinstallRunnerAction::StaticType()) {
     bool succeeded =
         code == ErrorCode::kSuccess || code == ErrorCode::kUpdatedButNotActive;
@@ -789,11 +822,14 @@ void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
                                        update_certificates_path_);
   download_action->set_delegate(this);
   download_action->set_base_offset(base_offset_);
+  download_action->set_prefetch_buffer_size(prefetch_buffer_size_);
   auto filesystem_verifier_action = std::make_unique<FilesystemVerifierAction>(
       boot_control_->GetDynamicPartitionControl());
   auto postinstall_runner_action =
       std::make_unique<PostinstallRunnerAction>(boot_control_, hardware_);
   filesystem_verifier_action->set_delegate(this);
+  filesystem_verifier_action->set_parallel_hashing(GetVerifyParallelism(),
+                                                   kVerifyMemoryBudget);
   postinstall_runner_action->set_delegate(this);
 
   // Bond them together. We have to use the leaf-types when calling
@@ -846,6 +882,8 @@ bool UpdateAttempterAndroid::UpdateCompletedOnThisBoot() {
 // Collect and report the android metrics when we terminate the update.
 void UpdateAttempterAndroid::CollectAndReportUpdateMetricsOnUpdateFinished(
     ErrorCode error_code) {
+  const int num_connects = num_connects_;
+  num_connects_ = 0;
   int64_t attempt_number =
       metrics_utils::GetPersistedValue(kPrefsPayloadAttemptNumber, prefs_);
   PayloadType payload_type = kPayloadTypeFull;
@@ -887,6 +925,7 @@ void UpdateAttempterAndroid::CollectAndReportUpdateMetricsOnUpdateFinished(
       DownloadSource::kNumDownloadSources,
       metrics::DownloadErrorCode::kUnset,
       metrics::ConnectionType::kUnset);
+  metrics_reporter_->ReportUpdateAttemptConnectionMetrics(num_connects);
 
   if (error_code == ErrorCode::kSuccess) {
     int64_t reboot_count =
@@ -1216,6 +1255,8 @@ bool UpdateAttempterAndroid::setShouldSwitchSlotOnReboot(
         std::make_unique<FilesystemVerifierAction>(
             boot_control_->GetDynamicPartitionControl());
     filesystem_verifier_action->set_delegate(this);
+    filesystem_verifier_action->set_parallel_hashing(GetVerifyParallelism(),
+                                                     kVerifyMemoryBudget);
     BondActions(install_plan_action.get(), filesystem_verifier_action.get());
     BondActions(filesystem_verifier_action.get(),
                 postinstall_runner_action.get());
@@ -261,6 +261,10 @@ class UpdateAttempterAndroid
   // The offset in the payload file where the CrAU part starts.
   int64_t base_offset_{0};
 
+  // How much of the downloaded payload may be buffered while it is applied,
+  // from the PREFETCH_BUFFER_SIZE payload property. Zero disables the buffer.
+  size_t prefetch_buffer_size_{0};
+
   // Helper class to select the network to use during the update.
   std::unique_ptr<NetworkSelectorInterface> network_selector_;
 
@@ -282,6 +286,8 @@ class UpdateAttempterAndroid
 
   metrics_utils::PersistedValue<int64_t> metric_bytes_downloaded_;
   metrics_utils::PersistedValue<int64_t> metric_total_bytes_downloaded_;
+  // Connections opened by the downloads of the current update attempt.
+  int num_connects_{0};
 
   DISALLOW_COPY_AND_ASSIGN(UpdateAttempterAndroid);
 };
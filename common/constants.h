@@ -134,6 +134,10 @@ static constexpr const auto& kPrefsUpdateStateNextDataOffset =
     "update-state-next-data-offset";
 static constexpr const auto& kPrefsUpdateStateNextOperation =
     "update-state-next-operation";
+static constexpr const auto& kPrefsUpdateStatePartialOperationDataHash =
+    "update-state-partial-operation-data-hash";
+static constexpr const auto& kPrefsUpdateStatePartialOperationDataSize =
+    "update-state-partial-operation-data-size";
 static constexpr const auto& kPrefsUpdateStatePayloadIndex =
     "update-state-payload-index";
 static constexpr const auto& kPrefsUpdateStateSHA256Context =
@@ -191,6 +195,20 @@ static constexpr const auto& kPayloadPropertySwitchSlotOnReboot =
 // The default is 1 (always run post install).
 static constexpr const auto& kPayloadPropertyRunPostInstall =
     "RUN_POST_INSTALL";
+// Set "HASH_WRITTEN_DATA=1" to hash the data written to the target partitions
+// while applying the update, so verifying them reads only the blocks which
+// weren't written in order. The default is 0.
+static constexpr const auto& kPayloadPropertyHashWrittenData =
+    "HASH_WRITTEN_DATA";
+// Set "PARALLEL_APPLY=1" to apply the partitions of a payload read from a
+// local file (file:// or fd:// URL) in parallel instead of in payload order.
+// The default is 0.
+static constexpr const auto& kPayloadPropertyParallelApply = "PARALLEL_APPLY";
+// Set "PREFETCH_BUFFER_SIZE=<bytes>" to buffer up to that much of the
+// downloaded payload in memory while it is applied, so slow writes to the
+// partitions don't stall the download. The default is 0, no buffer.
+static constexpr const auto& kPayloadPropertyPrefetchBufferSize =
+    "PREFETCH_BUFFER_SIZE";
 
 static constexpr const auto& kOmahaUpdaterVersion = "0.1.0.0";
 
@@ -28,6 +28,7 @@
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/http_fetcher.h"
 #include "update_engine/common/multi_range_http_fetcher.h"
+#include "update_engine/common/scoped_task_id.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/install_plan.h"
 
@@ -108,9 +109,18 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
 
   void set_base_offset(int64_t base_offset) { base_offset_ = base_offset; }
 
+  // Buffers up to |size| bytes of the downloaded payload in memory and
+  // applies them on another thread, so the download doesn't wait for each
+  // write to the partitions; it is paused while the buffer is full. Payloads
+  // applied in parallel, see InstallPlan::parallel_apply, aren't buffered.
+  // Zero, the default, applies the payload as it is received.
+  void set_prefetch_buffer_size(size_t size) { prefetch_buffer_size_ = size; }
+
   HttpFetcher* http_fetcher() { return http_fetcher_.get(); }
 
  private:
+  class PrefetchBuffer;
+
   // Attempt to load cached manifest data from prefs
   // return true on success, false otherwise.
   bool LoadCachedManifest(int64_t manifest_size);
@@ -118,6 +128,29 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
   // Start downloading the current payload using delta_performer.
   void StartDownloading();
 
+  // Resumes the download paused by ReceivedBytes() once |prefetch_buffer_|
+  // has room again, checking it periodically on the message loop.
+  void WaitForPrefetchBufferRoom();
+
+  // Waits on the message loop for the data in |prefetch_buffer_| to be
+  // applied once the transfer completed, |successful| or not, then goes on
+  // like TransferComplete() does without a buffer.
+  void DrainPrefetchBuffer(bool successful);
+
+  // Reports the progress to |delegate_|, |bytes_progressed| being the number
+  // of bytes received since the last report.
+  void ReportBytesReceived(uint64_t bytes_progressed);
+
+  // Waits on the message loop for the partitions still applied in parallel
+  // by |delta_performer_| once the payload was received, reporting their
+  // progress, then calls FinishTransfer().
+  void WaitForParallelApply();
+
+  // Closes |delta_performer_| and verifies the payload, if the transfer was
+  // |successful| and applying it didn't fail with |apply_error|, and
+  // completes the action.
+  void FinishTransfer(bool successful, ErrorCode apply_error);
+
   // Pointer to the current payload in install_plan_.payloads.
   InstallPlan::Payload* payload_{nullptr};
 
@@ -136,6 +169,24 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
 
   std::unique_ptr<DeltaPerformer> delta_performer_;
 
+  // The received payload data waiting to be applied by |delta_performer_|, if
+  // |prefetch_buffer_size_| is set.
+  size_t prefetch_buffer_size_{0};
+  std::unique_ptr<PrefetchBuffer> prefetch_buffer_;
+
+  // The pending WaitForPrefetchBufferRoom() or DrainPrefetchBuffer() call, if
+  // any.
+  ScopedTaskId prefetch_buffer_task_;
+
+  // Whether the download is paused until |prefetch_buffer_| has room, and
+  // whether it was suspended by the action processor. The fetcher is paused
+  // while either is set.
+  bool prefetch_buffer_full_{false};
+  bool suspended_{false};
+
+  // The pending WaitForParallelApply() call, if any.
+  ScopedTaskId parallel_apply_task_;
+
   // Used by TransferTerminated to figure if this action terminated itself or
   // was terminated by the action processor.
   ErrorCode code_;
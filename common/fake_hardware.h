@@ -122,7 +122,10 @@ class FakeHardware : public HardwareInterface {
   bool IsPowerwashScheduled() { return powerwash_scheduled_; }
 
   bool GetNonVolatileDirectory(base::FilePath* path) const override {
-    return false;
+    if (non_volatile_dir_.empty())
+      return false;
+    *path = non_volatile_dir_;
+    return true;
   }
 
   bool GetPowerwashSafeDirectory(base::FilePath* path) const override {
@@ -194,6 +197,10 @@ class FakeHardware : public HardwareInterface {
 
   void SetWarmReset(bool warm_reset) override { warm_reset_ = warm_reset; }
 
+  void SetNonVolatileDirectory(const base::FilePath& path) {
+    non_volatile_dir_ = path;
+  }
+
   void SetVbmetaDigestForInactiveSlot(bool reset) override {}
 
   // Getters to verify state.
@@ -247,6 +254,7 @@ class FakeHardware : public HardwareInterface {
   int64_t build_timestamp_{0};
   bool first_active_omaha_ping_sent_{false};
   bool warm_reset_{false};
+  base::FilePath non_volatile_dir_;
   mutable std::map<std::string, std::string> partition_timestamps_;
 
   DISALLOW_COPY_AND_ASSIGN(FakeHardware);
@@ -16,6 +16,10 @@
 
 #include "update_engine/common/file_fetcher.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <string>
 
@@ -23,6 +27,7 @@
 #include <base/format_macros.h>
 #include <base/location.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <brillo/streams/file_stream.h>
@@ -36,6 +41,10 @@ namespace {
 
 size_t kReadBufferSize = 16 * 1024;
 
+// The size of the reads of regular files. Reads are aligned to this size in
+// the file, so the first one may be shorter.
+const size_t kSpanSize = 1024 * 1024;
+
 }  // namespace
 
 namespace chromeos_update_engine {
@@ -69,21 +78,32 @@ void FileFetcher::BeginTransfer(const string& url) {
   }
 
   string file_path;
+  int fd = -1;
 
   if (base::StartsWith(url, "fd://", base::CompareCase::INSENSITIVE_ASCII)) {
-    int fd = std::stoi(url.substr(strlen("fd://")));
+    fd = std::stoi(url.substr(strlen("fd://")));
     file_path = url;
-    stream_ = brillo::FileStream::FromFileDescriptor(fd, false, nullptr);
   } else {
     file_path = url.substr(strlen("file://"));
+    fd = HANDLE_EINTR(open(file_path.c_str(), O_RDONLY | O_CLOEXEC));
+    owns_file_fd_ = fd >= 0;
+  }
+
+  struct stat stbuf;
+  if (fd >= 0 && fstat(fd, &stbuf) == 0 && S_ISREG(stbuf.st_mode)) {
+    // Regular files are read with large reads, ahead of which the kernel
+    // reads the next span.
+    file_fd_ = fd;
+    posix_fadvise(file_fd_, offset_, 0, POSIX_FADV_SEQUENTIAL);
+  } else if (fd >= 0) {
     stream_ =
-        brillo::FileStream::Open(base::FilePath(file_path),
-                                 brillo::Stream::AccessMode::READ,
-                                 brillo::FileStream::Disposition::OPEN_EXISTING,
-                                 nullptr);
+        brillo::FileStream::FromFileDescriptor(fd, owns_file_fd_, nullptr);
+    if (!stream_ && owns_file_fd_)
+      IGNORE_EINTR(close(fd));
+    owns_file_fd_ = false;
   }
 
-  if (!stream_) {
+  if (file_fd_ < 0 && !stream_) {
     LOG(ERROR) << "Couldn't open " << file_path;
     http_response_code_ = kHttpResponseNotFound;
     CleanUp();
@@ -93,7 +113,7 @@ void FileFetcher::BeginTransfer(const string& url) {
   }
   http_response_code_ = kHttpResponseOk;
 
-  if (offset_)
+  if (offset_ && stream_)
     stream_->SetPosition(offset_, nullptr);
   bytes_copied_ = 0;
   transfer_in_progress_ = true;
@@ -112,6 +132,21 @@ void FileFetcher::ScheduleRead() {
   if (transfer_paused_ || ongoing_read_ || !transfer_in_progress_)
     return;
 
+  if (file_fd_ >= 0) {
+    // Read from a task, so the delegate can pause or terminate the transfer
+    // and other events are handled between spans.
+    ongoing_read_ = read_task_.PostTask(
+        FROM_HERE,
+        base::BindOnce(&FileFetcher::ReadSpan, base::Unretained(this)));
+    if (!ongoing_read_) {
+      LOG(ERROR) << "Unable to schedule a read from the file.";
+      CleanUp();
+      if (delegate_)
+        delegate_->TransferComplete(this, false);
+    }
+    return;
+  }
+
   buffer_.resize(kReadBufferSize);
   size_t bytes_to_read = buffer_.size();
   if (data_length_ >= 0) {
@@ -139,6 +174,34 @@ void FileFetcher::ScheduleRead() {
   }
 }
 
+void FileFetcher::ReadSpan() {
+  ongoing_read_ = false;
+  if (transfer_paused_)
+    return;
+
+  const uint64_t position = offset_ + bytes_copied_;
+  uint64_t bytes_to_read = kSpanSize - position % kSpanSize;
+  if (data_length_ >= 0) {
+    bytes_to_read = std::min(bytes_to_read, data_length_ - bytes_copied_);
+  }
+  if (!bytes_to_read) {
+    OnReadDoneCallback(0);
+    return;
+  }
+
+  buffer_.resize(kSpanSize);
+  ssize_t bytes_read = HANDLE_EINTR(
+      pread(file_fd_, buffer_.data(), bytes_to_read, position));
+  if (bytes_read < 0) {
+    PLOG(ERROR) << "Unable to read from the file at offset " << position;
+    CleanUp();
+    if (delegate_)
+      delegate_->TransferComplete(this, false);
+    return;
+  }
+  OnReadDoneCallback(bytes_read);
+}
+
 void FileFetcher::OnReadDoneCallback(size_t bytes_read) {
   ongoing_read_ = false;
   if (bytes_read == 0) {
@@ -184,6 +247,11 @@ void FileFetcher::CleanUp() {
     stream_->CloseBlocking(nullptr);
     stream_.reset();
   }
+  read_task_.Cancel();
+  if (owns_file_fd_)
+    IGNORE_EINTR(close(file_fd_));
+  file_fd_ = -1;
+  owns_file_fd_ = false;
   // Destroying the |stream_| releases the callback, so we don't have any
   // ongoing read at this point.
   ongoing_read_ = false;
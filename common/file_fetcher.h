@@ -26,9 +26,11 @@
 #include <brillo/streams/stream.h>
 
 #include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/scoped_task_id.h"
 
 // This is a concrete implementation of HttpFetcher that reads files
-// asynchronously.
+// asynchronously. Regular files are read directly in large spans from tasks
+// of the main loop; other files, like pipes, are read through a stream.
 
 namespace chromeos_update_engine {
 
@@ -87,6 +89,9 @@ class FileFetcher : public HttpFetcher {
   // read is in process. This method can be called at any point.
   void ScheduleRead();
 
+  // Reads the next span of |file_fd_| and passes it to the delegate.
+  void ReadSpan();
+
   // Called from the main loop when a single read from |stream_| succeeds or
   // fails, calling OnReadDoneCallback() and OnReadErrorCallback() respectively.
   void OnReadDoneCallback(size_t bytes_read);
@@ -113,6 +118,15 @@ class FileFetcher : public HttpFetcher {
 
   brillo::StreamPtr stream_;
 
+  // The regular file read directly, or -1 when reading from |stream_|.
+  int file_fd_{-1};
+
+  // Whether |file_fd_| was opened by the fetcher and has to be closed.
+  bool owns_file_fd_{false};
+
+  // The task reading the next span of |file_fd_|.
+  ScopedTaskId read_task_;
+
   // The buffer used for reading from the stream.
   brillo::Blob buffer_;
 
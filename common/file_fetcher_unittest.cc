@@ -17,14 +17,50 @@
 #include "update_engine/common/file_fetcher.h"
 
 #include <string>
+#include <vector>
 
+#include <brillo/message_loops/fake_message_loop.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
 
 namespace chromeos_update_engine {
 
-class FileFetcherUnitTest : public ::testing::Test {};
+namespace {
+
+class FileFetcherTestDelegate : public HttpFetcherDelegate {
+ public:
+  bool ReceivedBytes(HttpFetcher* /* fetcher */,
+                     const void* bytes,
+                     size_t length) override {
+    const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+    data.insert(data.end(), begin, begin + length);
+    read_sizes.push_back(length);
+    return true;
+  }
+
+  void TransferComplete(HttpFetcher* /* fetcher */, bool successful) override {
+    completed = true;
+    transfer_successful = successful;
+  }
+
+  void TransferTerminated(HttpFetcher* /* fetcher */) override {}
+
+  brillo::Blob data;
+  std::vector<size_t> read_sizes;
+  bool completed{false};
+  bool transfer_successful{false};
+};
+
+}  // namespace
+
+class FileFetcherUnitTest : public ::testing::Test {
+ protected:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+};
 
 TEST_F(FileFetcherUnitTest, SupporterUrlsTest) {
   EXPECT_TRUE(FileFetcher::SupportedUrl("file:///path/to/somewhere.bin"));
@@ -34,4 +70,31 @@ TEST_F(FileFetcherUnitTest, SupporterUrlsTest) {
   EXPECT_FALSE(FileFetcher::SupportedUrl("http:///no_http_here"));
 }
 
+// Regular files are read in large spans aligned in the file.
+TEST_F(FileFetcherUnitTest, ReadsRegularFileInSpansTest) {
+  brillo::Blob file_data(3 * 1024 * 1024 + 123);
+  test_utils::FillWithData(&file_data);
+  ScopedTempFile file("FileFetcherUnitTest-file.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(file.path(), file_data));
+
+  const size_t offset = 1000;
+  const size_t length = file_data.size() - offset - 100;
+  FileFetcherTestDelegate delegate;
+  FileFetcher fetcher;
+  fetcher.set_delegate(&delegate);
+  fetcher.SetOffset(offset);
+  fetcher.SetLength(length);
+  fetcher.BeginTransfer("file://" + file.path());
+  while (!delegate.completed && loop_.RunOnce(false)) {
+  }
+
+  EXPECT_TRUE(delegate.transfer_successful);
+  EXPECT_EQ(brillo::Blob(file_data.begin() + offset,
+                         file_data.begin() + offset + length),
+            delegate.data);
+  ASSERT_EQ(4U, delegate.read_sizes.size());
+  EXPECT_EQ(1024U * 1024 - offset, delegate.read_sizes[0]);
+  EXPECT_EQ(1024U * 1024, delegate.read_sizes[1]);
+}
+
 }  // namespace chromeos_update_engine
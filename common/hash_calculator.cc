@@ -18,6 +18,8 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
+
 #include <base/logging.h>
 #include <base/posix/eintr_wrapper.h>
 
@@ -27,6 +29,14 @@ using std::string;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The chunk size of HashCalculator::UpdateAll(), small enough to stay in the
+// L1 data cache of the CPU while it is hashed by each calculator.
+const size_t kUpdateAllChunkSize = 16 * 1024;  // 16 KiB
+
+}  // namespace
+
 HashCalculator::HashCalculator() : valid_(false) {
   valid_ = (SHA256_Init(&ctx_) == 1);
   LOG_IF(ERROR, !valid_) << "SHA256_Init failed";
@@ -43,6 +53,22 @@ bool HashCalculator::Update(const void* data, size_t length) {
   return true;
 }
 
+// static
+bool HashCalculator::UpdateAll(const std::vector<HashCalculator*>& calculators,
+                               const void* data,
+                               size_t length) {
+  const uint8_t* chunk = static_cast<const uint8_t*>(data);
+  while (length > 0) {
+    const size_t chunk_size = std::min(length, kUpdateAllChunkSize);
+    for (HashCalculator* calculator : calculators) {
+      TEST_AND_RETURN_FALSE(calculator->Update(chunk, chunk_size));
+    }
+    chunk += chunk_size;
+    length -= chunk_size;
+  }
+  return true;
+}
+
 off_t HashCalculator::UpdateFile(const string& name, off_t length) {
   int fd = HANDLE_EINTR(open(name.c_str(), O_RDONLY));
   if (fd < 0) {
@@ -44,6 +44,14 @@ class HashCalculator {
   // Returns true on success.
   bool Update(const void* data, size_t length);
 
+  // Updates each of the |calculators| with |length| bytes of |data|. The data
+  // is passed to all of them one small chunk at a time, so it is read from
+  // memory once and from the CPU cache by the other calculators, instead of
+  // being read from memory once per calculator.
+  static bool UpdateAll(const std::vector<HashCalculator*>& calculators,
+                        const void* data,
+                        size_t length);
+
   // Updates the hash with up to |length| bytes of data from |file|. If |length|
   // is negative, reads in and updates with the whole file. Returns the number
   // of bytes that the hash was updated with, or -1 on error.
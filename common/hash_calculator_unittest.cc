@@ -77,6 +77,34 @@ TEST_F(HashCalculatorTest, ContextTest) {
   EXPECT_EQ(raw_hash, calc_next.raw_hash());
 }
 
+TEST_F(HashCalculatorTest, UpdateAllTest) {
+  // Larger than a few chunks, and not a multiple of the chunk size.
+  brillo::Blob data(100 * 1024 + 3);
+  test_utils::FillWithData(&data);
+  brillo::Blob expected_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data, &expected_hash));
+
+  // Calculators with different data already hashed end up different, but
+  // each matches hashing the data on its own.
+  HashCalculator first, second, third;
+  ASSERT_TRUE(second.Update("hi", 2));
+  string second_context = second.GetContext();
+  ASSERT_TRUE(HashCalculator::UpdateAll(
+      {&first, &second, &third}, data.data(), data.size()));
+  ASSERT_TRUE(first.Finalize());
+  ASSERT_TRUE(second.Finalize());
+  ASSERT_TRUE(third.Finalize());
+  EXPECT_EQ(expected_hash, first.raw_hash());
+  EXPECT_EQ(expected_hash, third.raw_hash());
+
+  HashCalculator second_alone;
+  ASSERT_TRUE(second_alone.SetContext(second_context));
+  ASSERT_TRUE(second_alone.Update(data.data(), data.size()));
+  ASSERT_TRUE(second_alone.Finalize());
+  EXPECT_EQ(second_alone.raw_hash(), second.raw_hash());
+  EXPECT_NE(expected_hash, second.raw_hash());
+}
+
 TEST_F(HashCalculatorTest, BigTest) {
   HashCalculator calc;
 
@@ -140,6 +140,10 @@ class HttpFetcher {
   // Get the total number of bytes downloaded by fetcher.
   virtual size_t GetBytesDownloaded() = 0;
 
+  // Returns the number of connections opened by the transfers of this fetcher
+  // so far, or 0 for fetchers that don't open connections.
+  virtual int GetNumConnects() { return 0; }
+
  protected:
   // The URL we're actively fetching from
   std::string url_;
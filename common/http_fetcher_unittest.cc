@@ -1355,6 +1355,33 @@ TYPED_TEST(HttpFetcherTest, MultiHttpFetcherTerminateBetweenRangesTest) {
   EXPECT_EQ(kRangeTrigger, delegate.bytes_downloaded_);
 }
 
+// Consecutive transfers of a fetcher to the same server reuse its connection,
+// so HTTPS transfers don't do a new TLS handshake each.
+TYPED_TEST(HttpFetcherTest, ReuseConnectionTest) {
+  if (this->test_.IsMock() || this->test_.IsMulti() ||
+      !this->test_.IsHttpSupported())
+    return;
+
+  HttpFetcherTestDelegate delegate;
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+  unique_ptr<LibcurlHttpFetcher> fetcher(
+      static_cast<LibcurlHttpFetcher*>(this->test_.NewLargeFetcher()));
+  fetcher->set_delegate(&delegate);
+
+  const string url = LocalServerUrlForPath(
+      server->GetPort(),
+      base::StringPrintf("/keep-alive/download/%d", kMediumLength));
+  for (int i = 1; i <= 2; i++) {
+    this->loop_.PostTask(FROM_HERE,
+                         base::Bind(StartTransfer, fetcher.get(), url));
+    this->loop_.Run();
+    EXPECT_EQ(i, delegate.times_transfer_complete_called_);
+  }
+  EXPECT_EQ(static_cast<size_t>(2 * kMediumLength), delegate.data.size());
+  EXPECT_EQ(1, fetcher->GetNumConnects());
+}
+
 class BlockedTransferTestDelegate : public HttpFetcherDelegate {
  public:
   bool ReceivedBytes(HttpFetcher* fetcher,
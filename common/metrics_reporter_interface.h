@@ -137,6 +137,11 @@ class MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) = 0;
 
+  // Helper function to report |num_connections|, the number of network
+  // connections opened to download the payload, and so of TLS handshakes for
+  // HTTPS, after the completion of each update attempt.
+  virtual void ReportUpdateAttemptConnectionMetrics(int num_connections) = 0;
+
   // Reports the |kAbnormalTermination| for the |kMetricAttemptResult|
   // metric. No other metrics in the UpdateEngine.Attempt.* namespace
   // will be reported.
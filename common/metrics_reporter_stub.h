@@ -58,6 +58,8 @@ class MetricsReporterStub : public MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) override {}
 
+  void ReportUpdateAttemptConnectionMetrics(int num_connections) override {}
+
   void ReportAbnormallyTerminatedUpdateAttemptMetrics() override {}
 
   void ReportSuccessfulUpdateMetrics(
@@ -57,6 +57,8 @@ class MockMetricsReporter : public MetricsReporterInterface {
                     metrics::DownloadErrorCode payload_download_error_code,
                     metrics::ConnectionType connection_type));
 
+  MOCK_METHOD1(ReportUpdateAttemptConnectionMetrics, void(int num_connections));
+
   MOCK_METHOD0(ReportAbnormallyTerminatedUpdateAttemptMetrics, void());
 
   MOCK_METHOD10(ReportSuccessfulUpdateMetrics,
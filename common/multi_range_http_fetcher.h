@@ -110,6 +110,8 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
     return base_fetcher_->GetBytesDownloaded();
   }
 
+  int GetNumConnects() override { return base_fetcher_->GetNumConnects(); }
+
   void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {
     base_fetcher_->set_low_speed_limit(low_speed_bps, low_speed_sec);
   }
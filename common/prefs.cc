@@ -53,17 +53,21 @@ void DeleteEmptyDirectories(const base::FilePath& path) {
 }  // namespace
 
 bool PrefsBase::GetString(const std::string_view key, string* value) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   return storage_->GetKey(key, value);
 }
 
 bool PrefsBase::SetString(std::string_view key, std::string_view value) {
-  TEST_AND_RETURN_FALSE(storage_->SetKey(key, value));
-  const auto observers_for_key = observers_.find(key);
-  if (observers_for_key != observers_.end()) {
-    std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
-    for (ObserverInterface* observer : copy_observers)
-      observer->OnPrefSet(key);
+  std::vector<ObserverInterface*> copy_observers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TEST_AND_RETURN_FALSE(storage_->SetKey(key, value));
+    const auto observers_for_key = observers_.find(key);
+    if (observers_for_key != observers_.end())
+      copy_observers = observers_for_key->second;
   }
+  for (ObserverInterface* observer : copy_observers)
+    observer->OnPrefSet(key);
   return true;
 }
 
@@ -101,17 +105,21 @@ bool PrefsBase::SetBoolean(std::string_view key, const bool value) {
 }
 
 bool PrefsBase::Exists(std::string_view key) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   return storage_->KeyExists(key);
 }
 
 bool PrefsBase::Delete(std::string_view key) {
-  TEST_AND_RETURN_FALSE(storage_->DeleteKey(key));
-  const auto observers_for_key = observers_.find(key);
-  if (observers_for_key != observers_.end()) {
-    std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
-    for (ObserverInterface* observer : copy_observers)
-      observer->OnPrefDeleted(key);
+  std::vector<ObserverInterface*> copy_observers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TEST_AND_RETURN_FALSE(storage_->DeleteKey(key));
+    const auto observers_for_key = observers_.find(key);
+    if (observers_for_key != observers_.end())
+      copy_observers = observers_for_key->second;
   }
+  for (ObserverInterface* observer : copy_observers)
+    observer->OnPrefDeleted(key);
   return true;
 }
 
@@ -134,15 +142,18 @@ bool PrefsBase::Delete(std::string_view pref_key, const vector<string>& nss) {
 }
 
 bool PrefsBase::GetSubKeys(std::string_view ns, vector<string>* keys) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   return storage_->GetSubKeys(ns, keys);
 }
 
 void PrefsBase::AddObserver(std::string_view key, ObserverInterface* observer) {
+  std::lock_guard<std::mutex> lock(mutex_);
   observers_[std::string{key}].push_back(observer);
 }
 
 void PrefsBase::RemoveObserver(std::string_view key,
                                ObserverInterface* observer) {
+  std::lock_guard<std::mutex> lock(mutex_);
   std::vector<ObserverInterface*>& observers_for_key =
       observers_[std::string{key}];
   auto observer_it =
@@ -19,6 +19,7 @@
 
 #include <functional>
 #include <map>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -31,7 +32,9 @@
 namespace chromeos_update_engine {
 
 // Implements a preference store by storing the value associated with a key
-// in a given storage passed during construction.
+// in a given storage passed during construction. The keys can be read and
+// written from several threads; observers are notified on the thread that
+// changed the key.
 class PrefsBase : public PrefsInterface {
  public:
   // Storage interface used to set and retrieve keys.
@@ -87,6 +90,9 @@ class PrefsBase : public PrefsInterface {
                       ObserverInterface* observer) override;
 
  private:
+  // Guards |observers_| and the accesses to |storage_|.
+  mutable std::mutex mutex_;
+
   // The registered observers watching for changes.
   std::map<std::string, std::vector<ObserverInterface*>, std::less<>>
       observers_;
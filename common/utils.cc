@@ -23,6 +23,7 @@
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -264,6 +265,31 @@ bool PWriteAll(const FileDescriptorPtr& fd,
   return success;
 }
 
+bool PWriteAll(const FileDescriptorPtr& fd,
+               const struct iovec* iov,
+               size_t iovcnt,
+               off_t offset) {
+  std::vector<struct iovec> remaining(iov, iov + iovcnt);
+  auto it = remaining.begin();
+  while (it != remaining.end()) {
+    const size_t batch = std::min<size_t>(remaining.end() - it, IOV_MAX);
+    ssize_t rc = fd->WriteV(&*it, batch, offset);
+    TEST_AND_RETURN_FALSE_ERRNO(rc >= 0);
+    TEST_AND_RETURN_FALSE(rc > 0 || it->iov_len == 0);
+    offset += rc;
+    // Skip the buffers fully written, and trim a partially written one.
+    for (; it != remaining.end() && rc >= static_cast<ssize_t>(it->iov_len);
+         ++it) {
+      rc -= it->iov_len;
+    }
+    if (rc > 0) {
+      it->iov_base = static_cast<uint8_t*>(it->iov_base) + rc;
+      it->iov_len -= rc;
+    }
+  }
+  return true;
+}
+
 // Append |nbytes| of content from |buf| to the vector pointed to by either
 // |vec_p| or |str_p|.
 static void AppendBytes(const uint8_t* buf,
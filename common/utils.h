@@ -19,6 +19,7 @@
 
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -86,6 +87,14 @@ bool PWriteAll(const FileDescriptorPtr& fd,
                size_t count,
                off_t offset);
 
+// Vectored flavor of the above, writes all |iovcnt| buffers in |iov| back to
+// back starting at |offset|, using as few FileDescriptor::WriteV() calls as
+// possible. DOES NOT modify file position.
+bool PWriteAll(const FileDescriptorPtr& fd,
+               const struct iovec* iov,
+               size_t iovcnt,
+               off_t offset);
+
 // Calls read() repeatedly until |count| bytes are read or EOF or EWOULDBLOCK
 // is reached. Returns whether all read() calls succeeded (including EWOULDBLOCK
 // as a success case), sets |eof| to whether the eof was reached and sets
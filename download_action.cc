@@ -17,13 +17,24 @@
 #include "update_engine/common/download_action.h"
 
 #include <errno.h>
+#include <fcntl.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
 #include <string>
 
+#include <android-base/unique_fd.h>
+#include <base/bind.h>
 #include <base/files/file_path.h>
 #include <base/metrics/statistics_recorder.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/error_code_utils.h"
@@ -36,6 +47,150 @@ using std::string;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+constexpr auto kParallelApplyProgressInterval =
+    base::TimeDelta::FromMilliseconds(100);
+
+// How often the prefetch buffer is checked for room, or for being drained,
+// while the main loop waits for it.
+constexpr auto kPrefetchBufferPollInterval =
+    base::TimeDelta::FromMilliseconds(10);
+
+// Opens the payload at |url| if it's a local file, as read by FileFetcher.
+android::base::unique_fd OpenLocalPayload(const string& url) {
+  if (base::StartsWith(url, "fd://", base::CompareCase::INSENSITIVE_ASCII)) {
+    int fd = -1;
+    if (!base::StringToInt(url.substr(strlen("fd://")), &fd))
+      return {};
+    return android::base::unique_fd(
+        HANDLE_EINTR(fcntl(fd, F_DUPFD_CLOEXEC, 0)));
+  }
+  if (base::StartsWith(url, "file:///", base::CompareCase::INSENSITIVE_ASCII)) {
+    const string path = url.substr(strlen("file://"));
+    return android::base::unique_fd(
+        HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+  }
+  return {};
+}
+
+// Local payloads can be read at any offset, which lets |delta_performer|
+// apply their partitions in parallel instead of in download order. Returns
+// whether the payload is applied in parallel.
+bool UseLocalPayload(DeltaPerformer* delta_performer,
+                     const string& url,
+                     int64_t base_offset) {
+  android::base::unique_fd fd = OpenLocalPayload(url);
+  if (!fd.ok())
+    return false;
+  delta_performer->SetLocalPayload(std::move(fd), base_offset);
+  return true;
+}
+
+}  // namespace
+
+// A bounded queue of received payload data, applied in order by a
+// DeltaPerformer on its own thread. Its methods never wait for the data to be
+// applied, so the caller polls it from the message loop and pauses the
+// download while it is full. The data is only kept in memory, so the update
+// progress persisted by the DeltaPerformer covers the applied data only and
+// resuming downloads again whatever was still queued.
+class DownloadAction::PrefetchBuffer
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  PrefetchBuffer(DeltaPerformer* delta_performer, size_t capacity)
+      : delta_performer_(delta_performer),
+        capacity_(capacity),
+        thread_(this, "download-apply") {
+    thread_.Start();
+  }
+
+  ~PrefetchBuffer() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_all();
+    // Waits for the data being applied, if any; the rest is discarded.
+    thread_.Join();
+  }
+
+  // Queues |length| bytes to be applied, even if the buffer is full, so the
+  // caller has to stop receiving data while IsFull(). Returns false, with the
+  // |error| of the DeltaPerformer, if applying the data failed.
+  bool Push(const void* bytes, size_t length, ErrorCode* error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_) {
+      *error = error_;
+      return false;
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    chunks_.emplace_back(data, data + length);
+    size_ += length;
+    cv_.notify_all();
+    return true;
+  }
+
+  // Returns whether the buffer has no room for more data. It has room again
+  // once applying failed, so the next Push() reports the error.
+  bool IsFull() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !failed_ && size_ >= capacity_;
+  }
+
+  // Returns whether all the queued data was applied or applying it failed,
+  // without waiting. |error| is set to the error of the DeltaPerformer then.
+  bool PollDrain(ErrorCode* error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!failed_ && size_ > 0)
+      return false;
+    *error = error_;
+    return true;
+  }
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this] { return stopped_ || !chunks_.empty(); });
+      if (stopped_)
+        return;
+      brillo::Blob chunk = std::move(chunks_.front());
+      chunks_.pop_front();
+      lock.unlock();
+      ErrorCode error = ErrorCode::kSuccess;
+      bool success =
+          delta_performer_->Write(chunk.data(), chunk.size(), &error);
+      lock.lock();
+      // The data being applied still counts against the capacity.
+      size_ -= chunk.size();
+      if (!success) {
+        failed_ = true;
+        error_ = error;
+        return;
+      }
+    }
+  }
+
+ private:
+  DeltaPerformer* const delta_performer_;
+  const size_t capacity_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The queued data and the size of it and of the data being applied.
+  std::deque<brillo::Blob> chunks_;
+  size_t size_{0};
+  bool stopped_{false};
+  // Whether applying failed, with the error of the DeltaPerformer.
+  bool failed_{false};
+  ErrorCode error_{ErrorCode::kSuccess};
+
+  base::DelegateSimpleThread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrefetchBuffer);
+};
+
 DownloadAction::DownloadAction(PrefsInterface* prefs,
                                BootControlInterface* boot_control,
                                HardwareInterface* hardware,
@@ -51,7 +206,10 @@ DownloadAction::DownloadAction(PrefsInterface* prefs,
       delegate_(nullptr),
       update_certificates_path_(std::move(update_certificates_path)) {}
 
-DownloadAction::~DownloadAction() {}
+DownloadAction::~DownloadAction() {
+  // Stop applying before |delta_performer_| is destroyed.
+  prefetch_buffer_.reset();
+}
 
 void DownloadAction::PerformAction() {
   http_fetcher_->set_delegate(this);
@@ -136,6 +294,10 @@ void DownloadAction::StartDownloading() {
                                               interactive_,
                                               update_certificates_path_));
   }
+  bool parallel_apply =
+      install_plan_.parallel_apply &&
+      UseLocalPayload(
+          delta_performer_.get(), install_plan_.download_url, base_offset_);
 
   if (install_plan_.is_resume &&
       payload_ == &install_plan_.payloads[resume_payload_index_]) {
@@ -158,9 +320,17 @@ void DownloadAction::StartDownloading() {
                                              payload_,
                                              interactive_,
                                              update_certificates_path_);
+        parallel_apply =
+            install_plan_.parallel_apply &&
+            UseLocalPayload(delta_performer_.get(),
+                            install_plan_.download_url,
+                            base_offset_);
       }
       http_fetcher_->AddRange(base_offset_,
                               manifest_metadata_size + manifest_signature_size);
+      // The persisted operation data is only checked once the manifest is
+      // parsed, which is after the ranges are requested, so don't skip it.
+      prefs_->SetInt64(kPrefsUpdateStatePartialOperationDataSize, 0);
     }
 
     // If there're remaining unprocessed data blobs, fetch them. Be careful
@@ -168,8 +338,14 @@ void DownloadAction::StartDownloading() {
     // response error codes.
     int64_t next_data_offset = 0;
     prefs_->GetInt64(kPrefsUpdateStateNextDataOffset, &next_data_offset);
-    uint64_t resume_offset =
-        manifest_metadata_size + manifest_signature_size + next_data_offset;
+    // Data of the next operation that was persisted by the DeltaPerformer
+    // doesn't need to be downloaded again either; the DeltaPerformer clears
+    // its size if it couldn't load it.
+    int64_t partial_operation_data_size = 0;
+    prefs_->GetInt64(kPrefsUpdateStatePartialOperationDataSize,
+                     &partial_operation_data_size);
+    uint64_t resume_offset = manifest_metadata_size + manifest_signature_size +
+                             next_data_offset + partial_operation_data_size;
     if (!payload_->size) {
       http_fetcher_->AddRange(base_offset_ + resume_offset);
     } else if (resume_offset < payload_->size) {
@@ -186,18 +362,35 @@ void DownloadAction::StartDownloading() {
     }
   }
 
+  // Partitions applied in parallel read their data from the payload anyway.
+  if (prefetch_buffer_size_ > 0 && !parallel_apply) {
+    LOG(INFO) << "Buffering up to " << prefetch_buffer_size_
+              << " bytes of the payload ahead of applying it.";
+    prefetch_buffer_ = std::make_unique<PrefetchBuffer>(delta_performer_.get(),
+                                                        prefetch_buffer_size_);
+  }
+
   http_fetcher_->BeginTransfer(install_plan_.download_url);
 }
 
 void DownloadAction::SuspendAction() {
-  http_fetcher_->Pause();
+  suspended_ = true;
+  // The fetcher is already paused while the prefetch buffer is full.
+  if (!prefetch_buffer_full_)
+    http_fetcher_->Pause();
 }
 
 void DownloadAction::ResumeAction() {
-  http_fetcher_->Unpause();
+  suspended_ = false;
+  if (!prefetch_buffer_full_)
+    http_fetcher_->Unpause();
 }
 
 void DownloadAction::TerminateProcessing() {
+  parallel_apply_task_.Cancel();
+  prefetch_buffer_task_.Cancel();
+  prefetch_buffer_full_ = false;
+  prefetch_buffer_.reset();
   if (delta_performer_) {
     delta_performer_->Close();
     delta_performer_.reset();
@@ -216,12 +409,12 @@ bool DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
                                    const void* bytes,
                                    size_t length) {
   bytes_received_ += length;
-  uint64_t bytes_downloaded_total =
-      bytes_received_previous_payloads_ + bytes_received_;
-  if (delegate_ && download_active_) {
-    delegate_->BytesReceived(length, bytes_downloaded_total, bytes_total_);
-  }
-  if (delta_performer_ && !delta_performer_->Write(bytes, length, &code_)) {
+  ReportBytesReceived(length);
+  const bool success =
+      !delta_performer_ ||
+      (prefetch_buffer_ ? prefetch_buffer_->Push(bytes, length, &code_)
+                        : delta_performer_->Write(bytes, length, &code_));
+  if (!success) {
     if (code_ != ErrorCode::kSuccess) {
       LOG(ERROR) << "Error " << utils::ErrorCodeToString(code_) << " (" << code_
                  << ") in DeltaPerformer's Write method when "
@@ -234,10 +427,112 @@ bool DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
     return false;
   }
 
+  if (prefetch_buffer_ && prefetch_buffer_->IsFull()) {
+    // Stops the download until the buffer has room again.
+    prefetch_buffer_full_ = true;
+    if (!suspended_)
+      http_fetcher_->Pause();
+    CHECK(prefetch_buffer_task_.PostTask(
+        FROM_HERE,
+        base::BindOnce(&DownloadAction::WaitForPrefetchBufferRoom,
+                       base::Unretained(this)),
+        kPrefetchBufferPollInterval));
+  }
   return true;
 }
 
+void DownloadAction::WaitForPrefetchBufferRoom() {
+  if (prefetch_buffer_->IsFull()) {
+    CHECK(prefetch_buffer_task_.PostTask(
+        FROM_HERE,
+        base::BindOnce(&DownloadAction::WaitForPrefetchBufferRoom,
+                       base::Unretained(this)),
+        kPrefetchBufferPollInterval));
+    return;
+  }
+  prefetch_buffer_full_ = false;
+  // This may deliver more data right away, so it is done last.
+  if (!suspended_)
+    http_fetcher_->Unpause();
+}
+
+void DownloadAction::ReportBytesReceived(uint64_t bytes_progressed) {
+  if (!delegate_ || !download_active_)
+    return;
+  uint64_t bytes_received = bytes_received_;
+  // Partitions applied in parallel lag behind the payload, so report how much
+  // of it they applied instead.
+  uint64_t bytes_applied = 0;
+  if (delta_performer_ &&
+      delta_performer_->GetParallelApplyProgress(&bytes_applied)) {
+    bytes_received = std::min(bytes_received, bytes_applied);
+  }
+  delegate_->BytesReceived(bytes_progressed,
+                           bytes_received_previous_payloads_ + bytes_received,
+                           bytes_total_);
+}
+
 void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
+  // The data still in the buffer has to be applied before the writer is
+  // closed and the payload is verified.
+  if (prefetch_buffer_) {
+    prefetch_buffer_task_.Cancel();
+    prefetch_buffer_full_ = false;
+    DrainPrefetchBuffer(successful);
+    return;
+  }
+  if (successful) {
+    WaitForParallelApply();
+    return;
+  }
+  FinishTransfer(successful, ErrorCode::kSuccess);
+}
+
+void DownloadAction::DrainPrefetchBuffer(bool successful) {
+  ErrorCode apply_error = ErrorCode::kSuccess;
+  if (!prefetch_buffer_->PollDrain(&apply_error)) {
+    CHECK(prefetch_buffer_task_.PostTask(
+        FROM_HERE,
+        base::BindOnce(&DownloadAction::DrainPrefetchBuffer,
+                       base::Unretained(this),
+                       successful),
+        kPrefetchBufferPollInterval));
+    return;
+  }
+  // Like in ReceivedBytes(), the DeltaPerformer stops without an error once
+  // it finds that the payload was already applied.
+  if (apply_error != ErrorCode::kSuccess) {
+    LOG(ERROR) << "Error " << utils::ErrorCodeToString(apply_error) << " ("
+               << apply_error << ") in DeltaPerformer's Write method when "
+               << "processing the buffered payload";
+  }
+  prefetch_buffer_.reset();
+  if (successful && apply_error == ErrorCode::kSuccess) {
+    WaitForParallelApply();
+    return;
+  }
+  FinishTransfer(successful, apply_error);
+}
+
+void DownloadAction::WaitForParallelApply() {
+  ErrorCode apply_error = ErrorCode::kSuccess;
+  if (delta_performer_ && !delta_performer_->PollParallelApply(&apply_error)) {
+    if (!delegate_ || !delegate_->ShouldCancel(&apply_error)) {
+      ReportBytesReceived(0);
+      CHECK(parallel_apply_task_.PostTask(
+          FROM_HERE,
+          base::BindOnce(&DownloadAction::WaitForParallelApply,
+                         base::Unretained(this)),
+          kParallelApplyProgressInterval));
+      return;
+    }
+    LOG(ERROR) << "Canceling the update while applying partitions: "
+               << utils::ErrorCodeToString(apply_error);
+  }
+  FinishTransfer(true, apply_error);
+}
+
+void DownloadAction::FinishTransfer(bool successful, ErrorCode apply_error) {
   if (delta_performer_) {
     LOG_IF(WARNING, delta_performer_->Close() != 0)
         << "Error closing the writer.";
@@ -245,6 +540,8 @@ void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
   download_active_ = false;
   ErrorCode code =
       successful ? ErrorCode::kSuccess : ErrorCode::kDownloadTransferError;
+  if (apply_error != ErrorCode::kSuccess)
+    code = apply_error;
   if (code == ErrorCode::kSuccess) {
     if (delta_performer_ && !payload_->already_applied)
       code = delta_performer_->VerifyPayload(payload_->hash, payload_->size);
@@ -17,7 +17,10 @@
 #include <unistd.h>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <thread>
 
+#include <brillo/message_loops/fake_message_loop.h>
 #include <gmock/gmock.h>
 #include <gmock/gmock-actions.h>
 #include <gmock/gmock-function-mocker.h>
@@ -29,6 +32,7 @@
 #include "update_engine/common/constants.h"
 #include "update_engine/common/download_action.h"
 #include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/fake_prefs.h"
 #include "update_engine/common/mock_action_processor.h"
 #include "update_engine/common/mock_http_fetcher.h"
 #include "update_engine/common/mock_prefs.h"
@@ -44,6 +48,7 @@ namespace chromeos_update_engine {
 using testing::_;
 using testing::DoAll;
 using testing::Return;
+using testing::SaveArg;
 using testing::SetArgPointee;
 
 class DownloadActionTest : public ::testing::Test {
@@ -54,6 +59,72 @@ class DownloadActionTest : public ::testing::Test {
       new ActionPipe<InstallPlan>()};
 };
 
+// A DeltaPerformer that only records the data written to it, and fails once
+// |fail_after_size| bytes were written.
+class RecordingDeltaPerformer : public DeltaPerformer {
+ public:
+  using DeltaPerformer::DeltaPerformer;
+
+  bool Write(const void* bytes, size_t count, ErrorCode* error) override {
+    if (std::this_thread::get_id() == main_thread_id)
+      written_on_main_thread = true;
+    if (data.size() >= fail_after_size) {
+      *error = ErrorCode::kDownloadOperationExecutionError;
+      return false;
+    }
+    data.append(static_cast<const char*>(bytes), count);
+    return true;
+  }
+
+  int Close() override { return 0; }
+
+  const std::thread::id main_thread_id{std::this_thread::get_id()};
+  size_t fail_after_size{SIZE_MAX};
+  bool written_on_main_thread{false};
+  std::string data;
+};
+
+// Downloads |data| with a prefetch buffer smaller than the chunks received,
+// writing it to |delta_performer|, and returns the error the action completed
+// with.
+ErrorCode DownloadWithPrefetchBuffer(
+    const std::string& data,
+    std::unique_ptr<RecordingDeltaPerformer> delta_performer,
+    std::shared_ptr<ActionPipe<InstallPlan>> action_pipe) {
+  brillo::FakeMessageLoop loop(nullptr);
+  loop.SetAsCurrent();
+  FakePrefs prefs;
+  BootControlStub boot_control;
+  FakeHardware hardware;
+  InstallPlan install_plan;
+  auto& payload = install_plan.payloads.emplace_back();
+  install_plan.download_url = "http://fake_url.invalid";
+  payload.size = data.size();
+  payload.payload_urls.emplace_back("http://fake_url.invalid");
+  // Skips the verification of the fake payload.
+  payload.already_applied = true;
+  action_pipe->set_contents(install_plan);
+
+  auto download_action = std::make_unique<DownloadAction>(
+      &prefs,
+      &boot_control,
+      &hardware,
+      new MockHttpFetcher(data.data(), data.size()),
+      false /* interactive */);
+  download_action->set_prefetch_buffer_size(kMockHttpFetcherChunkSize / 2);
+  download_action->SetTestFileWriter(std::move(delta_performer));
+  download_action->set_in_pipe(action_pipe);
+  MockActionProcessor mock_processor;
+  ErrorCode code = ErrorCode::kError;
+  EXPECT_CALL(mock_processor, ActionComplete(download_action.get(), _))
+      .WillOnce(SaveArg<1>(&code));
+  download_action->SetProcessor(&mock_processor);
+  download_action->PerformAction();
+  while (loop.PendingTasks())
+    loop.RunOnce(true);
+  return code;
+}
+
 TEST_F(DownloadActionTest, CacheManifestInvalid) {
   std::string data(METADATA_SIZE + SIGNATURE_SIZE, '-');
   MockPrefs prefs;
@@ -172,4 +243,34 @@ TEST_F(DownloadActionTest, CacheManifestValid) {
   // Manifest is cached, so no data should be downloaded from http fetcher.
   ASSERT_EQ(download_action->http_fetcher()->GetBytesDownloaded(), 0UL);
 }
+
+TEST_F(DownloadActionTest, PrefetchBufferTest) {
+  std::string data(3 * kMockHttpFetcherChunkSize + 100, '\0');
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = i * 7 % 251;
+  InstallPlan install_plan;
+  auto delta_performer = std::make_unique<RecordingDeltaPerformer>(
+      nullptr, nullptr, nullptr, nullptr, &install_plan, nullptr, false);
+  RecordingDeltaPerformer* recorder = delta_performer.get();
+
+  EXPECT_EQ(ErrorCode::kSuccess,
+            DownloadWithPrefetchBuffer(
+                data, std::move(delta_performer), action_pipe));
+  // The data was applied in order, but not on the thread receiving it.
+  EXPECT_EQ(data, recorder->data);
+  EXPECT_FALSE(recorder->written_on_main_thread);
+}
+
+TEST_F(DownloadActionTest, PrefetchBufferWriteErrorTest) {
+  std::string data(3 * kMockHttpFetcherChunkSize, 'x');
+  InstallPlan install_plan;
+  auto delta_performer = std::make_unique<RecordingDeltaPerformer>(
+      nullptr, nullptr, nullptr, nullptr, &install_plan, nullptr, false);
+  delta_performer->fail_after_size = kMockHttpFetcherChunkSize;
+
+  EXPECT_EQ(ErrorCode::kDownloadOperationExecutionError,
+            DownloadWithPrefetchBuffer(
+                data, std::move(delta_performer), action_pipe));
+}
+
 }  // namespace chromeos_update_engine
@@ -45,7 +45,6 @@
 
 using base::TimeDelta;
 using brillo::MessageLoop;
-using std::max;
 using std::string;
 
 // This is a concrete implementation of HttpFetcher that uses libcurl to do the
@@ -93,6 +92,61 @@ int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* clientp,
   return 1;
 }
 
+// static
+int LibcurlHttpFetcher::LibcurlSocketCallback(CURL* /* easy */,
+                                              curl_socket_t s,
+                                              int what,
+                                              void* userp,
+                                              void* /* socketp */) {
+  LibcurlHttpFetcher* fetcher = static_cast<LibcurlHttpFetcher*>(userp);
+  const bool must_track[2] = {
+      what == CURL_POLL_IN || what == CURL_POLL_INOUT,  // track 0 -- read
+      what == CURL_POLL_OUT || what == CURL_POLL_INOUT  // track 1 -- write
+  };
+  for (size_t t = 0; t < base::size(fetcher->fd_controller_maps_); ++t) {
+    auto& controllers = fetcher->fd_controller_maps_[t];
+    if (!must_track[t]) {
+      // If we have an outstanding watch, remove it.
+      controllers.erase(s);
+      continue;
+    }
+    // If we are already tracking this fd, continue -- nothing to do.
+    if (controllers.find(s) != controllers.end())
+      continue;
+
+    auto callback =
+        base::BindRepeating(&LibcurlHttpFetcher::CurlPerformOnce,
+                            base::Unretained(fetcher),
+                            s,
+                            t == 0 ? CURL_CSELECT_IN : CURL_CSELECT_OUT);
+    if (t == 0)
+      controllers[s] = base::FileDescriptorWatcher::WatchReadable(s, callback);
+    else
+      controllers[s] = base::FileDescriptorWatcher::WatchWritable(s, callback);
+  }
+  return 0;
+}
+
+// static
+int LibcurlHttpFetcher::LibcurlTimerCallback(
+    CURLM* /* multi */,
+    long timeout_ms,  // NOLINT(runtime/int)
+    void* userp) {
+  LibcurlHttpFetcher* fetcher = static_cast<LibcurlHttpFetcher*>(userp);
+  MessageLoop::current()->CancelTask(fetcher->timeout_id_);
+  fetcher->timeout_id_ = MessageLoop::kTaskIdNull;
+  // libcurl must not be called back from this callback, so even a timeout of
+  // 0 is handled from a task.
+  if (timeout_ms >= 0) {
+    fetcher->timeout_id_ = MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&LibcurlHttpFetcher::TimeoutCallback,
+                   base::Unretained(fetcher)),
+        TimeDelta::FromMilliseconds(timeout_ms));
+  }
+  return 0;
+}
+
 LibcurlHttpFetcher::LibcurlHttpFetcher(HardwareInterface* hardware)
     : hardware_(hardware) {
   // Dev users want a longer timeout (180 seconds) because they may
@@ -107,6 +161,24 @@ LibcurlHttpFetcher::~LibcurlHttpFetcher() {
   LOG_IF(ERROR, transfer_in_progress_)
       << "Destroying the fetcher while a transfer is in progress.";
   CleanUp();
+  LOG(INFO) << "Opened " << num_connects_ << " connection(s) for "
+            << num_transfers_ << " transfer(s).";
+
+  // Closing the cached connections may call back into this object, so the
+  // timer and the sockets are released afterwards.
+  if (curl_multi_handle_) {
+    CHECK_EQ(curl_multi_cleanup(curl_multi_handle_), CURLM_OK);
+    curl_multi_handle_ = nullptr;
+  }
+  if (curl_share_handle_) {
+    CHECK_EQ(curl_share_cleanup(curl_share_handle_), CURLSHE_OK);
+    curl_share_handle_ = nullptr;
+  }
+  MessageLoop::current()->CancelTask(timeout_id_);
+  timeout_id_ = MessageLoop::kTaskIdNull;
+  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
+    fd_controller_maps_[t].clear();
+  }
 }
 
 bool LibcurlHttpFetcher::GetProxyType(const string& proxy,
@@ -138,16 +210,64 @@ bool LibcurlHttpFetcher::GetProxyType(const string& proxy,
   return false;
 }
 
+void LibcurlHttpFetcher::SetupMultiHandle() {
+  curl_multi_handle_ = curl_multi_init();
+  CHECK(curl_multi_handle_);
+  // Several transfers to the same server may share a single HTTP/2
+  // connection.
+  CHECK_EQ(curl_multi_setopt(
+               curl_multi_handle_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX),
+           CURLM_OK);
+
+  // When there's no |base::SingleThreadTaskRunner| on current thread, it's
+  // not possible to watch file descriptors, so libcurl is polled instead.
+  use_socket_action_ = base::ThreadTaskRunnerHandle::IsSet();
+  if (use_socket_action_) {
+    CHECK_EQ(curl_multi_setopt(curl_multi_handle_,
+                               CURLMOPT_SOCKETFUNCTION,
+                               LibcurlSocketCallback),
+             CURLM_OK);
+    CHECK_EQ(curl_multi_setopt(curl_multi_handle_, CURLMOPT_SOCKETDATA, this),
+             CURLM_OK);
+    CHECK_EQ(curl_multi_setopt(curl_multi_handle_,
+                               CURLMOPT_TIMERFUNCTION,
+                               LibcurlTimerCallback),
+             CURLM_OK);
+    CHECK_EQ(curl_multi_setopt(curl_multi_handle_, CURLMOPT_TIMERDATA, this),
+             CURLM_OK);
+  }
+
+  // The connections are cached in the multi handle, but the TLS sessions and
+  // the resolved hosts are cached in each easy handle. Share them, so a new
+  // connection can resume the TLS session of a previous one instead of doing
+  // a full handshake.
+  curl_share_handle_ = curl_share_init();
+  CHECK(curl_share_handle_);
+  for (curl_lock_data data : {CURL_LOCK_DATA_SSL_SESSION, CURL_LOCK_DATA_DNS}) {
+    CHECK_EQ(curl_share_setopt(curl_share_handle_, CURLSHOPT_SHARE, data),
+             CURLSHE_OK);
+  }
+}
+
 void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   LOG(INFO) << "Starting/Resuming transfer";
   CHECK(!transfer_in_progress_);
   url_ = url;
-  curl_multi_handle_ = curl_multi_init();
-  CHECK(curl_multi_handle_);
+  if (!curl_multi_handle_)
+    SetupMultiHandle();
 
   curl_handle_ = curl_easy_init();
   CHECK(curl_handle_);
   ignore_failure_ = false;
+  CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_SHARE, curl_share_handle_),
+           CURLE_OK);
+  // Let libcurl negotiate HTTP/2 over TLS through ALPN, so all the requests to
+  // a server go through a single connection. libcurl falls back to HTTP/1.1
+  // if either side doesn't support it.
+  CURLcode http_version_code = curl_easy_setopt(
+      curl_handle_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  LOG_IF(WARNING, http_version_code != CURLE_OK)
+      << "libcurl doesn't support HTTP/2: " << http_version_code;
 
   // Tag and untag the socket for network usage stats.
   curl_easy_setopt(
@@ -352,7 +472,7 @@ void LibcurlHttpFetcher::BeginTransfer(const string& url) {
     return;
   }
   ResumeTransfer(url_);
-  CurlPerformOnce();
+  CurlPerformOnce(CURL_SOCKET_TIMEOUT, 0);
 }
 
 void LibcurlHttpFetcher::ForceTransferTermination() {
@@ -413,15 +533,20 @@ bool LibcurlHttpFetcher::GetHeader(const string& header_name,
   return true;
 }
 
-void LibcurlHttpFetcher::CurlPerformOnce() {
+void LibcurlHttpFetcher::CurlPerformOnce(curl_socket_t socket, int events) {
   CHECK(transfer_in_progress_);
   int running_handles = 0;
   CURLMcode retcode = CURLM_CALL_MULTI_PERFORM;
 
-  // libcurl may request that we immediately call curl_multi_perform after it
-  // returns, so we do. libcurl promises that curl_multi_perform will not block.
+  // libcurl may request that we immediately call it again after it returns, so
+  // we do. libcurl promises that these calls will not block.
   while (CURLM_CALL_MULTI_PERFORM == retcode) {
-    retcode = curl_multi_perform(curl_multi_handle_, &running_handles);
+    if (use_socket_action_) {
+      retcode = curl_multi_socket_action(
+          curl_multi_handle_, socket, events, &running_handles);
+    } else {
+      retcode = curl_multi_perform(curl_multi_handle_, &running_handles);
+    }
     if (terminate_requested_) {
       ForceTransferTermination();
       return;
@@ -448,22 +573,19 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
   }
 
   if (running_handles != 0 || transfer_paused_) {
-    // There's either more work to do or we are paused, so we just keep the
-    // file descriptors to watch up to date and exit, until we are done with the
-    // work and we are not paused.
-    //
-    // When there's no |base::SingleThreadTaskRunner| on current thread, it's
-    // not possible to watch file descriptors. Just poll it later. This usually
-    // happens if |brillo::FakeMessageLoop| is used.
-    if (!base::ThreadTaskRunnerHandle::IsSet()) {
+    // There's either more work to do or we are paused. libcurl already told
+    // us which file descriptors and timer to watch, so we just exit until we
+    // are done with the work and we are not paused. If it can't tell us, just
+    // poll it later.
+    if (!use_socket_action_) {
       MessageLoop::current()->PostDelayedTask(
           FROM_HERE,
           base::Bind(&LibcurlHttpFetcher::CurlPerformOnce,
-                     base::Unretained(this)),
-          TimeDelta::FromSeconds(1));
-      return;
+                     base::Unretained(this),
+                     CURL_SOCKET_TIMEOUT,
+                     0),
+          TimeDelta::FromSeconds(idle_seconds_));
     }
-    SetupMessageLoopSources();
     return;
   }
 
@@ -647,7 +769,7 @@ void LibcurlHttpFetcher::Unpause() {
   if (restart_transfer_on_unpause_) {
     restart_transfer_on_unpause_ = false;
     ResumeTransfer(url_);
-    CurlPerformOnce();
+    CurlPerformOnce(CURL_SOCKET_TIMEOUT, 0);
     return;
   }
   if (!transfer_in_progress_) {
@@ -658,96 +780,9 @@ void LibcurlHttpFetcher::Unpause() {
   CHECK(curl_handle_);
   CHECK_EQ(curl_easy_pause(curl_handle_, CURLPAUSE_CONT), CURLE_OK);
   // Since the transfer is in progress, we need to dispatch a CurlPerformOnce()
-  // now to let the connection continue, otherwise it would be called by the
-  // TimeoutCallback but with a delay.
-  CurlPerformOnce();
-}
-
-// This method sets up callbacks with the MessageLoop.
-void LibcurlHttpFetcher::SetupMessageLoopSources() {
-  fd_set fd_read;
-  fd_set fd_write;
-  fd_set fd_exc;
-
-  FD_ZERO(&fd_read);
-  FD_ZERO(&fd_write);
-  FD_ZERO(&fd_exc);
-
-  int fd_max = 0;
-
-  // Ask libcurl for the set of file descriptors we should track on its
-  // behalf.
-  CHECK_EQ(curl_multi_fdset(
-               curl_multi_handle_, &fd_read, &fd_write, &fd_exc, &fd_max),
-           CURLM_OK);
-
-  // We should iterate through all file descriptors up to libcurl's fd_max or
-  // the highest one we're tracking, whichever is larger.
-  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
-    if (!fd_controller_maps_[t].empty())
-      fd_max = max(fd_max, fd_controller_maps_[t].rbegin()->first);
-  }
-
-  // For each fd, if we're not tracking it, track it. If we are tracking it, but
-  // libcurl doesn't care about it anymore, stop tracking it. After this loop,
-  // there should be exactly as many tasks scheduled in
-  // fd_controller_maps_[0|1] as there are read/write fds that we're tracking.
-  for (int fd = 0; fd <= fd_max; ++fd) {
-    // Note that fd_exc is unused in the current version of libcurl so is_exc
-    // should always be false.
-    bool is_exc = FD_ISSET(fd, &fd_exc) != 0;
-    bool must_track[2] = {
-        is_exc || (FD_ISSET(fd, &fd_read) != 0),  // track 0 -- read
-        is_exc || (FD_ISSET(fd, &fd_write) != 0)  // track 1 -- write
-    };
-
-    for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
-      bool tracked =
-          fd_controller_maps_[t].find(fd) != fd_controller_maps_[t].end();
-
-      if (!must_track[t]) {
-        // If we have an outstanding io_channel, remove it.
-        fd_controller_maps_[t].erase(fd);
-        continue;
-      }
-
-      // If we are already tracking this fd, continue -- nothing to do.
-      if (tracked)
-        continue;
-
-      // Track a new fd.
-      switch (t) {
-        case 0:  // Read
-          fd_controller_maps_[t][fd] =
-              base::FileDescriptorWatcher::WatchReadable(
-                  fd,
-                  base::BindRepeating(&LibcurlHttpFetcher::CurlPerformOnce,
-                                      base::Unretained(this)));
-          break;
-        case 1:  // Write
-          fd_controller_maps_[t][fd] =
-              base::FileDescriptorWatcher::WatchWritable(
-                  fd,
-                  base::BindRepeating(&LibcurlHttpFetcher::CurlPerformOnce,
-                                      base::Unretained(this)));
-      }
-      static int io_counter = 0;
-      io_counter++;
-      if (io_counter % 50 == 0) {
-        LOG(INFO) << "io_counter = " << io_counter;
-      }
-    }
-  }
-
-  // Set up a timeout callback for libcurl.
-  if (timeout_id_ == MessageLoop::kTaskIdNull) {
-    VLOG(1) << "Setting up timeout source: " << idle_seconds_ << " seconds.";
-    timeout_id_ = MessageLoop::current()->PostDelayedTask(
-        FROM_HERE,
-        base::Bind(&LibcurlHttpFetcher::TimeoutCallback,
-                   base::Unretained(this)),
-        TimeDelta::FromSeconds(idle_seconds_));
-  }
+  // now to let the connection continue, otherwise it would only continue once
+  // its socket or timer fire.
+  CurlPerformOnce(CURL_SOCKET_TIMEOUT, 0);
 }
 
 void LibcurlHttpFetcher::RetryTimeoutCallback() {
@@ -757,40 +792,32 @@ void LibcurlHttpFetcher::RetryTimeoutCallback() {
     return;
   }
   ResumeTransfer(url_);
-  CurlPerformOnce();
+  CurlPerformOnce(CURL_SOCKET_TIMEOUT, 0);
 }
 
 void LibcurlHttpFetcher::TimeoutCallback() {
-  // We always re-schedule the callback, even if we don't want to be called
-  // anymore. We will remove the event source separately if we don't want to
-  // be called back.
-  timeout_id_ = MessageLoop::current()->PostDelayedTask(
-      FROM_HERE,
-      base::Bind(&LibcurlHttpFetcher::TimeoutCallback, base::Unretained(this)),
-      TimeDelta::FromSeconds(idle_seconds_));
-
-  // CurlPerformOnce() may call CleanUp(), so we need to schedule our callback
-  // first, since it could be canceled by this call.
+  // libcurl schedules its next timeout through LibcurlTimerCallback(), if any.
+  timeout_id_ = MessageLoop::kTaskIdNull;
   if (transfer_in_progress_)
-    CurlPerformOnce();
+    CurlPerformOnce(CURL_SOCKET_TIMEOUT, 0);
 }
 
 void LibcurlHttpFetcher::CleanUp() {
   MessageLoop::current()->CancelTask(retry_task_id_);
   retry_task_id_ = MessageLoop::kTaskIdNull;
 
-  MessageLoop::current()->CancelTask(timeout_id_);
-  timeout_id_ = MessageLoop::kTaskIdNull;
-
-  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
-    fd_controller_maps_[t].clear();
-  }
-
   if (curl_http_headers_) {
     curl_slist_free_all(curl_http_headers_);
     curl_http_headers_ = nullptr;
   }
   if (curl_handle_) {
+    // Every new connection, and so every TLS handshake, made by the transfer.
+    long num_connects = 0;  // NOLINT(runtime/int) - curl needs long.
+    if (curl_easy_getinfo(
+            curl_handle_, CURLINFO_NUM_CONNECTS, &num_connects) == CURLE_OK) {
+      num_connects_ += num_connects;
+    }
+    num_transfers_++;
     if (curl_multi_handle_) {
       CHECK_EQ(curl_multi_remove_handle(curl_multi_handle_, curl_handle_),
                CURLM_OK);
@@ -798,9 +825,16 @@ void LibcurlHttpFetcher::CleanUp() {
     curl_easy_cleanup(curl_handle_);
     curl_handle_ = nullptr;
   }
-  if (curl_multi_handle_) {
-    CHECK_EQ(curl_multi_cleanup(curl_multi_handle_), CURLM_OK);
-    curl_multi_handle_ = nullptr;
+  // |curl_multi_handle_| is kept, with its connection cache, so the next
+  // transfer to the same server reuses the connection.
+
+  // libcurl may update the timer and the sockets to watch while the handles
+  // are cleaned up, so only stop watching them afterwards.
+  MessageLoop::current()->CancelTask(timeout_id_);
+  timeout_id_ = MessageLoop::kTaskIdNull;
+
+  for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
+    fd_controller_maps_[t].clear();
   }
   transfer_in_progress_ = false;
   transfer_paused_ = false;
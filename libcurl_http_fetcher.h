@@ -112,15 +112,9 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Resume the transfer by calling curl_easy_pause(CURLPAUSE_CONT).
   void Unpause() override;
 
-  // Libcurl sometimes asks to be called back after some time while
-  // leaving that time unspecified. In that case, we pick a reasonable
-  // default of one second, but it can be overridden here. This is
-  // primarily useful for testing.
-  // From http://curl.haxx.se/libcurl/c/curl_multi_timeout.html:
-  //     if libcurl returns a -1 timeout here, it just means that libcurl
-  //     currently has no stored timeout value. You must not wait too long
-  //     (more than a few seconds perhaps) before you call
-  //     curl_multi_perform() again.
+  // When the message loop can't watch the sockets of libcurl, libcurl is
+  // polled every |seconds| instead, one second by default. This is primarily
+  // useful for testing.
   void set_idle_seconds(int seconds) override { idle_seconds_ = seconds; }
 
   // Sets the retry timeout. Useful for testing.
@@ -157,6 +151,9 @@ class LibcurlHttpFetcher : public HttpFetcher {
     is_update_check_ = is_update_check;
   }
 
+  // Connections opened are also TLS handshakes done for HTTPS.
+  int GetNumConnects() override { return num_connects_; }
+
  private:
   FRIEND_TEST(LibcurlHttpFetcherTest, HostResolvedTest);
 
@@ -164,6 +161,21 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // closing a socket created with the CURLOPT_OPENSOCKETFUNCTION callback.
   static int LibcurlCloseSocketCallback(void* clientp, curl_socket_t item);
 
+  // libcurl's CURLMOPT_SOCKETFUNCTION callback function. Called when libcurl
+  // wants the socket |s| to be watched for the events in |what|, or not to be
+  // watched anymore.
+  static int LibcurlSocketCallback(CURL* easy,
+                                   curl_socket_t s,
+                                   int what,
+                                   void* userp,
+                                   void* socketp);
+
+  // libcurl's CURLMOPT_TIMERFUNCTION callback function. Called when libcurl
+  // wants to be called back after |timeout_ms|, or not anymore if it is -1.
+  static int LibcurlTimerCallback(CURLM* multi,
+                                  long timeout_ms,  // NOLINT(runtime/int)
+                                  void* userp);
+
   // Asks libcurl for the http response code and stores it in the object.
   virtual void GetHttpResponseCode();
 
@@ -186,21 +198,22 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // left off.
   virtual void ResumeTransfer(const std::string& url);
 
+  // Creates |curl_multi_handle_| and |curl_share_handle_|, which are kept
+  // across transfers so their connections and TLS sessions can be reused.
+  void SetupMultiHandle();
+
   void TimeoutCallback();
   void RetryTimeoutCallback();
 
-  // Calls into curl_multi_perform to let libcurl do its work. Returns after
-  // curl_multi_perform is finished, which may actually be after more than
-  // one call to curl_multi_perform. This method will set up the message
-  // loop with sources for future work that libcurl will do, if any, or complete
-  // the transfer and finish the action if no work left to do.
+  // Calls into curl_multi_socket_action to let libcurl handle the |events|
+  // (CURL_CSELECT_* flags) on |socket|, or its timeouts if |socket| is
+  // CURL_SOCKET_TIMEOUT. libcurl updates the sockets and the timer to watch
+  // for its future work through LibcurlSocketCallback() and
+  // LibcurlTimerCallback(). If the message loop can't watch sockets, this
+  // calls curl_multi_perform instead and schedules the next poll. Completes
+  // the transfer and finishes the action if no work is left to do.
   // This method will not block.
-  void CurlPerformOnce();
-
-  // Sets up message loop sources as needed by libcurl. This is generally
-  // the file descriptor of the socket and a timer in case nothing happens
-  // on the fds.
-  void SetupMessageLoopSources();
+  void CurlPerformOnce(curl_socket_t socket, int events);
 
   // Callback called by libcurl when new data has arrived on the transfer
   size_t LibcurlWrite(void* ptr, size_t size, size_t nmemb);
@@ -213,7 +226,8 @@ class LibcurlHttpFetcher : public HttpFetcher {
   }
 
   // Cleans up the following if they are non-null:
-  // curl(m) handles, fd_controller_maps_(fd_task_maps_), timeout_id_.
+  // curl handle, fd_controller_maps_(fd_task_maps_), timeout_id_. The curlm
+  // handle is only cleaned up when the fetcher is destroyed.
   void CleanUp();
 
   // Force terminate the transfer. This will invoke the delegate's (if any)
@@ -241,15 +255,16 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Handles for the libcurl library
   CURLM* curl_multi_handle_{nullptr};
   CURL* curl_handle_{nullptr};
+  CURLSH* curl_share_handle_{nullptr};
   struct curl_slist* curl_http_headers_{nullptr};
 
   // The extra headers that will be sent on each request.
   std::map<std::string, std::string> extra_headers_;
 
   // Lists of all read(0)/write(1) file descriptors that we're waiting on from
-  // the message loop. libcurl may open/close descriptors and switch their
-  // directions so maintain two separate lists so that watch conditions can be
-  // set appropriately.
+  // the message loop, as requested by LibcurlSocketCallback(). libcurl may
+  // open/close descriptors and switch their directions so maintain two
+  // separate lists so that watch conditions can be set appropriately.
   std::map<int, std::unique_ptr<base::FileDescriptorWatcher::Controller>>
       fd_controller_maps_[2];
 
@@ -257,6 +272,11 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // on it.
   brillo::MessageLoop::TaskId timeout_id_{brillo::MessageLoop::kTaskIdNull};
 
+  // Whether libcurl tells us which sockets to watch, or has to be polled
+  // because the message loop can't watch file descriptors. The latter usually
+  // happens if |brillo::FakeMessageLoop| is used.
+  bool use_socket_action_{false};
+
   bool transfer_in_progress_{false};
   bool transfer_paused_{false};
 
@@ -299,7 +319,7 @@ class LibcurlHttpFetcher : public HttpFetcher {
   int no_network_retry_count_{0};
   int no_network_max_retries_{0};
 
-  // Seconds to wait before asking libcurl to "perform".
+  // Seconds to wait between polls of libcurl when not |use_socket_action_|.
   int idle_seconds_{1};
 
   // If true, we are currently performing a write callback on the delegate.
@@ -328,6 +348,11 @@ class LibcurlHttpFetcher : public HttpFetcher {
   int low_speed_time_seconds_{kDownloadLowSpeedTimeSeconds};
   int connect_timeout_seconds_{kDownloadConnectTimeoutSeconds};
 
+  // The number of connections opened and of transfers (including retries)
+  // done by this fetcher, logged when it is destroyed.
+  int num_connects_{0};
+  int num_transfers_{0};
+
   DISALLOW_COPY_AND_ASSIGN(LibcurlHttpFetcher);
 };
 
@@ -109,6 +109,44 @@ bool BlockExtentWriter::Write(const void* bytes, size_t count) {
   return true;
 }
 
+bool BlockExtentWriter::WriteZeros(size_t count, bool discard) {
+  while (count > 0) {
+    TEST_LT(cur_extent_idx_, static_cast<size_t>(extents_.size()));
+    const auto& cur_extent = extents_[cur_extent_idx_];
+    const auto cur_extent_size = cur_extent.num_blocks() * block_size_;
+    if (!buffer_.empty() || count < cur_extent_size) {
+      const size_t bytes_to_write =
+          std::min<size_t>(count, cur_extent_size - buffer_.size());
+      TEST_AND_RETURN_FALSE(ExtentWriter::WriteZeros(bytes_to_write, discard));
+      count -= bytes_to_write;
+      continue;
+    }
+    TEST_AND_RETURN_FALSE(ZeroExtent(cur_extent, block_size_));
+    count -= cur_extent_size;
+    if (!NextExtent() && count > 0) {
+      LOG(ERROR) << "Exhausted all blocks, but still have " << count
+                 << " bytes of zeros left";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BlockExtentWriter::ZeroExtent(const Extent& extent, size_t block_size) {
+  // Bound the size of each WriteExtent() call, so huge extents don't need a
+  // buffer of the same size.
+  constexpr uint64_t kMaxZeroBlocks = 256;
+  Extent chunk;
+  for (uint64_t i = 0; i < extent.num_blocks(); i += kMaxZeroBlocks) {
+    chunk.set_start_block(extent.start_block() + i);
+    chunk.set_num_blocks(std::min(kMaxZeroBlocks, extent.num_blocks() - i));
+    const auto zeros =
+        utils::GetReadonlyZeroString(chunk.num_blocks() * block_size);
+    TEST_AND_RETURN_FALSE(WriteExtent(zeros.data(), chunk, block_size));
+  }
+  return true;
+}
+
 bool BlockExtentWriter::NextExtent() {
   cur_extent_idx_++;
   return cur_extent_idx_ < static_cast<size_t>(extents_.size());
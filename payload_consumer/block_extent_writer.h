@@ -41,6 +41,12 @@ class BlockExtentWriter : public chromeos_update_engine::ExtentWriter {
   virtual bool WriteExtent(const void* bytes,
                            const Extent& extent,
                            size_t block_size) = 0;
+  // Whole extents covered by |count| are passed to ZeroExtent(), partial ones
+  // go through Write().
+  bool WriteZeros(size_t count, bool discard) final;
+  // Write zeros to 1 extent. The default implementation passes zero-filled
+  // buffers to WriteExtent(); subclasses can override it to avoid that.
+  virtual bool ZeroExtent(const Extent& extent, size_t block_size);
   size_t BlockSize() const { return block_size_; }
 
  private:
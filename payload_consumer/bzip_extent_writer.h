@@ -43,6 +43,7 @@ class BzipExtentWriter : public ExtentWriter {
   bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
             uint32_t block_size) override;
   bool Write(const void* bytes, size_t count) override;
+  bool Flush() override { return next_->Flush(); }
 
  private:
   std::unique_ptr<ExtentWriter> next_;  // The underlying ExtentWriter.
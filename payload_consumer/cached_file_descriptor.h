@@ -44,18 +44,26 @@ class CachedFileDescriptorBase : public FileDescriptor {
     return GetFd()->Read(buf, count);
   }
   ssize_t Write(const void* buf, size_t count) override;
+  // Vectored writes bypass |cache_|, pending writes are flushed first.
+  ssize_t WriteV(const struct iovec* iov, int iovcnt, off64_t offset) override {
+    return FlushCache() ? GetFd()->WriteV(iov, iovcnt, offset) : -1;
+  }
   off64_t Seek(off64_t offset, int whence) override;
   uint64_t BlockDevSize() override { return GetFd()->BlockDevSize(); }
   bool BlkIoctl(int request,
                 uint64_t start,
                 uint64_t length,
                 int* result) override {
-    return GetFd()->BlkIoctl(request, start, length, result);
+    // The ioctl bypasses |cache_|, so pending writes must land first.
+    return FlushCache() && GetFd()->BlkIoctl(request, start, length, result);
   }
   bool Flush() override;
   bool Close() override;
   bool IsSettingErrno() override { return GetFd()->IsSettingErrno(); }
   bool IsOpen() override { return GetFd()->IsOpen(); }
+  // Direct access to the file descriptor bypasses |cache_|, pending writes are
+  // flushed first.
+  int Fd() override { return FlushCache() ? GetFd()->Fd() : -1; }
 
  protected:
   virtual FileDescriptor* GetFd() = 0;
@@ -18,9 +18,12 @@
 
 #include <errno.h>
 #include <linux/fs.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cstring>
+#include <deque>
 #include <map>
 #include <memory>
 #include <set>
@@ -48,6 +51,7 @@
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/terminator.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/partition_update_generator_interface.h"
 #include "update_engine/payload_consumer/partition_writer.h"
 #include "update_engine/update_metadata.pb.h"
@@ -68,13 +72,117 @@ const unsigned DeltaPerformer::kProgressLogTimeoutSeconds = 30;
 const unsigned DeltaPerformer::kProgressDownloadWeight = 50;
 const unsigned DeltaPerformer::kProgressOperationsWeight = 50;
 const uint64_t DeltaPerformer::kCheckpointFrequencySeconds = 1;
+const uint64_t DeltaPerformer::kMinPartialOperationDataSize = 4 * 1024 * 1024;
+const size_t DeltaPerformer::kMaxNonDataOperationBatchSize = 1024;
+const uint64_t DeltaPerformer::kMaxParallelApplyDataSize = 64 * 1024 * 1024;
+const uint64_t DeltaPerformer::kParallelCheckpointDataInterval =
+    16 * 1024 * 1024;
+const size_t DeltaPerformer::kParallelCheckpointOperationInterval = 256;
 
 namespace {
 const int kUpdateStateOperationInvalid = -1;
 const int kMaxResumedUpdateFailures = 10;
+const char kPartialOperationDataFile[] = "partial_operation_data";
+
+// Adds the CPU time used by the current thread during its lifetime to a
+// counter, in nanoseconds.
+class ScopedThreadCpuTimer {
+ public:
+  explicit ScopedThreadCpuTimer(std::atomic<int64_t>* total_ns)
+      : total_ns_(total_ns), start_ns_(ThreadCpuTimeNs()) {}
+  ~ScopedThreadCpuTimer() { *total_ns_ += ThreadCpuTimeNs() - start_ns_; }
+
+ private:
+  static int64_t ThreadCpuTimeNs() {
+    struct timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0)
+      return 0;
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+  }
+
+  std::atomic<int64_t>* total_ns_;
+  const int64_t start_ns_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedThreadCpuTimer);
+};
+
+// Returns whether |operation| has no data in the payload, so it can be
+// applied without waiting for any.
+bool IsNonDataOperation(const InstallOperation& operation) {
+  switch (operation.type()) {
+    case InstallOperation::SOURCE_COPY:
+    case InstallOperation::ZERO:
+    case InstallOperation::DISCARD:
+      return !operation.has_data_offset() && !operation.has_data_length() &&
+             operation.data_sha256_hash().empty();
+    default:
+      return false;
+  }
+}
 
 }  // namespace
 
+// A partition whose operations are applied on a thread of the parallel apply
+// pool, reading their data directly from the local payload.
+class DeltaPerformer::ParallelPartition
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  ParallelPartition(DeltaPerformer* performer,
+                    size_t partition_index,
+                    size_t first_operation,
+                    std::unique_ptr<PartitionWriterInterface> writer)
+      : performer(performer),
+        partition_index(partition_index),
+        first_operation(first_operation),
+        writer(std::move(writer)) {}
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    error = performer->ApplyParallelPartition(this);
+    done = true;
+  }
+
+  bool applied() const { return done && error == ErrorCode::kSuccess; }
+
+  DeltaPerformer* const performer;
+  // Index of the partition in |partitions_|, and of its first operation to
+  // apply.
+  const size_t partition_index;
+  const size_t first_operation;
+  const std::unique_ptr<PartitionWriterInterface> writer;
+
+  // Guarded by |performer->parallel_apply_mutex_|. |checkpoint| is the
+  // latest position in the partition the update can be resumed from once the
+  // partitions before it are applied: its start, recorded by
+  // RecordParallelPartitionStart(), or the last of |requested_checkpoints|
+  // the thread reached and checkpointed |writer| at. |requested_checkpoints|
+  // are the positions ahead of the thread, recorded as the payload is hashed.
+  // |next_operation_num| is the index in the payload of the operation after
+  // the one being applied.
+  PayloadPosition checkpoint;
+  std::deque<PayloadPosition> requested_checkpoints;
+  size_t next_operation_num{0};
+
+  // Result of applying the partition, set when |done|.
+  std::atomic<bool> done{false};
+  ErrorCode error{ErrorCode::kSuccess};
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ParallelPartition);
+};
+
+DeltaPerformer::~DeltaPerformer() {
+  // Don't let the apply threads outlive the performer if it wasn't closed.
+  StopParallelApplyThreads();
+}
+
+void DeltaPerformer::SetLocalPayload(android::base::unique_fd fd,
+                                     uint64_t offset) {
+  CHECK(!manifest_valid_);
+  local_payload_fd_ = std::move(fd);
+  local_payload_offset_ = offset;
+}
+
 // Computes the ratio of |part| and |total|, scaled to |norm|, using integer
 // arithmetic.
 static uint64_t IntRatio(uint64_t part, uint64_t total, uint64_t norm) {
@@ -90,7 +198,7 @@ void DeltaPerformer::LogProgress(const char* message_prefix) {
     // Upcasting to 64-bit to avoid overflow, back to size_t for formatting.
     completed_percentage_str = base::StringPrintf(
         " (%" PRIu64 "%%)",
-        IntRatio(next_operation_num_, num_total_operations_, 100));
+        IntRatio(GetNumAppliedOperations(), num_total_operations_, 100));
   }
 
   // Format download total count and percentage.
@@ -104,7 +212,8 @@ void DeltaPerformer::LogProgress(const char* message_prefix) {
         " (%" PRIu64 "%%)", IntRatio(total_bytes_received_, payload_size, 100));
   }
 
-  LOG(INFO) << (message_prefix ? message_prefix : "") << next_operation_num_
+  LOG(INFO) << (message_prefix ? message_prefix : "")
+            << GetNumAppliedOperations()
             << "/" << total_operations_str << " operations"
             << completed_percentage_str << ", " << total_bytes_received_ << "/"
             << payload_size_str << " bytes downloaded"
@@ -143,7 +252,9 @@ void DeltaPerformer::UpdateOverallProgress(bool force_log,
   // this will eventually reach |actual_operations_weight|.
   if (num_total_operations_)
     new_overall_progress += IntRatio(
-        next_operation_num_, num_total_operations_, actual_operations_weight);
+        GetNumAppliedOperations(),
+        num_total_operations_,
+        actual_operations_weight);
 
   // Progress ratio cannot recede, unless our assumptions about the total
   // payload size, total number of operations, or the monotonicity of progress
@@ -200,10 +311,18 @@ bool DeltaPerformer::HandleOpResult(bool op_result,
 }
 
 int DeltaPerformer::Close() {
-  // Checkpoint update progress before canceling, so that subsequent attempts
-  // can resume from exactly where update_engine left last time.
-  CheckpointUpdateProgress(true);
-  int err = -CloseCurrentPartition();
+  int err = 0;
+  if (!parallel_partitions_.empty()) {
+    // Partitions being applied in parallel can only be checkpointed once all
+    // the partitions before them are applied.
+    err = -StopParallelApply();
+  } else {
+    // Checkpoint update progress before canceling, so that subsequent attempts
+    // can resume from exactly where update_engine left last time.
+    CheckpointPartialOperationData();
+    CheckpointUpdateProgress(true);
+    err = -CloseCurrentPartition();
+  }
   LOG_IF(ERROR,
          !payload_hash_calculator_.Finalize() ||
              !signed_hash_calculator_.Finalize())
@@ -220,6 +339,12 @@ int DeltaPerformer::CloseCurrentPartition() {
   if (!partition_writer_) {
     return 0;
   }
+  if (num_elided_operations_) {
+    LOG(INFO) << "Elided " << num_elided_operations_ << " operations ("
+              << num_elided_blocks_ << " blocks) of partition \""
+              << partitions_[current_partition_].partition_name()
+              << "\" that write nothing on this device.";
+  }
   int err = partition_writer_->Close();
   partition_writer_ = nullptr;
   return err;
@@ -229,29 +354,65 @@ bool DeltaPerformer::OpenCurrentPartition() {
   if (current_partition_ >= partitions_.size())
     return false;
 
+  partition_writer_ = CreateWriterForPartition(current_partition_);
+  // Open source fds if we have a delta payload, or for partitions in the
+  // partial update.
+  const bool source_may_exist = manifest_.partial_update() ||
+                                payload_->type == InstallPayloadType::kDelta;
+  const size_t partition_operation_num = GetPartitionOperationNum();
+
+  TEST_AND_RETURN_FALSE(partition_writer_->Init(
+      install_plan_, source_may_exist, partition_operation_num));
+
   const PartitionUpdate& partition = partitions_[current_partition_];
+  noop_operations_.assign(partition.operations_size(), false);
+  for (int i = partition_operation_num; i < partition.operations_size(); i++) {
+    noop_operations_[i] =
+        partition_writer_->IsNoOpOperation(partition.operations(i));
+  }
+  num_elided_operations_ = 0;
+  num_elided_blocks_ = 0;
+  CheckpointUpdateProgress(true);
+  return true;
+}
+
+bool DeltaPerformer::FinishPartitionInstallOps(
+    size_t partition_index, PartitionWriterInterface* writer) {
+  TEST_AND_RETURN_FALSE(writer->FinishedInstallOps());
+  size_t num_previous_partitions =
+      install_plan_->partitions.size() - partitions_.size();
+  InstallPlan::Partition& install_part =
+      install_plan_->partitions[num_previous_partitions + partition_index];
+  if (writer->GetWrittenDataHash(&install_part.written_size,
+                                 &install_part.written_hash_context)) {
+    LOG(INFO) << "Hashed the first " << install_part.written_size
+              << " bytes of partition " << install_part.name
+              << " while writing them.";
+  }
+  return true;
+}
+
+std::unique_ptr<PartitionWriterInterface>
+DeltaPerformer::CreateWriterForPartition(size_t partition_index) {
+  const PartitionUpdate& partition = partitions_[partition_index];
   size_t num_previous_partitions =
       install_plan_->partitions.size() - partitions_.size();
   const InstallPlan::Partition& install_part =
-      install_plan_->partitions[num_previous_partitions + current_partition_];
+      install_plan_->partitions[num_previous_partitions + partition_index];
   auto dynamic_control = boot_control_->GetDynamicPartitionControl();
-  partition_writer_ = CreatePartitionWriter(
+  return CreatePartitionWriter(
       partition,
       install_part,
       dynamic_control,
       block_size_,
       interactive_,
       IsDynamicPartition(install_part.name, install_plan_->target_slot));
-  // Open source fds if we have a delta payload, or for partitions in the
-  // partial update.
-  const bool source_may_exist = manifest_.partial_update() ||
-                                payload_->type == InstallPayloadType::kDelta;
-  const size_t partition_operation_num = GetPartitionOperationNum();
+}
 
-  TEST_AND_RETURN_FALSE(partition_writer_->Init(
-      install_plan_, source_may_exist, partition_operation_num));
-  CheckpointUpdateProgress(true);
-  return true;
+size_t DeltaPerformer::GetNumAppliedOperations() const {
+  if (!parallel_partitions_.empty())
+    return num_parallel_applied_operations_;
+  return next_operation_num_;
 }
 
 size_t DeltaPerformer::GetPartitionOperationNum() {
@@ -519,7 +680,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       return false;
     }
 
-    if (next_operation_num_ < acc_num_operations_[current_partition_]) {
+    if (local_payload_fd_.ok() && next_operation_num_ < num_total_operations_) {
+      if (!StartParallelApply(error))
+        return false;
+    } else if (next_operation_num_ < acc_num_operations_[current_partition_]) {
       if (!OpenCurrentPartition()) {
         *error = ErrorCode::kInstallDeviceOpenError;
         return false;
@@ -542,7 +706,8 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     // |num_total_operations_| limit yet.
     if (next_operation_num_ >= acc_num_operations_[current_partition_]) {
       if (partition_writer_) {
-        if (!partition_writer_->FinishedInstallOps()) {
+        if (!FinishPartitionInstallOps(current_partition_,
+                                       partition_writer_.get())) {
           *error = ErrorCode::kDownloadWriteError;
           return false;
         }
@@ -552,7 +717,9 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       while (next_operation_num_ >= acc_num_operations_[current_partition_]) {
         current_partition_++;
       }
-      if (!OpenCurrentPartition()) {
+      if (!parallel_partitions_.empty()) {
+        RecordParallelPartitionStart(current_partition_);
+      } else if (!OpenCurrentPartition()) {
         *error = ErrorCode::kInstallDeviceOpenError;
         return false;
       }
@@ -561,11 +728,39 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     const InstallOperation& op =
         partitions_[current_partition_].operations(GetPartitionOperationNum());
 
+    // Operations without data don't need to wait for the payload; apply them
+    // in batches, checkpointing once per batch.
+    if (parallel_partitions_.empty() && IsNonDataOperation(op)) {
+      if (!PerformNonDataOperations(error))
+        return false;
+      UpdateOverallProgress(false, "Completed ");
+      CheckpointUpdateProgress(false);
+      continue;
+    }
+
+    if (!parallel_partitions_.empty()) {
+      // The operation is applied by its partition's thread, which reads the
+      // data from the local payload. Only hash the data here, as it's
+      // received.
+      if (operation_data_hashed_ == 0 && buffer_.empty())
+        RequestParallelCheckpoint();
+      if (!HashOperationData(&c_bytes, &count, op.data_length()))
+        return true;
+      next_operation_num_++;
+      if (!CheckParallelApply(error))
+        return false;
+      UpdateOverallProgress(false, "Completed ");
+      continue;
+    }
+
     CopyDataToBuffer(&c_bytes, &count, op.data_length());
 
     // Check whether we received all of the next operation's data payload.
-    if (!CanPerformInstallOperation(op))
+    if (!CanPerformInstallOperation(op)) {
+      if (ShouldCheckpoint())
+        CheckpointPartialOperationData();
       return true;
+    }
 
     // Validate the operation unconditionally. This helps prevent the
     // exploitation of vulnerabilities in the patching libraries, e.g. bspatch.
@@ -632,7 +827,8 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
   }
 
   if (partition_writer_) {
-    TEST_AND_RETURN_FALSE(partition_writer_->FinishedInstallOps());
+    TEST_AND_RETURN_FALSE(FinishPartitionInstallOps(current_partition_,
+                                                    partition_writer_.get()));
   }
   CloseCurrentPartition();
 
@@ -661,8 +857,9 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     // checkpoint, otherwise we would reload the signature and try to extract
     // it again.
     // This is the last checkpoint for an update, force this checkpoint to be
-    // saved.
-    CheckpointUpdateProgress(true);
+    // saved. Partitions still applied in parallel get it on Close() instead.
+    if (parallel_partitions_.empty())
+      CheckpointUpdateProgress(true);
   }
 
   return true;
@@ -849,13 +1046,106 @@ bool DeltaPerformer::PerformZeroOrDiscardOperation(
   return partition_writer_->PerformZeroOrDiscardOperation(operation);
 }
 
+bool DeltaPerformer::PerformNonDataOperations(ErrorCode* error) {
+  // Makes sure we unblock exit when these operations complete.
+  ScopedTerminatorExitUnblocker exit_unblocker =
+      ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  const size_t partition_start =
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0;
+  const size_t batch_end =
+      min(acc_num_operations_[current_partition_],
+          next_operation_num_ + kMaxNonDataOperationBatchSize);
+
+  // The consecutive ZERO or DISCARD operations not applied yet, merged, and
+  // the number of the first one.
+  InstallOperation zero_op;
+  size_t zero_op_num = 0;
+  auto apply_zero_op = [&]() {
+    if (zero_op.dst_extents().empty())
+      return true;
+    next_operation_num_ = zero_op_num;
+    if (!HandleOpResult(PerformZeroOrDiscardOperation(zero_op),
+                        InstallOperationTypeName(zero_op.type()),
+                        error)) {
+      return false;
+    }
+    zero_op.Clear();
+    return true;
+  };
+  // Same for the consecutive SOURCE_COPY operations, which the partition
+  // writer applies as a batch.
+  vector<const InstallOperation*> copy_ops;
+  size_t copy_op_num = 0;
+  auto apply_copy_ops = [&]() {
+    if (copy_ops.empty())
+      return true;
+    next_operation_num_ = copy_op_num;
+    if (!HandleOpResult(PerformSourceCopyOperations(copy_ops, error),
+                        "SOURCE_COPY",
+                        error)) {
+      return false;
+    }
+    copy_ops.clear();
+    return true;
+  };
+
+  size_t op_num = next_operation_num_;
+  for (; op_num < batch_end; op_num++) {
+    const InstallOperation& op = partition.operations(op_num - partition_start);
+    if (!IsNonDataOperation(op))
+      break;
+    if (op.type() != InstallOperation::SOURCE_COPY) {
+      if (!apply_copy_ops())
+        return false;
+      if (!zero_op.dst_extents().empty() && zero_op.type() != op.type() &&
+          !apply_zero_op()) {
+        return false;
+      }
+      if (zero_op.dst_extents().empty()) {
+        zero_op.set_type(op.type());
+        zero_op_num = op_num;
+      }
+      zero_op.mutable_dst_extents()->MergeFrom(op.dst_extents());
+      continue;
+    }
+
+    if (!apply_zero_op())
+      return false;
+    if (noop_operations_[op_num - partition_start]) {
+      num_elided_operations_++;
+      num_elided_blocks_ += utils::BlocksInExtents(op.dst_extents());
+      // Nothing to write, but the source must still be verified.
+      if (!op.has_src_sha256_hash())
+        continue;
+    }
+    if (copy_ops.empty())
+      copy_op_num = op_num;
+    copy_ops.push_back(&op);
+  }
+  // Checkpoints only record whole batches as applied, so a failed batch is
+  // applied again from its first operation when resuming.
+  if (!apply_zero_op() || !apply_copy_ops())
+    return false;
+  next_operation_num_ = op_num;
+  return true;
+}
+
 bool DeltaPerformer::PerformSourceCopyOperation(
     const InstallOperation& operation, ErrorCode* error) {
-  if (operation.has_src_length())
-    TEST_AND_RETURN_FALSE(operation.src_length() % block_size_ == 0);
-  if (operation.has_dst_length())
-    TEST_AND_RETURN_FALSE(operation.dst_length() % block_size_ == 0);
-  return partition_writer_->PerformSourceCopyOperation(operation, error);
+  return PerformSourceCopyOperations({&operation}, error);
+}
+
+bool DeltaPerformer::PerformSourceCopyOperations(
+    const vector<const InstallOperation*>& operations, ErrorCode* error) {
+  for (const InstallOperation* operation : operations) {
+    if (operation->has_src_length())
+      TEST_AND_RETURN_FALSE(operation->src_length() % block_size_ == 0);
+    if (operation->has_dst_length())
+      TEST_AND_RETURN_FALSE(operation->dst_length() % block_size_ == 0);
+  }
+  return partition_writer_->PerformSourceCopyOperations(operations, error);
 }
 
 bool DeltaPerformer::ExtentsToBsdiffPositionsString(
@@ -1117,6 +1407,59 @@ ErrorCode DeltaPerformer::CheckTimestampError() const {
 
 ErrorCode DeltaPerformer::ValidateOperationHash(
     const InstallOperation& operation) {
+  if (buffer_.size() != operation.data_length() || buffer_hashed_size_ != 0) {
+    return ValidateOperationHash(
+        operation, buffer_.data(), next_operation_num_);
+  }
+
+  // The operation data is also part of the payload hashes. Hash it for all of
+  // them in one pass while it is in the CPU cache, instead of reading it once
+  // per hash.
+  HashCalculator op_hash_calculator;
+  vector<HashCalculator*> calculators = {&payload_hash_calculator_,
+                                         &signed_hash_calculator_};
+  if (operation.data_sha256_hash().size())
+    calculators.push_back(&op_hash_calculator);
+  bool hashed;
+  {
+    ScopedThreadCpuTimer timer(&hashing_cpu_time_ns_);
+    hashed =
+        HashCalculator::UpdateAll(calculators, buffer_.data(), buffer_.size());
+  }
+  buffer_hashed_size_ = buffer_.size();
+  brillo::Blob calculated_op_hash;
+  if (operation.data_sha256_hash().size()) {
+    if (!hashed || !op_hash_calculator.Finalize()) {
+      LOG(ERROR) << "Unable to compute actual hash of operation "
+                 << next_operation_num_;
+      return ErrorCode::kDownloadOperationHashVerificationError;
+    }
+    calculated_op_hash = op_hash_calculator.raw_hash();
+  }
+  return CheckOperationHash(operation, calculated_op_hash, next_operation_num_);
+}
+
+ErrorCode DeltaPerformer::ValidateOperationHash(
+    const InstallOperation& operation,
+    const uint8_t* data,
+    size_t operation_num) const {
+  brillo::Blob calculated_op_hash;
+  if (operation.data_sha256_hash().size()) {
+    ScopedThreadCpuTimer timer(&hashing_cpu_time_ns_);
+    if (!HashCalculator::RawHashOfBytes(
+            data, operation.data_length(), &calculated_op_hash)) {
+      LOG(ERROR) << "Unable to compute actual hash of operation "
+                 << operation_num;
+      return ErrorCode::kDownloadOperationHashVerificationError;
+    }
+  }
+  return CheckOperationHash(operation, calculated_op_hash, operation_num);
+}
+
+ErrorCode DeltaPerformer::CheckOperationHash(
+    const InstallOperation& operation,
+    const brillo::Blob& calculated_op_hash,
+    size_t operation_num) const {
   if (!operation.data_sha256_hash().size()) {
     if (!operation.data_length()) {
       // Operations that do not have any data blob won't have any operation
@@ -1139,15 +1482,15 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
     if (manifest_.signatures_offset() &&
         manifest_.signatures_offset() == operation.data_offset()) {
       LOG(INFO) << "Skipping hash verification for signature operation "
-                << next_operation_num_ + 1;
+                << operation_num + 1;
     } else {
       if (install_plan_->hash_checks_mandatory) {
         LOG(ERROR) << "Missing mandatory operation hash for operation "
-                   << next_operation_num_ + 1;
+                   << operation_num + 1;
         return ErrorCode::kDownloadOperationHashMissingError;
       }
 
-      LOG(WARNING) << "Cannot validate operation " << next_operation_num_ + 1
+      LOG(WARNING) << "Cannot validate operation " << operation_num + 1
                    << " as there's no operation hash in manifest";
     }
     return ErrorCode::kSuccess;
@@ -1158,17 +1501,8 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
                           (operation.data_sha256_hash().data() +
                            operation.data_sha256_hash().size()));
 
-  brillo::Blob calculated_op_hash;
-  if (!HashCalculator::RawHashOfBytes(
-          buffer_.data(), operation.data_length(), &calculated_op_hash)) {
-    LOG(ERROR) << "Unable to compute actual hash of operation "
-               << next_operation_num_;
-    return ErrorCode::kDownloadOperationHashVerificationError;
-  }
-
   if (calculated_op_hash != expected_op_hash) {
-    LOG(ERROR) << "Hash verification failed for operation "
-               << next_operation_num_
+    LOG(ERROR) << "Hash verification failed for operation " << operation_num
                << ". Expected hash = " << HexEncode(expected_op_hash);
     LOG(ERROR) << "Calculated hash over " << operation.data_length()
                << " bytes at offset: " << operation.data_offset() << " = "
@@ -1190,6 +1524,10 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
 ErrorCode DeltaPerformer::VerifyPayload(
     const brillo::Blob& update_check_response_hash,
     const uint64_t update_check_response_size) {
+  LOG(INFO) << base::StringPrintf(
+      "Spent %.3f CPU seconds hashing the payload data.",
+      hashing_cpu_time_ns_ / 1e9);
+
   // Verifies the download size.
   if (update_check_response_size !=
       metadata_size_ + metadata_signature_size_ + buffer_offset_) {
@@ -1244,12 +1582,171 @@ void DeltaPerformer::DiscardBuffer(bool do_advance_offset,
   if (do_advance_offset)
     buffer_offset_ += buffer_.size();
 
-  // Hash the content.
-  payload_hash_calculator_.Update(buffer_.data(), buffer_.size());
-  signed_hash_calculator_.Update(buffer_.data(), signed_hash_buffer_size);
+  // Hash the content not hashed yet by ValidateOperationHash().
+  DCHECK_LE(buffer_hashed_size_, signed_hash_buffer_size);
+  {
+    ScopedThreadCpuTimer timer(&hashing_cpu_time_ns_);
+    payload_hash_calculator_.Update(buffer_.data() + buffer_hashed_size_,
+                                    buffer_.size() - buffer_hashed_size_);
+    signed_hash_calculator_.Update(
+        buffer_.data() + buffer_hashed_size_,
+        signed_hash_buffer_size - buffer_hashed_size_);
+  }
+  buffer_hashed_size_ = 0;
 
   // Swap content with an empty vector to ensure that all memory is released.
   brillo::Blob().swap(buffer_);
+
+  // Whatever was persisted of the operation data is no longer needed.
+  if (partial_operation_data_persisted_ > 0) {
+    partial_operation_data_persisted_ = 0;
+    partial_operation_data_stale_ = true;
+  }
+}
+
+const InstallOperation& DeltaPerformer::GetOperation(
+    size_t operation_num) const {
+  CHECK_LT(operation_num, num_total_operations_);
+  const size_t partition_index =
+      std::upper_bound(acc_num_operations_.begin(),
+                       acc_num_operations_.end(),
+                       operation_num) -
+      acc_num_operations_.begin();
+  const size_t partition_operation_num =
+      operation_num -
+      (partition_index ? acc_num_operations_[partition_index - 1] : 0);
+  return partitions_[partition_index].operations(partition_operation_num);
+}
+
+const InstallOperation& DeltaPerformer::GetNextOperation() const {
+  return GetOperation(next_operation_num_);
+}
+
+bool DeltaPerformer::GetPartialOperationDataPath(base::FilePath* path) const {
+  if (!hardware_ || !hardware_->GetNonVolatileDirectory(path))
+    return false;
+  *path = path->Append(kPartialOperationDataFile);
+  return true;
+}
+
+bool DeltaPerformer::CheckpointPartialOperationData() {
+  // Updates can't be resumed before the first operation is applied, and
+  // partitions applied in parallel read their data from the local payload.
+  if (!manifest_valid_ || next_operation_num_ == 0 ||
+      next_operation_num_ >= num_total_operations_ ||
+      !parallel_partitions_.empty()) {
+    return false;
+  }
+  const InstallOperation& op = GetNextOperation();
+  // Only operations whose data starts at the beginning of |buffer_| and which
+  // take long enough to download are worth persisting.
+  if (op.data_length() < kMinPartialOperationDataSize ||
+      op.data_offset() != buffer_offset_ ||
+      buffer_.size() <= partial_operation_data_persisted_ ||
+      buffer_.size() >= op.data_length()) {
+    return false;
+  }
+  base::FilePath path;
+  if (!GetPartialOperationDataPath(&path))
+    return false;
+
+  // The persisted data is only valid together with the rest of the progress
+  // of the operation it belongs to, so make sure that's checkpointed first.
+  if (last_updated_operation_num_ != next_operation_num_)
+    TEST_AND_RETURN_FALSE(CheckpointUpdateProgress(true));
+
+  // A failure leaves the file in an unknown state, so until this succeeds
+  // nothing is considered persisted and the next call rewrites the file.
+  const size_t persisted = partial_operation_data_persisted_;
+  partial_operation_data_persisted_ = 0;
+  HashCalculator hasher;
+  if (persisted > 0) {
+    TEST_AND_RETURN_FALSE(
+        hasher.SetContext(partial_operation_data_hash_context_));
+  }
+  TEST_AND_RETURN_FALSE(
+      hasher.Update(buffer_.data() + persisted, buffer_.size() - persisted));
+  string hash_context = hasher.GetContext();
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+
+  int flags = O_WRONLY | O_CREAT | O_APPEND;
+  if (persisted == 0)
+    flags |= O_TRUNC;
+  EintrSafeFileDescriptor fd;
+  TEST_AND_RETURN_FALSE_ERRNO(fd.Open(path.value().c_str(), flags, 0600));
+  bool success = utils::WriteAll(
+      &fd, buffer_.data() + persisted, buffer_.size() - persisted);
+  // Closing the file also syncs it to disk.
+  success = fd.Close() && success;
+  TEST_AND_RETURN_FALSE(success);
+
+  TEST_AND_RETURN_FALSE(
+      prefs_->SetString(kPrefsUpdateStatePartialOperationDataHash,
+                        HexEncode(hasher.raw_hash())));
+  TEST_AND_RETURN_FALSE(prefs_->SetInt64(
+      kPrefsUpdateStatePartialOperationDataSize, buffer_.size()));
+  partial_operation_data_persisted_ = buffer_.size();
+  partial_operation_data_hash_context_ = std::move(hash_context);
+  partial_operation_data_stale_ = false;
+  LOG(INFO) << "Persisted " << partial_operation_data_persisted_ << "/"
+            << op.data_length() << " bytes of operation "
+            << next_operation_num_ << " data.";
+  return true;
+}
+
+void DeltaPerformer::LoadPartialOperationData() {
+  int64_t partial_data_size = 0;
+  if (!prefs_->GetInt64(kPrefsUpdateStatePartialOperationDataSize,
+                        &partial_data_size) ||
+      partial_data_size <= 0) {
+    return;
+  }
+  // The data is only an optimization, so whatever doesn't match is dropped
+  // and downloaded again.
+  auto discard = [this, partial_data_size](const char* reason) {
+    LOG(WARNING) << "Discarding " << partial_data_size
+                 << " bytes of persisted operation data: " << reason;
+    prefs_->SetInt64(kPrefsUpdateStatePartialOperationDataSize, 0);
+    base::FilePath path;
+    if (GetPartialOperationDataPath(&path))
+      base::DeleteFile(path);
+  };
+  if (next_operation_num_ >= num_total_operations_ ||
+      GetNextOperation().data_offset() != buffer_offset_ ||
+      static_cast<uint64_t>(partial_data_size) >=
+          GetNextOperation().data_length()) {
+    discard("it doesn't belong to the next operation.");
+    return;
+  }
+
+  base::FilePath path;
+  brillo::Blob data;
+  if (!GetPartialOperationDataPath(&path) ||
+      !utils::ReadFileChunk(path.value(), 0, partial_data_size, &data) ||
+      data.size() != static_cast<size_t>(partial_data_size)) {
+    discard("the file is missing or too short.");
+    return;
+  }
+  string expected_hash;
+  HashCalculator hasher;
+  if (!prefs_->GetString(kPrefsUpdateStatePartialOperationDataHash,
+                         &expected_hash) ||
+      !hasher.Update(data.data(), data.size())) {
+    discard("its hash is missing.");
+    return;
+  }
+  string hash_context = hasher.GetContext();
+  if (!hasher.Finalize() || HexEncode(hasher.raw_hash()) != expected_hash) {
+    discard("it doesn't match its hash.");
+    return;
+  }
+
+  buffer_ = std::move(data);
+  partial_operation_data_persisted_ = buffer_.size();
+  partial_operation_data_hash_context_ = std::move(hash_context);
+  LOG(INFO) << "Loaded " << partial_operation_data_persisted_ << "/"
+            << GetNextOperation().data_length() << " bytes of operation "
+            << next_operation_num_ << " data.";
 }
 
 bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
@@ -1326,6 +1823,8 @@ bool DeltaPerformer::ResetUpdateProgress(PrefsInterface* prefs, bool quick) {
   if (!quick) {
     prefs->SetInt64(kPrefsUpdateStateNextDataOffset, -1);
     prefs->SetInt64(kPrefsUpdateStateNextDataLength, 0);
+    prefs->SetInt64(kPrefsUpdateStatePartialOperationDataSize, 0);
+    prefs->SetString(kPrefsUpdateStatePartialOperationDataHash, "");
     prefs->SetString(kPrefsUpdateStateSHA256Context, "");
     prefs->SetString(kPrefsUpdateStateSignedSHA256Context, "");
     prefs->SetString(kPrefsUpdateStateSignatureBlob, "");
@@ -1350,54 +1849,66 @@ bool DeltaPerformer::ShouldCheckpoint() {
   return false;
 }
 
+DeltaPerformer::PayloadPosition DeltaPerformer::GetPayloadPosition() const {
+  return {next_operation_num_,
+          buffer_offset_,
+          payload_hash_calculator_.GetContext(),
+          signed_hash_calculator_.GetContext()};
+}
+
+bool DeltaPerformer::SaveUpdateProgress(const PayloadPosition& position) {
+  // Resets the progress in case we die in the middle of the state update.
+  ResetUpdateProgress(prefs_, true);
+  if (!signatures_message_data_.empty()) {
+    // Save the signature blob because if the update is interrupted after the
+    // download phase we don't go through this path anymore. Some alternatives
+    // to consider:
+    //
+    // 1. On resume, re-download the signature blob from the server and
+    // re-verify it.
+    //
+    // 2. Verify the signature as soon as it's received and don't checkpoint
+    // the blob and the signed sha-256 context.
+    LOG_IF(WARNING,
+           !prefs_->SetString(kPrefsUpdateStateSignatureBlob,
+                              signatures_message_data_))
+        << "Unable to store the signature blob.";
+  }
+  TEST_AND_RETURN_FALSE(
+      prefs_->SetString(kPrefsUpdateStateSHA256Context, position.hash_context));
+  TEST_AND_RETURN_FALSE(prefs_->SetString(kPrefsUpdateStateSignedSHA256Context,
+                                          position.signed_hash_context));
+  TEST_AND_RETURN_FALSE(
+      prefs_->SetInt64(kPrefsUpdateStateNextDataOffset, position.data_offset));
+  TEST_AND_RETURN_FALSE(
+      prefs_->SetInt64(kPrefsUpdateStatePartialOperationDataSize,
+                       partial_operation_data_persisted_));
+  if (partial_operation_data_stale_) {
+    base::FilePath path;
+    if (GetPartialOperationDataPath(&path))
+      base::DeleteFile(path);
+    partial_operation_data_stale_ = false;
+  }
+  last_updated_operation_num_ = position.operation_num;
+
+  if (position.operation_num < num_total_operations_) {
+    TEST_AND_RETURN_FALSE(
+        prefs_->SetInt64(kPrefsUpdateStateNextDataLength,
+                         GetOperation(position.operation_num).data_length()));
+  } else {
+    TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataLength, 0));
+  }
+  TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextOperation,
+                                         position.operation_num));
+  return true;
+}
+
 bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
   if (!force && !ShouldCheckpoint()) {
     return false;
   }
   Terminator::set_exit_blocked(true);
   if (last_updated_operation_num_ != next_operation_num_ || force) {
-    // Resets the progress in case we die in the middle of the state update.
-    ResetUpdateProgress(prefs_, true);
-    if (!signatures_message_data_.empty()) {
-      // Save the signature blob because if the update is interrupted after the
-      // download phase we don't go through this path anymore. Some alternatives
-      // to consider:
-      //
-      // 1. On resume, re-download the signature blob from the server and
-      // re-verify it.
-      //
-      // 2. Verify the signature as soon as it's received and don't checkpoint
-      // the blob and the signed sha-256 context.
-      LOG_IF(WARNING,
-             !prefs_->SetString(kPrefsUpdateStateSignatureBlob,
-                                signatures_message_data_))
-          << "Unable to store the signature blob.";
-    }
-    TEST_AND_RETURN_FALSE(prefs_->SetString(
-        kPrefsUpdateStateSHA256Context, payload_hash_calculator_.GetContext()));
-    TEST_AND_RETURN_FALSE(
-        prefs_->SetString(kPrefsUpdateStateSignedSHA256Context,
-                          signed_hash_calculator_.GetContext()));
-    TEST_AND_RETURN_FALSE(
-        prefs_->SetInt64(kPrefsUpdateStateNextDataOffset, buffer_offset_));
-    last_updated_operation_num_ = next_operation_num_;
-
-    if (next_operation_num_ < num_total_operations_) {
-      size_t partition_index = current_partition_;
-      while (next_operation_num_ >= acc_num_operations_[partition_index]) {
-        partition_index++;
-      }
-      const size_t partition_operation_num =
-          next_operation_num_ -
-          (partition_index ? acc_num_operations_[partition_index - 1] : 0);
-      const InstallOperation& op =
-          partitions_[partition_index].operations(partition_operation_num);
-      TEST_AND_RETURN_FALSE(
-          prefs_->SetInt64(kPrefsUpdateStateNextDataLength, op.data_length()));
-    } else {
-      TEST_AND_RETURN_FALSE(
-          prefs_->SetInt64(kPrefsUpdateStateNextDataLength, 0));
-    }
     if (partition_writer_) {
       partition_writer_->CheckpointUpdateProgress(GetPartitionOperationNum());
     } else {
@@ -1406,20 +1917,375 @@ bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
              "operations: "
           << next_operation_num_ << "/" << num_total_operations_;
     }
+    TEST_AND_RETURN_FALSE(SaveUpdateProgress(GetPayloadPosition()));
   }
-  TEST_AND_RETURN_FALSE(
-      prefs_->SetInt64(kPrefsUpdateStateNextOperation, next_operation_num_));
   LOG(INFO) << "Update progress successfully checkpointed.";
   return true;
 }
 
+bool DeltaPerformer::StartParallelApply(ErrorCode* error) {
+  // Open source fds if we have a delta payload, or for partitions in the
+  // partial update.
+  const bool source_may_exist = manifest_.partial_update() ||
+                                payload_->type == InstallPayloadType::kDelta;
+  for (size_t i = 0; i < partitions_.size(); i++) {
+    if (partitions_[i].operations_size() == 0 ||
+        next_operation_num_ >= acc_num_operations_[i]) {
+      continue;
+    }
+    const size_t partition_start = i ? acc_num_operations_[i - 1] : 0;
+    const size_t first_operation = next_operation_num_ > partition_start
+                                       ? next_operation_num_ - partition_start
+                                       : 0;
+    auto writer = CreateWriterForPartition(i);
+    if (!writer->Init(install_plan_, source_may_exist, first_operation)) {
+      writer->Close();
+      *error = ErrorCode::kInstallDeviceOpenError;
+      return false;
+    }
+    parallel_partitions_.push_back(std::make_unique<ParallelPartition>(
+        this, i, first_operation, std::move(writer)));
+  }
+  TEST_AND_RETURN_FALSE(!parallel_partitions_.empty());
+  num_parallel_applied_operations_ = next_operation_num_;
+  parallel_applied_payload_size_ =
+      metadata_size_ + metadata_signature_size_ + buffer_offset_;
+  // The stream is at the start of the first partition, which is also what
+  // the update progress currently records.
+  RecordParallelPartitionStart(parallel_partitions_[0]->partition_index);
+
+  const size_t num_threads =
+      std::min<size_t>(parallel_partitions_.size(),
+                       std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L));
+  LOG(INFO) << "Applying " << parallel_partitions_.size()
+            << " partitions in parallel on " << num_threads << " threads.";
+  parallel_apply_pool_ = std::make_unique<base::DelegateSimpleThreadPool>(
+      "delta-performer-apply", num_threads);
+  parallel_apply_pool_->Start();
+  for (const auto& partition : parallel_partitions_) {
+    parallel_apply_pool_->AddWork(partition.get());
+  }
+  return true;
+}
+
+void DeltaPerformer::RecordParallelPartitionStart(size_t partition_index) {
+  if (parallel_partitions_started_ >= parallel_partitions_.size())
+    return;
+  ParallelPartition& partition =
+      *parallel_partitions_[parallel_partitions_started_];
+  if (partition.partition_index != partition_index)
+    return;
+  // The writer was initialized at the first operation, so it doesn't need to
+  // checkpoint there.
+  PayloadPosition position = GetPayloadPosition();
+  {
+    std::lock_guard<std::mutex> lock(parallel_apply_mutex_);
+    partition.checkpoint = std::move(position);
+  }
+  parallel_partitions_started_++;
+}
+
+void DeltaPerformer::RequestParallelCheckpoint() {
+  if (parallel_partitions_started_ == 0)
+    return;
+  ParallelPartition& partition =
+      *parallel_partitions_[parallel_partitions_started_ - 1];
+  if (partition.partition_index != current_partition_)
+    return;
+  std::lock_guard<std::mutex> lock(parallel_apply_mutex_);
+  const PayloadPosition& last_checkpoint =
+      partition.requested_checkpoints.empty()
+          ? partition.checkpoint
+          : partition.requested_checkpoints.back();
+  if (partition.next_operation_num > next_operation_num_ ||
+      last_checkpoint.operation_num >= next_operation_num_) {
+    return;
+  }
+  if (buffer_offset_ - last_checkpoint.data_offset <
+          parallel_checkpoint_data_interval_ &&
+      next_operation_num_ - last_checkpoint.operation_num <
+          parallel_checkpoint_operation_interval_) {
+    return;
+  }
+  partition.requested_checkpoints.push_back(GetPayloadPosition());
+}
+
+bool DeltaPerformer::CheckParallelApply(ErrorCode* error) {
+  // The update progress can only record a position before which all the
+  // operations are applied, so it's only advanced within the first partition
+  // not applied yet.
+  while (parallel_partitions_applied_ < parallel_partitions_.size() &&
+         parallel_partitions_[parallel_partitions_applied_]->applied()) {
+    parallel_partitions_applied_++;
+  }
+  if (parallel_partitions_applied_ < parallel_partitions_started_) {
+    const ParallelPartition& partition =
+        *parallel_partitions_[parallel_partitions_applied_];
+    PayloadPosition position;
+    {
+      std::lock_guard<std::mutex> lock(parallel_apply_mutex_);
+      position.operation_num = partition.checkpoint.operation_num;
+      if (position.operation_num != last_updated_operation_num_)
+        position = partition.checkpoint;
+    }
+    // Like the other checkpoints, failing to save one doesn't fail the
+    // update.
+    if (position.operation_num != last_updated_operation_num_ &&
+        SaveUpdateProgress(position)) {
+      LOG(INFO) << "Update progress checkpointed at operation "
+                << position.operation_num << " in partition \""
+                << partitions_[partition.partition_index].partition_name()
+                << "\".";
+    }
+  }
+
+  for (const auto& partition : parallel_partitions_) {
+    if (partition->done && partition->error != ErrorCode::kSuccess) {
+      LOG(ERROR) << "Failed to apply partition \""
+                 << partitions_[partition->partition_index].partition_name()
+                 << "\"";
+      *error = partition->error;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DeltaPerformer::PollParallelApply(ErrorCode* error) {
+  *error = ErrorCode::kSuccess;
+  if (parallel_partitions_.empty())
+    return true;
+  if (!CheckParallelApply(error))
+    return true;
+  UpdateOverallProgress(false, "Completed ");
+  // If the payload ended early, Close() stops the partitions instead.
+  if (next_operation_num_ < num_total_operations_)
+    return true;
+  if (parallel_partitions_applied_ < parallel_partitions_.size())
+    return false;
+  FinishParallelApply(error);
+  return true;
+}
+
+bool DeltaPerformer::GetParallelApplyProgress(uint64_t* bytes_applied) const {
+  if (parallel_partitions_.empty())
+    return false;
+  *bytes_applied = parallel_applied_payload_size_;
+  return true;
+}
+
+bool DeltaPerformer::FinishParallelApply(ErrorCode* error) {
+  parallel_apply_pool_->JoinAll();
+  parallel_apply_pool_.reset();
+  for (const auto& partition : parallel_partitions_) {
+    if (partition->writer->Close() != 0) {
+      *error = ErrorCode::kDownloadWriteError;
+      return false;
+    }
+  }
+  parallel_partitions_.clear();
+  return true;
+}
+
+int DeltaPerformer::StopParallelApply() {
+  StopParallelApplyThreads();
+  ErrorCode error{};
+  CheckParallelApply(&error);
+
+  int err = 0;
+  for (const auto& partition : parallel_partitions_) {
+    int close_err = partition->writer->Close();
+    if (close_err && !err)
+      err = close_err;
+  }
+  parallel_partitions_.clear();
+  return err;
+}
+
+void DeltaPerformer::StopParallelApplyThreads() {
+  {
+    std::lock_guard<std::mutex> lock(parallel_apply_mutex_);
+    parallel_apply_stopped_ = true;
+  }
+  parallel_apply_cv_.notify_all();
+  if (parallel_apply_pool_) {
+    parallel_apply_pool_->JoinAll();
+    parallel_apply_pool_.reset();
+  }
+}
+
+bool DeltaPerformer::ReserveParallelApplyData(uint64_t size) {
+  std::unique_lock<std::mutex> lock(parallel_apply_mutex_);
+  // Without other data in memory any operation goes through, so a larger one
+  // can't wait forever.
+  parallel_apply_cv_.wait(lock, [this, size] {
+    return parallel_apply_stopped_ || size == 0 ||
+           parallel_apply_data_size_ == 0 ||
+           parallel_apply_data_size_ + size <= kMaxParallelApplyDataSize;
+  });
+  if (parallel_apply_stopped_)
+    return false;
+  parallel_apply_data_size_ += size;
+  return true;
+}
+
+void DeltaPerformer::ReleaseParallelApplyData(uint64_t size) {
+  if (size == 0)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(parallel_apply_mutex_);
+    parallel_apply_data_size_ -= size;
+  }
+  parallel_apply_cv_.notify_all();
+}
+
+ErrorCode DeltaPerformer::ApplyParallelPartition(
+    ParallelPartition* partition) {
+  const PartitionUpdate& partition_update =
+      partitions_[partition->partition_index];
+  const size_t partition_start =
+      partition->partition_index
+          ? acc_num_operations_[partition->partition_index - 1]
+          : 0;
+  const uint64_t data_start =
+      local_payload_offset_ + metadata_size_ + metadata_signature_size_;
+  PartitionWriterInterface* writer = partition->writer.get();
+
+  for (size_t i = partition->first_operation;
+       i < static_cast<size_t>(partition_update.operations_size());
+       i++) {
+    if (parallel_apply_stopped_)
+      return ErrorCode::kUserCanceled;
+
+    const InstallOperation& op = partition_update.operations(i);
+    const size_t operation_num = partition_start + i;
+
+    // The operations before this one are applied, so checkpoint the writer
+    // here if the update progress is to be checkpointed here.
+    bool checkpoint = false;
+    {
+      std::lock_guard<std::mutex> lock(parallel_apply_mutex_);
+      partition->next_operation_num = operation_num + 1;
+      checkpoint = !partition->requested_checkpoints.empty() &&
+                   partition->requested_checkpoints.front().operation_num ==
+                       operation_num;
+    }
+    if (checkpoint) {
+      writer->CheckpointUpdateProgress(i);
+      std::lock_guard<std::mutex> lock(parallel_apply_mutex_);
+      partition->checkpoint =
+          std::move(partition->requested_checkpoints.front());
+      partition->requested_checkpoints.pop_front();
+    }
+
+    const uint64_t data_length = op.data_length();
+    if (!ReserveParallelApplyData(data_length))
+      return ErrorCode::kUserCanceled;
+    DEFER { ReleaseParallelApplyData(data_length); };
+    brillo::Blob data(data_length);
+    if (!data.empty()) {
+      ssize_t bytes_read = 0;
+      if (!utils::PReadAll(local_payload_fd_.get(),
+                           data.data(),
+                           data.size(),
+                           data_start + op.data_offset(),
+                           &bytes_read) ||
+          bytes_read != static_cast<ssize_t>(data.size())) {
+        LOG(ERROR) << "Unable to read the data of operation " << operation_num;
+        return ErrorCode::kDownloadOperationExecutionError;
+      }
+    }
+
+    ErrorCode error = ValidateOperationHash(op, data.data(), operation_num);
+    if (error != ErrorCode::kSuccess) {
+      if (install_plan_->hash_checks_mandatory) {
+        LOG(ERROR) << "Mandatory operation hash check failed";
+        return error;
+      }
+      LOG(WARNING) << "Ignoring operation validation errors";
+      error = ErrorCode::kSuccess;
+    }
+
+    bool op_result = false;
+    switch (op.type()) {
+      case InstallOperation::REPLACE:
+      case InstallOperation::REPLACE_BZ:
+      case InstallOperation::REPLACE_XZ:
+        op_result =
+            writer->PerformReplaceOperation(op, data.data(), data.size());
+        break;
+      case InstallOperation::ZERO:
+      case InstallOperation::DISCARD:
+        op_result = writer->PerformZeroOrDiscardOperation(op);
+        break;
+      case InstallOperation::SOURCE_COPY:
+        op_result = writer->PerformSourceCopyOperation(op, &error);
+        break;
+      case InstallOperation::SOURCE_BSDIFF:
+      case InstallOperation::BROTLI_BSDIFF:
+      case InstallOperation::PUFFDIFF:
+      case InstallOperation::ZUCCHINI:
+      case InstallOperation::LZ4DIFF_PUFFDIFF:
+      case InstallOperation::LZ4DIFF_BSDIFF:
+        op_result = writer->PerformDiffOperation(
+            op, &error, data.data(), data.size());
+        break;
+      default:
+        break;
+    }
+    if (!op_result) {
+      LOG(ERROR) << "Failed to perform " << InstallOperationTypeName(op.type())
+                 << " operation " << operation_num
+                 << ", which is the operation " << i << " in partition \""
+                 << partition_update.partition_name() << "\"";
+      return error == ErrorCode::kSuccess
+                 ? ErrorCode::kDownloadOperationExecutionError
+                 : error;
+    }
+    num_parallel_applied_operations_++;
+    parallel_applied_payload_size_ += data_length;
+  }
+  if (!FinishPartitionInstallOps(partition->partition_index, writer))
+    return ErrorCode::kDownloadWriteError;
+  return ErrorCode::kSuccess;
+}
+
+bool DeltaPerformer::HashOperationData(const char** bytes_p,
+                                       size_t* count_p,
+                                       uint64_t data_length) {
+  // Data persisted by an earlier attempt is hashed like the rest.
+  if (!buffer_.empty()) {
+    operation_data_hashed_ += buffer_.size();
+    DiscardBuffer(false, buffer_.size());
+  }
+  const size_t hash_len =
+      min<uint64_t>(*count_p, data_length - operation_data_hashed_);
+  {
+    ScopedThreadCpuTimer timer(&hashing_cpu_time_ns_);
+    payload_hash_calculator_.Update(*bytes_p, hash_len);
+    signed_hash_calculator_.Update(*bytes_p, hash_len);
+  }
+  *bytes_p += hash_len;
+  *count_p -= hash_len;
+  operation_data_hashed_ += hash_len;
+  if (operation_data_hashed_ < data_length)
+    return false;
+  buffer_offset_ += data_length;
+  operation_data_hashed_ = 0;
+  return true;
+}
+
 bool DeltaPerformer::PrimeUpdateState() {
   CHECK(manifest_valid_);
 
   int64_t next_operation = kUpdateStateOperationInvalid;
   if (!prefs_->GetInt64(kPrefsUpdateStateNextOperation, &next_operation) ||
       next_operation == kUpdateStateOperationInvalid || next_operation <= 0) {
-    // Initiating a new update, no more state needs to be initialized.
+    // Initiating a new update, drop any operation data left over from a
+    // previous one. No more state needs to be initialized.
+    base::FilePath path;
+    if (GetPartialOperationDataPath(&path))
+      base::DeleteFile(path);
     return true;
   }
   next_operation_num_ = next_operation;
@@ -1459,9 +2325,11 @@ bool DeltaPerformer::PrimeUpdateState() {
       manifest_signature_size >= 0);
   metadata_signature_size_ = manifest_signature_size;
 
+  LoadPartialOperationData();
+
   // Advance the download progress to reflect what doesn't need to be
   // re-downloaded.
-  total_bytes_received_ += buffer_offset_;
+  total_bytes_received_ += buffer_offset_ + buffer_.size();
 
   // Speculatively count the resume as a failure.
   int64_t resumed_update_failures{};
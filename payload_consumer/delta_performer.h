@@ -19,12 +19,18 @@
 
 #include <inttypes.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <android-base/unique_fd.h>
+#include <base/files/file_path.h>
+#include <base/threading/simple_thread.h>
 #include <base/time/time.h>
 #include <brillo/secure_blob.h>
 #include <google/protobuf/repeated_field.h>
@@ -63,6 +69,22 @@ class DeltaPerformer : public FileWriter {
   static const unsigned kProgressDownloadWeight;
   static const unsigned kProgressOperationsWeight;
   static const uint64_t kCheckpointFrequencySeconds;
+  // Operations with at least this much data have their partially downloaded
+  // data persisted, so they don't need to be downloaded again from the start
+  // when the update is interrupted.
+  static const uint64_t kMinPartialOperationDataSize;
+  // Maximum number of consecutive operations without data applied at once,
+  // between two checks for cancellation and checkpoints.
+  static const size_t kMaxNonDataOperationBatchSize;
+  // Maximum size of the operation data read into memory at once by the
+  // threads applying partitions in parallel. A larger operation is only read
+  // when no other data is in memory.
+  static const uint64_t kMaxParallelApplyDataSize;
+  // Maximum amount of operation data, and number of operations, between two
+  // positions at which the threads applying partitions in parallel checkpoint
+  // their writers.
+  static const uint64_t kParallelCheckpointDataInterval;
+  static const size_t kParallelCheckpointOperationInterval;
 
   DeltaPerformer(
       PrefsInterface* prefs,
@@ -83,6 +105,7 @@ class DeltaPerformer : public FileWriter {
         interactive_(interactive) {
     CHECK(install_plan_);
   }
+  ~DeltaPerformer() override;
 
   // FileWriter's Write implementation where caller doesn't care about
   // error codes.
@@ -108,6 +131,12 @@ class DeltaPerformer : public FileWriter {
   // or -errno on error.
   int CloseCurrentPartition();
 
+  // Tells |writer| that all the operations of partition |partition_index| were
+  // sent to it, and records in the install plan the hash of the data it wrote,
+  // if any.
+  bool FinishPartitionInstallOps(size_t partition_index,
+                                 PartitionWriterInterface* writer);
+
   // Returns |true| only if the manifest has been processed and it's valid.
   bool IsManifestValid();
 
@@ -157,6 +186,28 @@ class DeltaPerformer : public FileWriter {
   MetadataParseResult ParsePayloadMetadata(const brillo::Blob& payload,
                                            ErrorCode* error);
 
+  // Tells the performer that the payload being written is also readable from
+  // |fd|, starting at |offset|. Partitions are then applied in parallel, each
+  // one on its own thread reading its operations' data from |fd|, while
+  // Write() only hashes the payload. The operation data is so read twice, once
+  // through Write() to hash the whole payload and once from |fd| to apply it,
+  // since the payload hash needs all of it in order; the second read only
+  // hits the page cache if the payload fits in it. Must be called before the
+  // manifest is written.
+  void SetLocalPayload(android::base::unique_fd fd, uint64_t offset);
+
+  // Checkpoints the partitions applied in parallel so far and returns whether
+  // they are all done, in which case they are closed. Also returns true, with
+  // |*error| set, if any of them failed. Returns true right away if there are
+  // none. Doesn't block; to be called periodically once the whole payload was
+  // written, until it returns true.
+  bool PollParallelApply(ErrorCode* error);
+
+  // Returns whether partitions are applied in parallel, in which case the
+  // payload is written ahead of being applied and |*bytes_applied| is set to
+  // the size of the part of the payload applied so far.
+  bool GetParallelApplyProgress(uint64_t* bytes_applied) const;
+
   void set_public_key_path(const std::string& public_key_path) {
     public_key_path_ = public_key_path;
   }
@@ -207,8 +258,23 @@ class DeltaPerformer : public FileWriter {
   friend class DeltaPerformerIntegrationTest;
   FRIEND_TEST(DeltaPerformerTest, BrilloMetadataSignatureSizeTest);
   FRIEND_TEST(DeltaPerformerTest, BrilloParsePayloadMetadataTest);
+  FRIEND_TEST(DeltaPerformerTest, FullPayloadParallelApplyTest);
+  FRIEND_TEST(DeltaPerformerTest, ParallelApplyCheckpointTest);
   FRIEND_TEST(DeltaPerformerTest, UsePublicKeyFromResponse);
 
+  // A partition applied on its own thread. Defined in the .cc file.
+  class ParallelPartition;
+
+  // A point of the payload an update can be resumed from: the operation
+  // |operation_num|, whose data starts at |data_offset|, and the contexts of
+  // |payload_hash_calculator_| and |signed_hash_calculator_| there.
+  struct PayloadPosition {
+    size_t operation_num{0};
+    uint64_t data_offset{0};
+    std::string hash_context;
+    std::string signed_hash_context;
+  };
+
   // Obtain the operation index for current partition. If all operations for
   // current partition is are finished, return # of operations. This is mostly
   // intended to be used by CheckpointUpdateProgress, where partition writer
@@ -226,6 +292,70 @@ class DeltaPerformer : public FileWriter {
   // and returns this number.
   size_t CopyDataToBuffer(const char** bytes_p, size_t* count_p, size_t max);
 
+  // Returns the number of operations applied so far, used for progress.
+  size_t GetNumAppliedOperations() const;
+
+  // Creates the writer for the partition at |partition_index| in
+  // |partitions_|, without initializing it.
+  std::unique_ptr<PartitionWriterInterface> CreateWriterForPartition(
+      size_t partition_index);
+
+  // Creates and initializes the writers of all the remaining partitions and
+  // starts applying them in parallel. Returns false on failure, setting
+  // |*error|.
+  bool StartParallelApply(ErrorCode* error);
+
+  // Records the current payload position as the beginning of the partition
+  // at |partition_index| if it's applied in parallel, so it can be
+  // checkpointed once all the partitions before it are applied.
+  void RecordParallelPartitionStart(size_t partition_index);
+
+  // Asks the thread applying the current partition to checkpoint its writer
+  // at the current payload position, the start of the next operation, if it
+  // didn't start applying that operation yet and the position is far enough
+  // from the last one, see kParallelCheckpointDataInterval. The hash contexts
+  // are only known where the payload is hashed, so the positions are recorded
+  // here, usually well ahead of the thread, and the thread makes each one its
+  // partition's checkpoint as it reaches it.
+  void RequestParallelCheckpoint();
+
+  // Checkpoints the latest position of the payload before which all the
+  // partitions applied in parallel are applied. Returns false if any of them
+  // failed, setting |*error|.
+  bool CheckParallelApply(ErrorCode* error);
+
+  // Closes the partitions applied in parallel once they are all done.
+  // Returns false on failure, setting |*error|.
+  bool FinishParallelApply(ErrorCode* error);
+
+  // Stops applying partitions in parallel and closes them, checkpointing the
+  // progress made. Returns 0 on success or -errno on error.
+  int StopParallelApply();
+
+  // Makes the threads applying partitions in parallel stop early and waits
+  // for them.
+  void StopParallelApplyThreads();
+
+  // Applies the operations of |partition| reading their data from the local
+  // payload. Runs on a thread of |parallel_apply_pool_|.
+  ErrorCode ApplyParallelPartition(ParallelPartition* partition);
+
+  // Waits until |size| more bytes of operation data fit in
+  // kMaxParallelApplyDataSize and accounts for them, or until the threads are
+  // stopped, in which case it returns false. ReleaseParallelApplyData() gives
+  // them back.
+  bool ReserveParallelApplyData(uint64_t size);
+  void ReleaseParallelApplyData(uint64_t size);
+
+  // Hashes up to |*count_p| bytes from |*bytes_p| as the data of the next
+  // operation, up to its |data_length|, without buffering them. Advances
+  // |*bytes_p| and decreases |*count_p| by the number of bytes hashed. Returns
+  // whether all the data of the operation was hashed, in which case
+  // |buffer_offset_| is moved past it.
+  bool HashOperationData(const char** bytes_p,
+                         size_t* count_p,
+                         uint64_t data_length);
+
   // If |op_result| is false, emits an error message using |op_type_name| and
   // sets |*error| accordingly. Otherwise does nothing. Returns |op_result|.
   bool HandleOpResult(bool op_result,
@@ -249,11 +379,31 @@ class DeltaPerformer : public FileWriter {
   // Validates that the hash of the blobs corresponding to the given |operation|
   // matches what's specified in the manifest in the payload.
   // Returns ErrorCode::kSuccess on match or a suitable error code otherwise.
+  // The data in |buffer_| is hashed for the payload hashes in the same pass,
+  // so DiscardBuffer() doesn't hash it again.
   ErrorCode ValidateOperationHash(const InstallOperation& operation);
+  // Same as above for the data of |operation| in |data|. |operation_num| is
+  // only used for logging.
+  ErrorCode ValidateOperationHash(const InstallOperation& operation,
+                                  const uint8_t* data,
+                                  size_t operation_num) const;
+  // Checks the |calculated_op_hash| of the data of |operation| against the
+  // manifest. |calculated_op_hash| is ignored if the operation has no hash.
+  ErrorCode CheckOperationHash(const InstallOperation& operation,
+                               const brillo::Blob& calculated_op_hash,
+                               size_t operation_num) const;
 
   // Returns true on success.
   bool PerformInstallOperation(const InstallOperation& operation);
 
+  // Applies the operations without data starting at |next_operation_num_| in
+  // the current partition, up to kMaxNonDataOperationBatchSize of them, and
+  // advances |next_operation_num_| past them. Consecutive ZERO or DISCARD
+  // operations are applied as one, consecutive SOURCE_COPY operations as a
+  // batch, and the ones in |noop_operations_| only verify their source, if
+  // they have a source hash. Returns false on failure, setting |*error|.
+  bool PerformNonDataOperations(ErrorCode* error);
+
   // These perform a specific type of operation and return true on success.
   // |error| will be set if source hash mismatch, otherwise |error| might not be
   // set even if it fails.
@@ -261,6 +411,9 @@ class DeltaPerformer : public FileWriter {
   bool PerformZeroOrDiscardOperation(const InstallOperation& operation);
   bool PerformSourceCopyOperation(const InstallOperation& operation,
                                   ErrorCode* error);
+  bool PerformSourceCopyOperations(
+      const std::vector<const InstallOperation*>& operations,
+      ErrorCode* error);
   bool PerformDiffOperation(const InstallOperation& operation,
                             ErrorCode* error);
 
@@ -271,11 +424,42 @@ class DeltaPerformer : public FileWriter {
 
   // Updates the payload hash calculator with the bytes in |buffer_|, also
   // updates the signed hash calculator with the first |signed_hash_buffer_size|
-  // bytes in |buffer_|. Then discard the content, ensuring that memory is being
+  // bytes in |buffer_|, skipping the first |buffer_hashed_size_| bytes already
+  // hashed. Then discard the content, ensuring that memory is being
   // deallocated. If |do_advance_offset|, advances the internal offset counter
   // accordingly.
   void DiscardBuffer(bool do_advance_offset, size_t signed_hash_buffer_size);
 
+  // Returns the operation at index |operation_num|, which must be less than
+  // |num_total_operations_|.
+  const InstallOperation& GetOperation(size_t operation_num) const;
+
+  // Returns the operation at index |next_operation_num_|.
+  const InstallOperation& GetNextOperation() const;
+
+  // Returns the position of the payload where the data of the operation at
+  // |next_operation_num_| starts.
+  PayloadPosition GetPayloadPosition() const;
+
+  // Persists |position| as the update progress, to resume the update from
+  // after a reboot. All the operations before it must have been applied.
+  bool SaveUpdateProgress(const PayloadPosition& position);
+
+  // Appends the data of the next operation received since the last call to
+  // the partial operation data file and records its size and hash in prefs,
+  // if the operation is large enough. Returns whether the data was persisted.
+  bool CheckpointPartialOperationData();
+
+  // Sets |path| to the file where partial operation data is persisted.
+  // Returns false if there's no non-volatile directory to store it in.
+  bool GetPartialOperationDataPath(base::FilePath* path) const;
+
+  // Loads the data persisted by CheckpointPartialOperationData() into
+  // |buffer_| when resuming an update. Data that doesn't match the next
+  // operation or its recorded size and hash is discarded, so the operation is
+  // downloaded again from its start.
+  void LoadPartialOperationData();
+
   // Primes the required update state. Returns true if the update state was
   // successfully initialized to a saved resume state or if the update is a new
   // update. Returns false otherwise.
@@ -373,6 +557,15 @@ class DeltaPerformer : public FileWriter {
   // Last |next_operation_num_| value updated as part of the progress update.
   uint64_t last_updated_operation_num_{std::numeric_limits<uint64_t>::max()};
 
+  // Number of bytes at the beginning of |buffer_| persisted in the partial
+  // operation data file for the next operation.
+  size_t partial_operation_data_persisted_{0};
+  // The context of the hash of the persisted data.
+  std::string partial_operation_data_hash_context_;
+  // Whether the partial operation data file holds data of an operation that
+  // was already applied, and can be deleted at the next checkpoint.
+  bool partial_operation_data_stale_{false};
+
   // The block size (parsed from the manifest).
   uint32_t block_size_{0};
 
@@ -384,6 +577,17 @@ class DeltaPerformer : public FileWriter {
   // the metadata and doesn't include the payload signature itself.
   HashCalculator signed_hash_calculator_;
 
+  // Number of bytes at the beginning of |buffer_| already added to
+  // |payload_hash_calculator_| and |signed_hash_calculator_|.
+  size_t buffer_hashed_size_{0};
+  // Number of bytes of the data of the next operation hashed by
+  // HashOperationData() so far.
+  uint64_t operation_data_hashed_{0};
+
+  // The CPU time spent by all threads hashing payload data since the update
+  // started or resumed, in nanoseconds.
+  mutable std::atomic<int64_t> hashing_cpu_time_ns_{0};
+
   // Signatures message blob extracted directly from the payload.
   std::string signatures_message_data_;
 
@@ -422,6 +626,43 @@ class DeltaPerformer : public FileWriter {
 
   std::unique_ptr<PartitionWriterInterface> partition_writer_;
 
+  // Whether each operation of the current partition writes nothing on this
+  // device, as planned by OpenCurrentPartition(), and the number of them and
+  // of their blocks elided so far.
+  std::vector<bool> noop_operations_;
+  size_t num_elided_operations_{0};
+  uint64_t num_elided_blocks_{0};
+
+  // The payload set by SetLocalPayload(), and its offset in the file.
+  android::base::unique_fd local_payload_fd_;
+  uint64_t local_payload_offset_{0};
+
+  // The partitions applied in parallel, in manifest order, and the threads
+  // applying them. Empty unless applying partitions in parallel.
+  std::vector<std::unique_ptr<ParallelPartition>> parallel_partitions_;
+  std::unique_ptr<base::DelegateSimpleThreadPool> parallel_apply_pool_;
+  // Number of |parallel_partitions_| whose start was recorded by
+  // RecordParallelPartitionStart(), and number of them applied in order.
+  size_t parallel_partitions_started_{0};
+  size_t parallel_partitions_applied_{0};
+  // Set to make the threads stop early, on failure or on Close().
+  std::atomic<bool> parallel_apply_stopped_{false};
+  // Number of operations, and size of the payload, applied when applying
+  // partitions in parallel, including what was applied before.
+  std::atomic<size_t> num_parallel_applied_operations_{0};
+  std::atomic<uint64_t> parallel_applied_payload_size_{0};
+  // Guards the checkpoints of |parallel_partitions_| and
+  // |parallel_apply_data_size_|, the size of the operation data the threads
+  // hold in memory. Signaled whenever that data is released.
+  std::mutex parallel_apply_mutex_;
+  std::condition_variable parallel_apply_cv_;
+  uint64_t parallel_apply_data_size_{0};
+  // The intervals between the positions requested by
+  // RequestParallelCheckpoint().
+  uint64_t parallel_checkpoint_data_interval_{kParallelCheckpointDataInterval};
+  size_t parallel_checkpoint_operation_interval_{
+      kParallelCheckpointOperationInterval};
+
   DISALLOW_COPY_AND_ASSIGN(DeltaPerformer);
 };
 
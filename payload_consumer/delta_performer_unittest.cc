@@ -17,15 +17,19 @@
 #include "update_engine/payload_consumer/delta_performer.h"
 
 #include <endian.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <android-base/unique_fd.h>
 #include <base/files/file_path.h>
 #include <base/files/file_util.h>
 #include <base/files/scoped_temp_dir.h>
@@ -33,6 +37,7 @@
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/threading/platform_thread.h>
 #include <brillo/secure_blob.h>
 #include <gmock/gmock.h>
 #include <google/protobuf/repeated_field.h>
@@ -314,6 +319,8 @@ class DeltaPerformerTest : public ::testing::Test {
 
     EXPECT_EQ(expect_success,
               delta_performer->Write(payload_data.data(), payload_data.size()));
+    if (expect_success)
+      WaitForParallelApply(delta_performer);
     EXPECT_EQ(0, performer_.Close());
 
     brillo::Blob partition_data;
@@ -321,6 +328,15 @@ class DeltaPerformerTest : public ::testing::Test {
     return partition_data;
   }
 
+  // Waits for the partitions |delta_performer| applies in parallel, if any, to
+  // be applied successfully.
+  void WaitForParallelApply(DeltaPerformer* delta_performer) {
+    ErrorCode error{};
+    while (!delta_performer->PollParallelApply(&error))
+      base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(1));
+    EXPECT_EQ(ErrorCode::kSuccess, error);
+  }
+
   // Calls delta performer's Write method by pretending to pass in bytes from a
   // delta file whose metadata size is actual_metadata_size and tests if all
   // checks are correctly performed if the install plan contains
@@ -467,6 +483,35 @@ TEST_F(DeltaPerformerTest, FullPayloadWriteTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, FullPayloadParallelApplyTest) {
+  payload_.type = InstallPayloadType::kFull;
+  brillo::Blob expected_data(4096 * 2);  // 2 blocks
+  test_utils::FillWithData(&expected_data);
+  vector<AnnotatedOperation> aops(2);
+  for (size_t i = 0; i < aops.size(); i++) {
+    *(aops[i].op.add_dst_extents()) = ExtentForRange(i, 1);
+    aops[i].op.set_data_offset(i * 4096);
+    aops[i].op.set_data_length(4096);
+    aops[i].op.set_type(InstallOperation::REPLACE);
+  }
+
+  brillo::Blob payload_data = GeneratePayload(expected_data,
+                                              aops,
+                                              false,
+                                              kBrilloMajorPayloadVersion,
+                                              kFullPayloadMinorVersion);
+  ScopedTempFile payload_file("Payload-XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(payload_file.path(), payload_data));
+  android::base::unique_fd payload_fd(
+      open(payload_file.path().c_str(), O_RDONLY | O_CLOEXEC));
+  ASSERT_TRUE(payload_fd.ok());
+  performer_.SetLocalPayload(std::move(payload_fd), 0);
+
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  EXPECT_EQ(performer_.num_total_operations_,
+            performer_.GetNumAppliedOperations());
+}
+
 TEST_F(DeltaPerformerTest, ShouldCancelTest) {
   payload_.type = InstallPayloadType::kFull;
   brillo::Blob expected_data =
@@ -1197,4 +1242,319 @@ TEST_F(DeltaPerformerTest, SetNextOpIndex) {
   ASSERT_EQ(indices[indices.size() - 1], 2UL);
 }
 
+TEST_F(DeltaPerformerTest, NonDataOperationsBatchTest) {
+  TestDeltaPerformer delta_performer{&prefs_,
+                                     &fake_boot_control_,
+                                     &fake_hardware_,
+                                     &mock_delegate_,
+                                     &install_plan_,
+                                     &payload_,
+                                     false};
+  brillo::Blob source_data(4096 * 4);
+  test_utils::FillWithData(&source_data);
+  ScopedTempFile source("Source-XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(source.path(), source_data));
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = source_data.size();
+
+  // Two in place SOURCE_COPY operations, only the second one with a source
+  // hash, two ZERO operations and a SOURCE_COPY moving a block.
+  vector<AnnotatedOperation> aops(5);
+  for (size_t i = 0; i < aops.size(); i++) {
+    InstallOperation& op = aops[i].op;
+    const uint64_t block = i < 4 ? i : 3;
+    *op.add_dst_extents() = ExtentForRange(block, 1);
+    if (i == 2 || i == 3) {
+      op.set_type(InstallOperation::ZERO);
+      continue;
+    }
+    op.set_type(InstallOperation::SOURCE_COPY);
+    *op.add_src_extents() = ExtentForRange(i == 4 ? 2 : block, 1);
+    if (i > 0)
+      op.set_src_sha256_hash("hash");
+  }
+  brillo::Blob payload_data =
+      GeneratePayload(brillo::Blob(), aops, false, &old_part);
+
+  delta_performer.partition_writers_[kPartitionNameRoot] =
+      std::make_unique<MockPartitionWriter>();
+  auto& writer = *delta_performer.partition_writers_[kPartitionNameRoot];
+  std::vector<size_t> indices;
+  EXPECT_CALL(writer, CheckpointUpdateProgress(_))
+      .WillRepeatedly([&indices](size_t index) { indices.push_back(index); });
+  EXPECT_CALL(writer, Init(_, true, _)).WillOnce(Return(true));
+  EXPECT_CALL(writer, IsNoOpOperation(_))
+      .WillRepeatedly([](const InstallOperation& op) {
+        return op.type() == InstallOperation::SOURCE_COPY &&
+               op.src_extents(0).start_block() ==
+                   op.dst_extents(0).start_block();
+      });
+  // Only the in place operation with a source hash is verified.
+  EXPECT_CALL(writer, PerformSourceCopyOperation(_, _))
+      .Times(2)
+      .WillRepeatedly(Return(true));
+  // The ZERO operations are applied at once.
+  EXPECT_CALL(writer, PerformZeroOrDiscardOperation(_))
+      .WillOnce([](const InstallOperation& op) {
+        return op.type() == InstallOperation::ZERO &&
+               op.dst_extents_size() == 2;
+      });
+
+  ApplyPayloadToData(&delta_performer, payload_data, source.path(), {}, true);
+  // A single checkpoint for the operations after the partition is opened.
+  EXPECT_EQ((std::vector<size_t>{0, 5}), indices);
+}
+
+TEST_F(DeltaPerformerTest, ResumeWithPartialOperationData) {
+  base::ScopedTempDir non_volatile_dir;
+  ASSERT_TRUE(non_volatile_dir.CreateUniqueTempDir());
+  fake_hardware_.SetNonVolatileDirectory(non_volatile_dir.GetPath());
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameRoot, install_plan_.target_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+
+  // A small operation followed by one large enough to persist its data.
+  const size_t kSmallOpSize = 4096;
+  const size_t kLargeOpSize = DeltaPerformer::kMinPartialOperationDataSize;
+  brillo::Blob blob(kSmallOpSize + kLargeOpSize);
+  test_utils::FillWithData(&blob);
+  AnnotatedOperation small_aop;
+  *(small_aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  small_aop.op.set_data_offset(0);
+  small_aop.op.set_data_length(kSmallOpSize);
+  small_aop.op.set_type(InstallOperation::REPLACE);
+  AnnotatedOperation large_aop;
+  *(large_aop.op.add_dst_extents()) =
+      ExtentForRange(1, kLargeOpSize / kBlockSize);
+  large_aop.op.set_data_offset(kSmallOpSize);
+  large_aop.op.set_data_length(kLargeOpSize);
+  large_aop.op.set_type(InstallOperation::REPLACE);
+
+  payload_.type = InstallPayloadType::kFull;
+  brillo::Blob payload_data = GeneratePayload(blob,
+                                              {small_aop, large_aop},
+                                              false,
+                                              kBrilloMajorPayloadVersion,
+                                              kFullPayloadMinorVersion);
+  payload_.size = payload_data.size();
+  const size_t data_start = payload_.metadata_size;
+  const size_t interrupt_offset = data_start + kSmallOpSize + kLargeOpSize / 4;
+
+  // Interrupt the update a quarter of the way into the large operation.
+  {
+    TestDeltaPerformer delta_performer{&prefs_,
+                                       &fake_boot_control_,
+                                       &fake_hardware_,
+                                       &mock_delegate_,
+                                       &install_plan_,
+                                       &payload_,
+                                       false};
+    delta_performer.partition_writers_[kPartitionNameRoot] =
+        std::make_unique<MockPartitionWriter>();
+    auto& writer = *delta_performer.partition_writers_[kPartitionNameRoot];
+    EXPECT_CALL(writer, Init(_, _, 0)).WillOnce(Return(true));
+    EXPECT_CALL(writer, PerformReplaceOperation(_, _, kSmallOpSize))
+        .WillOnce(Return(true));
+    ASSERT_TRUE(delta_performer.Write(payload_data.data(), interrupt_offset));
+    delta_performer.Close();
+  }
+
+  int64_t value = 0;
+  ASSERT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &value));
+  EXPECT_EQ(1, value);
+  ASSERT_TRUE(
+      prefs_.GetInt64(kPrefsUpdateStatePartialOperationDataSize, &value));
+  EXPECT_EQ(static_cast<int64_t>(kLargeOpSize / 4), value);
+
+  // Resume the update, only downloading the rest of the large operation.
+  install_plan_.is_resume = true;
+  TestDeltaPerformer delta_performer{&prefs_,
+                                     &fake_boot_control_,
+                                     &fake_hardware_,
+                                     &mock_delegate_,
+                                     &install_plan_,
+                                     &payload_,
+                                     false};
+  delta_performer.partition_writers_[kPartitionNameRoot] =
+      std::make_unique<MockPartitionWriter>();
+  auto& writer = *delta_performer.partition_writers_[kPartitionNameRoot];
+  const brillo::Blob large_op_data(blob.begin() + kSmallOpSize, blob.end());
+  EXPECT_CALL(writer, Init(_, _, 1)).WillOnce(Return(true));
+  EXPECT_CALL(writer, PerformReplaceOperation(_, _, kLargeOpSize))
+      .WillOnce([&large_op_data](const InstallOperation& operation,
+                                 const void* data,
+                                 size_t count) {
+        const uint8_t* begin = static_cast<const uint8_t*>(data);
+        return brillo::Blob(begin, begin + count) == large_op_data;
+      });
+  ASSERT_TRUE(delta_performer.Write(payload_data.data(), data_start));
+  ASSERT_TRUE(delta_performer.Write(payload_data.data() + interrupt_offset,
+                                    payload_data.size() - interrupt_offset));
+  EXPECT_EQ(0, delta_performer.Close());
+  EXPECT_FALSE(base::PathExists(
+      non_volatile_dir.GetPath().Append("partial_operation_data")));
+}
+
+TEST_F(DeltaPerformerTest, ResumeWithTruncatedPartialOperationData) {
+  base::ScopedTempDir non_volatile_dir;
+  ASSERT_TRUE(non_volatile_dir.CreateUniqueTempDir());
+  fake_hardware_.SetNonVolatileDirectory(non_volatile_dir.GetPath());
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameRoot, install_plan_.target_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+
+  const size_t kSmallOpSize = 4096;
+  const size_t kLargeOpSize = DeltaPerformer::kMinPartialOperationDataSize;
+  brillo::Blob blob(kSmallOpSize + kLargeOpSize);
+  test_utils::FillWithData(&blob);
+  AnnotatedOperation small_aop;
+  *(small_aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  small_aop.op.set_data_offset(0);
+  small_aop.op.set_data_length(kSmallOpSize);
+  small_aop.op.set_type(InstallOperation::REPLACE);
+  AnnotatedOperation large_aop;
+  *(large_aop.op.add_dst_extents()) =
+      ExtentForRange(1, kLargeOpSize / kBlockSize);
+  large_aop.op.set_data_offset(kSmallOpSize);
+  large_aop.op.set_data_length(kLargeOpSize);
+  large_aop.op.set_type(InstallOperation::REPLACE);
+
+  payload_.type = InstallPayloadType::kFull;
+  brillo::Blob payload_data = GeneratePayload(blob,
+                                              {small_aop, large_aop},
+                                              false,
+                                              kBrilloMajorPayloadVersion,
+                                              kFullPayloadMinorVersion);
+  payload_.size = payload_data.size();
+  const size_t data_start = payload_.metadata_size;
+  const size_t interrupt_offset = data_start + kSmallOpSize + kLargeOpSize / 4;
+  {
+    TestDeltaPerformer delta_performer{&prefs_,
+                                       &fake_boot_control_,
+                                       &fake_hardware_,
+                                       &mock_delegate_,
+                                       &install_plan_,
+                                       &payload_,
+                                       false};
+    delta_performer.partition_writers_[kPartitionNameRoot] =
+        std::make_unique<MockPartitionWriter>();
+    auto& writer = *delta_performer.partition_writers_[kPartitionNameRoot];
+    EXPECT_CALL(writer, Init(_, _, 0)).WillOnce(Return(true));
+    EXPECT_CALL(writer, PerformReplaceOperation(_, _, kSmallOpSize))
+        .WillOnce(Return(true));
+    ASSERT_TRUE(delta_performer.Write(payload_data.data(), interrupt_offset));
+    delta_performer.Close();
+  }
+
+  // Lose the end of the persisted data.
+  const base::FilePath partial_data_path =
+      non_volatile_dir.GetPath().Append("partial_operation_data");
+  ASSERT_EQ(0, truncate(partial_data_path.value().c_str(), kLargeOpSize / 8));
+
+  // The update still resumes, downloading the large operation from its start.
+  install_plan_.is_resume = true;
+  TestDeltaPerformer delta_performer{&prefs_,
+                                     &fake_boot_control_,
+                                     &fake_hardware_,
+                                     &mock_delegate_,
+                                     &install_plan_,
+                                     &payload_,
+                                     false};
+  delta_performer.partition_writers_[kPartitionNameRoot] =
+      std::make_unique<MockPartitionWriter>();
+  auto& writer = *delta_performer.partition_writers_[kPartitionNameRoot];
+  EXPECT_CALL(writer, Init(_, _, 1)).WillOnce(Return(true));
+  EXPECT_CALL(writer, PerformReplaceOperation(_, _, kLargeOpSize))
+      .WillOnce(Return(true));
+  ASSERT_TRUE(delta_performer.Write(payload_data.data(), data_start));
+  int64_t value = -1;
+  ASSERT_TRUE(
+      prefs_.GetInt64(kPrefsUpdateStatePartialOperationDataSize, &value));
+  EXPECT_EQ(0, value);
+  EXPECT_FALSE(base::PathExists(partial_data_path));
+  const size_t resume_offset = data_start + kSmallOpSize;
+  ASSERT_TRUE(delta_performer.Write(payload_data.data() + resume_offset,
+                                    payload_data.size() - resume_offset));
+  EXPECT_EQ(0, delta_performer.Close());
+}
+
+TEST_F(DeltaPerformerTest, ParallelApplyCheckpointTest) {
+  TestDeltaPerformer delta_performer{&prefs_,
+                                     &fake_boot_control_,
+                                     &fake_hardware_,
+                                     &mock_delegate_,
+                                     &install_plan_,
+                                     &payload_,
+                                     false};
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameRoot, install_plan_.target_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+
+  payload_.type = InstallPayloadType::kFull;
+  brillo::Blob blob(kBlockSize * 2);
+  test_utils::FillWithData(&blob);
+  vector<AnnotatedOperation> aops(2);
+  for (size_t i = 0; i < aops.size(); i++) {
+    *(aops[i].op.add_dst_extents()) = ExtentForRange(i, 1);
+    aops[i].op.set_data_offset(i * kBlockSize);
+    aops[i].op.set_data_length(kBlockSize);
+    aops[i].op.set_type(InstallOperation::REPLACE);
+  }
+  brillo::Blob payload_data = GeneratePayload(blob,
+                                              aops,
+                                              false,
+                                              kBrilloMajorPayloadVersion,
+                                              kFullPayloadMinorVersion);
+  payload_.size = payload_data.size();
+  ScopedTempFile payload_file("Payload-XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(payload_file.path(), payload_data));
+  android::base::unique_fd payload_fd(
+      open(payload_file.path().c_str(), O_RDONLY | O_CLOEXEC));
+  ASSERT_TRUE(payload_fd.ok());
+  delta_performer.SetLocalPayload(std::move(payload_fd), 0);
+  delta_performer.parallel_checkpoint_operation_interval_ = 1;
+
+  // The first operation is held until the whole payload is written, which
+  // requests a checkpoint at the second one, and the second one until that
+  // checkpoint is saved.
+  std::promise<void> payload_written;
+  std::promise<void> checkpoint_saved;
+  delta_performer.partition_writers_[kPartitionNameRoot] =
+      std::make_unique<MockPartitionWriter>();
+  auto& writer = *delta_performer.partition_writers_[kPartitionNameRoot];
+  EXPECT_CALL(writer, Init(_, _, 0)).WillOnce(Return(true));
+  EXPECT_CALL(writer, CheckpointUpdateProgress(1));
+  EXPECT_CALL(writer, PerformReplaceOperation(_, _, kBlockSize))
+      .WillOnce([future = payload_written.get_future().share()](
+                    const InstallOperation&, const void*, size_t) {
+        future.wait();
+        return true;
+      })
+      .WillOnce([future = checkpoint_saved.get_future().share()](
+                    const InstallOperation&, const void*, size_t) {
+        future.wait();
+        return true;
+      });
+
+  ASSERT_TRUE(delta_performer.Write(payload_data.data(), payload_data.size()));
+  payload_written.set_value();
+  ErrorCode error{};
+  int64_t next_operation = 0;
+  while (!prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation) ||
+         next_operation != 1) {
+    ASSERT_FALSE(delta_performer.PollParallelApply(&error));
+    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(1));
+  }
+  checkpoint_saved.set_value();
+  WaitForParallelApply(&delta_performer);
+  EXPECT_EQ(0, delta_performer.Close());
+  ASSERT_TRUE(prefs_.GetInt64(kPrefsUpdateStateNextOperation, &next_operation));
+  EXPECT_EQ(2, next_operation);
+}
+
 }  // namespace chromeos_update_engine
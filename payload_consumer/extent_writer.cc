@@ -17,7 +17,9 @@
 #include "update_engine/payload_consumer/extent_writer.h"
 
 #include <errno.h>
+#include <linux/fs.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -29,6 +31,25 @@ using std::min;
 
 namespace chromeos_update_engine {
 
+namespace {
+// Largest buffer of zeros passed to Write() when zeroing the blocks can't be
+// offloaded to the underlying storage.
+constexpr size_t kMaxZeroWriteSize = 1024 * 1024;  // 1 MiB
+
+// BLKZEROOUT and BLKDISCARD only accept ranges aligned to the sector size.
+constexpr uint64_t kSectorSize = 512;
+}  // namespace
+
+bool ExtentWriter::WriteZeros(size_t count, bool discard) {
+  while (count > 0) {
+    const size_t bytes_to_write = min(count, kMaxZeroWriteSize);
+    const auto zeros = utils::GetReadonlyZeroString(bytes_to_write);
+    TEST_AND_RETURN_FALSE(Write(zeros.data(), zeros.size()));
+    count -= bytes_to_write;
+  }
+  return true;
+}
+
 bool DirectExtentWriter::Write(const void* bytes, size_t count) {
   if (count == 0)
     return true;
@@ -45,12 +66,137 @@ bool DirectExtentWriter::Write(const void* bytes, size_t count) {
     TEST_AND_RETURN_FALSE(bytes_to_write > 0);
 
     if (cur_extent_->start_block() != kSparseHole) {
-      const off64_t offset =
+      const uint64_t offset =
           cur_extent_->start_block() * block_size_ + extent_bytes_written_;
-      TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset, SEEK_SET) !=
-                                  static_cast<off64_t>(-1));
       TEST_AND_RETURN_FALSE(
-          utils::WriteAll(fd_, c_bytes + bytes_written, bytes_to_write));
+          WriteAt(offset, c_bytes + bytes_written, bytes_to_write));
+    }
+    bytes_written += bytes_to_write;
+    extent_bytes_written_ += bytes_to_write;
+    if (bytes_remaining_cur_extent == bytes_to_write) {
+      // We filled this extent
+      CHECK_EQ(extent_bytes_written_, cur_extent_->num_blocks() * block_size_);
+      // move to next extent
+      extent_bytes_written_ = 0;
+      cur_extent_++;
+    }
+  }
+  if (cur_extent_ == extents_.end()) {
+    TEST_AND_RETURN_FALSE(Flush());
+  }
+  return true;
+}
+
+DirectExtentWriter::~DirectExtentWriter() {
+  // Writing the data here would hide a failure from the caller, which already
+  // considers it written, so make the loss visible instead.
+  LOG_IF(ERROR, !staged_writes_.empty())
+      << staging_buffer_.size()
+      << " staged bytes were never flushed and are lost.";
+}
+
+bool DirectExtentWriter::WriteAt(uint64_t offset,
+                                 const void* bytes,
+                                 size_t count) {
+  if (coalesce_size_ == 0) {
+    TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset, SEEK_SET) !=
+                                static_cast<off64_t>(-1));
+    return utils::WriteAll(fd_, bytes, count);
+  }
+  if (staging_buffer_.size() + count > coalesce_size_) {
+    TEST_AND_RETURN_FALSE(Flush());
+  }
+  if (count >= coalesce_size_) {
+    // Too large to be worth staging, write it in place.
+    struct iovec iov = {const_cast<void*>(bytes), count};
+    return utils::PWriteAll(fd_, &iov, 1, offset);
+  }
+  if (!staged_writes_.empty()) {
+    StagedWrite& last = staged_writes_.back();
+    if (last.offset + last.length == offset) {
+      last.length += count;
+    } else {
+      staged_writes_.push_back({offset, staging_buffer_.size(), count});
+    }
+  } else {
+    staged_writes_.push_back({offset, staging_buffer_.size(), count});
+  }
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  staging_buffer_.insert(staging_buffer_.end(), data, data + count);
+  return true;
+}
+
+bool DirectExtentWriter::Flush() {
+  if (staged_writes_.empty()) {
+    return true;
+  }
+  // Extents of an operation never overlap, so the staged writes can be
+  // reordered freely. Sorting them lets writes of blocks that are adjacent on
+  // disk, but not in the extent list, go out as one vectored write.
+  std::sort(staged_writes_.begin(),
+            staged_writes_.end(),
+            [](const StagedWrite& a, const StagedWrite& b) {
+              return a.offset < b.offset;
+            });
+  std::vector<struct iovec> iovs;
+  bool success = true;
+  for (size_t i = 0; i < staged_writes_.size() && success;) {
+    const uint64_t run_offset = staged_writes_[i].offset;
+    uint64_t run_end = run_offset;
+    iovs.clear();
+    for (; i < staged_writes_.size() && staged_writes_[i].offset == run_end;
+         i++) {
+      const StagedWrite& write = staged_writes_[i];
+      iovs.push_back(
+          {staging_buffer_.data() + write.buffer_offset, write.length});
+      run_end += write.length;
+    }
+    success = utils::PWriteAll(fd_, iovs.data(), iovs.size(), run_offset);
+  }
+  staged_writes_.clear();
+  staging_buffer_.clear();
+  return success;
+}
+
+bool DirectExtentWriter::ZeroRange(uint64_t offset,
+                                   uint64_t length,
+                                   bool discard) {
+#ifdef BLKZEROOUT
+  if (offset % kSectorSize != 0 || length % kSectorSize != 0)
+    return false;
+  int result = 0;
+  return fd_->BlkIoctl(
+             discard ? BLKDISCARD : BLKZEROOUT, offset, length, &result) &&
+         result == 0;
+#else   // !defined(BLKZEROOUT)
+  return false;
+#endif  // !defined(BLKZEROOUT)
+}
+
+bool DirectExtentWriter::WriteZeros(size_t count, bool discard) {
+  // The ioctls bypass |staging_buffer_|, so earlier writes must land first.
+  TEST_AND_RETURN_FALSE(Flush());
+  size_t bytes_written = 0;
+  while (bytes_written < count) {
+    TEST_AND_RETURN_FALSE(cur_extent_ != extents_.end());
+    uint64_t bytes_remaining_cur_extent =
+        cur_extent_->num_blocks() * block_size_ - extent_bytes_written_;
+    CHECK_NE(bytes_remaining_cur_extent, static_cast<uint64_t>(0));
+    size_t bytes_to_write =
+        static_cast<size_t>(min(static_cast<uint64_t>(count - bytes_written),
+                                bytes_remaining_cur_extent));
+    TEST_AND_RETURN_FALSE(bytes_to_write > 0);
+
+    if (cur_extent_->start_block() != kSparseHole) {
+      const uint64_t offset =
+          cur_extent_->start_block() * block_size_ + extent_bytes_written_;
+      if (!ZeroRange(offset, bytes_to_write, discard)) {
+        // Write() picks up from the current position, so let it write the
+        // zeros for the rest of this extent.
+        TEST_AND_RETURN_FALSE(ExtentWriter::WriteZeros(bytes_to_write, discard));
+        bytes_written += bytes_to_write;
+        continue;
+      }
     }
     bytes_written += bytes_to_write;
     extent_bytes_written_ += bytes_to_write;
@@ -19,6 +19,7 @@
 
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include <base/logging.h>
 #include <brillo/secure_blob.h>
@@ -43,6 +44,18 @@ class ExtentWriter {
 
   // Returns true on success.
   virtual bool Write(const void* bytes, size_t count) = 0;
+
+  // Writes |count| bytes of zeros, as if Write() was called with a zero-filled
+  // buffer of that size. If |discard| is true, the blocks are allowed to read
+  // back as undefined data afterwards. Implementations should override this to
+  // zero the blocks without moving any data through memory; the default
+  // implementation falls back to Write(). Returns true on success.
+  virtual bool WriteZeros(size_t count, bool discard);
+
+  // Writes out the data the writer, or the writers it wraps, still hold in
+  // memory. Must be called once the operation is written: data still held
+  // when the writer is destroyed is lost. Returns true on success.
+  virtual bool Flush() { return true; }
 };
 
 // DirectExtentWriter is probably the simplest ExtentWriter implementation.
@@ -51,20 +64,50 @@ class ExtentWriter {
 class DirectExtentWriter : public ExtentWriter {
  public:
   explicit DirectExtentWriter(FileDescriptorPtr fd) : fd_(fd) {}
-  ~DirectExtentWriter() override = default;
+  // With a non-zero |coalesce_size|, up to that many bytes of writes are staged
+  // in memory and then submitted sorted by offset, with writes to adjacent
+  // ranges merged into a single vectored write. Staged data is flushed once
+  // all extents are written, otherwise Flush() must be called.
+  DirectExtentWriter(FileDescriptorPtr fd, size_t coalesce_size)
+      : fd_(fd), coalesce_size_(coalesce_size) {}
+  ~DirectExtentWriter() override;
 
   bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
             uint32_t block_size) override {
+    TEST_AND_RETURN_FALSE(Flush());
     block_size_ = block_size;
     extents_ = extents;
     cur_extent_ = extents_.begin();
     return true;
   }
   bool Write(const void* bytes, size_t count) override;
+  // Uses BLKZEROOUT/BLKDISCARD on block devices and FALLOC_FL_PUNCH_HOLE on
+  // regular files, falling back to writing zeros if neither is supported.
+  bool WriteZeros(size_t count, bool discard) override;
+  // Submits all staged writes to |fd_|.
+  bool Flush() override;
 
  private:
+  // Zeroes |length| bytes at byte |offset| of |fd_| without writing any data.
+  // Returns false if the underlying file doesn't support it.
+  bool ZeroRange(uint64_t offset, uint64_t length, bool discard);
+
+  // Writes |count| bytes at byte |offset| of |fd_|, or stages them if
+  // coalescing is enabled.
+  bool WriteAt(uint64_t offset, const void* bytes, size_t count);
+
   FileDescriptorPtr fd_{nullptr};
 
+  // A write held in |staging_buffer_| until the next Flush().
+  struct StagedWrite {
+    uint64_t offset;
+    size_t buffer_offset;
+    size_t length;
+  };
+  const size_t coalesce_size_{0};
+  brillo::Blob staging_buffer_;
+  std::vector<StagedWrite> staged_writes_;
+
   size_t block_size_{0};
   // Bytes written into |cur_extent_| thus far.
   uint64_t extent_bytes_written_{0};
@@ -137,6 +137,59 @@ void ExtentWriterTest::WriteAlignedExtents(size_t chunk_size,
   ExpectVectorsEq(expected_file, result_file);
 }
 
+TEST_F(ExtentWriterTest, CoalescedWriteTest) {
+  vector<Extent> extents = {ExtentForRange(3, 1),
+                            ExtentForRange(1, 1),
+                            ExtentForRange(kSparseHole, 1),
+                            ExtentForRange(2, 1),
+                            ExtentForRange(0, 1)};
+  brillo::Blob data(kBlockSize * 5);
+  test_utils::FillWithData(&data);
+
+  {
+    DirectExtentWriter direct_writer{fd_, kBlockSize * 2};
+    EXPECT_TRUE(
+        direct_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+    // Odd sized writes, so some of them have to be split across extents.
+    for (size_t i = 0; i < data.size(); i += 3000) {
+      EXPECT_TRUE(
+          direct_writer.Write(&data[i], min<size_t>(3000, data.size() - i)));
+    }
+    EXPECT_TRUE(direct_writer.Flush());
+  }
+
+  brillo::Blob result_file;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result_file));
+
+  brillo::Blob expected_file(kBlockSize * 4);
+  const size_t order[] = {4, 1, 3, 0};
+  for (size_t block = 0; block < 4; block++) {
+    std::copy(data.begin() + order[block] * kBlockSize,
+              data.begin() + (order[block] + 1) * kBlockSize,
+              expected_file.begin() + block * kBlockSize);
+  }
+  ExpectVectorsEq(expected_file, result_file);
+}
+
+TEST_F(ExtentWriterTest, FlushStagedWritesTest) {
+  vector<Extent> extents = {ExtentForRange(1, 1), ExtentForRange(0, 1)};
+  brillo::Blob data(kBlockSize);
+  test_utils::FillWithData(&data);
+
+  DirectExtentWriter direct_writer{fd_, kBlockSize * 4};
+  EXPECT_TRUE(direct_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  // Only the first extent is written, so the data stays staged until Flush().
+  EXPECT_TRUE(direct_writer.Write(data.data(), data.size()));
+  EXPECT_EQ(static_cast<off_t>(0), utils::FileSize(temp_file_.path()));
+
+  EXPECT_TRUE(direct_writer.Flush());
+  brillo::Blob result_file;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result_file));
+  brillo::Blob expected_file(kBlockSize);
+  expected_file.insert(expected_file.end(), data.begin(), data.end());
+  ExpectVectorsEq(expected_file, result_file);
+}
+
 TEST_F(ExtentWriterTest, SparseFileTest) {
   vector<Extent> extents = {ExtentForRange(1, 1),
                             ExtentForRange(kSparseHole, 2),
@@ -176,4 +229,39 @@ TEST_F(ExtentWriterTest, SparseFileTest) {
   ExpectVectorsEq(expected_data, resultant_data);
 }
 
+TEST_F(ExtentWriterTest, WriteZerosTest) {
+  brillo::Blob data(kBlockSize * 4);
+  test_utils::FillWithData(&data);
+  ASSERT_TRUE(utils::WriteAll(fd_, data.data(), data.size()));
+
+  vector<Extent> extents = {ExtentForRange(2, 1),
+                            ExtentForRange(kSparseHole, 1),
+                            ExtentForRange(0, 1),
+                            ExtentForRange(5, 1)};
+  DirectExtentWriter direct_writer{fd_};
+  EXPECT_TRUE(direct_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  // Start with an unaligned write, so the rest of block 2 can't be offloaded.
+  EXPECT_TRUE(direct_writer.Write(data.data(), 7));
+  EXPECT_TRUE(direct_writer.WriteZeros(kBlockSize * 4 - 7, false));
+
+  // Block 5 was past the end of the file, zeroing it must extend the file like
+  // a regular write would.
+  EXPECT_EQ(static_cast<off_t>(kBlockSize * 6),
+            utils::FileSize(temp_file_.path()));
+
+  brillo::Blob result_file;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result_file));
+
+  brillo::Blob expected_file(kBlockSize * 6);
+  std::copy(data.begin() + kBlockSize,
+            data.begin() + kBlockSize * 2,
+            expected_file.begin() + kBlockSize);
+  std::copy(
+      data.begin(), data.begin() + 7, expected_file.begin() + kBlockSize * 2);
+  std::copy(data.begin() + kBlockSize * 3,
+            data.end(),
+            expected_file.begin() + kBlockSize * 3);
+  ExpectVectorsEq(expected_file, result_file);
+}
+
 }  // namespace chromeos_update_engine
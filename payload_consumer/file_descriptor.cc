@@ -21,6 +21,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <base/posix/eintr_wrapper.h>
@@ -29,6 +30,23 @@
 
 namespace chromeos_update_engine {
 
+ssize_t FileDescriptor::WriteV(const struct iovec* iov,
+                               int iovcnt,
+                               off64_t offset) {
+  const off64_t old_offset = Seek(0, SEEK_CUR);
+  if (old_offset < 0 || Seek(offset, SEEK_SET) != offset)
+    return -1;
+  ssize_t written = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (!utils::WriteAll(this, iov[i].iov_base, iov[i].iov_len))
+      return written ? written : -1;
+    written += iov[i].iov_len;
+  }
+  if (Seek(old_offset, SEEK_SET) != old_offset)
+    return -1;
+  return written;
+}
+
 EintrSafeFileDescriptor::~EintrSafeFileDescriptor() {
   if (IsOpen()) {
     Close();
@@ -69,6 +87,13 @@ ssize_t EintrSafeFileDescriptor::Write(const void* buf, size_t count) {
   return written;
 }
 
+ssize_t EintrSafeFileDescriptor::WriteV(const struct iovec* iov,
+                                        int iovcnt,
+                                        off64_t offset) {
+  CHECK_GE(fd_, 0);
+  return HANDLE_EINTR(pwritev64(fd_, iov, iovcnt, offset));
+}
+
 off64_t EintrSafeFileDescriptor::Seek(off64_t offset, int whence) {
   CHECK_GE(fd_, 0);
   return lseek64(fd_, offset, whence);
@@ -99,6 +124,13 @@ bool EintrSafeFileDescriptor::BlkIoctl(int request,
 #else   // defined(BLKZEROOUT)
   DCHECK(request == BLKDISCARD || request == BLKZEROOUT ||
          request == BLKSECDISCARD);
+  struct stat stbuf;
+  if (fstat(fd_, &stbuf) == 0 && S_ISREG(stbuf.st_mode)) {
+    if (request == BLKSECDISCARD)
+      return false;
+    *result = PunchHole(start, length);
+    return true;
+  }
   // On some devices, the BLKDISCARD will actually read back as zeros, instead
   // of "undefined" data. The BLKDISCARDZEROES ioctl tells whether that's the
   // case, so we issue a BLKDISCARD in those cases to speed up the writes.
@@ -130,6 +162,23 @@ bool EintrSafeFileDescriptor::BlkIoctl(int request,
 #endif  // defined(BLKZEROOUT)
 }
 
+int EintrSafeFileDescriptor::PunchHole(uint64_t start, uint64_t length) {
+  // Deallocating the range makes it read back as zeros, which satisfies both
+  // BLKZEROOUT and BLKDISCARD. Unlike a write, FALLOC_FL_KEEP_SIZE doesn't
+  // extend the file, so grow it explicitly if the range ends past EOF.
+  if (fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, length))
+    return -1;
+  struct stat stbuf;
+  if (fstat(fd_, &stbuf))
+    return -1;
+  const uint64_t end = start + length;
+  if (end > static_cast<uint64_t>(stbuf.st_size) &&
+      HANDLE_EINTR(ftruncate(fd_, end))) {
+    return -1;
+  }
+  return 0;
+}
+
 bool EintrSafeFileDescriptor::Flush() {
   CHECK_GE(fd_, 0);
   // Implemented as a No-Op, as delta_performer typically uses |O_DSYNC|, except
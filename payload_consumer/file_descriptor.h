@@ -19,6 +19,7 @@
 
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <memory>
 
 #include <base/macros.h>
@@ -67,6 +68,12 @@ class FileDescriptor {
   // no bytes were written. Specific implementations may set errno accordingly.
   virtual ssize_t Write(const void* buf, size_t count) = 0;
 
+  // Writes the |iovcnt| buffers in |iov| back to back at byte |offset|, without
+  // changing the file position. Returns the number of bytes written, or -1 on
+  // error, like pwritev(). The default implementation seeks and writes each
+  // buffer in turn.
+  virtual ssize_t WriteV(const struct iovec* iov, int iovcnt, off64_t offset);
+
   // Seeks to an offset. Returns the resulting offset location as measured in
   // bytes from the beginning. On error, return -1. Specific implementations
   // may set errno accordingly.
@@ -81,7 +88,8 @@ class FileDescriptor {
   // BLKZEROOUT and BLKSECDISCARD to discard, write zeros or securely discard
   // the blocks. These ioctls accept a range of bytes (|start| and |length|)
   // over which they perform the operation. The return value from the ioctl is
-  // stored in |result|.
+  // stored in |result|. Implementations backed by a regular file may emulate
+  // BLKDISCARD and BLKZEROOUT by deallocating the range.
   virtual bool BlkIoctl(int request,
                         uint64_t start,
                         uint64_t length,
@@ -125,6 +133,7 @@ class EintrSafeFileDescriptor final : public FileDescriptor {
   bool Open(const char* path, int flags) override;
   ssize_t Read(void* buf, size_t count) override;
   ssize_t Write(const void* buf, size_t count) override;
+  ssize_t WriteV(const struct iovec* iov, int iovcnt, off64_t offset) override;
   off64_t Seek(off64_t offset, int whence) override;
   uint64_t BlockDevSize() override;
   bool BlkIoctl(int request,
@@ -138,6 +147,10 @@ class EintrSafeFileDescriptor final : public FileDescriptor {
   int Fd() override { return fd_; }
 
  protected:
+  // Punches a hole over the byte range on a regular file so it reads back as
+  // zeros. Returns 0 on success or -1 on error, like ioctl() does.
+  int PunchHole(uint64_t start, uint64_t length);
+
   int fd_;
 };
 
@@ -16,9 +16,13 @@
 
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
 
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
@@ -90,6 +94,58 @@ bool CopyAndHashExtents(FileDescriptorPtr source,
   return true;
 }
 
+bool CopyFileRangeExtents(FileDescriptorPtr source,
+                          const RepeatedPtrField<Extent>& src_extents,
+                          FileDescriptorPtr target,
+                          const RepeatedPtrField<Extent>& tgt_extents,
+                          uint64_t block_size) {
+  TEST_AND_RETURN_FALSE(utils::BlocksInExtents(src_extents) ==
+                        utils::BlocksInExtents(tgt_extents));
+  const int source_fd = source->Fd();
+  const int target_fd = target->Fd();
+  struct stat source_stat, target_stat;
+  if (source_fd < 0 || target_fd < 0 || fstat(source_fd, &source_stat) != 0 ||
+      fstat(target_fd, &target_stat) != 0 || !S_ISREG(source_stat.st_mode) ||
+      !S_ISREG(target_stat.st_mode) ||
+      source_stat.st_dev != target_stat.st_dev) {
+    return false;
+  }
+
+  // Copy the longest runs of blocks contiguous in both the source and the
+  // target.
+  auto src = src_extents.begin();
+  auto tgt = tgt_extents.begin();
+  uint64_t src_blocks_done = 0;
+  uint64_t tgt_blocks_done = 0;
+  while (src != src_extents.end() && tgt != tgt_extents.end()) {
+    const uint64_t blocks = min(src->num_blocks() - src_blocks_done,
+                                tgt->num_blocks() - tgt_blocks_done);
+    loff_t src_offset = (src->start_block() + src_blocks_done) * block_size;
+    loff_t tgt_offset = (tgt->start_block() + tgt_blocks_done) * block_size;
+    size_t length = blocks * block_size;
+    while (length > 0) {
+      ssize_t copied = HANDLE_EINTR(copy_file_range(
+          source_fd, &src_offset, target_fd, &tgt_offset, length, 0));
+      if (copied <= 0) {
+        PLOG(WARNING) << "copy_file_range failed";
+        return false;
+      }
+      length -= copied;
+    }
+    src_blocks_done += blocks;
+    tgt_blocks_done += blocks;
+    if (src_blocks_done == src->num_blocks()) {
+      ++src;
+      src_blocks_done = 0;
+    }
+    if (tgt_blocks_done == tgt->num_blocks()) {
+      ++tgt;
+      tgt_blocks_done = 0;
+    }
+  }
+  return true;
+}
+
 bool ReadAndHashExtents(FileDescriptorPtr source,
                         const RepeatedPtrField<Extent>& extents,
                         uint64_t block_size,
@@ -50,6 +50,19 @@ bool CopyAndHashExtents(
     uint64_t block_size,
     brillo::Blob* hash_out);
 
+// Copies blocks from the |source| file to the |target| file like
+// CopyAndHashExtents(), but with copy_file_range(), so the data doesn't go
+// through userspace and the filesystem may share the blocks instead of
+// copying them. Returns false without copying anything unless both files are
+// regular files on the same filesystem, and returns false if the copy fails,
+// in which case the target blocks may be partially written.
+bool CopyFileRangeExtents(
+    FileDescriptorPtr source,
+    const google::protobuf::RepeatedPtrField<Extent>& src_extents,
+    FileDescriptorPtr target,
+    const google::protobuf::RepeatedPtrField<Extent>& tgt_extents,
+    uint64_t block_size);
+
 // Reads blocks from |source| and calculates the hash. The blocks to read are
 // specified by |extents|. Stores the hash in |hash_out| if it is not null. The
 // block sizes are passed as |block_size|. In case of error reading, it returns
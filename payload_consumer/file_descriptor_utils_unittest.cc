@@ -165,6 +165,31 @@ TEST_F(FileDescriptorUtilsTest, CopyAndHashExtentsManyToManyTest) {
   EXPECT_EQ(expected_hash, hash_out);
 }
 
+// copy_file_range() is only used between regular files.
+TEST_F(FileDescriptorUtilsTest, CopyFileRangeExtentsNotRegularFileTest) {
+  auto extents = CreateExtentList({{0, 5}});
+
+  EXPECT_FALSE(fd_utils::CopyFileRangeExtents(
+      source_, extents, target_, extents, 4));
+  EXPECT_TRUE(fake_source_->GetReadOps().empty());
+}
+
+TEST_F(FileDescriptorUtilsTest, CopyFileRangeExtentsManyToManyTest) {
+  ScopedTempFile src_file("fd_src.XXXXXX");
+  const char kSourceData[] = "00000001000200030004";
+  ASSERT_TRUE(utils::WriteFile(
+      src_file.path().c_str(), kSourceData, strlen(kSourceData)));
+  FileDescriptorPtr source(new EintrSafeFileDescriptor());
+  ASSERT_TRUE(source->Open(src_file.path().c_str(), O_RDONLY));
+  auto src_extents = CreateExtentList({{1, 1}, {4, 1}, {2, 2}, {0, 1}});
+  auto tgt_extents = CreateExtentList({{2, 3}, {0, 2}});
+
+  EXPECT_TRUE(fd_utils::CopyFileRangeExtents(
+      source, src_extents, target_, tgt_extents, 4));
+  // Same result as CopyAndHashExtentsManyToManyTest.
+  ExpectTarget("00030000000100040002");
+}
+
 // Failing to read from the source should fail the hash calculation.
 TEST_F(FileDescriptorUtilsTest, ReadAndHashExtentsReadFailureTest) {
   auto extents = CreateExtentList({{0, 5}});
@@ -32,6 +32,7 @@
 
 #include <base/bind.h>
 #include <base/strings/string_util.h>
+#include <base/time/time.h>
 #include <brillo/data_encoding.h>
 #include <brillo/message_loops/message_loop.h>
 #include <brillo/secure_blob.h>
@@ -81,8 +82,115 @@ namespace chromeos_update_engine {
 namespace {
 const off_t kReadFileBufferSize = 128 * 1024;
 constexpr float kVerityProgressPercent = 0.6;
+// Partitions hashed in parallel are read with larger buffers when the memory
+// budget allows it, as each thread then does fewer and longer reads.
+const size_t kParallelReadBufferSize = 1024 * 1024;
+constexpr auto kParallelHashingProgressInterval =
+    base::TimeDelta::FromMilliseconds(100);
+
+// Resumes in |hasher| the hash of the data written to the first bytes of the
+// target |partition| of |size| bytes while the update was applied, if any.
+// Returns the offset to continue hashing from.
+uint64_t ResumeWrittenDataHash(const InstallPlan::Partition& partition,
+                               uint64_t size,
+                               HashCalculator* hasher) {
+  if (partition.written_size == 0 || partition.written_size > size)
+    return 0;
+  if (!hasher->SetContext(partition.written_hash_context)) {
+    LOG(WARNING) << "Invalid hash context of the data written to "
+                 << partition.name << ", hashing it whole.";
+    return 0;
+  }
+  LOG(INFO) << "Resuming the hash of " << partition.name << " after the "
+            << partition.written_size << " bytes hashed while writing them.";
+  return partition.written_size;
+}
 }  // namespace
 
+// A partition hashed on a thread of the hashing pool, with its own file
+// descriptor, buffer and hasher.
+class FilesystemVerifierAction::PartitionHashJob
+    : public base::DelegateSimpleThread::Delegate {
+ public:
+  PartitionHashJob(const InstallPlan::Partition& partition,
+                   const string& path,
+                   uint64_t size,
+                   size_t buffer_size,
+                   const std::atomic<bool>* stopped)
+      : partition(partition),
+        path(path),
+        size(size),
+        buffer_size(buffer_size),
+        stopped(stopped) {}
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    success = Hash();
+    done = true;
+  }
+
+  const InstallPlan::Partition& partition;
+  const string path;
+  const uint64_t size;
+  const size_t buffer_size;
+  const std::atomic<bool>* const stopped;
+
+  // Number of bytes hashed so far, for the progress.
+  std::atomic<uint64_t> bytes_hashed{0};
+  // Whether the partition was hashed, and its hash, set when |done|.
+  std::atomic<bool> done{false};
+  bool success{false};
+  brillo::Blob hash;
+
+ private:
+  bool Hash() {
+    if (!utils::SetBlockDeviceReadOnly(path, true)) {
+      LOG(WARNING) << "Failed to set block device " << path << " as readonly";
+    }
+    EintrSafeFileDescriptor fd;
+    if (!fd.Open(path.c_str(), O_RDONLY)) {
+      LOG(ERROR) << "Unable to open " << path << " for reading.";
+      return false;
+    }
+    brillo::Blob buffer(buffer_size);
+    HashCalculator hasher;
+    const uint64_t start_offset =
+        ResumeWrittenDataHash(partition, size, &hasher);
+    bytes_hashed = start_offset;
+    if (fd.Seek(start_offset, SEEK_SET) != static_cast<off64_t>(start_offset)) {
+      PLOG(ERROR) << "Failed to seek to offset " << start_offset << " of "
+                  << path;
+      return false;
+    }
+    for (uint64_t offset = start_offset; offset < size;
+         offset += buffer.size()) {
+      if (*stopped)
+        return false;
+      buffer.resize(std::min<uint64_t>(buffer.size(), size - offset));
+      const auto bytes_read = fd.Read(buffer.data(), buffer.size());
+      if (bytes_read < 0 || static_cast<size_t>(bytes_read) != buffer.size()) {
+        PLOG(ERROR) << "Failed to read offset " << offset << " of " << path
+                    << " expected " << buffer.size()
+                    << " bytes, actual: " << bytes_read;
+        return false;
+      }
+      TEST_AND_RETURN_FALSE(hasher.Update(buffer.data(), buffer.size()));
+      bytes_hashed += buffer.size();
+    }
+    fd.Close();
+    TEST_AND_RETURN_FALSE(hasher.Finalize());
+    hash = hasher.raw_hash();
+    return true;
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionHashJob);
+};
+
+FilesystemVerifierAction::~FilesystemVerifierAction() {
+  // Don't let the hashing threads outlive the action if it didn't complete.
+  StopParallelHashing();
+}
+
 void FilesystemVerifierAction::PerformAction() {
   // Will tell the ActionProcessor we've failed if we return.
   ScopedActionCompleter abort_action_completer(processor_, this);
@@ -121,16 +229,110 @@ void FilesystemVerifierAction::PerformAction() {
       !install_plan_.write_verity) {
     dynamic_control_->MapAllPartitions();
   }
-  StartPartitionHashing();
+  if (StartParallelHashing()) {
+    WaitForParallelHashing();
+  } else {
+    StartPartitionHashing();
+  }
   abort_action_completer.set_should_complete(false);
 }
 
+bool FilesystemVerifierAction::StartParallelHashing() {
+  if (hashing_parallelism_ <= 1)
+    return false;
+  // Only the target partitions which are just read can be hashed in parallel:
+  // writing verity data to a VABC partition remaps all of them.
+  std::vector<size_t> indexes;
+  for (size_t i = 0; i < install_plan_.partitions.size(); i++) {
+    if (IsVABC(install_plan_.partitions[i]) && install_plan_.write_verity)
+      continue;
+    if (ShouldWriteVerity(i) || GetPartitionPath(i).empty() ||
+        GetPartitionSize(i) == 0) {
+      continue;
+    }
+    indexes.push_back(i);
+  }
+
+  const size_t num_threads =
+      std::min({hashing_parallelism_,
+                indexes.size(),
+                hashing_memory_budget_ / kReadFileBufferSize});
+  if (num_threads <= 1)
+    return false;
+  const size_t buffer_size =
+      std::min(kParallelReadBufferSize, hashing_memory_budget_ / num_threads);
+  LOG(INFO) << "Hashing " << indexes.size() << " partitions on "
+            << num_threads << " threads, with " << buffer_size
+            << " bytes buffers.";
+
+  hashing_stopped_ = false;
+  hash_jobs_.clear();
+  hash_jobs_.resize(install_plan_.partitions.size());
+  hashing_pool_ = std::make_unique<base::DelegateSimpleThreadPool>(
+      "filesystem-verifier-hash", num_threads);
+  hashing_pool_->Start();
+  for (size_t index : indexes) {
+    hash_jobs_[index] =
+        std::make_unique<PartitionHashJob>(install_plan_.partitions[index],
+                                           GetPartitionPath(index),
+                                           GetPartitionSize(index),
+                                           buffer_size,
+                                           &hashing_stopped_);
+    hashing_pool_->AddWork(hash_jobs_[index].get());
+  }
+  return true;
+}
+
+void FilesystemVerifierAction::WaitForParallelHashing() {
+  TEST_AND_RETURN(hashing_pool_ != nullptr);
+  uint64_t bytes_hashed = 0;
+  bool done = true;
+  for (const auto& job : hash_jobs_) {
+    if (job) {
+      bytes_hashed += job->bytes_hashed;
+      done = done && job->done;
+    }
+  }
+  UpdateProgress(static_cast<double>(bytes_hashed) / partition_weight_.back());
+  if (!done) {
+    CHECK(pending_task_id_.PostTask(
+        FROM_HERE,
+        base::BindOnce(&FilesystemVerifierAction::WaitForParallelHashing,
+                       base::Unretained(this)),
+        kParallelHashingProgressInterval));
+    return;
+  }
+  hashing_pool_->JoinAll();
+  hashing_pool_.reset();
+
+  // The partitions hashed in parallel are done, so the progress of the others
+  // starts after all of them and doesn't go back.
+  size_t weight = bytes_hashed;
+  for (size_t i = 0; i < install_plan_.partitions.size(); i++) {
+    partition_weight_[i] = weight;
+    if (!hash_jobs_[i])
+      weight += install_plan_.partitions[i].target_size;
+  }
+  partition_weight_.back() = weight;
+  StartPartitionHashing();
+}
+
+void FilesystemVerifierAction::StopParallelHashing() {
+  if (hashing_pool_) {
+    hashing_stopped_ = true;
+    hashing_pool_->JoinAll();
+    hashing_pool_.reset();
+  }
+  hash_jobs_.clear();
+}
+
 void FilesystemVerifierAction::TerminateProcessing() {
   cancelled_ = true;
   Cleanup(ErrorCode::kSuccess);  // error code is ignored if canceled_ is true.
 }
 
 void FilesystemVerifierAction::Cleanup(ErrorCode code) {
+  StopParallelHashing();
   partition_fd_.reset();
   // This memory is not used anymore.
   buffer_.clear();
@@ -206,7 +408,7 @@ bool FilesystemVerifierAction::InitializeFdVABC(bool should_write_verity) {
 
 bool FilesystemVerifierAction::InitializeFd(const std::string& part_path) {
   partition_fd_ = std::make_unique<EintrSafeFileDescriptor>();
-  const bool write_verity = ShouldWriteVerity();
+  const bool write_verity = ShouldWriteVerity(partition_index_);
   int flags = write_verity ? O_RDWR : O_RDONLY;
   if (!utils::SetBlockDeviceReadOnly(part_path, !write_verity)) {
     LOG(WARNING) << "Failed to set block device " << part_path << " as "
@@ -332,7 +534,7 @@ void FilesystemVerifierAction::HashPartition(const off64_t start_offset,
   // If we are writing verity, then the progress bar will be split between
   // verity writes and partition hashing. Otherwise, the entire progress bar is
   // dedicated to partition hashing for smooth progress.
-  if (ShouldWriteVerity()) {
+  if (ShouldWriteVerity(partition_index_)) {
     UpdatePartitionProgress(progress * (1 - kVerityProgressPercent) +
                             kVerityProgressPercent);
   } else {
@@ -369,14 +571,26 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   }
   const InstallPlan::Partition& partition =
       install_plan_.partitions[partition_index_];
-  const auto& part_path = GetPartitionPath();
-  partition_size_ = GetPartitionSize();
+  if (verifier_step_ == VerifierStep::kVerifyTargetHash &&
+      partition_index_ < hash_jobs_.size() && hash_jobs_[partition_index_]) {
+    const auto job = std::move(hash_jobs_[partition_index_]);
+    if (!job->success) {
+      LOG(ERROR) << "Failed to hash partition " << partition_index_ << " ("
+                 << partition.name << ") on device " << job->path;
+      Cleanup(ErrorCode::kFilesystemVerifierError);
+      return;
+    }
+    VerifyPartitionHash(job->hash);
+    return;
+  }
+  const auto& part_path = GetPartitionPath(partition_index_);
+  partition_size_ = GetPartitionSize(partition_index_);
 
   LOG(INFO) << "Hashing partition " << partition_index_ << " ("
             << partition.name << ") on device " << part_path;
   auto success = false;
   if (IsVABC(partition)) {
-    success = InitializeFdVABC(ShouldWriteVerity());
+    success = InitializeFdVABC(ShouldWriteVerity(partition_index_));
   } else {
     if (part_path.empty()) {
       if (partition_size_ == 0) {
@@ -413,7 +627,7 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   } else if (partition.fec_offset != 0) {
     filesystem_data_end_ = partition.fec_offset;
   }
-  if (ShouldWriteVerity()) {
+  if (ShouldWriteVerity(partition_index_)) {
     LOG(INFO) << "Verity writes enabled on partition " << partition.name;
     if (!verity_writer_->Init(partition)) {
       LOG(INFO) << "Verity writes enabled on partition " << partition.name;
@@ -424,7 +638,13 @@ void FilesystemVerifierAction::StartPartitionHashing() {
         0, filesystem_data_end_, buffer_.data(), buffer_.size());
   } else {
     LOG(INFO) << "Verity writes disabled on partition " << partition.name;
-    HashPartition(0, partition_size_, buffer_.data(), buffer_.size());
+    uint64_t start_offset = 0;
+    if (verifier_step_ == VerifierStep::kVerifyTargetHash) {
+      start_offset =
+          ResumeWrittenDataHash(partition, partition_size_, hasher_.get());
+    }
+    HashPartition(
+        start_offset, partition_size_, buffer_.data(), buffer_.size());
   }
 }
 
@@ -436,9 +656,10 @@ bool FilesystemVerifierAction::IsVABC(
                                               install_plan_.target_slot);
 }
 
-const std::string& FilesystemVerifierAction::GetPartitionPath() const {
+const std::string& FilesystemVerifierAction::GetPartitionPath(
+    size_t partition_index) const {
   const InstallPlan::Partition& partition =
-      install_plan_.partitions[partition_index_];
+      install_plan_.partitions[partition_index];
   switch (verifier_step_) {
     case VerifierStep::kVerifySourceHash:
       return partition.source_path;
@@ -451,9 +672,10 @@ const std::string& FilesystemVerifierAction::GetPartitionPath() const {
   }
 }
 
-size_t FilesystemVerifierAction::GetPartitionSize() const {
+size_t FilesystemVerifierAction::GetPartitionSize(
+    size_t partition_index) const {
   const InstallPlan::Partition& partition =
-      install_plan_.partitions[partition_index_];
+      install_plan_.partitions[partition_index];
   switch (verifier_step_) {
     case VerifierStep::kVerifySourceHash:
       return partition.source_size;
@@ -462,9 +684,10 @@ size_t FilesystemVerifierAction::GetPartitionSize() const {
   }
 }
 
-bool FilesystemVerifierAction::ShouldWriteVerity() {
+bool FilesystemVerifierAction::ShouldWriteVerity(
+    size_t partition_index) const {
   const InstallPlan::Partition& partition =
-      install_plan_.partitions[partition_index_];
+      install_plan_.partitions[partition_index];
   return verifier_step_ == VerifierStep::kVerifyTargetHash &&
          install_plan_.write_verity &&
          (partition.hash_tree_size > 0 || partition.fec_size > 0);
@@ -476,14 +699,17 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
     Cleanup(ErrorCode::kError);
     return;
   }
+  VerifyPartitionHash(hasher_->raw_hash());
+}
+
+void FilesystemVerifierAction::VerifyPartitionHash(const brillo::Blob& hash) {
   const InstallPlan::Partition& partition =
       install_plan_.partitions[partition_index_];
-  LOG(INFO) << "Hash of " << partition.name << ": "
-            << HexEncode(hasher_->raw_hash());
+  LOG(INFO) << "Hash of " << partition.name << ": " << HexEncode(hash);
 
   switch (verifier_step_) {
     case VerifierStep::kVerifyTargetHash:
-      if (partition.target_hash != hasher_->raw_hash()) {
+      if (partition.target_hash != hash) {
         LOG(ERROR) << "New '" << partition.name
                    << "' partition verification failed.";
         if (partition.source_hash.empty()) {
@@ -501,7 +727,7 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
       }
       break;
     case VerifierStep::kVerifySourceHash:
-      if (partition.source_hash != hasher_->raw_hash()) {
+      if (partition.source_hash != hash) {
         LOG(ERROR) << "Old '" << partition.name
                    << "' partition verification failed.";
         LOG(ERROR) << "This is a server-side error due to mismatched delta"
@@ -514,7 +740,7 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
                       " means that the delta I've been given doesn't match my"
                       " existing system. The "
                    << partition.name << " partition I have has hash: "
-                   << Base64Encode(hasher_->raw_hash())
+                   << Base64Encode(hash)
                    << " but the update expected me to have "
                    << Base64Encode(partition.source_hash) << " .";
         LOG(INFO) << "To get the checksum of the " << partition.name
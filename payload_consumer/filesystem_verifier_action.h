@@ -20,11 +20,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <base/threading/simple_thread.h>
 #include <brillo/message_loops/message_loop.h>
 
 #include "update_engine/common/action.h"
@@ -67,7 +69,7 @@ class FilesystemVerifierAction : public InstallPlanAction {
     CHECK(dynamic_control_);
   }
 
-  ~FilesystemVerifierAction() override = default;
+  ~FilesystemVerifierAction() override;
 
   void PerformAction() override;
   void TerminateProcessing() override;
@@ -80,12 +82,22 @@ class FilesystemVerifierAction : public InstallPlanAction {
     return this->delegate_;
   }
 
+  // Hashes up to |parallelism| partitions at once, each on its own thread,
+  // with read buffers of at most |memory_budget| bytes in total. Partitions
+  // which need verity data written are still hashed one at a time afterwards.
+  void set_parallel_hashing(size_t parallelism, size_t memory_budget) {
+    hashing_parallelism_ = parallelism;
+    hashing_memory_budget_ = memory_budget;
+  }
+
   // Debugging/logging
   static std::string StaticType() { return "FilesystemVerifierAction"; }
   std::string Type() const override { return StaticType(); }
 
  private:
   friend class FilesystemVerifierActionTestDelegate;
+  class PartitionHashJob;
+
   // Wrapper function that schedules calls of EncodeFEC. Returns true on success
   void WriteVerityData(FileDescriptor* fd,
                        void* buffer,
@@ -99,22 +111,40 @@ class FilesystemVerifierAction : public InstallPlanAction {
                      void* buffer,
                      const size_t buffer_size);
 
-  // Return true if we need to write verity bytes.
-  bool ShouldWriteVerity();
+  // Return true if we need to write verity bytes for the partition at
+  // |partition_index|.
+  bool ShouldWriteVerity(size_t partition_index) const;
   // Starts the hashing of the current partition. If there aren't any partitions
   // remaining to be hashed, it finishes the action.
   void StartPartitionHashing();
 
-  const std::string& GetPartitionPath() const;
+  // The path and size of the partition at |partition_index| to hash in the
+  // current step.
+  const std::string& GetPartitionPath(size_t partition_index) const;
 
   bool IsVABC(const InstallPlan::Partition& partition) const;
 
-  size_t GetPartitionSize() const;
+  size_t GetPartitionSize(size_t partition_index) const;
 
   // When the read is done, finalize the hash checking of the current partition
   // and continue checking the next one.
   void FinishPartitionHashing();
 
+  // Checks |hash| of the current partition against the install plan and
+  // continues checking the next one.
+  void VerifyPartitionHash(const brillo::Blob& hash);
+
+  // Starts hashing on the threads of |hashing_pool_| the partitions which
+  // don't need verity data written. Returns whether any was started.
+  bool StartParallelHashing();
+
+  // Reports the progress of the partitions hashed in parallel until they are
+  // all hashed, then verifies all the partitions in order.
+  void WaitForParallelHashing();
+
+  // Stops the threads hashing partitions in parallel, if any.
+  void StopParallelHashing();
+
   // Cleans up all the variables we use for async operations and tells the
   // ActionProcessor we're done w/ |code| as passed in. |cancelled_| should be
   // true if TerminateProcessing() was called.
@@ -181,6 +211,18 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // partitions.
   std::vector<size_t> partition_weight_;
 
+  // Maximum number of partitions hashed at once, and total size of their
+  // read buffers.
+  size_t hashing_parallelism_{1};
+  size_t hashing_memory_budget_{0};
+
+  // The partitions hashed in parallel, indexed like install_plan_.partitions
+  // and null for the others, and the threads hashing them.
+  std::vector<std::unique_ptr<PartitionHashJob>> hash_jobs_;
+  std::unique_ptr<base::DelegateSimpleThreadPool> hashing_pool_;
+  // Set to stop the threads of |hashing_pool_| early.
+  std::atomic<bool> hashing_stopped_{false};
+
   DISALLOW_COPY_AND_ASSIGN(FilesystemVerifierAction);
 };
 
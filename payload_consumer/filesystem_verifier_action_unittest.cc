@@ -197,6 +197,9 @@ class FilesystemVerifierActionTest : public ::testing::Test {
   static ScopedTempFile source_part_;
   static ScopedTempFile target_part_;
   InstallPlan install_plan_;
+  // Passed to the FilesystemVerifierAction built by BuildActions().
+  size_t hashing_parallelism_{1};
+  FilesystemVerifyDelegate* verify_delegate_{nullptr};
 };
 
 ScopedTempFile FilesystemVerifierActionTest::source_part_{
@@ -348,6 +351,9 @@ void FilesystemVerifierActionTest::BuildActions(
   auto feeder_action = std::make_unique<ObjectFeederAction<InstallPlan>>();
   auto verifier_action =
       std::make_unique<FilesystemVerifierAction>(dynamic_control);
+  verifier_action->set_parallel_hashing(hashing_parallelism_,
+                                        hashing_parallelism_ * 1024 * 1024);
+  verifier_action->set_delegate(verify_delegate_);
   auto collector_action =
       std::make_unique<ObjectCollectorAction<InstallPlan>>();
 
@@ -366,6 +372,14 @@ void FilesystemVerifierActionTest::BuildActions(
   BuildActions(install_plan, &dynamic_control_stub_);
 }
 
+class FilesystemVerifyProgressRecorder : public FilesystemVerifyDelegate {
+ public:
+  void OnVerifyProgressUpdate(double progress) override {
+    progress_.push_back(progress);
+  }
+  std::vector<double> progress_;
+};
+
 class FilesystemVerifierActionTest2Delegate : public ActionProcessorDelegate {
  public:
   void ActionCompleted(ActionProcessor* processor,
@@ -436,6 +450,88 @@ TEST_F(FilesystemVerifierActionTest, RunAsRootTerminateEarlyTest) {
   }
 }
 
+TEST_F(FilesystemVerifierActionTest, ParallelHashingTest) {
+  AddFakePartition(&install_plan_, "a");
+  // A partition which isn't hashed, in the middle of the parallel ones.
+  InstallPlan::Partition* empty_part = AddFakePartition(&install_plan_, "b");
+  empty_part->target_path.clear();
+  empty_part->target_size = 0;
+  AddFakePartition(&install_plan_, "c");
+  AddFakePartition(&install_plan_, "d");
+  hashing_parallelism_ = 2;
+  FilesystemVerifyProgressRecorder progress_recorder;
+  verify_delegate_ = &progress_recorder;
+  BuildActions(install_plan_);
+
+  FilesystemVerifierActionTestDelegate delegate;
+  processor_.set_delegate(&delegate);
+  loop_.PostTask(FROM_HERE,
+                 base::Bind(&ActionProcessor::StartProcessing,
+                            base::Unretained(&processor_)));
+  loop_.Run();
+
+  ASSERT_FALSE(processor_.IsRunning());
+  ASSERT_TRUE(delegate.ran());
+  EXPECT_EQ(ErrorCode::kSuccess, delegate.code());
+  // The progress of the partitions hashed at once never goes back.
+  const auto& progress = progress_recorder.progress_;
+  ASSERT_FALSE(progress.empty());
+  EXPECT_TRUE(std::is_sorted(progress.begin(), progress.end()));
+  EXPECT_EQ(1.0, progress.back());
+}
+
+TEST_F(FilesystemVerifierActionTest, ParallelHashingMismatchTest) {
+  AddFakePartition(&install_plan_, "a");
+  AddFakePartition(&install_plan_, "b")->target_hash[0] ^= 1;
+  AddFakePartition(&install_plan_, "c");
+  hashing_parallelism_ = 3;
+  BuildActions(install_plan_);
+
+  FilesystemVerifierActionTestDelegate delegate;
+  processor_.set_delegate(&delegate);
+  loop_.PostTask(FROM_HERE,
+                 base::Bind(&ActionProcessor::StartProcessing,
+                            base::Unretained(&processor_)));
+  loop_.Run();
+
+  ASSERT_FALSE(processor_.IsRunning());
+  ASSERT_TRUE(delegate.ran());
+  // The source of "b" is hashed after the mismatch, and matches.
+  EXPECT_EQ(ErrorCode::kNewRootfsVerificationError, delegate.code());
+}
+
+TEST_F(FilesystemVerifierActionTest, WrittenDataHashTest) {
+  InstallPlan::Partition* part = AddFakePartition(&install_plan_);
+  // Resume the hash of the first half of the partition as if it was computed
+  // while writing it, from the source partition so it only matches if that
+  // half isn't read again.
+  brillo::Blob source_data;
+  ASSERT_TRUE(utils::ReadFile(source_part_.path(), &source_data));
+  source_data.resize(PARTITION_SIZE / 2);
+  brillo::Blob target_data;
+  ASSERT_TRUE(utils::ReadFile(target_part_.path(), &target_data));
+  HashCalculator hasher;
+  ASSERT_TRUE(hasher.Update(source_data.data(), source_data.size()));
+  part->written_size = source_data.size();
+  part->written_hash_context = hasher.GetContext();
+  ASSERT_TRUE(hasher.Update(target_data.data() + source_data.size(),
+                            target_data.size() - source_data.size()));
+  ASSERT_TRUE(hasher.Finalize());
+  part->target_hash = hasher.raw_hash();
+  BuildActions(install_plan_);
+
+  FilesystemVerifierActionTestDelegate delegate;
+  processor_.set_delegate(&delegate);
+  loop_.PostTask(FROM_HERE,
+                 base::Bind(&ActionProcessor::StartProcessing,
+                            base::Unretained(&processor_)));
+  loop_.Run();
+
+  ASSERT_FALSE(processor_.IsRunning());
+  ASSERT_TRUE(delegate.ran());
+  EXPECT_EQ(ErrorCode::kSuccess, delegate.code());
+}
+
 #ifdef __ANDROID__
 TEST_F(FilesystemVerifierActionTest, RunAsRootWriteVerityTest) {
   ScopedTempFile part_file("part_file.XXXXXX");
@@ -24,7 +24,6 @@
 #include <utility>
 #include <vector>
 
-#include <base/files/memory_mapped_file.h>
 #include <base/files/file_util.h>
 #include <bsdiff/bspatch.h>
 #include <puffin/brotli_util.h>
@@ -46,12 +45,22 @@
 
 namespace chromeos_update_engine {
 
+namespace {
+// Flushes |writer| once an operation is executed, and returns whether both the
+// operation, whose result is |success|, and the flush succeeded. The writer is
+// flushed even if the operation failed, so it never holds data when destroyed.
+bool FlushWriter(ExtentWriter* writer, bool success) {
+  return writer->Flush() && success;
+}
+}  // namespace
+
 class BsdiffExtentFile : public bsdiff::FileInterface {
  public:
   BsdiffExtentFile(std::unique_ptr<ExtentReader> reader, size_t size)
       : BsdiffExtentFile(std::move(reader), nullptr, size) {}
-  BsdiffExtentFile(std::unique_ptr<ExtentWriter> writer, size_t size)
-      : BsdiffExtentFile(nullptr, std::move(writer), size) {}
+  // |writer| isn't owned, it's flushed by the caller once patched.
+  BsdiffExtentFile(ExtentWriter* writer, size_t size)
+      : BsdiffExtentFile(nullptr, writer, size) {}
 
   ~BsdiffExtentFile() override = default;
 
@@ -90,15 +99,15 @@ class BsdiffExtentFile : public bsdiff::FileInterface {
 
  private:
   BsdiffExtentFile(std::unique_ptr<ExtentReader> reader,
-                   std::unique_ptr<ExtentWriter> writer,
+                   ExtentWriter* writer,
                    size_t size)
       : reader_(std::move(reader)),
-        writer_(std::move(writer)),
+        writer_(writer),
         size_(size),
         offset_(0) {}
 
   std::unique_ptr<ExtentReader> reader_;
-  std::unique_ptr<ExtentWriter> writer_;
+  ExtentWriter* writer_;
   uint64_t size_;
   uint64_t offset_;
 
@@ -112,9 +121,10 @@ class PuffinExtentStream : public puffin::StreamInterface {
   PuffinExtentStream(std::unique_ptr<ExtentReader> reader, uint64_t size)
       : PuffinExtentStream(std::move(reader), nullptr, size) {}
 
-  // Constructor for creating a stream for writing to an |ExtentWriter|.
-  PuffinExtentStream(std::unique_ptr<ExtentWriter> writer, uint64_t size)
-      : PuffinExtentStream(nullptr, std::move(writer), size) {}
+  // Constructor for creating a stream for writing to an |ExtentWriter|, which
+  // isn't owned.
+  PuffinExtentStream(ExtentWriter* writer, uint64_t size)
+      : PuffinExtentStream(nullptr, writer, size) {}
 
   ~PuffinExtentStream() override = default;
 
@@ -158,16 +168,16 @@ class PuffinExtentStream : public puffin::StreamInterface {
 
  private:
   PuffinExtentStream(std::unique_ptr<ExtentReader> reader,
-                     std::unique_ptr<ExtentWriter> writer,
+                     ExtentWriter* writer,
                      uint64_t size)
       : reader_(std::move(reader)),
-        writer_(std::move(writer)),
+        writer_(writer),
         size_(size),
         offset_(0),
         is_read_(reader_ ? true : false) {}
 
   std::unique_ptr<ExtentReader> reader_;
-  std::unique_ptr<ExtentWriter> writer_;
+  ExtentWriter* writer_;
   uint64_t size_;
   uint64_t offset_;
   bool is_read_;
@@ -190,33 +200,22 @@ bool InstallOperationExecutor::ExecuteReplaceOperation(
     writer.reset(new XzExtentWriter(std::move(writer)));
   }
   TEST_AND_RETURN_FALSE(writer->Init(operation.dst_extents(), block_size_));
-  TEST_AND_RETURN_FALSE(writer->Write(data, operation.data_length()));
-
-  return true;
+  return FlushWriter(writer.get(),
+                     writer->Write(data, operation.data_length()));
 }
 
 bool InstallOperationExecutor::ExecuteZeroOrDiscardOperation(
     const InstallOperation& operation, std::unique_ptr<ExtentWriter> writer) {
   TEST_AND_RETURN_FALSE(operation.type() == InstallOperation::ZERO ||
                         operation.type() == InstallOperation::DISCARD);
-  using base::MemoryMappedFile;
-  using Access = base::MemoryMappedFile::Access;
-  using Region = base::MemoryMappedFile::Region;
-  writer->Init(operation.dst_extents(), block_size_);
-  // Mmap a region of /dev/zero, as we don't need any actual memory to store
-  // these 0s, so mmap a region of "free memory".
-  base::File dev_zero(base::FilePath("/dev/zero"),
-                      base::File::FLAG_OPEN | base::File::FLAG_READ);
-  MemoryMappedFile buffer;
-  TEST_AND_RETURN_FALSE_ERRNO(buffer.Initialize(
-      std::move(dev_zero),
-      Region{
-          0,
-          static_cast<size_t>(utils::BlocksInExtents(operation.dst_extents()) *
-                              block_size_)},
-      Access::READ_ONLY));
-  writer->Write(buffer.data(), buffer.length());
-  return true;
+  TEST_AND_RETURN_FALSE(writer->Init(operation.dst_extents(), block_size_));
+  // Let the writer zero the blocks natively, so no zeros need to be pushed
+  // through memory when the underlying storage supports it.
+  return FlushWriter(
+      writer.get(),
+      writer->WriteZeros(
+          utils::BlocksInExtents(operation.dst_extents()) * block_size_,
+          operation.type() == InstallOperation::DISCARD));
 }
 
 bool InstallOperationExecutor::ExecuteSourceCopyOperation(
@@ -225,8 +224,12 @@ bool InstallOperationExecutor::ExecuteSourceCopyOperation(
     FileDescriptorPtr source_fd) {
   TEST_AND_RETURN_FALSE(operation.type() == InstallOperation::SOURCE_COPY);
   TEST_AND_RETURN_FALSE(writer->Init(operation.dst_extents(), block_size_));
-  return fd_utils::CommonHashExtents(
-      source_fd, operation.src_extents(), writer.get(), block_size_, nullptr);
+  return FlushWriter(writer.get(),
+                     fd_utils::CommonHashExtents(source_fd,
+                                                 operation.src_extents(),
+                                                 writer.get(),
+                                                 block_size_,
+                                                 nullptr));
 }
 
 bool InstallOperationExecutor::ExecuteDiffOperation(
@@ -237,33 +240,39 @@ bool InstallOperationExecutor::ExecuteDiffOperation(
     size_t count) {
   TEST_AND_RETURN_FALSE(source_fd != nullptr);
   TEST_AND_RETURN_FALSE(writer->Init(operation.dst_extents(), block_size_));
+  bool success = false;
   switch (operation.type()) {
     case InstallOperation::SOURCE_BSDIFF:
     case InstallOperation::BSDIFF:
     case InstallOperation::BROTLI_BSDIFF:
-      return ExecuteSourceBsdiffOperation(
-          operation, std::move(writer), source_fd, data, count);
+      success = ExecuteSourceBsdiffOperation(
+          operation, writer.get(), source_fd, data, count);
+      break;
     case InstallOperation::PUFFDIFF:
-      return ExecutePuffDiffOperation(
-          operation, std::move(writer), source_fd, data, count);
+      success = ExecutePuffDiffOperation(
+          operation, writer.get(), source_fd, data, count);
+      break;
     case InstallOperation::ZUCCHINI:
-      return ExecuteZucchiniOperation(
-          operation, std::move(writer), source_fd, data, count);
+      success = ExecuteZucchiniOperation(
+          operation, writer.get(), source_fd, data, count);
+      break;
     case InstallOperation::LZ4DIFF_BSDIFF:
     case InstallOperation::LZ4DIFF_PUFFDIFF:
-      return ExecuteLz4diffOperation(
-          operation, std::move(writer), source_fd, data, count);
+      success = ExecuteLz4diffOperation(
+          operation, writer.get(), source_fd, data, count);
+      break;
     default:
       LOG(ERROR) << "Unexpected operation type when executing diff ops "
                  << operation.type() << " "
                  << operation.Type_Name(operation.type());
       return false;
   }
+  return FlushWriter(writer.get(), success);
 }
 
 bool InstallOperationExecutor::ExecuteLz4diffOperation(
     const InstallOperation& operation,
-    std::unique_ptr<ExtentWriter> writer,
+    ExtentWriter* writer,
     FileDescriptorPtr source_fd,
     const void* data,
     size_t count) {
@@ -274,7 +283,7 @@ bool InstallOperationExecutor::ExecuteLz4diffOperation(
   TEST_AND_RETURN_FALSE(Lz4Patch(
       ToStringView(src_data),
       ToStringView(data, count),
-      [writer(writer.get())](const uint8_t* data, size_t size) -> size_t {
+      [writer](const uint8_t* data, size_t size) -> size_t {
         if (!writer->Write(data, size)) {
           return 0;
         }
@@ -285,7 +294,7 @@ bool InstallOperationExecutor::ExecuteLz4diffOperation(
 
 bool InstallOperationExecutor::ExecuteSourceBsdiffOperation(
     const InstallOperation& operation,
-    std::unique_ptr<ExtentWriter> writer,
+    ExtentWriter* writer,
     FileDescriptorPtr source_fd,
     const void* data,
     size_t count) {
@@ -297,7 +306,7 @@ bool InstallOperationExecutor::ExecuteSourceBsdiffOperation(
       utils::BlocksInExtents(operation.src_extents()) * block_size_);
 
   auto dst_file = std::make_unique<BsdiffExtentFile>(
-      std::move(writer),
+      writer,
       utils::BlocksInExtents(operation.dst_extents()) * block_size_);
 
   TEST_AND_RETURN_FALSE(bsdiff::bspatch(std::move(src_file),
@@ -309,7 +318,7 @@ bool InstallOperationExecutor::ExecuteSourceBsdiffOperation(
 
 bool InstallOperationExecutor::ExecutePuffDiffOperation(
     const InstallOperation& operation,
-    std::unique_ptr<ExtentWriter> writer,
+    ExtentWriter* writer,
     FileDescriptorPtr source_fd,
     const void* data,
     size_t count) {
@@ -321,7 +330,7 @@ bool InstallOperationExecutor::ExecutePuffDiffOperation(
       utils::BlocksInExtents(operation.src_extents()) * block_size_));
 
   puffin::UniqueStreamPtr dst_stream(new PuffinExtentStream(
-      std::move(writer),
+      writer,
       utils::BlocksInExtents(operation.dst_extents()) * block_size_));
 
   constexpr size_t kMaxCacheSize = 5 * 1024 * 1024;  // Total 5MB cache.
@@ -336,7 +345,7 @@ bool InstallOperationExecutor::ExecutePuffDiffOperation(
 
 bool InstallOperationExecutor::ExecuteZucchiniOperation(
     const InstallOperation& operation,
-    std::unique_ptr<ExtentWriter> writer,
+    ExtentWriter* writer,
     FileDescriptorPtr source_fd,
     const void* data,
     size_t count) {
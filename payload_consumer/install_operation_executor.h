@@ -48,22 +48,22 @@ class InstallOperationExecutor {
 
  private:
   bool ExecuteSourceBsdiffOperation(const InstallOperation& operation,
-                                    std::unique_ptr<ExtentWriter> writer,
+                                    ExtentWriter* writer,
                                     FileDescriptorPtr source_fd,
                                     const void* data,
                                     size_t count);
   bool ExecutePuffDiffOperation(const InstallOperation& operation,
-                                std::unique_ptr<ExtentWriter> writer,
+                                ExtentWriter* writer,
                                 FileDescriptorPtr source_fd,
                                 const void* data,
                                 size_t count);
   bool ExecuteZucchiniOperation(const InstallOperation& operation,
-                                std::unique_ptr<ExtentWriter> writer,
+                                ExtentWriter* writer,
                                 FileDescriptorPtr source_fd,
                                 const void* data,
                                 size_t count);
   bool ExecuteLz4diffOperation(const InstallOperation& operation,
-                               std::unique_ptr<ExtentWriter> writer,
+                               ExtentWriter* writer,
                                FileDescriptorPtr source_fd,
                                const void* data,
                                size_t count);
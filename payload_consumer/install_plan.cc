@@ -104,6 +104,8 @@ string InstallPlan::ToString() const {
           {"rollback_data_save_requested",
            utils::ToString(rollback_data_save_requested)},
           {"write_verity", utils::ToString(write_verity)},
+          {"hash_written_data", utils::ToString(hash_written_data)},
+          {"parallel_apply", utils::ToString(parallel_apply)},
       },
       "\n"));
 
@@ -125,6 +127,7 @@ string InstallPlan::ToString() const {
             {"postinstall_path", partition.postinstall_path},
             {"readonly_target_path", partition.readonly_target_path},
             {"filesystem_type", partition.filesystem_type},
+            {"written_size", base::NumberToString(partition.written_size)},
         },
         "\n  "));
   }
@@ -158,6 +158,13 @@ struct InstallPlan {
     uint64_t fec_size{0};
     uint32_t fec_roots{0};
 
+    // The HashCalculator context of the hash of the first |written_size|
+    // bytes of the target partition, computed while applying the update when
+    // |hash_written_data| is set. FilesystemVerifierAction resumes hashing the
+    // partition from there.
+    uint64_t written_size{0};
+    std::string written_hash_context;
+
     bool ParseVerityConfig(const PartitionUpdate&);
   };
   std::vector<Partition> partitions;
@@ -188,6 +195,14 @@ struct InstallPlan {
   // False otherwise.
   bool write_verity{true};
 
+  // True if the data written to the target partitions should be hashed while
+  // the update is applied, so it doesn't have to be read again to verify them.
+  bool hash_written_data{false};
+
+  // True if the partitions of a payload read from a local file should be
+  // applied in parallel, each one reading its operations' data from the file.
+  bool parallel_apply{false};
+
   // If not blank, a base-64 encoded representation of the PEM-encoded
   // public key in the response.
   std::string public_key_rsa;
@@ -58,6 +58,7 @@ run_post_install: true
 is_rollback: false
 rollback_data_save_requested: false
 write_verity: true
+hash_written_data: false
 Partition: foo-partition_name
   source_size: 0
   source_path: foo-source-path
@@ -69,6 +70,7 @@ Partition: foo-partition_name
   postinstall_path: foo-path
   readonly_target_path: mountable-device
   filesystem_type: foo-type
+  written_size: 0
 Payload: 0
   urls: (url1,url2)
   size: 0
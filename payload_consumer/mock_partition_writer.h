@@ -17,6 +17,8 @@
 #ifndef UPDATE_ENGINE_MOCK_PARTITION_WRITER_H_
 #define UPDATE_ENGINE_MOCK_PARTITION_WRITER_H_
 
+#include <vector>
+
 #include <gmock/gmock.h>
 
 #include "common/error_code.h"
@@ -53,10 +55,18 @@ class MockPartitionWriter : public PartitionWriter {
               PerformSourceCopyOperation,
               (const InstallOperation&, ErrorCode*),
               (override));
+  // Batches go through the mocked PerformSourceCopyOperation().
+  bool PerformSourceCopyOperations(
+      const std::vector<const InstallOperation*>& operations,
+      ErrorCode* error) override {
+    return PartitionWriterInterface::PerformSourceCopyOperations(operations,
+                                                                 error);
+  }
   MOCK_METHOD(bool,
               PerformDiffOperation,
               (const InstallOperation&, ErrorCode*, const void*, size_t),
               (override));
+  MOCK_METHOD(bool, IsNoOpOperation, (const InstallOperation&), (override));
 };
 
 }  // namespace chromeos_update_engine
@@ -84,6 +84,25 @@ bool DiscardPartitionTail(const FileDescriptorPtr& fd, uint64_t data_size) {
   return false;
 }
 
+// Appends |extents_to_add| to |extents| in order, merging the extents that
+// touch the previous one.
+void AppendExtents(
+    google::protobuf::RepeatedPtrField<Extent>* extents,
+    const google::protobuf::RepeatedPtrField<Extent>& extents_to_add) {
+  for (const Extent& extent : extents_to_add) {
+    if (extent.num_blocks() == 0)
+      continue;
+    if (!extents->empty()) {
+      Extent* last = extents->Mutable(extents->size() - 1);
+      if (last->start_block() + last->num_blocks() == extent.start_block()) {
+        last->set_num_blocks(last->num_blocks() + extent.num_blocks());
+        continue;
+      }
+    }
+    *extents->Add() = extent;
+  }
+}
+
 }  // namespace
 
 // Opens path for read/write. On success returns an open FileDescriptor
@@ -185,6 +204,8 @@ bool PartitionWriter::Init(const InstallPlan* install_plan,
   // Discard the end of the partition, but ignore failures.
   DiscardPartitionTail(target_fd_, install_part_.target_size);
 
+  if (install_plan->hash_written_data)
+    written_data_hasher_ = std::make_unique<WrittenDataHasher>(block_size_);
   return true;
 }
 
@@ -199,58 +220,101 @@ bool PartitionWriter::PerformReplaceOperation(const InstallOperation& operation,
 
 bool PartitionWriter::PerformZeroOrDiscardOperation(
     const InstallOperation& operation) {
-#ifdef BLKZEROOUT
-  int request =
-      (operation.type() == InstallOperation::ZERO ? BLKZEROOUT : BLKDISCARD);
-#else   // !defined(BLKZEROOUT)
+  // DirectExtentWriter issues BLKZEROOUT/BLKDISCARD and only falls back to
+  // writing zeros for the ranges where that fails.
   auto writer = CreateBaseExtentWriter();
   return install_op_executor_.ExecuteZeroOrDiscardOperation(operation,
-                                                            writer.get());
-#endif  // !defined(BLKZEROOUT)
-
-  for (const Extent& extent : operation.dst_extents()) {
-    const uint64_t start = extent.start_block() * block_size_;
-    const uint64_t length = extent.num_blocks() * block_size_;
-    int result = 0;
-    if (target_fd_->BlkIoctl(request, start, length, &result) && result == 0) {
-      continue;
-    }
-    // In case of failure, we fall back to writing 0 for the entire operation.
-    PLOG(WARNING) << "BlkIoctl failed. Falling back to write 0s for remainder "
-                     "of this operation.";
-    auto writer = CreateBaseExtentWriter();
-    return install_op_executor_.ExecuteZeroOrDiscardOperation(
-        operation, std::move(writer));
-  }
-  return true;
+                                                            std::move(writer));
 }
 
 bool PartitionWriter::PerformSourceCopyOperation(
     const InstallOperation& operation, ErrorCode* error) {
-  // The device may optimize the SOURCE_COPY operation.
-  // Being this a device-specific optimization let DynamicPartitionController
-  // decide it the operation should be skipped.
+  return PerformSourceCopyOperations({&operation}, error);
+}
+
+bool PartitionWriter::PerformSourceCopyOperations(
+    const std::vector<const InstallOperation*>& operations, ErrorCode* error) {
   const PartitionUpdate& partition = partition_update_;
 
-  InstallOperation buf;
-  const bool should_optimize = dynamic_control_->OptimizeOperation(
-      partition.partition_name(), operation, &buf);
-  const InstallOperation& optimized = should_optimize ? buf : operation;
-
-  // Invoke ChooseSourceFD with original operation, so that it can properly
-  // verify source hashes. Optimized operation might contain a smaller set of
-  // extents, or completely empty.
-  auto source_fd = ChooseSourceFD(operation, error);
-  if (source_fd == nullptr) {
-    LOG(ERROR) << "Unrecoverable source hash mismatch found on partition "
-               << partition.partition_name()
-               << " extents: " << ExtentsToString(operation.src_extents());
-    return false;
+  // The blocks to copy from |source_fd|, merged across operations.
+  InstallOperation merged;
+  merged.set_type(InstallOperation::SOURCE_COPY);
+  FileDescriptorPtr source_fd;
+  for (const InstallOperation* operation : operations) {
+    // The device may optimize the SOURCE_COPY operation.
+    // Being this a device-specific optimization let
+    // DynamicPartitionController decide it the operation should be skipped.
+    InstallOperation buf;
+    const bool should_optimize = dynamic_control_->OptimizeOperation(
+        partition.partition_name(), *operation, &buf);
+    const InstallOperation& optimized = should_optimize ? buf : *operation;
+
+    // Invoke ChooseSourceFD with original operation, so that it can properly
+    // verify source hashes. Optimized operation might contain a smaller set
+    // of extents, or completely empty.
+    auto op_source_fd = ChooseSourceFD(*operation, error);
+    if (op_source_fd == nullptr) {
+      LOG(ERROR) << "Unrecoverable source hash mismatch found on partition "
+                 << partition.partition_name()
+                 << " extents: " << ExtentsToString(operation->src_extents());
+      return false;
+    }
+    // Blocks are only matched across operations if each one copies as many
+    // as it reads.
+    TEST_AND_RETURN_FALSE(utils::BlocksInExtents(optimized.src_extents()) ==
+                          utils::BlocksInExtents(optimized.dst_extents()));
+
+    if (op_source_fd != source_fd) {
+      TEST_AND_RETURN_FALSE(CopySourceBlocks(merged, source_fd));
+      merged.clear_src_extents();
+      merged.clear_dst_extents();
+      source_fd = op_source_fd;
+    }
+    AppendExtents(merged.mutable_src_extents(), optimized.src_extents());
+    AppendExtents(merged.mutable_dst_extents(), optimized.dst_extents());
   }
+  return CopySourceBlocks(merged, source_fd);
+}
 
+bool PartitionWriter::CopySourceBlocks(const InstallOperation& operation,
+                                       FileDescriptorPtr source_fd) {
+  if (operation.dst_extents().empty())
+    return true;
+  if (!copy_file_range_failed_) {
+    if (fd_utils::CopyFileRangeExtents(source_fd,
+                                       operation.src_extents(),
+                                       target_fd_,
+                                       operation.dst_extents(),
+                                       block_size_)) {
+      if (written_data_hasher_)
+        written_data_hasher_->RecordWrite(operation.dst_extents());
+      return true;
+    }
+    // Not supported by these files. Copying through memory writes the
+    // blocks again anyway.
+    copy_file_range_failed_ = true;
+  }
   auto writer = CreateBaseExtentWriter();
   return install_op_executor_.ExecuteSourceCopyOperation(
-      optimized, std::move(writer), source_fd);
+      operation, std::move(writer), source_fd);
+}
+
+bool PartitionWriter::IsNoOpOperation(const InstallOperation& operation) {
+  if (operation.type() != InstallOperation::SOURCE_COPY)
+    return false;
+  InstallOperation optimized;
+  return dynamic_control_->OptimizeOperation(
+             partition_update_.partition_name(), operation, &optimized) &&
+         optimized.dst_extents().empty();
+}
+
+bool PartitionWriter::GetWrittenDataHash(uint64_t* size,
+                                         std::string* context) const {
+  if (!written_data_hasher_)
+    return false;
+  *size = written_data_hasher_->hashed_size();
+  *context = written_data_hasher_->GetContext();
+  return true;
 }
 
 bool PartitionWriter::PerformDiffOperation(const InstallOperation& operation,
@@ -292,7 +356,12 @@ void PartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
 }
 
 std::unique_ptr<ExtentWriter> PartitionWriter::CreateBaseExtentWriter() {
-  return std::make_unique<DirectExtentWriter>(target_fd_);
+  // Stage up to |kCacheSize| bytes so writes to fragmented dst extents are
+  // sorted and merged into few vectored writes.
+  auto writer = std::make_unique<DirectExtentWriter>(target_fd_, kCacheSize);
+  if (written_data_hasher_)
+    return written_data_hasher_->WrapExtentWriter(std::move(writer));
+  return writer;
 }
 
 bool PartitionWriter::ValidateSourceHash(const InstallOperation& operation,
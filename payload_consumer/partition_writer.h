@@ -31,6 +31,7 @@
 #include "update_engine/payload_consumer/install_plan.h"
 #include "update_engine/payload_consumer/partition_writer_interface.h"
 #include "update_engine/payload_consumer/verified_source_fd.h"
+#include "update_engine/payload_consumer/written_data_hasher.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -80,11 +81,21 @@ class PartitionWriter : public PartitionWriterInterface {
 
   [[nodiscard]] bool PerformSourceCopyOperation(
       const InstallOperation& operation, ErrorCode* error) override;
+  // Merges the blocks copied by consecutive operations, and copies them with
+  // copy_file_range() when the source and target are regular files on the
+  // same filesystem.
+  [[nodiscard]] bool PerformSourceCopyOperations(
+      const std::vector<const InstallOperation*>& operations,
+      ErrorCode* error) override;
   [[nodiscard]] bool PerformDiffOperation(const InstallOperation& operation,
                                           ErrorCode* error,
                                           const void* data,
                                           size_t count) override;
 
+  bool IsNoOpOperation(const InstallOperation& operation) override;
+
+  bool GetWrittenDataHash(uint64_t* size, std::string* context) const override;
+
   // |DeltaPerformer| calls this when all Install Ops are sent to partition
   // writer. No |Perform*Operation| methods will be called in the future, and
   // the partition writer is expected to be closed soon.
@@ -101,6 +112,10 @@ class PartitionWriter : public PartitionWriterInterface {
 
   [[nodiscard]] std::unique_ptr<ExtentWriter> CreateBaseExtentWriter();
 
+  // Copies the blocks of the SOURCE_COPY |operation| from |source_fd|.
+  [[nodiscard]] bool CopySourceBlocks(const InstallOperation& operation,
+                                      FileDescriptorPtr source_fd);
+
   const PartitionUpdate& partition_update_;
   const InstallPlan::Partition& install_part_;
   DynamicPartitionControlInterface* dynamic_control_;
@@ -112,6 +127,10 @@ class PartitionWriter : public PartitionWriterInterface {
   FileDescriptorPtr target_fd_;
   const bool interactive_;
   const size_t block_size_;
+  // Whether copy_file_range() failed, so it isn't tried again.
+  bool copy_file_range_failed_{false};
+  // Hashes the data written, if InstallPlan::hash_written_data is set.
+  std::unique_ptr<WrittenDataHasher> written_data_hasher_;
 
   // This instance handles decompression/bsdfif/puffdiff. It's responsible for
   // constructing data which should be written to target partition, actual
@@ -19,6 +19,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include <brillo/secure_blob.h>
 #include <gtest/gtest_prod.h>
@@ -59,12 +60,41 @@ class PartitionWriterInterface {
 
   [[nodiscard]] virtual bool PerformSourceCopyOperation(
       const InstallOperation& operation, ErrorCode* error) = 0;
+  // Performs the SOURCE_COPY |operations| in order, as a batch whose reads
+  // and writes may be merged. |error| is set as in
+  // PerformSourceCopyOperation(). On failure, any of them may have been
+  // applied, so the whole batch must be applied again.
+  [[nodiscard]] virtual bool PerformSourceCopyOperations(
+      const std::vector<const InstallOperation*>& operations,
+      ErrorCode* error) {
+    for (const InstallOperation* operation : operations) {
+      if (!PerformSourceCopyOperation(*operation, error))
+        return false;
+    }
+    return true;
+  }
   [[nodiscard]] virtual bool PerformDiffOperation(
       const InstallOperation& operation,
       ErrorCode* error,
       const void* data,
       size_t count) = 0;
 
+  // Returns whether applying |operation| writes nothing to the target
+  // partition on this device, e.g. a SOURCE_COPY whose blocks are already in
+  // place. Such an operation still verifies its source when applied. Only
+  // valid after Init().
+  virtual bool IsNoOpOperation(const InstallOperation& operation) {
+    return false;
+  }
+
+  // Returns the HashCalculator |context| of the hash of the first |size| bytes
+  // of the target partition, computed as they were written when
+  // InstallPlan::hash_written_data is set. Returns false if the written data
+  // isn't hashed.
+  virtual bool GetWrittenDataHash(uint64_t* size, std::string* context) const {
+    return false;
+  }
+
   // |DeltaPerformer| calls this when all Install Ops are sent to partition
   // writer. No |Perform*Operation| methods will be called in the future, and
   // the partition writer is expected to be closed soon.
@@ -15,6 +15,7 @@
 //
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include <brillo/secure_blob.h>
@@ -186,6 +187,54 @@ TEST_F(PartitionWriterTest, ErrorCorrectionSourceCopyFallbackTest) {
   EXPECT_EQ(1U, GetSourceEccRecoveredFailures());
 }
 
+// Test that a batch of SOURCE_COPY operations copies each block to the right
+// place, with the blocks of adjacent operations merged.
+TEST_F(PartitionWriterTest, PerformSourceCopyOperationsTest) {
+  constexpr size_t kNumBlocks = 8;
+  brillo::Blob source_data(kNumBlocks * kBlockSize);
+  test_utils::FillWithData(&source_data);
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(source_partition.path(), source_data));
+  install_part_.source_size = source_data.size();
+  install_part_.target_size = source_data.size();
+
+  // Moves the first half of the partition after the second half.
+  const std::vector<std::pair<Extent, Extent>> copies = {
+      {ExtentForRange(0, 2), ExtentForRange(4, 2)},
+      {ExtentForRange(2, 1), ExtentForRange(6, 1)},
+      {ExtentForRange(3, 1), ExtentForRange(7, 1)},
+      {ExtentForRange(4, 4), ExtentForRange(0, 4)},
+  };
+  std::vector<InstallOperation> ops(copies.size());
+  std::vector<const InstallOperation*> op_ptrs;
+  for (size_t i = 0; i < copies.size(); i++) {
+    ops[i].set_type(InstallOperation::SOURCE_COPY);
+    *ops[i].add_src_extents() = copies[i].first;
+    *ops[i].add_dst_extents() = copies[i].second;
+    brillo::Blob src_hash;
+    ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+        source_data.data() + copies[i].first.start_block() * kBlockSize,
+        copies[i].first.num_blocks() * kBlockSize,
+        &src_hash));
+    ops[i].set_src_sha256_hash(src_hash.data(), src_hash.size());
+    op_ptrs.push_back(&ops[i]);
+  }
+
+  ASSERT_TRUE(writer_.Init(&install_plan_, true, 0));
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_TRUE(writer_.PerformSourceCopyOperations(op_ptrs, &error));
+  writer_.CheckpointUpdateProgress(ops.size());
+
+  brillo::Blob expected_data(source_data.begin() + 4 * kBlockSize,
+                             source_data.end());
+  expected_data.insert(expected_data.end(),
+                       source_data.begin(),
+                       source_data.begin() + 4 * kBlockSize);
+  brillo::Blob output_data;
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  EXPECT_EQ(expected_data, output_data);
+}
+
 TEST_F(PartitionWriterTest, ChooseSourceFDTest) {
   constexpr size_t kSourceSize = 4 * 4096;
   ScopedTempFile source("Source-XXXXXX");
@@ -32,4 +32,9 @@ bool SnapshotExtentWriter::WriteExtent(const void* bytes,
       extent.start_block(), bytes, extent.num_blocks() * block_size);
 }
 
+bool SnapshotExtentWriter::ZeroExtent(const Extent& extent,
+                                      size_t block_size) {
+  return cow_writer_->AddZeroBlocks(extent.start_block(), extent.num_blocks());
+}
+
 }  // namespace chromeos_update_engine
@@ -34,6 +34,8 @@ class SnapshotExtentWriter final : public BlockExtentWriter {
   bool WriteExtent(const void* bytes,
                    const Extent& extent,
                    size_t block_size) override;
+  // Emits COW_ZERO operations, no data is stored in the COW image.
+  bool ZeroExtent(const Extent& extent, size_t block_size) override;
 
  private:
   android::snapshot::ICowWriter* cow_writer_;
@@ -193,4 +193,17 @@ TEST_F(SnapshotExtentWriterTest, WriteAcrossBlockBoundary) {
                      cow_writer_.operations_[125].data.end());
   ASSERT_EQ(buf, actual_data);
 }
+
+TEST_F(SnapshotExtentWriterTest, WriteZerosEmitsZeroBlocks) {
+  google::protobuf::RepeatedPtrField<Extent> extents;
+  AddExtent(&extents, 123, 1);
+  AddExtent(&extents, 125, 2);
+  writer_.Init(extents, kBlockSize);
+
+  ASSERT_TRUE(writer_.WriteZeros(kBlockSize * 3, false));
+  ASSERT_EQ(cow_writer_.operations_.size(), 2U);
+  ASSERT_EQ(cow_writer_.operations_[123].type, FakeCowWriter::CowOp::COW_ZERO);
+  ASSERT_EQ(cow_writer_.operations_[125].type, FakeCowWriter::CowOp::COW_ZERO);
+  ASSERT_EQ(cow_writer_.GetCowSize(), 0U);
+}
 }  // namespace chromeos_update_engine
@@ -124,6 +124,8 @@ bool VABCPartitionWriter::Init(const InstallPlan* install_plan,
   cow_writer_ = dynamic_control_->OpenCowWriter(
       install_part_.name, source_path, install_plan->is_resume);
   TEST_AND_RETURN_FALSE(cow_writer_ != nullptr);
+  if (install_plan->hash_written_data)
+    written_data_hasher_ = std::make_unique<WrittenDataHasher>(block_size_);
 
   // ===== Resume case handling code goes here ====
   // It is possible that the SOURCE_COPY are already written but
@@ -235,16 +237,31 @@ bool VABCPartitionWriter::WriteMergeSequence(
 }
 
 std::unique_ptr<ExtentWriter> VABCPartitionWriter::CreateBaseExtentWriter() {
-  return std::make_unique<SnapshotExtentWriter>(cow_writer_.get());
+  return MaybeHashWrites(
+      std::make_unique<SnapshotExtentWriter>(cow_writer_.get()));
+}
+
+std::unique_ptr<ExtentWriter> VABCPartitionWriter::MaybeHashWrites(
+    std::unique_ptr<ExtentWriter> writer) {
+  if (written_data_hasher_)
+    return written_data_hasher_->WrapExtentWriter(std::move(writer));
+  return writer;
+}
+
+bool VABCPartitionWriter::GetWrittenDataHash(uint64_t* size,
+                                             std::string* context) const {
+  if (!written_data_hasher_)
+    return false;
+  *size = written_data_hasher_->hashed_size();
+  *context = written_data_hasher_->GetContext();
+  return true;
 }
 
 [[nodiscard]] bool VABCPartitionWriter::PerformZeroOrDiscardOperation(
     const InstallOperation& operation) {
-  for (const auto& extent : operation.dst_extents()) {
-    TEST_AND_RETURN_FALSE(
-        cow_writer_->AddZeroBlocks(extent.start_block(), extent.num_blocks()));
-  }
-  return true;
+  // SnapshotExtentWriter turns these into COW_ZERO operations.
+  auto writer = CreateBaseExtentWriter();
+  return executor_.ExecuteZeroOrDiscardOperation(operation, std::move(writer));
 }
 
 [[nodiscard]] bool VABCPartitionWriter::PerformSourceCopyOperation(
@@ -253,6 +270,11 @@ std::unique_ptr<ExtentWriter> VABCPartitionWriter::CreateBaseExtentWriter() {
   // we still want to verify that all blocks contain expected data.
   auto source_fd = verified_source_fd_.ChooseSourceFD(operation, error);
   TEST_AND_RETURN_FALSE(source_fd != nullptr);
+  // The blocks copied by COW_COPY operations were written before any other
+  // operation, but count them as written now, which can only make the hashed
+  // prefix shorter.
+  if (written_data_hasher_)
+    written_data_hasher_->RecordWrite(operation.dst_extents());
   std::vector<CowOperation> converted;
 
   const auto& src_extents = operation.src_extents();
@@ -291,6 +313,18 @@ std::unique_ptr<ExtentWriter> VABCPartitionWriter::CreateBaseExtentWriter() {
   return true;
 }
 
+bool VABCPartitionWriter::IsNoOpOperation(const InstallOperation& operation) {
+  if (operation.type() != InstallOperation::SOURCE_COPY)
+    return false;
+  BlockIterator it1{operation.src_extents()};
+  BlockIterator it2{operation.dst_extents()};
+  for (; !it1.is_end() && !it2.is_end(); ++it1, ++it2) {
+    if (*it1 != *it2 && !copy_blocks_.ContainsBlock(*it2))
+      return false;
+  }
+  return true;
+}
+
 bool VABCPartitionWriter::PerformReplaceOperation(const InstallOperation& op,
                                                   const void* data,
                                                   size_t count) {
@@ -311,8 +345,8 @@ bool VABCPartitionWriter::PerformDiffOperation(
   TEST_AND_RETURN_FALSE(source_fd->IsOpen());
 
   std::unique_ptr<ExtentWriter> writer =
-      IsXorEnabled() ? std::make_unique<XORExtentWriter>(
-                           operation, source_fd, cow_writer_.get(), xor_map_)
+      IsXorEnabled() ? MaybeHashWrites(std::make_unique<XORExtentWriter>(
+                           operation, source_fd, cow_writer_.get(), xor_map_))
                      : CreateBaseExtentWriter();
   return executor_.ExecuteDiffOperation(
       operation, std::move(writer), source_fd, data, count);
@@ -29,6 +29,7 @@
 #include "update_engine/payload_consumer/install_plan.h"
 #include "update_engine/payload_consumer/partition_writer_interface.h"
 #include "update_engine/payload_consumer/verified_source_fd.h"
+#include "update_engine/payload_consumer/written_data_hasher.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
 namespace chromeos_update_engine {
@@ -60,6 +61,12 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
                                           const void* data,
                                           size_t count) override;
 
+  // SOURCE_COPY operations whose blocks are copied in place or by a COW_COPY
+  // merge operation write nothing.
+  bool IsNoOpOperation(const InstallOperation& operation) override;
+
+  bool GetWrittenDataHash(uint64_t* size, std::string* context) const override;
+
   void CheckpointUpdateProgress(size_t next_op_index) override;
 
   [[nodiscard]] bool FinishedInstallOps() override;
@@ -74,6 +81,9 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
   std::unique_ptr<android::snapshot::ISnapshotWriter> cow_writer_;
 
   [[nodiscard]] std::unique_ptr<ExtentWriter> CreateBaseExtentWriter();
+  // Wraps |writer| to hash the data it writes, if needed.
+  [[nodiscard]] std::unique_ptr<ExtentWriter> MaybeHashWrites(
+      std::unique_ptr<ExtentWriter> writer);
 
   const PartitionUpdate& partition_update_;
   const InstallPlan::Partition& install_part_;
@@ -86,6 +96,8 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
   VerifiedSourceFd verified_source_fd_;
   ExtentMap<const CowMergeOperation*, ExtentLess> xor_map_;
   ExtentRanges copy_blocks_;
+  // Hashes the data written, if InstallPlan::hash_written_data is set.
+  std::unique_ptr<WrittenDataHasher> written_data_hasher_;
 };
 
 }  // namespace chromeos_update_engine
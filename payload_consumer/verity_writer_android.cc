@@ -35,6 +35,12 @@ extern "C" {
 
 namespace chromeos_update_engine {
 
+namespace {
+// Maximum size of the FEC data kept in memory to encode it while the data is
+// streamed, this covers about 4 GiB of data with 2 roots.
+const uint64_t kMaxStreamingFECSize = 32 * (1 << 20);
+}  // namespace
+
 bool IncrementalEncodeFEC::Init(const uint64_t _data_offset,
                                 const uint64_t _data_size,
                                 const uint64_t _fec_offset,
@@ -150,6 +156,102 @@ bool IncrementalEncodeFEC::Finished() const {
   return current_step_ == EncodeFECStep::kComplete;
 }
 
+bool StreamingEncodeFEC::Init(uint64_t data_size,
+                              uint64_t fec_size,
+                              uint32_t fec_roots,
+                              uint32_t block_size) {
+  Reset();
+  // fec_ecc_interleave() spreads the rs blocks in units of FEC_BLOCKSIZE.
+  if (fec_size == 0 || fec_size > kMaxStreamingFECSize ||
+      block_size != FEC_BLOCKSIZE) {
+    return false;
+  }
+  TEST_AND_RETURN_FALSE(data_size % block_size == 0);
+  TEST_AND_RETURN_FALSE(fec_roots > 0 && fec_roots < FEC_RSM);
+  // This is the N in RS(M, N), which is the number of bytes for each rs block.
+  size_t rs_n = FEC_RSM - fec_roots;
+  size_t num_rounds = utils::DivRoundUp(data_size / block_size, rs_n);
+  TEST_AND_RETURN_FALSE(num_rounds * fec_roots * block_size == fec_size);
+
+  std::unique_ptr<void, decltype(&free_rs_char)> rs_char(
+      init_rs_char(FEC_PARAMS(fec_roots)), &free_rs_char);
+  TEST_AND_RETURN_FALSE(rs_char != nullptr);
+  // Encode each bit at each position of an rs block, the parity of the other
+  // byte values is the sum of the parity of their bits.
+  parity_table_.resize(rs_n * 256 * fec_roots, 0);
+  brillo::Blob rs_block(rs_n, 0);
+  for (size_t j = 0; j < rs_n; j++) {
+    uint8_t* parity = parity_table_.data() + j * 256 * fec_roots;
+    for (size_t bit = 1; bit < 256; bit <<= 1) {
+      rs_block[j] = static_cast<uint8_t>(bit);
+      encode_rs_char(rs_char.get(), rs_block.data(), parity + bit * fec_roots);
+      for (size_t value = bit + 1; value < 2 * bit; value++) {
+        for (size_t r = 0; r < fec_roots; r++) {
+          parity[value * fec_roots + r] = parity[bit * fec_roots + r] ^
+                                          parity[(value - bit) * fec_roots + r];
+        }
+      }
+    }
+    rs_block[j] = 0;
+  }
+  fec_.resize(fec_size, 0);
+  data_size_ = data_size;
+  num_rounds_ = num_rounds;
+  fec_roots_ = fec_roots;
+  block_size_ = block_size;
+  return true;
+}
+
+void StreamingEncodeFEC::Update(uint64_t offset,
+                                const uint8_t* buffer,
+                                size_t size) {
+  if (fec_.empty() || size == 0) {
+    return;
+  }
+  if (offset != encoded_size_ || offset + size > data_size_) {
+    LOG(INFO) << "FEC data not streamed in order, expected at: "
+              << encoded_size_ << " actual at: " << offset
+              << ", it will be read again to encode FEC.";
+    Reset();
+    return;
+  }
+  while (size > 0) {
+    const uint64_t block = encoded_size_ / block_size_;
+    const size_t block_offset = encoded_size_ % block_size_;
+    const size_t count = std::min(size, block_size_ - block_offset);
+    // This block is at position |block / num_rounds_| of the rs blocks of
+    // round |block % num_rounds_|, with one rs block for each of its bytes.
+    const uint8_t* parity_table =
+        parity_table_.data() + block / num_rounds_ * 256 * fec_roots_;
+    uint8_t* fec = fec_.data() +
+                   ((block % num_rounds_) * block_size_ + block_offset) *
+                       fec_roots_;
+    for (size_t k = 0; k < count; k++, fec += fec_roots_) {
+      if (buffer[k] == 0) {
+        continue;
+      }
+      const uint8_t* parity = parity_table + buffer[k] * fec_roots_;
+      for (size_t r = 0; r < fec_roots_; r++) {
+        fec[r] ^= parity[r];
+      }
+    }
+    buffer += count;
+    size -= count;
+    encoded_size_ += count;
+  }
+}
+
+bool StreamingEncodeFEC::Finished() const {
+  return !fec_.empty() && encoded_size_ == data_size_;
+}
+
+void StreamingEncodeFEC::Reset() {
+  brillo::Blob().swap(parity_table_);
+  brillo::Blob().swap(fec_);
+  data_size_ = 0;
+  encoded_size_ = 0;
+}
+
 namespace verity_writer {
 std::unique_ptr<VerityWriterInterface> CreateVerityWriter() {
   return std::make_unique<VerityWriterAndroid>();
@@ -166,6 +268,14 @@ bool VerityWriterAndroid::Init(const InstallPlan::Partition& partition) {
                                         partition_->fec_roots,
                                         partition_->block_size,
                                         false /* verify_mode */));
+  if (partition_->fec_size != 0 &&
+      streamingFEC_.Init(partition_->fec_data_size,
+                         partition_->fec_size,
+                         partition_->fec_roots,
+                         partition_->block_size)) {
+    LOG(INFO) << "Encoding FEC while reading the partition";
+  }
+  streamed_fec_written_ = false;
   hash_tree_written_ = false;
   if (partition_->hash_tree_size != 0) {
     auto hash_function =
@@ -223,10 +333,67 @@ bool VerityWriterAndroid::Update(const uint64_t offset,
       }
     }
   }
+  if (partition_->fec_size != 0) {
+    // The hash tree is encoded as it's written, the data on disk there isn't
+    // up to date yet.
+    uint64_t end = partition_->fec_data_offset + partition_->fec_data_size;
+    if (partition_->hash_tree_size != 0 && partition_->hash_tree_offset < end &&
+        partition_->hash_tree_offset + partition_->hash_tree_size >
+            partition_->fec_data_offset) {
+      end = std::max(partition_->hash_tree_offset, partition_->fec_data_offset);
+    }
+    StreamFECData(offset, buffer, size, end);
+  }
   total_offset_ += size;
 
   return true;
 }
+
+void VerityWriterAndroid::StreamFECData(uint64_t offset,
+                                        const uint8_t* buffer,
+                                        size_t size,
+                                        uint64_t end) {
+  const uint64_t start_offset = std::max(offset, partition_->fec_data_offset);
+  const uint64_t end_offset = std::min(offset + size, end);
+  if (start_offset < end_offset) {
+    streamingFEC_.Update(start_offset - partition_->fec_data_offset,
+                         buffer + start_offset - offset,
+                         end_offset - start_offset);
+  }
+}
+
+bool VerityWriterAndroid::WriteHashTree(FileDescriptor* write_fd) {
+  TEST_AND_RETURN_FALSE(hash_tree_builder_->BuildHashTree());
+  TEST_AND_RETURN_FALSE_ERRNO(
+      write_fd->Seek(partition_->hash_tree_offset, SEEK_SET));
+  const uint64_t fec_data_end =
+      partition_->fec_data_offset + partition_->fec_data_size;
+  uint64_t offset = partition_->hash_tree_offset;
+  auto success = hash_tree_builder_->WriteHashTree(
+      [this, write_fd, fec_data_end, &offset](auto data, auto size) {
+        StreamFECData(offset, data, size, fec_data_end);
+        offset += size;
+        return utils::WriteAll(write_fd, data, size);
+      });
+  // hashtree builder already prints error messages.
+  TEST_AND_RETURN_FALSE(success);
+  hash_tree_builder_.reset();
+  return true;
+}
+
+bool VerityWriterAndroid::WriteStreamedFEC(FileDescriptor* write_fd) {
+  const brillo::Blob& fec = streamingFEC_.fec();
+  TEST_AND_RETURN_FALSE_ERRNO(write_fd->Seek(partition_->fec_offset,
+                                             SEEK_SET) != -1);
+  if (!utils::WriteAll(write_fd, fec.data(), fec.size())) {
+    PLOG(ERROR) << "EncodeFEC write() failed";
+    return false;
+  }
+  TEST_AND_RETURN_FALSE(write_fd->Flush());
+  streamingFEC_.Reset();
+  streamed_fec_written_ = true;
+  return true;
+}
 bool VerityWriterAndroid::Finalize(FileDescriptor* read_fd,
                                    FileDescriptor* write_fd) {
   const auto hash_tree_data_end =
@@ -242,18 +409,13 @@ bool VerityWriterAndroid::Finalize(FileDescriptor* read_fd,
   LOG(INFO) << "Writing verity hash tree to "
             << partition_->readonly_target_path;
   if (hash_tree_builder_) {
-    TEST_AND_RETURN_FALSE(hash_tree_builder_->BuildHashTree());
-    TEST_AND_RETURN_FALSE_ERRNO(
-        write_fd->Seek(partition_->hash_tree_offset, SEEK_SET));
-    auto success =
-        hash_tree_builder_->WriteHashTree([write_fd](auto data, auto size) {
-          return utils::WriteAll(write_fd, data, size);
-        });
-    // hashtree builder already prints error messages.
-    TEST_AND_RETURN_FALSE(success);
-    hash_tree_builder_.reset();
+    TEST_AND_RETURN_FALSE(WriteHashTree(write_fd));
   }
-  if (partition_->fec_size != 0) {
+  if (partition_->fec_size != 0 && streamingFEC_.Finished()) {
+    LOG(INFO) << "Writing streamed verity FEC to "
+              << partition_->readonly_target_path;
+    TEST_AND_RETURN_FALSE(WriteStreamedFEC(write_fd));
+  } else if (partition_->fec_size != 0) {
     LOG(INFO) << "Writing verity FEC to " << partition_->readonly_target_path;
     TEST_AND_RETURN_FALSE(EncodeFEC(read_fd,
                                     write_fd,
@@ -285,29 +447,24 @@ bool VerityWriterAndroid::IncrementalFinalize(FileDescriptor* read_fd,
     LOG(INFO) << "Writing verity hash tree to "
               << partition_->readonly_target_path;
     if (hash_tree_builder_) {
-      TEST_AND_RETURN_FALSE(hash_tree_builder_->BuildHashTree());
-      TEST_AND_RETURN_FALSE_ERRNO(
-          write_fd->Seek(partition_->hash_tree_offset, SEEK_SET));
-      auto success =
-          hash_tree_builder_->WriteHashTree([write_fd](auto data, auto size) {
-            return utils::WriteAll(write_fd, data, size);
-          });
-      // hashtree builder already prints error messages.
-      TEST_AND_RETURN_FALSE(success);
-      hash_tree_builder_.reset();
+      TEST_AND_RETURN_FALSE(WriteHashTree(write_fd));
     }
     hash_tree_written_ = true;
     if (partition_->fec_size != 0) {
       LOG(INFO) << "Writing verity FEC to " << partition_->readonly_target_path;
     }
   }
-  if (partition_->fec_size != 0) {
+  if (partition_->fec_size != 0 && streamingFEC_.Finished()) {
+    // All the FEC data has been encoded as it was read, no need to read it
+    // again.
+    TEST_AND_RETURN_FALSE(WriteStreamedFEC(write_fd));
+  } else if (partition_->fec_size != 0) {
     TEST_AND_RETURN_FALSE(encodeFEC_.Compute(read_fd, write_fd));
   }
   return true;
 }
 bool VerityWriterAndroid::FECFinished() const {
-  if (encodeFEC_.Finished()) {
+  if (encodeFEC_.Finished() || streamed_fec_written_) {
     return true;
   }
   return false;
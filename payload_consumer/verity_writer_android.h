@@ -78,6 +78,42 @@ class IncrementalEncodeFEC {
   UnownedCachedFileDescriptor cache_fd_;
 };
 
+// StreamingEncodeFEC computes the same FEC data as IncrementalEncodeFEC, from
+// the FEC data passed to Update() in order instead of reading it back from
+// the partition. The rs block of every round takes the blocks of its column
+// from consecutive parts of the data, so all the rounds are encoded at once as
+// the data goes by, keeping the whole FEC data in memory until it's written.
+// Since RS encoding is linear, the parity of each byte is looked up in a
+// table and added to the parity of its rs block.
+class StreamingEncodeFEC {
+ public:
+  StreamingEncodeFEC() = default;
+  // Returns whether the FEC data can be streamed, it can't if it would use too
+  // much memory.
+  bool Init(uint64_t data_size,
+            uint64_t fec_size,
+            uint32_t fec_roots,
+            uint32_t block_size);
+  // Encodes the FEC data at [offset : offset + size). Streaming stops, and
+  // the memory is released, if the data isn't passed in order.
+  void Update(uint64_t offset, const uint8_t* buffer, size_t size);
+  // Returns true once all the data has been encoded, so fec() is complete.
+  bool Finished() const;
+  const brillo::Blob& fec() const { return fec_; }
+  void Reset();
+
+ private:
+  // The parity of byte value v at position j of an rs block is at
+  // |(j * 256 + v) * fec_roots_| in |parity_table_|.
+  brillo::Blob parity_table_;
+  brillo::Blob fec_;
+  uint64_t data_size_{0};
+  uint64_t encoded_size_{0};
+  size_t num_rounds_{0};
+  size_t fec_roots_{0};
+  size_t block_size_{0};
+};
+
 class VerityWriterAndroid : public VerityWriterInterface {
  public:
   VerityWriterAndroid() = default;
@@ -92,10 +128,10 @@ class VerityWriterAndroid : public VerityWriterInterface {
   bool FECFinished() const override;
   // Read [data_offset : data_offset + data_size) from |path| and encode FEC
   // data, if |verify_mode|, then compare the encoded FEC with the one in
-  // |path|, otherwise write the encoded FEC to |path|. We can't encode as we go
-  // in each Update() like hash tree, because for every rs block, its data are
-  // spreaded across entire |data_size|, unless we can cache all data in
-  // memory, we have to re-read them from disk.
+  // |path|, otherwise write the encoded FEC to |path|. This re-reads the data
+  // from disk, because for every rs block, its data are spreaded across entire
+  // |data_size|. Update() encodes it as we go with StreamingEncodeFEC instead,
+  // when the whole FEC data fits in memory.
   static bool EncodeFEC(FileDescriptor* read_fd,
                         FileDescriptor* write_fd,
                         uint64_t data_offset,
@@ -115,8 +151,23 @@ class VerityWriterAndroid : public VerityWriterInterface {
                         bool verify_mode);
 
  private:
+  // Passes the part of [offset : offset + size) in the FEC data before
+  // |end| to |streamingFEC_|.
+  void StreamFECData(uint64_t offset,
+                     const uint8_t* buffer,
+                     size_t size,
+                     uint64_t end);
+  // Writes the hash tree, which is also passed to |streamingFEC_|.
+  bool WriteHashTree(FileDescriptor* write_fd);
+  // Writes the FEC data encoded by |streamingFEC_|.
+  bool WriteStreamedFEC(FileDescriptor* write_fd);
+
   // stores the state of EncodeFEC
   IncrementalEncodeFEC encodeFEC_;
+  // Encodes the FEC data passed to Update() and written in the hash tree, if
+  // enabled. Falls back to |encodeFEC_| otherwise.
+  StreamingEncodeFEC streamingFEC_;
+  bool streamed_fec_written_ = false;
   bool hash_tree_written_ = false;
   const InstallPlan::Partition* partition_ = nullptr;
 
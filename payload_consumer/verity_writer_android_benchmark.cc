@@ -0,0 +1,206 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/verity_writer_android.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const size_t kBlockSize = 4096;
+const uint32_t kFECRoots = 2;
+// Size of the reads of FilesystemVerifierAction.
+const size_t kReadBufferSize = 128 * 1024;
+
+// Forwards to another FileDescriptor, counting the bytes read.
+class CountingFileDescriptor : public FileDescriptor {
+ public:
+  explicit CountingFileDescriptor(FileDescriptor* fd) : fd_(fd) {}
+
+  bool Open(const char* path, int flags, mode_t mode) override {
+    return fd_->Open(path, flags, mode);
+  }
+  bool Open(const char* path, int flags) override {
+    return fd_->Open(path, flags);
+  }
+  ssize_t Read(void* buf, size_t count) override {
+    ssize_t bytes_read = fd_->Read(buf, count);
+    if (bytes_read > 0)
+      bytes_read_ += bytes_read;
+    return bytes_read;
+  }
+  ssize_t Write(const void* buf, size_t count) override {
+    return fd_->Write(buf, count);
+  }
+  off64_t Seek(off64_t offset, int whence) override {
+    return fd_->Seek(offset, whence);
+  }
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    return fd_->BlkIoctl(request, start, length, result);
+  }
+  bool Flush() override { return fd_->Flush(); }
+  bool Close() override { return fd_->Close(); }
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_->IsOpen(); }
+  int Fd() override { return fd_->Fd(); }
+
+  uint64_t bytes_read() const { return bytes_read_; }
+
+ private:
+  FileDescriptor* fd_;
+  uint64_t bytes_read_{0};
+};
+
+// An image of |data_size| bytes of random data, followed by its sha256 hash
+// tree and its FEC, with the hash tree covered by the FEC like in a
+// partition built by avbtool.
+class VerityImage {
+ public:
+  explicit VerityImage(uint64_t data_size) {
+    partition_.readonly_target_path = image_file_.path();
+    partition_.block_size = kBlockSize;
+    partition_.hash_tree_algorithm = "sha256";
+    partition_.hash_tree_data_offset = 0;
+    partition_.hash_tree_data_size = data_size;
+    partition_.hash_tree_offset = data_size;
+    partition_.hash_tree_size =
+        HashTreeBuilder(kBlockSize, HashTreeBuilder::HashFunction("sha256"))
+            .CalculateSize(data_size);
+    partition_.fec_roots = kFECRoots;
+    partition_.fec_data_offset = 0;
+    partition_.fec_data_size = data_size + partition_.hash_tree_size;
+    partition_.fec_offset = partition_.fec_data_size;
+    partition_.fec_size =
+        utils::DivRoundUp(partition_.fec_data_size / kBlockSize,
+                          FEC_RSM - kFECRoots) *
+        kFECRoots * kBlockSize;
+
+    CHECK(fd_.Open(image_file_.path().c_str(), O_RDWR));
+    std::mt19937 gen(12345);
+    brillo::Blob buffer(1024 * 1024);
+    for (uint64_t offset = 0; offset < data_size; offset += buffer.size()) {
+      std::generate(buffer.begin(), buffer.end(), gen);
+      CHECK(utils::WriteAll(&fd_,
+                            buffer.data(),
+                            std::min<uint64_t>(buffer.size(),
+                                               data_size - offset)));
+    }
+    CHECK(fd_.Flush());
+  }
+
+  // Drops the image from the page cache, so it's read again from disk.
+  void DropCaches() {
+    CHECK_EQ(0, fsync(fd_.Fd()));
+    CHECK_EQ(0, posix_fadvise(fd_.Fd(), 0, 0, POSIX_FADV_DONTNEED));
+  }
+
+  // Reads the data sequentially and passes it to |writer| like
+  // FilesystemVerifierAction, then writes the verity data.
+  void WriteVerity(const InstallPlan::Partition& partition,
+                   FileDescriptor* fd) {
+    VerityWriterAndroid writer;
+    CHECK(writer.Init(partition));
+    brillo::Blob buffer(kReadBufferSize);
+    const uint64_t data_end = partition_.hash_tree_offset;
+    for (uint64_t offset = 0; offset < data_end; offset += buffer.size()) {
+      const size_t size = std::min<uint64_t>(buffer.size(), data_end - offset);
+      ssize_t bytes_read = 0;
+      CHECK(utils::PReadAll(fd, buffer.data(), size, offset, &bytes_read));
+      CHECK(writer.Update(offset, buffer.data(), size));
+    }
+    CHECK(writer.Finalize(fd, fd));
+  }
+
+  const InstallPlan::Partition& partition() const { return partition_; }
+  FileDescriptor* fd() { return &fd_; }
+
+ private:
+  ScopedTempFile image_file_{"VerityWriterAndroidBenchmark-image.XXXXXX"};
+  EintrSafeFileDescriptor fd_;
+  InstallPlan::Partition partition_;
+};
+
+// Writes the hash tree while reading the data, then encodes the FEC by reading
+// the data back in the order of the rs blocks.
+void BM_ReadBackFEC(benchmark::State& state) {
+  VerityImage image(state.range(0));
+  InstallPlan::Partition hash_tree_only = image.partition();
+  hash_tree_only.fec_size = 0;
+  const InstallPlan::Partition& partition = image.partition();
+  uint64_t bytes_read = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    image.DropCaches();
+    CountingFileDescriptor fd(image.fd());
+    state.ResumeTiming();
+    image.WriteVerity(hash_tree_only, &fd);
+    CHECK(VerityWriterAndroid::EncodeFEC(&fd,
+                                         &fd,
+                                         partition.fec_data_offset,
+                                         partition.fec_data_size,
+                                         partition.fec_offset,
+                                         partition.fec_size,
+                                         partition.fec_roots,
+                                         partition.block_size,
+                                         false /* verify_mode */));
+    bytes_read += fd.bytes_read();
+  }
+  state.counters["bytes_read"] =
+      benchmark::Counter(bytes_read, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_ReadBackFEC)
+    ->Arg(64 << 20)
+    ->Arg(1 << 30)
+    ->Unit(benchmark::kMillisecond);
+
+// Encodes the FEC from the data read to write the hash tree.
+void BM_StreamedFEC(benchmark::State& state) {
+  VerityImage image(state.range(0));
+  uint64_t bytes_read = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    image.DropCaches();
+    CountingFileDescriptor fd(image.fd());
+    state.ResumeTiming();
+    image.WriteVerity(image.partition(), &fd);
+    bytes_read += fd.bytes_read();
+  }
+  state.counters["bytes_read"] =
+      benchmark::Counter(bytes_read, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_StreamedFEC)
+    ->Arg(64 << 20)
+    ->Arg(1 << 30)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN();
@@ -18,6 +18,8 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
+
 #include <brillo/secure_blob.h>
 #include <gtest/gtest.h>
 
@@ -42,6 +44,40 @@ class VerityWriterAndroidTest : public ::testing::Test {
     partition_fd_->Open(partition_.target_path.c_str(), O_RDWR);
   }
 
+  // Sets up FEC with 2 roots of |fec_data_size| bytes from the start of the
+  // partition, followed by the FEC data, and returns the partition size.
+  uint64_t SetUpFEC(uint64_t fec_data_size) {
+    partition_.fec_data_offset = 0;
+    partition_.fec_data_size = fec_data_size;
+    partition_.fec_offset = fec_data_size;
+    partition_.fec_size =
+        utils::DivRoundUp(fec_data_size / 4096, FEC_RSM - 2) * 2 * 4096;
+    return partition_.fec_offset + partition_.fec_size;
+  }
+
+  // Passes [0 : size) of |part_data| to |verity_writer_| in chunks which
+  // aren't block aligned.
+  void UpdateInChunks(const brillo::Blob& part_data, uint64_t size) {
+    const uint64_t kChunkSize = 100000;
+    for (uint64_t offset = 0; offset < size; offset += kChunkSize) {
+      ASSERT_TRUE(verity_writer_.Update(offset,
+                                        part_data.data() + offset,
+                                        std::min(kChunkSize, size - offset)));
+    }
+  }
+
+  // Checks the FEC data written to the partition by encoding it again.
+  void ExpectFECWritten() {
+    EXPECT_TRUE(VerityWriterAndroid::EncodeFEC(partition_.target_path,
+                                               partition_.fec_data_offset,
+                                               partition_.fec_data_size,
+                                               partition_.fec_offset,
+                                               partition_.fec_size,
+                                               partition_.fec_roots,
+                                               partition_.block_size,
+                                               true /* verify_mode */));
+  }
+
   VerityWriterAndroid verity_writer_;
   InstallPlan::Partition partition_;
   FileDescriptorPtr partition_fd_;
@@ -183,4 +219,47 @@ TEST_F(VerityWriterAndroidTest, HashTreeDisabled) {
       verity_writer_.Finalize(partition_fd_.get(), partition_fd_.get()));
 }
 
+TEST_F(VerityWriterAndroidTest, StreamedFECTest) {
+  // Enough blocks for the rs blocks to span several rounds.
+  const uint64_t data_size = 600 * 4096;
+  partition_.hash_tree_algorithm = "sha256";
+  partition_.hash_tree_data_size = data_size;
+  partition_.hash_tree_offset = data_size;
+  partition_.hash_tree_size =
+      HashTreeBuilder(4096, HashTreeBuilder::HashFunction("sha256"))
+          .CalculateSize(data_size);
+  brillo::Blob part_data(
+      SetUpFEC(partition_.hash_tree_offset + partition_.hash_tree_size));
+  test_utils::FillWithData(&part_data);
+  test_utils::WriteFileVector(partition_.target_path, part_data);
+  ASSERT_TRUE(verity_writer_.Init(partition_));
+  UpdateInChunks(part_data, data_size);
+  // The FEC data, including the hash tree, was encoded while streaming, so
+  // it's all written at once.
+  ASSERT_TRUE(verity_writer_.IncrementalFinalize(partition_fd_.get(),
+                                                 partition_fd_.get()));
+  EXPECT_TRUE(verity_writer_.FECFinished());
+  ExpectFECWritten();
+}
+
+TEST_F(VerityWriterAndroidTest, PartiallyStreamedFECTest) {
+  partition_.hash_tree_data_size = 0;
+  partition_.hash_tree_size = 0;
+  const uint64_t data_size = 600 * 4096;
+  brillo::Blob part_data(SetUpFEC(data_size));
+  test_utils::FillWithData(&part_data);
+  test_utils::WriteFileVector(partition_.target_path, part_data);
+  ASSERT_TRUE(verity_writer_.Init(partition_));
+  // Only part of the FEC data is streamed, so it's read again from disk.
+  UpdateInChunks(part_data, data_size / 2);
+  ASSERT_TRUE(verity_writer_.IncrementalFinalize(partition_fd_.get(),
+                                                 partition_fd_.get()));
+  EXPECT_FALSE(verity_writer_.FECFinished());
+  while (!verity_writer_.FECFinished()) {
+    ASSERT_TRUE(verity_writer_.IncrementalFinalize(partition_fd_.get(),
+                                                   partition_fd_.get()));
+  }
+  ExpectFECWritten();
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/written_data_hasher.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// Size of the buffer of zeros hashed for ZERO operations.
+const size_t kZerosBufferSize = 64 * 1024;
+}  // namespace
+
+// Writes through another ExtentWriter, hashing the data if its extents
+// continue the hashed prefix.
+class WrittenDataHasher::HashingExtentWriter : public ExtentWriter {
+ public:
+  HashingExtentWriter(std::unique_ptr<ExtentWriter> writer,
+                      WrittenDataHasher* hasher)
+      : writer_(std::move(writer)), hasher_(hasher) {}
+
+  bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override {
+    hashing_ = hasher_->StartWrite(extents);
+    return writer_->Init(extents, block_size);
+  }
+
+  bool Write(const void* bytes, size_t count) override {
+    TEST_AND_RETURN_FALSE(writer_->Write(bytes, count));
+    return !hashing_ || hasher_->Update(bytes, count);
+  }
+
+  bool WriteZeros(size_t count, bool discard) override {
+    TEST_AND_RETURN_FALSE(writer_->WriteZeros(count, discard));
+    // Discarded blocks may read back as anything, so the prefix ends there.
+    if (discard)
+      hashing_ = false;
+    return !hashing_ || hasher_->UpdateZeros(count);
+  }
+
+  bool Flush() override { return writer_->Flush(); }
+
+ private:
+  std::unique_ptr<ExtentWriter> writer_;
+  WrittenDataHasher* hasher_;
+  bool hashing_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(HashingExtentWriter);
+};
+
+WrittenDataHasher::WrittenDataHasher(size_t block_size)
+    : block_size_(block_size), hasher_(std::make_unique<HashCalculator>()) {}
+
+std::unique_ptr<ExtentWriter> WrittenDataHasher::WrapExtentWriter(
+    std::unique_ptr<ExtentWriter> writer) {
+  return std::make_unique<HashingExtentWriter>(std::move(writer), this);
+}
+
+void WrittenDataHasher::RecordWrite(
+    const google::protobuf::RepeatedPtrField<Extent>& extents) {
+  StartWrite(extents);
+}
+
+bool WrittenDataHasher::StartWrite(
+    const google::protobuf::RepeatedPtrField<Extent>& extents) {
+  if (extents.empty())
+    return false;
+  bool continues_prefix =
+      extents[0].start_block() * block_size_ == hashed_size_;
+  for (int i = 1; i < extents.size() && continues_prefix; i++) {
+    const Extent& previous = extents[i - 1];
+    continues_prefix = extents[i].start_block() ==
+                       previous.start_block() + previous.num_blocks();
+  }
+  if (continues_prefix)
+    return true;
+  for (const Extent& extent : extents) {
+    if (extent.num_blocks() > 0 &&
+        extent.start_block() * block_size_ < hashed_size_) {
+      LOG(INFO) << "Block " << extent.start_block()
+                << " is written again, the first " << hashed_size_
+                << " bytes hashed while applying the update are dropped.";
+      hasher_ = std::make_unique<HashCalculator>();
+      hashed_size_ = 0;
+      break;
+    }
+  }
+  return false;
+}
+
+bool WrittenDataHasher::Update(const void* data, size_t count) {
+  TEST_AND_RETURN_FALSE(hasher_->Update(data, count));
+  hashed_size_ += count;
+  return true;
+}
+
+bool WrittenDataHasher::UpdateZeros(size_t count) {
+  static const brillo::Blob zeros(kZerosBufferSize);
+  while (count > 0) {
+    const size_t chunk = std::min(count, zeros.size());
+    TEST_AND_RETURN_FALSE(Update(zeros.data(), chunk));
+    count -= chunk;
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
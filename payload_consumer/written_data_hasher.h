@@ -0,0 +1,77 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITTEN_DATA_HASHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITTEN_DATA_HASHER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// WrittenDataHasher hashes the data written to a target partition while the
+// update is applied, for as long as it is written in order from the start of
+// the partition. This is the case for full payloads, whose operations write
+// the partition sequentially. The hash of that prefix of the partition can
+// then be resumed when verifying the partition, which only has to read the
+// rest of it.
+class WrittenDataHasher {
+ public:
+  explicit WrittenDataHasher(size_t block_size);
+
+  // Returns an ExtentWriter writing through |writer|, which also hashes the
+  // written data if the operation continues the hashed prefix.
+  std::unique_ptr<ExtentWriter> WrapExtentWriter(
+      std::unique_ptr<ExtentWriter> writer);
+
+  // Records that an operation writes to |extents| without going through an
+  // ExtentWriter returned by WrapExtentWriter().
+  void RecordWrite(const google::protobuf::RepeatedPtrField<Extent>& extents);
+
+  // Number of bytes at the start of the partition hashed so far, and the
+  // HashCalculator context of their hash.
+  uint64_t hashed_size() const { return hashed_size_; }
+  std::string GetContext() const { return hasher_->GetContext(); }
+
+ private:
+  class HashingExtentWriter;
+
+  // Records that |extents| are about to be written, and returns whether their
+  // data should be hashed because they continue the hashed prefix. Forgets
+  // the prefix if they overwrite part of it.
+  bool StartWrite(const google::protobuf::RepeatedPtrField<Extent>& extents);
+
+  // Hashes the next |count| bytes of the prefix.
+  bool Update(const void* data, size_t count);
+  bool UpdateZeros(size_t count);
+
+  const size_t block_size_;
+  std::unique_ptr<HashCalculator> hasher_;
+  uint64_t hashed_size_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(WrittenDataHasher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITTEN_DATA_HASHER_H_
@@ -0,0 +1,142 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/written_data_hasher.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const size_t kBlockSize = 4096;
+
+// Accepts all the writes, without writing anything.
+class NullExtentWriter : public ExtentWriter {
+ public:
+  bool Init(const RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override {
+    return true;
+  }
+  bool Write(const void* bytes, size_t count) override { return true; }
+  bool WriteZeros(size_t count, bool discard) override { return true; }
+};
+
+RepeatedPtrField<Extent> MakeExtents(const vector<Extent>& extents) {
+  RepeatedPtrField<Extent> result;
+  for (const Extent& extent : extents) {
+    *result.Add() = extent;
+  }
+  return result;
+}
+
+}  // namespace
+
+class WrittenDataHasherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(8 * kBlockSize);
+    test_utils::FillWithData(&data_);
+  }
+
+  // Writes the blocks of |data_| at |extents| through |hasher_|.
+  void WriteBlocks(const vector<Extent>& extents) {
+    auto writer =
+        hasher_.WrapExtentWriter(std::make_unique<NullExtentWriter>());
+    ASSERT_TRUE(writer->Init(MakeExtents(extents), kBlockSize));
+    for (const Extent& extent : extents) {
+      ASSERT_TRUE(
+          writer->Write(data_.data() + extent.start_block() * kBlockSize,
+                        extent.num_blocks() * kBlockSize));
+    }
+  }
+
+  // Returns the hash of the prefix hashed by |hasher_|.
+  brillo::Blob HashedPrefix() {
+    HashCalculator calculator;
+    EXPECT_TRUE(calculator.SetContext(hasher_.GetContext()));
+    EXPECT_TRUE(calculator.Finalize());
+    return calculator.raw_hash();
+  }
+
+  brillo::Blob ExpectedHash(size_t num_blocks) {
+    brillo::Blob hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        data_.data(), num_blocks * kBlockSize, &hash));
+    return hash;
+  }
+
+  brillo::Blob data_;
+  WrittenDataHasher hasher_{kBlockSize};
+};
+
+TEST_F(WrittenDataHasherTest, InOrderWritesTest) {
+  WriteBlocks({ExtentForRange(0, 2)});
+  WriteBlocks({ExtentForRange(2, 1), ExtentForRange(3, 2)});
+  EXPECT_EQ(5 * kBlockSize, hasher_.hashed_size());
+  EXPECT_EQ(ExpectedHash(5), HashedPrefix());
+}
+
+TEST_F(WrittenDataHasherTest, GapTest) {
+  WriteBlocks({ExtentForRange(0, 1)});
+  // Not contiguous with the prefix, so not hashed.
+  WriteBlocks({ExtentForRange(3, 1)});
+  WriteBlocks({ExtentForRange(1, 1), ExtentForRange(4, 1)});
+  EXPECT_EQ(kBlockSize, hasher_.hashed_size());
+  // Filling the gap continues the prefix.
+  WriteBlocks({ExtentForRange(1, 2)});
+  EXPECT_EQ(3 * kBlockSize, hasher_.hashed_size());
+  EXPECT_EQ(ExpectedHash(3), HashedPrefix());
+}
+
+TEST_F(WrittenDataHasherTest, OverwriteTest) {
+  WriteBlocks({ExtentForRange(0, 4)});
+  EXPECT_EQ(4 * kBlockSize, hasher_.hashed_size());
+  // Blocks written without going through the hasher drop the prefix.
+  hasher_.RecordWrite(
+      MakeExtents({ExtentForRange(6, 1), ExtentForRange(2, 1)}));
+  EXPECT_EQ(0U, hasher_.hashed_size());
+  WriteBlocks({ExtentForRange(0, 1)});
+  EXPECT_EQ(kBlockSize, hasher_.hashed_size());
+  EXPECT_EQ(ExpectedHash(1), HashedPrefix());
+}
+
+TEST_F(WrittenDataHasherTest, ZerosTest) {
+  std::fill(data_.begin(), data_.begin() + 3 * kBlockSize, 0);
+  auto writer = hasher_.WrapExtentWriter(std::make_unique<NullExtentWriter>());
+  ASSERT_TRUE(writer->Init(MakeExtents({ExtentForRange(0, 3)}), kBlockSize));
+  ASSERT_TRUE(writer->WriteZeros(3 * kBlockSize, false));
+  EXPECT_EQ(3 * kBlockSize, hasher_.hashed_size());
+  EXPECT_EQ(ExpectedHash(3), HashedPrefix());
+
+  // Discarded blocks aren't hashed.
+  writer = hasher_.WrapExtentWriter(std::make_unique<NullExtentWriter>());
+  ASSERT_TRUE(writer->Init(MakeExtents({ExtentForRange(3, 1)}), kBlockSize));
+  ASSERT_TRUE(writer->WriteZeros(kBlockSize, true));
+  EXPECT_EQ(3 * kBlockSize, hasher_.hashed_size());
+}
+
+}  // namespace chromeos_update_engine
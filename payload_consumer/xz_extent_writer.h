@@ -46,6 +46,7 @@ class XzExtentWriter : public ExtentWriter {
   bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
             uint32_t block_size) override;
   bool Write(const void* bytes, size_t count) override;
+  bool Flush() override { return underlying_writer_->Flush(); }
 
  private:
   // The underlying ExtentWriter.
@@ -20,6 +20,7 @@
 #include <utility>
 
 #include <base/strings/stringprintf.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
@@ -28,6 +29,8 @@
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/partition_image_reader.h"
+#include "update_engine/payload_generator/task_scheduler.h"
 
 using chromeos_update_engine::diff_utils::IsAReplaceOperation;
 using std::string;
@@ -35,6 +38,129 @@ using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The number of merged operations compressed at a time for each thread of the
+// task scheduler.
+const size_t kMergeBatchOpsPerThread = 2;
+
+// Reads the destination extents of the REPLACE/REPLACE_BZ/REPLACE_XZ operation
+// |aop| from |target_part| and stores in |blob| and |op_type| the best
+// full operation for them.
+bool GenerateReplaceBlob(const AnnotatedOperation& aop,
+                         const PayloadVersion& version,
+                         const PartitionImage& target_part,
+                         brillo::Blob* blob,
+                         InstallOperation::Type* op_type) {
+  TEST_AND_RETURN_FALSE(IsAReplaceOperation(aop.op.type()));
+
+  vector<Extent> dst_extents;
+  ExtentsToVector(aop.op.dst_extents(), &dst_extents);
+  brillo::Blob data(utils::BlocksInExtents(dst_extents) * kBlockSize);
+  TEST_AND_RETURN_FALSE(
+      target_part.ReadExtents(dst_extents, &data, data.size(), kBlockSize));
+
+  TEST_AND_RETURN_FALSE(
+      diff_utils::GenerateBestFullOperation(data, version, blob, op_type));
+  return true;
+}
+
+// Sets the type of |aop| to |op_type| and its data to |blob|, which is written
+// to |blob_file|. If the operation already has the right type and points to a
+// data blob of the same size, nothing is written.
+bool SetReplaceBlob(AnnotatedOperation* aop,
+                    const brillo::Blob& blob,
+                    InstallOperation::Type op_type,
+                    BlobFileWriter* blob_file) {
+  if (aop->op.type() != op_type || aop->op.data_length() != blob.size()) {
+    aop->op.set_type(op_type);
+    TEST_AND_RETURN_FALSE(aop->SetOperationBlob(blob, blob_file));
+  }
+  return true;
+}
+
+// Generates the blob of a merged REPLACE/REPLACE_BZ/REPLACE_XZ operation on a
+// worker thread. The blob is only written to the blob file afterwards, in the
+// order of the operations, so the output doesn't depend on the scheduling.
+// The generator drops the blob once it's written.
+class ReplaceBlobGenerator : public base::DelegateSimpleThread::Delegate {
+ public:
+  ReplaceBlobGenerator(AnnotatedOperation* aop,
+                       const PayloadVersion& version,
+                       const PartitionImage& target_part)
+      : aop_(aop), version_(version), target_part_(target_part) {}
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    success_ = GenerateReplaceBlob(
+        *aop_, version_, target_part_, &blob_, &op_type_);
+  }
+
+  // Stores the generated blob in |blob_file| and updates the operation.
+  bool Finish(BlobFileWriter* blob_file) {
+    TEST_AND_RETURN_FALSE(success_);
+    TEST_AND_RETURN_FALSE(SetReplaceBlob(aop_, blob_, op_type_, blob_file));
+    brillo::Blob().swap(blob_);
+    return true;
+  }
+
+ private:
+  AnnotatedOperation* aop_;
+  const PayloadVersion& version_;
+  const PartitionImage target_part_;
+
+  brillo::Blob blob_;
+  InstallOperation::Type op_type_ = InstallOperation::REPLACE;
+  bool success_ = false;
+};
+
+// Reads the source extents of |aop| from |source_part| on a worker thread
+// and sets the source hash of the operation.
+class SourceHashCalculator : public base::DelegateSimpleThread::Delegate {
+ public:
+  SourceHashCalculator(AnnotatedOperation* aop,
+                       const PartitionImage& source_part)
+      : aop_(aop), source_part_(source_part) {}
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { success_ = CalculateSourceHash(); }
+
+  bool success() const { return success_; }
+
+ private:
+  bool CalculateSourceHash() {
+    vector<Extent> src_extents;
+    ExtentsToVector(aop_->op.src_extents(), &src_extents);
+    brillo::Blob src_data, src_hash;
+    uint64_t src_length =
+        aop_->op.has_src_length()
+            ? aop_->op.src_length()
+            : utils::BlocksInExtents(aop_->op.src_extents()) * kBlockSize;
+    TEST_AND_RETURN_FALSE(source_part_.ReadExtents(
+        src_extents, &src_data, src_length, kBlockSize));
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(src_data, &src_hash));
+    aop_->op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    return true;
+  }
+
+  AnnotatedOperation* aop_;
+  const PartitionImage source_part_;
+  bool success_ = false;
+};
+
+// Runs all the |delegates| on the shared task scheduler and waits for them.
+template <typename Delegate>
+void RunTasks(vector<Delegate>* delegates) {
+  vector<TaskScheduler::Task> tasks;
+  tasks.reserve(delegates->size());
+  for (Delegate& delegate : *delegates) {
+    tasks.push_back({&delegate});
+  }
+  TaskScheduler::Get()->RunTasks(tasks);
+}
+
+}  // namespace
+
 bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
                                      const PartitionConfig& old_part,
                                      const PartitionConfig& new_part,
@@ -70,11 +196,11 @@ bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
 
   LOG(INFO) << "Merging " << aops->size() << " operations.";
   TEST_AND_RETURN_FALSE(MergeOperations(
-      aops, config.version, merge_chunk_blocks, new_part.path, blob_file));
+      aops, config.version, merge_chunk_blocks, new_part.image(), blob_file));
   LOG(INFO) << aops->size() << " operations after merge.";
 
   if (config.version.minor >= kOpSrcHashMinorPayloadVersion)
-    TEST_AND_RETURN_FALSE(AddSourceHash(aops, old_part.path));
+    TEST_AND_RETURN_FALSE(AddSourceHash(aops, old_part.image()));
 
   return true;
 }
@@ -86,7 +212,7 @@ void ABGenerator::SortOperationsByDestination(
 
 bool ABGenerator::FragmentOperations(const PayloadVersion& version,
                                      vector<AnnotatedOperation>* aops,
-                                     const string& target_part_path,
+                                     const PartitionImage& target_part,
                                      BlobFileWriter* blob_file) {
   vector<AnnotatedOperation> fragmented_aops;
   for (const AnnotatedOperation& aop : *aops) {
@@ -98,7 +224,7 @@ bool ABGenerator::FragmentOperations(const PayloadVersion& version,
       }
       if (IsAReplaceOperation(aop.op.type())) {
         TEST_AND_RETURN_FALSE(SplitAReplaceOp(
-            version, aop, target_part_path, &fragmented_aops, blob_file));
+            version, aop, target_part, &fragmented_aops, blob_file));
         continue;
       }
     }
@@ -160,7 +286,7 @@ bool ABGenerator::SplitSourceCopy(const AnnotatedOperation& original_aop,
 
 bool ABGenerator::SplitAReplaceOp(const PayloadVersion& version,
                                   const AnnotatedOperation& original_aop,
-                                  const string& target_part_path,
+                                  const PartitionImage& target_part,
                                   vector<AnnotatedOperation>* result_aops,
                                   BlobFileWriter* blob_file) {
   InstallOperation original_op = original_aop.op;
@@ -186,7 +312,7 @@ bool ABGenerator::SplitAReplaceOp(const PayloadVersion& version,
     new_aop.op = new_op;
     new_aop.name = base::StringPrintf("%s:%d", original_aop.name.c_str(), i);
     TEST_AND_RETURN_FALSE(
-        AddDataAndSetType(&new_aop, version, target_part_path, blob_file));
+        AddDataAndSetType(&new_aop, version, target_part, blob_file));
 
     result_aops->push_back(new_aop);
   }
@@ -196,7 +322,7 @@ bool ABGenerator::SplitAReplaceOp(const PayloadVersion& version,
 bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
                                   const PayloadVersion& version,
                                   size_t chunk_blocks,
-                                  const string& target_part_path,
+                                  const PartitionImage& target_part,
                                   BlobFileWriter* blob_file) {
   vector<AnnotatedOperation> new_aops;
   for (const AnnotatedOperation& curr_aop : *aops) {
@@ -250,12 +376,28 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
   }
 
   // Set the blobs for REPLACE/REPLACE_BZ/REPLACE_XZ operations that have been
-  // merged.
+  // merged. Compressing them is done in parallel, in batches of a few
+  // operations per thread. The blobs of a batch are stored in the order of the
+  // operations once it's done, so only one batch of blobs is held in memory.
+  vector<AnnotatedOperation*> merged_aops;
   for (AnnotatedOperation& curr_aop : new_aops) {
     if (curr_aop.op.data_length() == 0 &&
         IsAReplaceOperation(curr_aop.op.type())) {
-      TEST_AND_RETURN_FALSE(
-          AddDataAndSetType(&curr_aop, version, target_part_path, blob_file));
+      merged_aops.push_back(&curr_aop);
+    }
+  }
+  const size_t batch_size =
+      kMergeBatchOpsPerThread * TaskScheduler::Get()->max_threads();
+  for (size_t first = 0; first < merged_aops.size(); first += batch_size) {
+    size_t end = std::min(first + batch_size, merged_aops.size());
+    vector<ReplaceBlobGenerator> generators;
+    generators.reserve(end - first);
+    for (size_t i = first; i < end; i++) {
+      generators.emplace_back(merged_aops[i], version, target_part);
+    }
+    RunTasks(&generators);
+    for (ReplaceBlobGenerator& generator : generators) {
+      TEST_AND_RETURN_FALSE(generator.Finish(blob_file));
     }
   }
 
@@ -265,48 +407,26 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
 
 bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
                                     const PayloadVersion& version,
-                                    const string& target_part_path,
+                                    const PartitionImage& target_part,
                                     BlobFileWriter* blob_file) {
-  TEST_AND_RETURN_FALSE(IsAReplaceOperation(aop->op.type()));
-
-  vector<Extent> dst_extents;
-  ExtentsToVector(aop->op.dst_extents(), &dst_extents);
-  brillo::Blob data(utils::BlocksInExtents(dst_extents) * kBlockSize);
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(
-      target_part_path, dst_extents, &data, data.size(), kBlockSize));
-
   brillo::Blob blob;
   InstallOperation::Type op_type;
   TEST_AND_RETURN_FALSE(
-      diff_utils::GenerateBestFullOperation(data, version, &blob, &op_type));
-
-  // If the operation doesn't point to a data blob or points to a data blob of
-  // a different type then we add it.
-  if (aop->op.type() != op_type || aop->op.data_length() != blob.size()) {
-    aop->op.set_type(op_type);
-    aop->SetOperationBlob(blob, blob_file);
-  }
-
-  return true;
+      GenerateReplaceBlob(*aop, version, target_part, &blob, &op_type));
+  return SetReplaceBlob(aop, blob, op_type, blob_file);
 }
 
 bool ABGenerator::AddSourceHash(vector<AnnotatedOperation>* aops,
-                                const string& source_part_path) {
+                                const PartitionImage& source_part) {
+  vector<SourceHashCalculator> calculators;
   for (AnnotatedOperation& aop : *aops) {
     if (aop.op.src_extents_size() == 0)
       continue;
-
-    vector<Extent> src_extents;
-    ExtentsToVector(aop.op.src_extents(), &src_extents);
-    brillo::Blob src_data, src_hash;
-    uint64_t src_length =
-        aop.op.has_src_length()
-            ? aop.op.src_length()
-            : utils::BlocksInExtents(aop.op.src_extents()) * kBlockSize;
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(
-        source_part_path, src_extents, &src_data, src_length, kBlockSize));
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(src_data, &src_hash));
-    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+    calculators.emplace_back(&aop, source_part);
+  }
+  RunTasks(&calculators);
+  for (const SourceHashCalculator& calculator : calculators) {
+    TEST_AND_RETURN_FALSE(calculator.success());
   }
   return true;
 }
@@ -28,6 +28,7 @@
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
 #include "update_engine/payload_generator/operations_generator.h"
+#include "update_engine/payload_generator/partition_image_reader.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -58,12 +59,12 @@ class ABGenerator : public OperationsGenerator {
   // for every operation there is only one dst extent and updates |aops| with
   // the new list of operations. All kinds of operations are fragmented except
   // BSDIFF and SOURCE_BSDIFF, PUFFDIFF and BROTLI_BSDIFF operations.  The
-  // |target_part_path| is the filename of the new image, where the destination
-  // extents refer to. The blobs of the operations in |aops| should reference
-  // |blob_file|. |blob_file| are updated if needed.
+  // |target_part| is the new image, where the destination extents refer to.
+  // The blobs of the operations in |aops| should reference |blob_file|.
+  // |blob_file| are updated if needed.
   static bool FragmentOperations(const PayloadVersion& version,
                                  std::vector<AnnotatedOperation>* aops,
-                                 const std::string& target_part_path,
+                                 const PartitionImage& target_part,
                                  BlobFileWriter* blob_file);
 
   // Takes a vector of AnnotatedOperations |aops| and sorts them by the first
@@ -90,7 +91,7 @@ class ABGenerator : public OperationsGenerator {
   // type depending on whether compression is advantageous.
   static bool SplitAReplaceOp(const PayloadVersion& version,
                               const AnnotatedOperation& original_aop,
-                              const std::string& target_part,
+                              const PartitionImage& target_part,
                               std::vector<AnnotatedOperation>* result_aops,
                               BlobFileWriter* blob_file);
 
@@ -106,17 +107,17 @@ class ABGenerator : public OperationsGenerator {
   static bool MergeOperations(std::vector<AnnotatedOperation>* aops,
                               const PayloadVersion& version,
                               size_t chunk_blocks,
-                              const std::string& target_part,
+                              const PartitionImage& target_part,
                               BlobFileWriter* blob_file);
 
   // Takes a vector of AnnotatedOperations |aops|, adds source hash to all
   // operations that have src_extents.
   static bool AddSourceHash(std::vector<AnnotatedOperation>* aops,
-                            const std::string& source_part_path);
+                            const PartitionImage& source_part);
 
  private:
   // Adds the data payload for a REPLACE/REPLACE_BZ/REPLACE_XZ operation |aop|
-  // by reading its output extents from |target_part_path| and appending a
+  // by reading its output extents from |target_part| and appending a
   // corresponding data blob to |blob_file|. The blob will be compressed if this
   // is smaller than the uncompressed form, and the operation type will be set
   // accordingly. |*blob_file| will be updated as well. If the operation happens
@@ -124,7 +125,7 @@ class ABGenerator : public OperationsGenerator {
   // written. Caller should only set type and data blob if it's valid.
   static bool AddDataAndSetType(AnnotatedOperation* aop,
                                 const PayloadVersion& version,
-                                const std::string& target_part_path,
+                                const PartitionImage& target_part,
                                 BlobFileWriter* blob_file);
 
   DISALLOW_COPY_AND_ASSIGN(ABGenerator);
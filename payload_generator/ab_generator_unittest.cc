@@ -573,4 +573,31 @@ TEST_F(ABGeneratorTest, AddSourceHashTest) {
   EXPECT_EQ(expected_hash, result_hash);
 }
 
+TEST_F(ABGeneratorTest, AddSourceHashManyOperationsTest) {
+  // More operations than threads, in reverse order of their source blocks.
+  const size_t kNumOps = 64;
+  ScopedTempFile src_part_file("AddSourceHashTest_src_part.XXXXXX");
+  brillo::Blob src_data(kNumOps * kBlockSize);
+  test_utils::FillWithData(&src_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(src_part_file.path(), src_data));
+
+  vector<AnnotatedOperation> aops(kNumOps);
+  for (size_t i = 0; i < kNumOps; i++) {
+    aops[i].op.set_type(InstallOperation::SOURCE_COPY);
+    *(aops[i].op.add_src_extents()) = ExtentForRange(kNumOps - 1 - i, 1);
+  }
+
+  EXPECT_TRUE(ABGenerator::AddSourceHash(&aops, src_part_file.path()));
+
+  for (size_t i = 0; i < kNumOps; i++) {
+    const auto block_begin = src_data.begin() + (kNumOps - 1 - i) * kBlockSize;
+    brillo::Blob expected_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfData(
+        brillo::Blob(block_begin, block_begin + kBlockSize), &expected_hash));
+    brillo::Blob result_hash(aops[i].op.src_sha256_hash().begin(),
+                             aops[i].op.src_sha256_hash().end());
+    EXPECT_EQ(expected_hash, result_hash) << "op " << i;
+  }
+}
+
 }  // namespace chromeos_update_engine
@@ -20,6 +20,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <string.h>
+
+#include <algorithm>
 #include <functional>
 #include <string>
 #include <utility>
@@ -32,9 +35,12 @@ using std::vector;
 
 namespace {
 
-size_t HashValue(const brillo::Blob& blob) {
-  std::hash<string> hash_fn;
-  return hash_fn(string(blob.begin(), blob.end()));
+// The number of blocks read at once by AddManyDiskBlocks().
+const size_t kReadSpanBlocks = 256;
+
+size_t HashValue(std::string_view block_data) {
+  std::hash<std::string_view> hash_fn;
+  return hash_fn(block_data);
 }
 
 }  // namespace
@@ -42,7 +48,7 @@ size_t HashValue(const brillo::Blob& blob) {
 namespace chromeos_update_engine {
 
 BlockMapping::BlockId BlockMapping::AddBlock(const brillo::Blob& block_data) {
-  return AddBlock(-1, 0, block_data);
+  return AddBlock(-1, 0, ToStringView(block_data));
 }
 
 BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
@@ -52,7 +58,7 @@ BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
     return -1;
   if (static_cast<size_t>(bytes_read) != block_size_)
     return -1;
-  return AddBlock(fd, byte_offset, blob);
+  return AddBlock(fd, byte_offset, ToStringView(blob));
 }
 
 bool BlockMapping::AddManyDiskBlocks(int fd,
@@ -61,19 +67,42 @@ bool BlockMapping::AddManyDiskBlocks(int fd,
                                      vector<BlockId>* block_ids) {
   bool ret = true;
   block_ids->resize(num_blocks);
-  for (size_t block = 0; block < num_blocks; block++) {
-    (*block_ids)[block] =
-        AddDiskBlock(fd, initial_byte_offset + block * block_size_);
-    ret = ret && (*block_ids)[block] != -1;
+  brillo::Blob span;
+  for (size_t first_block = 0; first_block < num_blocks;
+       first_block += kReadSpanBlocks) {
+    size_t span_blocks = std::min(kReadSpanBlocks, num_blocks - first_block);
+    off_t span_offset = initial_byte_offset + first_block * block_size_;
+    span.resize(span_blocks * block_size_);
+    ssize_t bytes_read = 0;
+    bool span_read =
+        utils::PReadAll(fd, span.data(), span.size(), span_offset, &bytes_read);
+    for (size_t i = 0; i < span_blocks; i++) {
+      BlockId* block_id = &(*block_ids)[first_block + i];
+      off_t byte_offset = span_offset + i * block_size_;
+      if (span_read && static_cast<size_t>(bytes_read) == span.size()) {
+        *block_id = AddBlock(
+            fd,
+            byte_offset,
+            ToStringView(span.data() + i * block_size_, block_size_));
+      } else {
+        // Add the blocks one by one to find which ones can't be read.
+        *block_id = AddDiskBlock(fd, byte_offset);
+      }
+      ret = ret && *block_id != -1;
+    }
   }
   return ret;
 }
 
 BlockMapping::BlockId BlockMapping::AddBlock(int fd,
                                              off_t byte_offset,
-                                             const brillo::Blob& block_data) {
+                                             std::string_view block_data) {
   if (block_data.size() != block_size_)
     return -1;
+  const bool is_zero = IsZeroData(
+      reinterpret_cast<const uint8_t*>(block_data.data()), block_data.size());
+  if (is_zero && zero_block_id_ != -1)
+    return zero_block_id_;
   size_t h = HashValue(block_data);
 
   // We either reuse a UniqueBlock or create a new one. If we need a new
@@ -89,8 +118,11 @@ BlockMapping::BlockId BlockMapping::AddBlock(int fd,
       bool equals = false;
       if (!existing_block.CompareData(block_data, &equals))
         return -1;
-      if (equals)
+      if (equals) {
+        if (is_zero)
+          zero_block_id_ = existing_block.block_id;
         return existing_block.block_id;
+      }
     }
     bucket = &mapping_it->second;
   }
@@ -106,15 +138,17 @@ BlockMapping::BlockId BlockMapping::AddBlock(int fd,
   new_ublock->block_id = used_block_ids++;
   // We need to cache blocks that are not referencing any disk location.
   if (fd == -1)
-    new_ublock->block_data = block_data;
+    new_ublock->block_data.assign(block_data.begin(), block_data.end());
+  if (is_zero)
+    zero_block_id_ = new_ublock->block_id;
 
   return new_ublock->block_id;
 }
 
-bool BlockMapping::UniqueBlock::CompareData(const brillo::Blob& other_block,
+bool BlockMapping::UniqueBlock::CompareData(std::string_view other_block,
                                             bool* equals) {
   if (!block_data.empty()) {
-    *equals = block_data == other_block;
+    *equals = ToStringView(block_data) == other_block;
     return true;
   }
   const size_t block_size = other_block.size();
@@ -124,7 +158,7 @@ bool BlockMapping::UniqueBlock::CompareData(const brillo::Blob& other_block,
     return false;
   if (static_cast<size_t>(bytes_read) != block_size)
     return false;
-  *equals = blob == other_block;
+  *equals = ToStringView(blob) == other_block;
 
   // We increase the number of times we had to read this block from disk and
   // we cache this block based on that. This caching method is optimized for
@@ -137,6 +171,20 @@ bool BlockMapping::UniqueBlock::CompareData(const brillo::Blob& other_block,
   return true;
 }
 
+bool IsZeroData(const uint8_t* data, size_t size) {
+  // Checking a short prefix rejects most non-zero data right away. Once the
+  // prefix is zero, the data is all zeros if it is equal to itself shifted by
+  // the prefix size, which memcmp() checks with the widest loads available.
+  constexpr size_t kPrefixSize = 2 * sizeof(uint64_t);
+  if (size < kPrefixSize)
+    return std::all_of(data, data + size, [](uint8_t x) { return x == 0; });
+  uint64_t prefix[2];
+  memcpy(prefix, data, sizeof(prefix));
+  if ((prefix[0] | prefix[1]) != 0)
+    return false;
+  return memcmp(data, data + kPrefixSize, size - kPrefixSize) == 0;
+}
+
 bool MapPartitionBlocks(const string& old_part,
                         const string& new_part,
                         size_t old_size,
@@ -19,6 +19,7 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <brillo/secure_blob.h>
@@ -51,6 +52,7 @@ class BlockMapping {
 
   // This is a helper method to add |num_blocks| contiguous blocks reading them
   // from the file descriptor |fd| starting at offset |initial_byte_offset|.
+  // The blocks are read in large spans rather than one by one.
   // Returns whether it succeeded to add all the disk blocks and stores in
   // |block_ids| the block id for each one of the added blocks.
   bool AddManyDiskBlocks(int fd,
@@ -64,12 +66,16 @@ class BlockMapping {
   // Add a single block passed in |block_data|. If |fd| is not -1, the block
   // can be discarded to save RAM and retrieved later from |fd| at the position
   // |byte_offset|.
-  BlockId AddBlock(int fd, off_t byte_offset, const brillo::Blob& block_data);
+  BlockId AddBlock(int fd, off_t byte_offset, std::string_view block_data);
 
   size_t block_size_;
 
   BlockId used_block_ids{0};
 
+  // The block id of the block with all zeros once it has been added, or -1.
+  // Zero blocks are very common, so they are recognized without hashing them.
+  BlockId zero_block_id_{-1};
+
   // The UniqueBlock represents the data of a block associated to a unique
   // block id.
   struct UniqueBlock {
@@ -88,13 +94,17 @@ class BlockMapping {
     // Compares the UniqueBlock data with the other_block data and stores if
     // they are equal in |equals|. Returns whether there was an error reading
     // the block from disk while comparing it.
-    bool CompareData(const brillo::Blob& other_block, bool* equals);
+    bool CompareData(std::string_view other_block, bool* equals);
   };
 
   // A mapping from hash values to possible block ids.
   std::map<size_t, std::vector<UniqueBlock>> mapping_;
 };
 
+// Returns whether the |size| bytes at |data| are all zeros. This compares
+// many bytes at a time rather than byte by byte.
+bool IsZeroData(const uint8_t* data, size_t size);
+
 // Maps the blocks of the old and new partitions |old_part| and |new_part| whose
 // size in bytes are |old_size| and |new_size| into block ids where two blocks
 // with the same data will have the same block id and vice versa, regardless of
@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/block_mapping.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+const size_t kBlockSize = 4096;
+
+void BM_IsZeroData(benchmark::State& state) {
+  const brillo::Blob block(kBlockSize);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(IsZeroData(block.data(), block.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * block.size());
+}
+BENCHMARK(BM_IsZeroData);
+
+// Maps an image of |state.range(0)| blocks where a third of the blocks are
+// zeros, a third are repeated and the rest are unique, like the free space,
+// duplicated files and content of a typical filesystem image.
+void BM_AddManyDiskBlocks(benchmark::State& state) {
+  const size_t num_blocks = state.range(0);
+  brillo::Blob image(num_blocks * kBlockSize);
+  std::mt19937 gen(12345);
+  for (size_t block = 0; block < num_blocks; block++) {
+    uint8_t* data = image.data() + block * kBlockSize;
+    if (block % 3 == 0) {
+      continue;
+    } else if (block % 3 == 1) {
+      std::fill(data, data + kBlockSize, 1 + block % 16);
+    } else {
+      std::generate(data, data + kBlockSize, gen);
+    }
+  }
+  ScopedTempFile image_file("BlockMappingBenchmark-image.XXXXXX");
+  utils::WriteFile(image_file.path().c_str(), image.data(), image.size());
+  int fd = HANDLE_EINTR(open(image_file.path().c_str(), O_RDONLY));
+  ScopedFdCloser fd_closer(&fd);
+
+  for (auto _ : state) {
+    BlockMapping mapping(kBlockSize);
+    mapping.AddBlock(brillo::Blob(kBlockSize));
+    vector<BlockMapping::BlockId> block_ids;
+    benchmark::DoNotOptimize(
+        mapping.AddManyDiskBlocks(fd, 0, num_blocks, &block_ids));
+  }
+  state.SetBytesProcessed(state.iterations() * image.size());
+}
+BENCHMARK(BM_AddManyDiskBlocks)->Range(1 << 10, 1 << 16);
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN();
@@ -112,4 +112,58 @@ TEST_F(BlockMappingTest, MapPartitionBlocks) {
   EXPECT_EQ((vector<BlockMapping::BlockId>{0, 11, 12, 13, 1, 2}), new_ids);
 }
 
+TEST_F(BlockMappingTest, IsZeroDataTest) {
+  // Check every size and position of a non-zero byte around the word groups.
+  for (size_t size = 0; size < 200; size++) {
+    brillo::Blob data(size + 3);
+    // Start at an unaligned address.
+    uint8_t* start = data.data() + 3;
+    EXPECT_TRUE(IsZeroData(start, size)) << "size = " << size;
+    for (size_t i = 0; i < size; i++) {
+      start[i] = 1;
+      EXPECT_FALSE(IsZeroData(start, size))
+          << "size = " << size << ", i = " << i;
+      start[i] = 0;
+    }
+  }
+}
+
+TEST_F(BlockMappingTest, AddManyDiskBlocksInSpans) {
+  // More blocks than read at once, with zero and repeated blocks spread over
+  // several spans.
+  const size_t kNumBlocks = 600;
+  string contents(kNumBlocks * block_size_, '\0');
+  for (size_t block = 0; block < kNumBlocks; block++) {
+    if (block % 3 == 0)
+      continue;
+    for (size_t i = 0; i < block_size_; i++)
+      contents[block * block_size_ + i] = 1 + block % 150;
+  }
+  test_utils::WriteFileString(old_part_.path(), contents);
+  int old_fd = HANDLE_EINTR(open(old_part_.path().c_str(), O_RDONLY));
+  ScopedFdCloser old_fd_closer(&old_fd);
+
+  EXPECT_EQ(0, bm_.AddBlock(brillo::Blob(block_size_, '\0')));
+  vector<BlockMapping::BlockId> ids;
+  EXPECT_TRUE(bm_.AddManyDiskBlocks(old_fd, 0, kNumBlocks, &ids));
+  ASSERT_EQ(kNumBlocks, ids.size());
+  for (size_t block = 0; block < kNumBlocks; block++) {
+    if (block % 3 == 0) {
+      EXPECT_EQ(0, ids[block]) << "block = " << block;
+    } else if (block >= 150) {
+      EXPECT_EQ(ids[block - 150], ids[block]) << "block = " << block;
+    } else {
+      EXPECT_NE(0, ids[block]) << "block = " << block;
+    }
+  }
+
+  // Reading past the end of the file fails only for the missing blocks.
+  vector<BlockMapping::BlockId> last_ids;
+  EXPECT_FALSE(bm_.AddManyDiskBlocks(
+      old_fd, (kNumBlocks - 2) * block_size_, 4, &last_ids));
+  EXPECT_EQ((vector<BlockMapping::BlockId>{
+                ids[kNumBlocks - 2], ids[kNumBlocks - 1], -1, -1}),
+            last_ids);
+}
+
 }  // namespace chromeos_update_engine
@@ -16,19 +16,30 @@
 
 #include "update_engine/payload_generator/deflate_utils.h"
 
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <string>
 #include <utility>
 
+#include <android-base/unique_fd.h>
 #include <base/files/file_util.h>
 #include <base/logging.h>
 #include <base/strings/string_util.h>
+#include <base/threading/simple_thread.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/partition_cache.h"
+#include "update_engine/payload_generator/partition_image_reader.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
+#include "update_engine/payload_generator/task_scheduler.h"
 #include "update_engine/update_metadata.pb.h"
 
 using puffin::BitExtent;
@@ -43,15 +54,24 @@ namespace {
 // The minimum size for a squashfs image to be processed.
 const uint64_t kMinimumSquashfsImageSize = 1 * 1024 * 1024;  // bytes
 
+// Bump this whenever the way deflates are located changes, so the deflates
+// cached by an older generator are not used anymore.
+const int kDeflateCacheVersion = 1;
+
+// Cached deflates are stored next to the partition cache entries, in files
+// named with this prefix followed by the key. Each file holds the offset and
+// the length of each deflate as big-endian uint64_t.
+const char kDeflateCachePrefix[] = "deflates-";
+
 // TODO(*): Optimize this so we don't have to read all extents into memory in
 // case it is large.
-bool CopyExtentsToFile(const string& in_path,
+bool CopyExtentsToFile(const PartitionImage& in_part,
                        const vector<Extent>& extents,
                        const string& out_path,
                        size_t block_size) {
   brillo::Blob data(utils::BlocksInExtents(extents) * block_size);
   TEST_AND_RETURN_FALSE(
-      utils::ReadExtents(in_path, extents, &data, data.size(), block_size));
+      in_part.ReadExtents(extents, &data, data.size(), block_size));
   TEST_AND_RETURN_FALSE(
       utils::WriteFile(out_path.c_str(), data.data(), data.size()));
   return true;
@@ -111,8 +131,130 @@ bool IsBitExtentInExtent(const Extent& extent, const BitExtent& bit_extent) {
              ((extent.start_block() + extent.num_blocks()) * kBlockSize);
 }
 
-// Returns whether the given file |name| has an extension listed in
-// |extensions|.
+bool IsZipFile(const std::string_view name) {
+  return IsFileExtensions(
+      name, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"});
+}
+
+bool IsGzipFile(const std::string_view name) {
+  return IsFileExtensions(name, {".gz", ".gzip", ".tgz"});
+}
+
+// Returns the cache key of the deflates of the file |filename| with contents
+// |data|, or an empty string on error. Only the format of the file is part of
+// the key, so files with the same contents share the entry wherever they are,
+// but the build of the generator is, since another build of puffin may locate
+// other deflates.
+string DeflateCacheKey(const std::string_view filename,
+                       const brillo::Blob& data) {
+  const string& build_fingerprint = PartitionCache::GetBuildFingerprint();
+  if (build_fingerprint.empty())
+    return "";
+  const string prefix =
+      build_fingerprint +
+      "deflate_cache_version=" + std::to_string(kDeflateCacheVersion) +
+      "\nformat=" + (IsZipFile(filename) ? "zip" : "gzip") + "\n";
+  HashCalculator hasher;
+  if (!hasher.Update(prefix.data(), prefix.size()) ||
+      !hasher.Update(data.data(), data.size()) || !hasher.Finalize()) {
+    return "";
+  }
+  return HexEncode(hasher.raw_hash());
+}
+
+bool LoadCachedDeflates(const string& path, vector<BitExtent>* deflates) {
+  brillo::Blob entry;
+  if (!utils::ReadFile(path, &entry))
+    return false;
+  TEST_AND_RETURN_FALSE(entry.size() % (2 * sizeof(uint64_t)) == 0);
+  vector<BitExtent> cached(entry.size() / (2 * sizeof(uint64_t)));
+  const uint8_t* next = entry.data();
+  for (BitExtent& deflate : cached) {
+    uint64_t values_be[2];
+    memcpy(values_be, next, sizeof(values_be));
+    next += sizeof(values_be);
+    deflate = BitExtent(be64toh(values_be[0]), be64toh(values_be[1]));
+  }
+  *deflates = std::move(cached);
+  return true;
+}
+
+bool StoreCachedDeflates(const string& path,
+                         const vector<BitExtent>& deflates) {
+  vector<uint64_t> values_be;
+  values_be.reserve(2 * deflates.size());
+  for (const BitExtent& deflate : deflates) {
+    values_be.push_back(htobe64(deflate.offset));
+    values_be.push_back(htobe64(deflate.length));
+  }
+  // Only complete entries are renamed into place, so generators running at
+  // the same time can share the directory, and they are synced first so a
+  // crash can't leave an entry with missing data in place.
+  string tmp_path = path + ".XXXXXX";
+  android::base::unique_fd fd(mkstemp(tmp_path.data()));
+  TEST_AND_RETURN_FALSE_ERRNO(fd.ok());
+  if (!utils::WriteAll(fd.get(),
+                       values_be.data(),
+                       values_be.size() * sizeof(uint64_t)) ||
+      fsync(fd.get()) != 0 || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    PLOG(ERROR) << "Failed to store the cached deflates " << path;
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Locates the deflates of a zip or gzip file of a partition, so the files of
+// a partition are scanned in parallel.
+class DeflateLocator : public base::DelegateSimpleThread::Delegate {
+ public:
+  // Sets the deflates of |file|, in the partition image |part|.
+  DeflateLocator(const PartitionImage& part,
+                 const string& cache_dir,
+                 FilesystemInterface::File* file)
+      : part_(part), cache_dir_(cache_dir), file_(file) {}
+  DeflateLocator(DeflateLocator&&) = default;
+  ~DeflateLocator() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { success_ = LocateFileDeflates(); }
+
+  bool success() const { return success_; }
+
+ private:
+  bool LocateFileDeflates() {
+    brillo::Blob data;
+    TEST_AND_RETURN_FALSE(
+        part_.ReadExtents(file_->extents,
+                          &data,
+                          kBlockSize * utils::BlocksInExtents(file_->extents),
+                          kBlockSize));
+    // |data| read from disk always has size multiple of kBlockSize. So it
+    // might contain trailing garbage data and confuse the gzip/zip
+    // processors. Trim them.
+    if (file_->file_stat.st_size > 0 &&
+        static_cast<size_t>(file_->file_stat.st_size) < data.size()) {
+      data.resize(file_->file_stat.st_size);
+    }
+    vector<puffin::BitExtent> deflates;
+    TEST_AND_RETURN_FALSE(
+        LocateDeflatesWithCache(file_->name, data, cache_dir_, &deflates));
+    // Shift the deflate's extent to the offset starting from the beginning
+    // of the current partition; and the delta processor will align the
+    // extents in a continuous buffer later.
+    TEST_AND_RETURN_FALSE(
+        ShiftBitExtentsOverExtents(file_->extents, &deflates));
+    file_->deflates = std::move(deflates);
+    return true;
+  }
+
+  const PartitionImage part_;
+  const string& cache_dir_;
+  FilesystemInterface::File* file_;
+  bool success_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(DeflateLocator);
+};
 
 }  // namespace
 
@@ -278,9 +420,8 @@ bool FindAndCompactDeflates(const vector<Extent>& extents,
 bool DeflatePreprocessFileData(const std::string_view filename,
                                const brillo::Blob& data,
                                vector<puffin::BitExtent>* deflates) {
-  bool is_zip = IsFileExtensions(
-      filename, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"});
-  bool is_gzip = IsFileExtensions(filename, {".gz", ".gzip", ".tgz"});
+  bool is_zip = IsZipFile(filename);
+  bool is_gzip = IsGzipFile(filename);
   if (is_zip) {
     if (!puffin::LocateDeflatesInZipArchive(data, deflates)) {
       LOG(ERROR) << "Failed to locate deflates in zip file " << filename;
@@ -297,13 +438,38 @@ bool DeflatePreprocessFileData(const std::string_view filename,
   return true;
 }
 
+bool LocateDeflatesWithCache(const std::string_view filename,
+                             const brillo::Blob& data,
+                             const string& cache_dir,
+                             vector<puffin::BitExtent>* deflates) {
+  if (cache_dir.empty() || !(IsZipFile(filename) || IsGzipFile(filename)))
+    return DeflatePreprocessFileData(filename, data, deflates);
+
+  // Without a key the deflates are located as if there were no cache.
+  const string key = DeflateCacheKey(filename, data);
+  if (key.empty())
+    return DeflatePreprocessFileData(filename, data, deflates);
+  const string path = cache_dir + "/" + kDeflateCachePrefix + key;
+  if (LoadCachedDeflates(path, deflates))
+    return true;
+  TEST_AND_RETURN_FALSE(DeflatePreprocessFileData(filename, data, deflates));
+  // A failure to store the entry only means the file is scanned again next
+  // time.
+  StoreCachedDeflates(path, *deflates);
+  return true;
+}
+
 bool PreprocessPartitionFiles(const PartitionConfig& part,
                               vector<FilesystemInterface::File>* result_files,
-                              bool extract_deflates) {
+                              bool extract_deflates,
+                              const string& deflate_cache_dir) {
   // Get the file system files.
   vector<FilesystemInterface::File> tmp_files;
   part.fs_interface->GetFiles(&tmp_files);
   result_files->reserve(tmp_files.size());
+  // The indexes in |result_files| of the zip and gzip files to locate the
+  // deflates of.
+  vector<size_t> archive_indexes;
 
   for (auto& file : tmp_files) {
     auto is_regular_file = IsRegularFile(file);
@@ -313,8 +479,8 @@ bool PreprocessPartitionFiles(const PartitionConfig& part,
       base::FilePath path;
       TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
       ScopedPathUnlinker old_unlinker(path.value());
-      TEST_AND_RETURN_FALSE(
-          CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
+      TEST_AND_RETURN_FALSE(CopyExtentsToFile(
+          part.image(), file.extents, path.value(), kBlockSize));
       // Test if it is actually a Squashfs file.
       auto sqfs = SquashfsFilesystem::CreateFromFile(path.value(),
                                                      extract_deflates,
@@ -339,44 +505,35 @@ bool PreprocessPartitionFiles(const PartitionConfig& part,
       }
     }
 
-    if (is_regular_file && extract_deflates && !file.is_compressed) {
-      // Search for deflates if the file is in zip or gzip format.
+    result_files->push_back(file);
+    if (is_regular_file && extract_deflates && !file.is_compressed &&
+        (IsZipFile(file.name) || IsGzipFile(file.name))) {
+      // Search for deflates if the file is in zip or gzip format once all the
+      // files are known, in parallel.
       // .zvoice files may eventually move out of rootfs. If that happens,
       // remove ".zvoice" (crbug.com/782918).
-      bool is_zip = IsFileExtensions(
-          file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"});
-      bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
-      if (is_zip || is_gzip) {
-        brillo::Blob data;
-        TEST_AND_RETURN_FALSE(utils::ReadExtents(
-            part.path,
-            file.extents,
-            &data,
-            kBlockSize * utils::BlocksInExtents(file.extents),
-            kBlockSize));
-        // |data| read from disk always has size multiple of kBlockSize. So it
-        // might contain trailing garbage data and confuse the gzip/zip
-        // processors. Trim them.
-        if (file.file_stat.st_size > 0 &&
-            static_cast<size_t>(file.file_stat.st_size) < data.size()) {
-          data.resize(file.file_stat.st_size);
-        }
-        vector<puffin::BitExtent> deflates;
-        if (!DeflatePreprocessFileData(file.name, data, &deflates)) {
-          LOG(ERROR) << "Failed to preprocess deflate data in partition "
-                     << part.name;
-          return false;
-        }
-        // Shift the deflate's extent to the offset starting from the beginning
-        // of the current partition; and the delta processor will align the
-        // extents in a continuous buffer later.
-        TEST_AND_RETURN_FALSE(
-            ShiftBitExtentsOverExtents(file.extents, &deflates));
-        file.deflates = std::move(deflates);
-      }
+      archive_indexes.push_back(result_files->size() - 1);
     }
+  }
 
-    result_files->push_back(file);
+  // |result_files| doesn't grow anymore, so the locators can point into it.
+  vector<DeflateLocator> locators;
+  locators.reserve(archive_indexes.size());
+  vector<TaskScheduler::Task> tasks;
+  tasks.reserve(archive_indexes.size());
+  for (size_t index : archive_indexes) {
+    FilesystemInterface::File* file = &(*result_files)[index];
+    locators.emplace_back(part.image(), deflate_cache_dir, file);
+    tasks.push_back(
+        {&locators.back(), utils::BlocksInExtents(file->extents) * kBlockSize});
+  }
+  TaskScheduler::Get()->RunTasks(tasks);
+  for (const DeflateLocator& locator : locators) {
+    if (!locator.success()) {
+      LOG(ERROR) << "Failed to preprocess deflate data in partition "
+                 << part.name;
+      return false;
+    }
   }
   return true;
 }
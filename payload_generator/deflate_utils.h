@@ -32,9 +32,13 @@ namespace deflate_utils {
 // includes:
 //  - splitting large Squashfs containers into its smaller files.
 //  - extracting deflates in zip and gzip files.
+// The zip and gzip files are scanned in parallel on the TaskScheduler. If
+// |deflate_cache_dir| is not empty, their deflates are cached in it by
+// contents, see LocateDeflatesWithCache().
 bool PreprocessPartitionFiles(const PartitionConfig& part,
                               std::vector<FilesystemInterface::File>* result,
-                              bool extract_deflates);
+                              bool extract_deflates,
+                              const std::string& deflate_cache_dir);
 
 // Spreads all extents in |over_extents| over |base_extents|. Here we assume the
 // |over_extents| are non-overlapping and sorted by their offset.
@@ -103,6 +107,14 @@ bool DeflatePreprocessFileData(const std::string_view filename,
                                const brillo::Blob& data,
                                std::vector<puffin::BitExtent>* deflates);
 
+// Like DeflatePreprocessFileData(), but the deflates of zip and gzip files are
+// looked up in |cache_dir| by the hash of |data| first, and stored there after
+// locating them. An empty |cache_dir| disables the cache.
+bool LocateDeflatesWithCache(const std::string_view filename,
+                             const brillo::Blob& data,
+                             const std::string& cache_dir,
+                             std::vector<puffin::BitExtent>* deflates);
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
 #endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_DEFLATE_UTILS_H_
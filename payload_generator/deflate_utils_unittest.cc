@@ -22,6 +22,8 @@
 #include <utility>
 #include <vector>
 
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
@@ -186,5 +188,34 @@ TEST(DeflateUtilsTest, CompactBoundaryTest) {
   EXPECT_EQ(out_deflates, expected_out_deflates);
 }
 
+TEST(DeflateUtilsTest, LocateDeflatesWithCacheTest) {
+  // A gzip file with "hello" in a single stored deflate block.
+  const brillo::Blob gzip = {0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00,
+                             0x00, 0x03, 0x01, 0x05, 0x00, 0xfa, 0xff, 'h',
+                             'e',  'l',  'l',  'o',  0x86, 0xa6, 0x10, 0x36,
+                             0x05, 0x00, 0x00, 0x00};
+  vector<BitExtent> expected_deflates;
+  ASSERT_TRUE(DeflatePreprocessFileData("a.gz", gzip, &expected_deflates));
+
+  base::ScopedTempDir cache_dir;
+  ASSERT_TRUE(cache_dir.CreateUniqueTempDir());
+  const std::string cache_path = cache_dir.GetPath().value();
+  // Files whose deflates can't be located are not cached.
+  vector<BitExtent> deflates;
+  EXPECT_FALSE(LocateDeflatesWithCache(
+      "bad.gz", brillo::Blob(100, 'x'), cache_path, &deflates));
+  EXPECT_TRUE(base::IsDirectoryEmpty(cache_dir.GetPath()));
+
+  ASSERT_TRUE(LocateDeflatesWithCache("a.gz", gzip, cache_path, &deflates));
+  EXPECT_EQ(expected_deflates, deflates);
+  EXPECT_FALSE(base::IsDirectoryEmpty(cache_dir.GetPath()));
+
+  // Files with the same contents share the cached deflates.
+  deflates.clear();
+  ASSERT_TRUE(
+      LocateDeflatesWithCache("dir/b.tgz", gzip, cache_path, &deflates));
+  EXPECT_EQ(expected_deflates, deflates);
+}
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
@@ -42,7 +42,9 @@
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/full_update_generator.h"
 #include "update_engine/payload_generator/merge_sequence_generator.h"
+#include "update_engine/payload_generator/partition_cache.h"
 #include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/task_scheduler.h"
 #include "update_engine/update_metadata.pb.h"
 
 using std::string;
@@ -190,11 +192,14 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
 
     std::vector<size_t> all_cow_sizes(config.target.partitions.size(), 0);
 
+    // Partitions found in the cache are not generated again. The ones that are
+    // generated are stored in the cache under their key once done.
+    unique_ptr<PartitionCache> cache;
+    if (!config.partition_cache_dir.empty())
+      cache = std::make_unique<PartitionCache>(config.partition_cache_dir);
+    std::vector<std::pair<size_t, string>> keys_to_store;
+
     std::vector<PartitionProcessor> partition_tasks{};
-    auto thread_count = std::min<int>(diff_utils::GetMaxThreads(),
-                                      config.target.partitions.size());
-    base::DelegateSimpleThreadPool thread_pool{"partition-thread-pool",
-                                               thread_count};
     for (size_t i = 0; i < config.target.partitions.size(); i++) {
       const PartitionConfig& old_part =
           config.is_delta ? config.source.partitions[i] : empty_part;
@@ -203,6 +208,24 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
       LOG(INFO) << "Partition size: " << new_part.size;
       LOG(INFO) << "Block count: " << new_part.size / config.block_size;
 
+      if (cache) {
+        string key;
+        if (!PartitionCache::ComputeKey(config, old_part, new_part, &key)) {
+          LOG(WARNING) << "Failed to compute the cache key of partition "
+                       << new_part.name << ", not using the cache for it.";
+        } else if (cache->Load(key,
+                               &blob_file,
+                               &all_aops[i],
+                               &all_merge_sequences[i],
+                               &all_cow_sizes[i])) {
+          LOG(INFO) << "Using the cached operations of partition "
+                    << new_part.name;
+          continue;
+        } else {
+          keys_to_store.emplace_back(i, key);
+        }
+      }
+
       // Select payload generation strategy based on the config.
       unique_ptr<OperationsGenerator> strategy;
       if (!old_part.path.empty()) {
@@ -226,11 +249,27 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                                    &all_cow_sizes[i],
                                                    std::move(strategy)));
     }
-    thread_pool.Start();
+    // The partitions share the scheduler with the files and chunks they are
+    // split in, so the work of all the partitions is spread on the same
+    // threads. The partition tasks only wait for their own tasks, so they
+    // declare no memory.
+    std::vector<TaskScheduler::Task> tasks;
+    tasks.reserve(partition_tasks.size());
     for (auto& processor : partition_tasks) {
-      thread_pool.AddWork(&processor);
+      tasks.push_back({&processor});
+    }
+    TaskScheduler::Get()->RunTasks(tasks);
+
+    for (const auto& [i, key] : keys_to_store) {
+      if (!cache->Store(key,
+                        data_file.path(),
+                        all_aops[i],
+                        all_merge_sequences[i],
+                        all_cow_sizes[i])) {
+        LOG(WARNING) << "Failed to cache the operations of partition "
+                     << config.target.partitions[i].name;
+      }
     }
-    thread_pool.JoinAll();
 
     for (size_t i = 0; i < config.target.partitions.size(); i++) {
       const PartitionConfig& old_part =
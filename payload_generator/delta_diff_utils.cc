@@ -35,7 +35,9 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -67,6 +69,8 @@
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/partition_image_reader.h"
+#include "update_engine/payload_generator/task_scheduler.h"
 #include "update_engine/payload_generator/xz.h"
 
 using std::list;
@@ -201,6 +205,38 @@ bool BestDiffGenerator::GenerateBestDiffOperation(AnnotatedOperation* aop,
   return GenerateBestDiffOperation(diff_candidates, aop, data_blob);
 }
 
+BestDiffGenerator::BestDiffGenerator(std::string_view old_data,
+                                     std::string_view new_data,
+                                     const vector<Extent>& src_extents,
+                                     const vector<Extent>& dst_extents,
+                                     const File& old_file,
+                                     const File& new_file,
+                                     const PayloadGenerationConfig& config)
+    : old_data_(old_data),
+      new_data_(new_data),
+      src_extents_(src_extents),
+      dst_extents_(dst_extents),
+      old_deflates_(old_file.deflates),
+      new_deflates_(new_file.deflates),
+      old_block_info_(old_file.compressed_file_info),
+      new_block_info_(new_file.compressed_file_info),
+      config_(config) {
+  // Find all deflate positions inside the given extents and then put all
+  // deflates together because we have already read all the extents into
+  // one buffer.
+  vector<puffin::BitExtent> src_deflates;
+  TEST_AND_RETURN(deflate_utils::FindAndCompactDeflates(
+      src_extents_, old_deflates_, &src_deflates));
+
+  vector<puffin::BitExtent> dst_deflates;
+  TEST_AND_RETURN(deflate_utils::FindAndCompactDeflates(
+      dst_extents_, new_deflates_, &dst_deflates));
+  // The deflates puffin can't use are only removed when trying puffdiff,
+  // since that needs a copy of the data.
+  old_deflates_ = std::move(src_deflates);
+  new_deflates_ = std::move(dst_deflates);
+}
+
 std::vector<bsdiff::CompressorType>
 BestDiffGenerator::GetUsableCompressorTypes() const {
   return config_.compressors;
@@ -291,12 +327,13 @@ bool BestDiffGenerator::TryBsdiffAndUpdateOperation(
   }
 
   brillo::Blob bsdiff_delta;
-  TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data_.data(),
-                                            old_data_.size(),
-                                            new_data_.data(),
-                                            new_data_.size(),
-                                            bsdiff_patch_writer.get(),
-                                            nullptr));
+  TEST_AND_RETURN_FALSE(
+      0 == bsdiff::bsdiff(reinterpret_cast<const uint8_t*>(old_data_.data()),
+                          old_data_.size(),
+                          reinterpret_cast<const uint8_t*>(new_data_.data()),
+                          new_data_.size(),
+                          bsdiff_patch_writer.get(),
+                          nullptr));
 
   TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), &bsdiff_delta));
   TEST_AND_RETURN_FALSE(!bsdiff_delta.empty());
@@ -319,15 +356,33 @@ bool BestDiffGenerator::TryBsdiffAndUpdateOperation(
 
 bool BestDiffGenerator::TryPuffdiffAndUpdateOperation(AnnotatedOperation* aop,
                                                       brillo::Blob* data_blob) {
+  if (old_deflates_.empty() || new_deflates_.empty())
+    return true;
+  // puffin only works on buffers, so copy the data, possibly mapped from the
+  // images, only for as long as puffdiff needs it.
+  const brillo::Blob old_buffer(old_data_.begin(), old_data_.end());
+  const brillo::Blob new_buffer(new_data_.begin(), new_data_.end());
+  vector<puffin::BitExtent> src_deflates = old_deflates_;
+  vector<puffin::BitExtent> dst_deflates = new_deflates_;
+  puffin::RemoveEqualBitExtents(
+      old_buffer, new_buffer, &src_deflates, &dst_deflates);
+  // See crbug.com/915559.
+  if (config_.version.minor <= kPuffdiffMinorPayloadVersion) {
+    CHECK(
+        puffin::RemoveDeflatesWithBadDistanceCaches(old_buffer, &src_deflates));
+
+    CHECK(
+        puffin::RemoveDeflatesWithBadDistanceCaches(new_buffer, &dst_deflates));
+  }
   // Only Puffdiff if both files have at least one deflate left.
-  if (!old_deflates_.empty() && !new_deflates_.empty()) {
+  if (!src_deflates.empty() && !dst_deflates.empty()) {
     brillo::Blob puffdiff_delta;
     ScopedTempFile temp_file("puffdiff-delta.XXXXXX");
     // Perform PuffDiff operation.
-    TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data_,
-                                           new_data_,
-                                           old_deflates_,
-                                           new_deflates_,
+    TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_buffer,
+                                           new_buffer,
+                                           src_deflates,
+                                           dst_deflates,
                                            GetUsableCompressorTypes(),
                                            temp_file.path(),
                                            &puffdiff_delta));
@@ -361,8 +416,10 @@ bool BestDiffGenerator::TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
            /*, ".capex",".jar", ".apk", ".apex"*/})) {
     return true;
   }
-  zucchini::ConstBufferView src_bytes(old_data_.data(), old_data_.size());
-  zucchini::ConstBufferView dst_bytes(new_data_.data(), new_data_.size());
+  zucchini::ConstBufferView src_bytes(
+      reinterpret_cast<const uint8_t*>(old_data_.data()), old_data_.size());
+  zucchini::ConstBufferView dst_bytes(
+      reinterpret_cast<const uint8_t*>(new_data_.data()), new_data_.size());
 
   zucchini::EnsemblePatchWriter patch_writer(src_bytes, dst_bytes);
   auto status = zucchini::GenerateBuffer(src_bytes, dst_bytes, &patch_writer);
@@ -390,28 +447,85 @@ bool BestDiffGenerator::TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
   return true;
 }
 
+namespace {
+
+// Same as DeltaReadFile(), but only for the chunks of |new_file| starting
+// between the blocks |begin_block| and |end_block| of the file. |chunk_blocks|
+// must be positive.
+bool DeltaReadFileChunks(vector<AnnotatedOperation>* aops,
+                         const PartitionImage& old_part,
+                         const PartitionImage& new_part,
+                         const File& old_file,
+                         const File& new_file,
+                         uint64_t chunk_blocks,
+                         uint64_t begin_block,
+                         uint64_t end_block,
+                         const PayloadGenerationConfig& config,
+                         BlobFileWriter* blob_file);
+
+// Keeps track of how long each worker thread of a thread pool spent running
+// tasks, to tell how well the work was spread between them.
+class ThreadPoolUtilization {
+ public:
+  // Adds |busy_time| to the time spent by the calling thread.
+  void AddBusyTime(base::TimeDelta busy_time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_times_[std::this_thread::get_id()] += busy_time;
+  }
+
+  // Logs the time each thread was busy over |wall_time|.
+  void Log(const string& name, base::TimeDelta wall_time) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t thread_index = 0;
+    for (const auto& [thread_id, busy_time] : busy_times_) {
+      const double percent =
+          wall_time.is_zero()
+              ? 100.0
+              : 100.0 * busy_time.InSecondsF() / wall_time.InSecondsF();
+      LOG(INFO) << name << " thread " << thread_index++ << " was busy for "
+                << busy_time << " (" << static_cast<int>(percent) << "% of "
+                << wall_time << ")";
+    }
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  map<std::thread::id, base::TimeDelta> busy_times_;
+};
+
+}  // namespace
+
 // This class encapsulates a file delta processing thread work. The
 // processor computes the delta between the source and target files;
 // and write the compressed delta to the blob.
 class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
  public:
-  FileDeltaProcessor(const string& old_part,
-                     const string& new_part,
+  // Processes the chunks of |chunk_blocks| blocks of the file starting between
+  // the blocks |begin_block| and |end_block| of |new_extents|, so a big file
+  // can be split across several processors.
+  FileDeltaProcessor(const PartitionImage& old_part,
+                     const PartitionImage& new_part,
                      const PayloadGenerationConfig& config,
                      const File& old_extents,
                      const File& new_extents,
                      const string& name,
-                     ssize_t chunk_blocks,
-                     BlobFileWriter* blob_file)
+                     uint64_t chunk_blocks,
+                     uint64_t begin_block,
+                     uint64_t end_block,
+                     BlobFileWriter* blob_file,
+                     ThreadPoolUtilization* utilization)
       : old_part_(old_part),
         new_part_(new_part),
         config_(config),
         old_extents_(old_extents),
         new_extents_(new_extents),
-        new_extents_blocks_(utils::BlocksInExtents(new_extents.extents)),
+        new_extents_blocks_(end_block - begin_block),
         name_(name),
         chunk_blocks_(chunk_blocks),
-        blob_file_(blob_file) {}
+        begin_block_(begin_block),
+        end_block_(end_block),
+        blob_file_(blob_file),
+        utilization_(utilization) {}
 
   bool operator>(const FileDeltaProcessor& other) const {
     return new_extents_blocks_ > other.new_extents_blocks_;
@@ -419,6 +533,17 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
 
   ~FileDeltaProcessor() override = default;
 
+  // Returns a rough estimate of the peak memory used to diff one chunk: the
+  // old and new data, the suffix array bsdiff builds over the old data and
+  // the resulting patches.
+  uint64_t EstimatedMemory() const {
+    const uint64_t new_blocks =
+        std::min<uint64_t>(chunk_blocks_, new_extents_blocks_);
+    const uint64_t old_blocks = std::min<uint64_t>(
+        chunk_blocks_, utils::BlocksInExtents(old_extents_.extents));
+    return (old_blocks * 9 + new_blocks * 2) * config_.block_size;
+  }
+
   // Overrides DelegateSimpleThread::Delegate.
   // Calculate the list of operations and write their corresponding deltas to
   // the blob_file.
@@ -428,8 +553,8 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   bool MergeOperation(vector<AnnotatedOperation>* aops);
 
  private:
-  const string& old_part_;  // NOLINT(runtime/member_string_references)
-  const string& new_part_;  // NOLINT(runtime/member_string_references)
+  const PartitionImage old_part_;
+  const PartitionImage new_part_;
   const PayloadGenerationConfig& config_;
 
   // The block ranges of the old/new file within the src/tgt image
@@ -438,8 +563,12 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   const size_t new_extents_blocks_;
   const string name_;
   // Block limit of one aop.
-  const ssize_t chunk_blocks_;
+  const uint64_t chunk_blocks_;
+  // The range of blocks of |new_extents_| handled by this processor.
+  const uint64_t begin_block_;
+  const uint64_t end_block_;
   BlobFileWriter* blob_file_;
+  ThreadPoolUtilization* utilization_;
 
   // The list of ops to reach the new file from the old file.
   vector<AnnotatedOperation> file_aops_;
@@ -453,29 +582,32 @@ void FileDeltaProcessor::Run() {
   TEST_AND_RETURN(blob_file_ != nullptr);
   base::TimeTicks start = base::TimeTicks::Now();
 
-  if (!DeltaReadFile(&file_aops_,
-                     old_part_,
-                     new_part_,
-                     old_extents_,
-                     new_extents_,
-                     chunk_blocks_,
-                     config_,
-                     blob_file_)) {
+  if (!DeltaReadFileChunks(&file_aops_,
+                           old_part_,
+                           new_part_,
+                           old_extents_,
+                           new_extents_,
+                           chunk_blocks_,
+                           begin_block_,
+                           end_block_,
+                           config_,
+                           blob_file_)) {
     LOG(ERROR) << "Failed to generate delta for " << name_ << " ("
                << new_extents_blocks_ << " blocks)";
     failed_ = true;
-    return;
-  }
-
-  if (!ABGenerator::FragmentOperations(
-          config_.version, &file_aops_, new_part_, blob_file_)) {
+  } else if (!ABGenerator::FragmentOperations(
+                 config_.version, &file_aops_, new_part_, blob_file_)) {
     LOG(ERROR) << "Failed to fragment operations for " << name_;
     failed_ = true;
-    return;
   }
 
-  LOG(INFO) << "Encoded file " << name_ << " (" << new_extents_blocks_
-            << " blocks) in " << (base::TimeTicks::Now() - start);
+  base::TimeDelta duration = base::TimeTicks::Now() - start;
+  if (utilization_)
+    utilization_->AddBusyTime(duration);
+  if (!failed_) {
+    LOG(INFO) << "Encoded file " << name_ << " (" << new_extents_blocks_
+              << " blocks) in " << duration;
+  }
 }
 
 bool FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
@@ -555,7 +687,7 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   TEST_AND_RETURN_FALSE(new_part.fs_interface);
   vector<FilesystemInterface::File> new_files;
   TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
-      new_part, &new_files, puffdiff_allowed));
+      new_part, &new_files, puffdiff_allowed, config.partition_cache_dir));
 
   ExtentRanges old_zero_blocks;
   // Prematurely removing moved blocks will render compression info useless.
@@ -571,8 +703,8 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   if (!config.OperationEnabled(InstallOperation::LZ4DIFF_BSDIFF) ||
       no_compressed_files) {
     TEST_AND_RETURN_FALSE(DeltaMovedAndZeroBlocks(aops,
-                                                  old_part.path,
-                                                  new_part.path,
+                                                  old_part.image(),
+                                                  new_part.image(),
                                                   old_part.size / kBlockSize,
                                                   new_part.size / kBlockSize,
                                                   soft_chunk_blocks,
@@ -587,12 +719,52 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   if (old_part.fs_interface) {
     vector<FilesystemInterface::File> old_files;
     TEST_AND_RETURN_FALSE(deflate_utils::PreprocessPartitionFiles(
-        old_part, &old_files, puffdiff_allowed));
+        old_part, &old_files, puffdiff_allowed, config.partition_cache_dir));
     for (const FilesystemInterface::File& file : old_files)
       old_files_map[file.name] = file;
   }
 
+  TaskScheduler* scheduler = TaskScheduler::Get();
+  const size_t max_threads = scheduler->max_threads();
+  ThreadPoolUtilization utilization;
   list<FileDeltaProcessor> file_delta_processors;
+  // Adds the processors for |new_file|. A file with several chunks is split in
+  // up to |max_threads| processors of consecutive chunks, so that a single big
+  // file doesn't keep one thread busy long after the others are done.
+  auto add_file_delta_processors = [&](const File& old_file,
+                                       const File& new_file,
+                                       const string& name,
+                                       ssize_t chunk_blocks) {
+    if (chunk_blocks == 0) {
+      LOG(ERROR) << "Invalid number of chunk_blocks. Cannot be 0.";
+      return false;
+    }
+    const uint64_t total_blocks = utils::BlocksInExtents(new_file.extents);
+    if (total_blocks == 0)
+      return true;
+    const uint64_t file_chunk_blocks =
+        chunk_blocks == -1 ? total_blocks : chunk_blocks;
+    const uint64_t num_chunks =
+        utils::DivRoundUp(total_blocks, file_chunk_blocks);
+    const uint64_t num_processors = std::min<uint64_t>(num_chunks, max_threads);
+    for (uint64_t i = 0; i < num_processors; i++) {
+      const uint64_t begin_chunk = num_chunks * i / num_processors;
+      const uint64_t end_chunk = num_chunks * (i + 1) / num_processors;
+      file_delta_processors.emplace_back(
+          old_part.image(),
+          new_part.image(),
+          config,
+          old_file,
+          new_file,
+          name,
+          file_chunk_blocks,
+          begin_chunk * file_chunk_blocks,
+          std::min(end_chunk * file_chunk_blocks, total_blocks),
+          blob_file,
+          &utilization);
+    }
+    return true;
+  };
 
   // The processing is very straightforward here, we generate operations for
   // every file (and pseudo-file such as the metadata) in the new filesystem
@@ -634,14 +806,11 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     // whatsoever.
     auto filtered_new_file = new_file;
     filtered_new_file.extents = RemoveDuplicateBlocks(new_file_extents);
-    file_delta_processors.emplace_back(old_part.path,
-                                       new_part.path,
-                                       config,
-                                       std::move(old_file),
-                                       std::move(filtered_new_file),
-                                       new_file.name,  // operation name
-                                       hard_chunk_blocks,
-                                       blob_file);
+    TEST_AND_RETURN_FALSE(
+        add_file_delta_processors(old_file,
+                                  filtered_new_file,
+                                  new_file.name,  // operation name
+                                  hard_chunk_blocks));
   }
   // Process all the blocks not included in any file. We provided all the unused
   // blocks in the old partition as available data.
@@ -665,31 +834,29 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     old_file.extents = old_unvisited;
     File new_file;
     new_file.extents = RemoveDuplicateBlocks(new_unvisited);
-    file_delta_processors.emplace_back(old_part.path,
-                                       new_part.path,
-                                       config,
-                                       old_file,
-                                       new_file,
-                                       "<non-file-data>",  // operation name
-                                       soft_chunk_blocks,
-                                       blob_file);
+    TEST_AND_RETURN_FALSE(
+        add_file_delta_processors(old_file,
+                                  new_file,
+                                  "<non-file-data>",  // operation name
+                                  soft_chunk_blocks));
   }
 
-  size_t max_threads = GetMaxThreads();
-
   // Sort the files in descending order based on number of new blocks to make
-  // sure we start the largest ones first.
+  // sure we start the largest ones first. The scheduler hands the next
+  // processor to whichever thread becomes idle first, so this schedules the
+  // longest processing first.
   if (file_delta_processors.size() > max_threads) {
     file_delta_processors.sort(std::greater<FileDeltaProcessor>());
   }
 
-  base::DelegateSimpleThreadPool thread_pool("incremental-update-generator",
-                                             max_threads);
-  thread_pool.Start();
+  vector<TaskScheduler::Task> tasks;
+  tasks.reserve(file_delta_processors.size());
   for (auto& processor : file_delta_processors) {
-    thread_pool.AddWork(&processor);
+    tasks.push_back({&processor, processor.EstimatedMemory()});
   }
-  thread_pool.JoinAll();
+  base::TimeTicks start = base::TimeTicks::Now();
+  scheduler->RunTasks(tasks);
+  utilization.Log(new_part.name, base::TimeTicks::Now() - start);
 
   for (auto& processor : file_delta_processors) {
     TEST_AND_RETURN_FALSE(processor.MergeOperation(aops));
@@ -699,8 +866,8 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
 }
 
 bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
-                             const string& old_part,
-                             const string& new_part,
+                             const PartitionImage& old_part,
+                             const PartitionImage& new_part,
                              size_t old_num_blocks,
                              size_t new_num_blocks,
                              ssize_t chunk_blocks,
@@ -711,8 +878,8 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
                              ExtentRanges* old_zero_blocks) {
   vector<BlockMapping::BlockId> old_block_ids;
   vector<BlockMapping::BlockId> new_block_ids;
-  TEST_AND_RETURN_FALSE(MapPartitionBlocks(old_part,
-                                           new_part,
+  TEST_AND_RETURN_FALSE(MapPartitionBlocks(old_part.path(),
+                                           new_part.path(),
                                            old_num_blocks * kBlockSize,
                                            new_num_blocks * kBlockSize,
                                            kBlockSize,
@@ -848,20 +1015,14 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
 }
 
 bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
-                   const std::string& old_part,
-                   const std::string& new_part,
+                   const PartitionImage& old_part,
+                   const PartitionImage& new_part,
                    const File& old_file,
                    const File& new_file,
                    ssize_t chunk_blocks,
                    const PayloadGenerationConfig& config,
                    BlobFileWriter* blob_file) {
-  const auto& old_extents = old_file.extents;
-  const auto& new_extents = new_file.extents;
-  const auto& name = new_file.name;
-
-  brillo::Blob data;
-
-  uint64_t total_blocks = utils::BlocksInExtents(new_extents);
+  uint64_t total_blocks = utils::BlocksInExtents(new_file.extents);
   if (chunk_blocks == 0) {
     LOG(ERROR) << "Invalid number of chunk_blocks. Cannot be 0.";
     return false;
@@ -869,8 +1030,42 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
 
   if (chunk_blocks == -1)
     chunk_blocks = total_blocks;
+  if (total_blocks == 0)
+    return true;
 
-  for (uint64_t block_offset = 0; block_offset < total_blocks;
+  return DeltaReadFileChunks(aops,
+                             old_part,
+                             new_part,
+                             old_file,
+                             new_file,
+                             chunk_blocks,
+                             0,
+                             total_blocks,
+                             config,
+                             blob_file);
+}
+
+namespace {
+
+bool DeltaReadFileChunks(vector<AnnotatedOperation>* aops,
+                         const PartitionImage& old_part,
+                         const PartitionImage& new_part,
+                         const File& old_file,
+                         const File& new_file,
+                         uint64_t chunk_blocks,
+                         uint64_t begin_block,
+                         uint64_t end_block,
+                         const PayloadGenerationConfig& config,
+                         BlobFileWriter* blob_file) {
+  const auto& old_extents = old_file.extents;
+  const auto& new_extents = new_file.extents;
+  const auto& name = new_file.name;
+
+  brillo::Blob data;
+
+  TEST_AND_RETURN_FALSE(chunk_blocks > 0);
+  const uint64_t total_blocks = utils::BlocksInExtents(new_extents);
+  for (uint64_t block_offset = begin_block; block_offset < end_block;
        block_offset += chunk_blocks) {
     // Split the old/new file in the same chunks. Note that this could drop
     // some information from the old file used for the new chunk. If the old
@@ -902,7 +1097,7 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
       return false;
     }
 
-    if (static_cast<uint64_t>(chunk_blocks) < total_blocks) {
+    if (chunk_blocks < total_blocks) {
       aop.name = base::StringPrintf(
           "%s:%" PRIu64, name.c_str(), block_offset / chunk_blocks);
     }
@@ -914,6 +1109,8 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
   return true;
 }
 
+}  // namespace
+
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
                                const PayloadVersion& version,
                                brillo::Blob* out_blob,
@@ -922,8 +1119,7 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
     return false;
 
   if (version.OperationAllowed(InstallOperation::ZERO) &&
-      std::all_of(
-          new_data.begin(), new_data.end(), [](uint8_t x) { return x == 0; })) {
+      IsZeroData(new_data.data(), new_data.size())) {
     // The read buffer is all zeros, so produce a ZERO operation. No need to
     // check other types of operations in this case.
     *out_blob = brillo::Blob();
@@ -1034,8 +1230,8 @@ bool PopulateXorOps(AnnotatedOperation* aop, const uint8_t* data, size_t size) {
   return true;
 }
 
-bool ReadExtentsToDiff(const string& old_part,
-                       const string& new_part,
+bool ReadExtentsToDiff(const PartitionImage& old_part,
+                       const PartitionImage& new_part,
                        const vector<Extent>& src_extents,
                        const vector<Extent>& dst_extents,
                        const File& old_file,
@@ -1056,11 +1252,8 @@ bool ReadExtentsToDiff(const string& old_part,
 
   // Read in bytes from new data.
   brillo::Blob new_data;
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(new_part,
-                                           dst_extents,
-                                           &new_data,
-                                           kBlockSize * blocks_to_write,
-                                           kBlockSize));
+  TEST_AND_RETURN_FALSE(new_part.ReadExtents(
+      dst_extents, &new_data, kBlockSize * blocks_to_write, kBlockSize));
   TEST_AND_RETURN_FALSE(!new_data.empty());
 
   // Data blob that will be written to delta file.
@@ -1074,14 +1267,17 @@ bool ReadExtentsToDiff(const string& old_part,
   operation.set_type(op_type);
 
   if (blocks_to_read > 0) {
-    brillo::Blob old_data;
-    // Read old data.
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(old_part,
-                                             src_extents,
-                                             &old_data,
-                                             kBlockSize * blocks_to_read,
-                                             kBlockSize));
-    if (old_data == new_data) {
+    // Use the old data in place if the old image is mapped, otherwise read it.
+    std::string_view old_data;
+    brillo::Blob old_data_buffer;
+    if (!old_part.MapExtents(src_extents, kBlockSize, &old_data)) {
+      TEST_AND_RETURN_FALSE(old_part.ReadExtents(src_extents,
+                                                 &old_data_buffer,
+                                                 kBlockSize * blocks_to_read,
+                                                 kBlockSize));
+      old_data = ToStringView(old_data_buffer);
+    }
+    if (old_data == ToStringView(new_data)) {
       // No change in data.
       operation.set_type(InstallOperation::SOURCE_COPY);
       data_blob = brillo::Blob();
@@ -1091,7 +1287,7 @@ bool ReadExtentsToDiff(const string& old_part,
       // still worse than replace.
 
       BestDiffGenerator best_diff_generator(old_data,
-                                            new_data,
+                                            ToStringView(new_data),
                                             src_extents,
                                             dst_extents,
                                             old_file,
@@ -19,6 +19,7 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -29,6 +30,7 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/partition_image_reader.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -66,8 +68,8 @@ bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
 // for unvisited blocks are produced by this function updating both collections
 // with the used blocks.
 bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
-                             const std::string& old_part,
-                             const std::string& new_part,
+                             const PartitionImage& old_part,
+                             const PartitionImage& new_part,
                              size_t old_num_blocks,
                              size_t new_num_blocks,
                              ssize_t chunk_blocks,
@@ -86,8 +88,8 @@ bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
 // in the |blob_file|. |old_deflates| and |new_deflates| are all deflate
 // locations in |old_part| and |new_part|. Returns true on success.
 bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
-                   const std::string& old_part,
-                   const std::string& new_part,
+                   const PartitionImage& old_part,
+                   const PartitionImage& new_part,
                    const File& old_file,
                    const File& new_file,
                    ssize_t chunk_blocks,
@@ -104,8 +106,8 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
 // |new_extents| must not be empty. |old_deflates| and |new_deflates| are all
 // the deflate locations in |old_part| and |new_part|. Returns true on success.
 // TODO(197361113) Move logic to calculate deflates inside puffin.
-bool ReadExtentsToDiff(const std::string& old_part,
-                       const std::string& new_part,
+bool ReadExtentsToDiff(const PartitionImage& old_part,
+                       const PartitionImage& new_part,
                        const std::vector<Extent>& old_extents,
                        const std::vector<Extent>& new_extents,
                        const File& old_file,
@@ -165,6 +167,16 @@ inline bool PopulateXorOps(AnnotatedOperation* aop,
 
 class BestDiffGenerator {
  public:
+  // |old_data| and |new_data| must outlive the generator. They can point into
+  // a mapped image, in which case they are only copied if puffdiff needs them.
+  BestDiffGenerator(std::string_view old_data,
+                    std::string_view new_data,
+                    const std::vector<Extent>& src_extents,
+                    const std::vector<Extent>& dst_extents,
+                    const File& old_file,
+                    const File& new_file,
+                    const PayloadGenerationConfig& config);
+
   BestDiffGenerator(const brillo::Blob& old_data,
                     const brillo::Blob& new_data,
                     const std::vector<Extent>& src_extents,
@@ -172,39 +184,13 @@ class BestDiffGenerator {
                     const File& old_file,
                     const File& new_file,
                     const PayloadGenerationConfig& config)
-      : old_data_(old_data),
-        new_data_(new_data),
-        src_extents_(src_extents),
-        dst_extents_(dst_extents),
-        old_deflates_(old_file.deflates),
-        new_deflates_(new_file.deflates),
-        old_block_info_(old_file.compressed_file_info),
-        new_block_info_(new_file.compressed_file_info),
-        config_(config) {
-    using std::vector;
-    // Find all deflate positions inside the given extents and then put all
-    // deflates together because we have already read all the extents into
-    // one buffer.
-    vector<puffin::BitExtent> src_deflates;
-    TEST_AND_RETURN(deflate_utils::FindAndCompactDeflates(
-        src_extents_, old_deflates_, &src_deflates));
-
-    vector<puffin::BitExtent> dst_deflates;
-    TEST_AND_RETURN(deflate_utils::FindAndCompactDeflates(
-        dst_extents_, new_deflates_, &dst_deflates));
-    puffin::RemoveEqualBitExtents(
-        old_data_, new_data_, &src_deflates, &dst_deflates);
-    // See crbug.com/915559.
-    if (config.version.minor <= kPuffdiffMinorPayloadVersion) {
-      CHECK(
-          puffin::RemoveDeflatesWithBadDistanceCaches(old_data, &src_deflates));
-
-      CHECK(
-          puffin::RemoveDeflatesWithBadDistanceCaches(new_data, &dst_deflates));
-    }
-    old_deflates_ = std::move(src_deflates);
-    new_deflates_ = std::move(dst_deflates);
-  }
+      : BestDiffGenerator(ToStringView(old_data),
+                          ToStringView(new_data),
+                          src_extents,
+                          dst_extents,
+                          old_file,
+                          new_file,
+                          config) {}
 
   // Tries different algorithms and compares their patch sizes with the
   // compressed full operation data in |data_blob|. If the size is smaller,
@@ -228,8 +214,8 @@ class BestDiffGenerator {
   bool TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
                                      brillo::Blob* data_blob);
 
-  const brillo::Blob& old_data_;
-  const brillo::Blob& new_data_;
+  const std::string_view old_data_;
+  const std::string_view new_data_;
   const std::vector<Extent>& src_extents_;
   const std::vector<Extent>& dst_extents_;
   std::vector<puffin::BitExtent> old_deflates_;
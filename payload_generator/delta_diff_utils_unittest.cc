@@ -186,6 +186,34 @@ TEST_F(DeltaDiffUtilsTest, SkipVerityExtentsTest) {
   }
 }
 
+TEST_F(DeltaDiffUtilsTest, SplitChunkedFilesTest) {
+  // All the blocks are different, so the whole partition ends up in the
+  // chunked <non-file-data> pseudo-file, which is split across processors.
+  ASSERT_TRUE(InitializePartitionWithUniqueBlocks(old_part_, kBlockSize, 42));
+  ASSERT_TRUE(InitializePartitionWithUniqueBlocks(new_part_, kBlockSize, 5));
+
+  BlobFileWriter blob_file(tmp_blob_file_.fd(), &blob_size_);
+  ASSERT_TRUE(diff_utils::DeltaReadPartition(
+      &aops_,
+      old_part_,
+      new_part_,
+      -1,
+      4,
+      {.version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                 kSourceMinorPayloadVersion)},
+      &blob_file));
+
+  // Every new block is written exactly once, in chunks of up to 4 blocks.
+  uint64_t num_blocks = 0;
+  for (const auto& aop : aops_) {
+    EXPECT_LE(utils::BlocksInExtents(aop.op.dst_extents()), 4U);
+    num_blocks += utils::BlocksInExtents(aop.op.dst_extents());
+    new_visited_blocks_.AddRepeatedExtents(aop.op.dst_extents());
+  }
+  EXPECT_EQ(new_part_.size / kBlockSize, num_blocks);
+  EXPECT_EQ(new_part_.size / kBlockSize, new_visited_blocks_.blocks());
+}
+
 TEST_F(DeltaDiffUtilsTest, ReplaceSmallTest) {
   // The old file is on a different block than the new one.
   vector<Extent> old_extents = {ExtentForRange(1, 1)};
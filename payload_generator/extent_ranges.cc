@@ -17,6 +17,7 @@
 #include "update_engine/payload_generator/extent_ranges.h"
 
 #include <algorithm>
+#include <iterator>
 #include <set>
 #include <utility>
 #include <vector>
@@ -81,27 +82,27 @@ void ExtentRanges::AddExtent(Extent extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
-  ExtentSet::iterator begin_del = extent_set_.end();
-  ExtentSet::iterator end_del = extent_set_.end();
+  const auto should_merge = [this](const Extent& a, const Extent& b) {
+    return merge_touching_extents_ ? ExtentsOverlapOrTouch(a, b)
+                                   : ExtentsOverlap(a, b);
+  };
+  // The extents in |extent_set_| are disjoint and sorted, so only the extent
+  // right before |extent| can reach into it from the left, and the extents to
+  // merge form a contiguous run starting there.
+  ExtentSet::iterator begin_del = extent_set_.lower_bound(extent);
+  if (begin_del != extent_set_.begin() &&
+      should_merge(*std::prev(begin_del), extent)) {
+    --begin_del;
+  }
+  ExtentSet::iterator end_del = begin_del;
   uint64_t del_blocks = 0;
-  for (ExtentSet::iterator it = extent_set_.begin(), e = extent_set_.end();
-       it != e;
-       ++it) {
-    const bool should_merge = merge_touching_extents_
-                                  ? ExtentsOverlapOrTouch(*it, extent)
-                                  : ExtentsOverlap(*it, extent);
-    if (should_merge) {
-      end_del = it;
-      ++end_del;
-      del_blocks += it->num_blocks();
-      if (begin_del == extent_set_.end())
-        begin_del = it;
-
-      extent = UnionOverlappingExtents(extent, *it);
-    }
+  for (; end_del != extent_set_.end() && should_merge(*end_del, extent);
+       ++end_del) {
+    del_blocks += end_del->num_blocks();
+    extent = UnionOverlappingExtents(extent, *end_del);
   }
-  extent_set_.erase(begin_del, end_del);
-  extent_set_.insert(extent);
+  end_del = extent_set_.erase(begin_del, end_del);
+  extent_set_.insert(end_del, extent);
   blocks_ -= del_blocks;
   blocks_ += extent.num_blocks();
 }
@@ -128,33 +129,32 @@ void ExtentRanges::SubtractExtent(const Extent& extent) {
   if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
     return;
 
-  ExtentSet::iterator begin_del = extent_set_.end();
-  ExtentSet::iterator end_del = extent_set_.end();
+  // Same as in AddExtent(), the overlapping extents form a contiguous run
+  // that starts at most one extent before lower_bound(extent).
+  ExtentSet::iterator begin_del = extent_set_.lower_bound(extent);
+  if (begin_del != extent_set_.begin() &&
+      ExtentsOverlap(*std::prev(begin_del), extent)) {
+    --begin_del;
+  }
+  ExtentSet::iterator end_del = begin_del;
   uint64_t del_blocks = 0;
   ExtentSet new_extents;
-  for (ExtentSet::iterator it = extent_set_.begin(), e = extent_set_.end();
-       it != e;
-       ++it) {
-    if (!ExtentsOverlap(*it, extent))
-      continue;
-
-    if (begin_del == extent_set_.end())
-      begin_del = it;
-    end_del = it;
-    ++end_del;
-
-    del_blocks += it->num_blocks();
-
-    ExtentSet subtraction = SubtractOverlappingExtents(*it, extent);
-    for (ExtentSet::iterator jt = subtraction.begin(), je = subtraction.end();
-         jt != je;
-         ++jt) {
-      new_extents.insert(*jt);
-      del_blocks -= jt->num_blocks();
+  for (; end_del != extent_set_.end() && ExtentsOverlap(*end_del, extent);
+       ++end_del) {
+    del_blocks += end_del->num_blocks();
+
+    // Only the first and the last overlapping extents can leave anything
+    // behind, so |new_extents| holds at most two extents.
+    for (const Extent& remaining :
+         SubtractOverlappingExtents(*end_del, extent)) {
+      new_extents.insert(remaining);
+      del_blocks -= remaining.num_blocks();
     }
   }
-  extent_set_.erase(begin_del, end_del);
-  extent_set_.insert(new_extents.begin(), new_extents.end());
+  end_del = extent_set_.erase(begin_del, end_del);
+  for (const Extent& remaining : new_extents) {
+    extent_set_.insert(end_del, remaining);
+  }
   blocks_ -= del_blocks;
 }
 
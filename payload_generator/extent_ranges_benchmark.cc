@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns |count| single block extents with a one block gap in between, in
+// random order. This mimics the visited blocks of a heavily fragmented image.
+vector<Extent> FragmentedExtents(size_t count) {
+  vector<Extent> extents;
+  extents.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    extents.push_back(ExtentForRange(i * 2, 1));
+  }
+  std::mt19937 gen(12345);
+  std::shuffle(extents.begin(), extents.end(), gen);
+  return extents;
+}
+
+void BM_AddExtents(benchmark::State& state) {
+  const vector<Extent> extents = FragmentedExtents(state.range(0));
+  for (auto _ : state) {
+    ExtentRanges ranges;
+    ranges.AddExtents(extents);
+    benchmark::DoNotOptimize(ranges.blocks());
+  }
+  state.SetItemsProcessed(state.iterations() * extents.size());
+}
+BENCHMARK(BM_AddExtents)->Range(1 << 10, 1 << 20);
+
+void BM_SubtractExtents(benchmark::State& state) {
+  const vector<Extent> extents = FragmentedExtents(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    ExtentRanges ranges;
+    ranges.AddExtents(extents);
+    state.ResumeTiming();
+    ranges.SubtractExtents(extents);
+    benchmark::DoNotOptimize(ranges.blocks());
+  }
+  state.SetItemsProcessed(state.iterations() * extents.size());
+}
+BENCHMARK(BM_SubtractExtents)->Range(1 << 10, 1 << 20);
+
+// Fills the gaps between the fragmented extents, so every added extent merges
+// with both of its neighbors.
+void BM_AddTouchingExtents(benchmark::State& state) {
+  const vector<Extent> extents = FragmentedExtents(state.range(0));
+  vector<Extent> gaps;
+  gaps.reserve(extents.size());
+  for (const Extent& extent : extents) {
+    gaps.push_back(ExtentForRange(extent.start_block() + 1, 1));
+  }
+  for (auto _ : state) {
+    state.PauseTiming();
+    ExtentRanges ranges;
+    ranges.AddExtents(extents);
+    state.ResumeTiming();
+    ranges.AddExtents(gaps);
+    benchmark::DoNotOptimize(ranges.blocks());
+  }
+  state.SetItemsProcessed(state.iterations() * gaps.size());
+}
+BENCHMARK(BM_AddTouchingExtents)->Range(1 << 10, 1 << 20);
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN();
@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_generator/extent_ranges.h"
 
+#include <algorithm>
+#include <random>
 #include <vector>
 
 #include <base/stl_util.h>
@@ -390,4 +392,46 @@ TEST(ExtentRangesTest, OverlapsWithExtent) {
   ASSERT_TRUE(ranges.OverlapsWithExtent(ExtentForRange(19, 1)));
 }
 
+TEST(ExtentRangesTest, RandomAddSubtractMatchesBitmap) {
+  constexpr uint64_t kNumBlocks = 512;
+  for (bool merge_touching_extents : {true, false}) {
+    ExtentRanges ranges(merge_touching_extents);
+    vector<bool> bitmap(kNumBlocks);
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<uint64_t> start_dis(0, kNumBlocks - 1);
+    std::uniform_int_distribution<uint64_t> length_dis(1, 16);
+    for (int i = 0; i < 2000; i++) {
+      const uint64_t start = start_dis(gen);
+      const uint64_t length = std::min(length_dis(gen), kNumBlocks - start);
+      const bool add = gen() % 3 != 0;
+      if (add) {
+        ranges.AddExtent(ExtentForRange(start, length));
+      } else {
+        ranges.SubtractExtent(ExtentForRange(start, length));
+      }
+      for (uint64_t block = start; block < start + length; block++) {
+        bitmap[block] = add;
+      }
+
+      uint64_t expected_blocks = 0;
+      for (uint64_t block = 0; block < kNumBlocks; block++) {
+        ASSERT_EQ(bitmap[block], ranges.ContainsBlock(block));
+        expected_blocks += bitmap[block];
+      }
+      ASSERT_EQ(expected_blocks, ranges.blocks());
+      // Extents must stay disjoint, and never touch when merging is enabled.
+      uint64_t prev_end = 0;
+      for (const Extent& extent : ranges.extent_set()) {
+        ASSERT_NE(0u, extent.num_blocks());
+        if (merge_touching_extents && extent.start_block() != 0) {
+          ASSERT_LT(prev_end, extent.start_block());
+        } else {
+          ASSERT_LE(prev_end, extent.start_block());
+        }
+        prev_end = extent.start_block() + extent.num_blocks();
+      }
+    }
+  }
+}
+
 }  // namespace chromeos_update_engine
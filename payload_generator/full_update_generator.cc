@@ -22,6 +22,8 @@
 #include <algorithm>
 #include <deque>
 #include <memory>
+#include <numeric>
+#include <utility>
 
 #include <base/format_macros.h>
 #include <base/strings/string_util.h>
@@ -32,6 +34,7 @@
 
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/task_scheduler.h"
 
 using std::vector;
 
@@ -41,70 +44,101 @@ namespace {
 
 const size_t kDefaultFullChunkSize = 1024 * 1024;  // 1 MiB
 
+// The number of chunks per scheduler thread read at once. Chunks are read and
+// compressed one window at a time, while the next window is read.
+const size_t kWindowChunksPerThread = 2;
+
+// Reads a window of consecutive chunks of the partition with sequential reads,
+// so the compressors don't issue scattered reads to the image.
+class WindowReader : public base::DelegateSimpleThread::Delegate {
+ public:
+  // Reads the chunks of |chunk_sizes| bytes from |fd| starting at offset
+  // |offset| into |chunks|, reusing their buffers.
+  WindowReader(int fd,
+               off_t offset,
+               vector<size_t> chunk_sizes,
+               vector<brillo::Blob>* chunks)
+      : fd_(fd),
+        offset_(offset),
+        chunk_sizes_(std::move(chunk_sizes)),
+        chunks_(chunks) {}
+  ~WindowReader() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { success_ = ReadWindow(); }
+
+  bool success() const { return success_; }
+
+ private:
+  bool ReadWindow() {
+    chunks_->resize(chunk_sizes_.size());
+    off_t offset = offset_;
+    for (size_t i = 0; i < chunk_sizes_.size(); ++i) {
+      brillo::Blob* chunk = &(*chunks_)[i];
+      chunk->resize(chunk_sizes_[i]);
+      ssize_t bytes_read = -1;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(
+          fd_, chunk->data(), chunk->size(), offset, &bytes_read));
+      TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(chunk->size()));
+      offset += chunk->size();
+    }
+    return true;
+  }
+
+  int fd_;
+  off_t offset_;
+  const vector<size_t> chunk_sizes_;
+  vector<brillo::Blob>* chunks_;
+  bool success_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(WindowReader);
+};
+
 // This class encapsulates a full update chunk processing thread work. The
-// processor reads a chunk of data from the input file descriptor and compresses
-// it. The processor will destroy itself when the work is done.
+// processor compresses a chunk of data already read from the partition and
+// keeps the result until it is stored in the blob file in order.
 class ChunkProcessor : public base::DelegateSimpleThread::Delegate {
  public:
-  // Read a chunk of |size| bytes from |fd| starting at offset |offset|.
-  ChunkProcessor(const PayloadVersion& version,
-                 int fd,
-                 off_t offset,
-                 size_t size,
-                 BlobFileWriter* blob_file,
-                 AnnotatedOperation* aop)
-      : version_(version),
-        fd_(fd),
-        offset_(offset),
-        size_(size),
-        blob_file_(blob_file),
-        aop_(aop) {}
-  // We use a default move constructor since all the data members are POD types.
+  // Compress the chunk |data|.
+  ChunkProcessor(const PayloadVersion& version, const brillo::Blob& data)
+      : version_(version), data_(data) {}
+  // We use a default move constructor since all the data members are movable.
   ChunkProcessor(ChunkProcessor&&) = default;
   ~ChunkProcessor() override = default;
 
   // Overrides DelegateSimpleThread::Delegate.
-  // Run() handles the read from |fd| in a thread-safe way, and stores the
-  // new operation to generate the region starting at |offset| of size |size|
-  // in the output operation |aop|. The associated blob data is stored in
-  // |blob_fd| and |blob_file_size| is updated.
+  // Run() generates the operation to write |data|, to be stored with
+  // StoreOperation().
   void Run() override;
 
- private:
-  bool ProcessChunk();
+  // Sets the operation type of |aop| and stores its blob in |blob_file|.
+  bool StoreOperation(BlobFileWriter* blob_file, AnnotatedOperation* aop);
 
+ private:
   // Work parameters.
   const PayloadVersion& version_;
-  int fd_;
-  off_t offset_;
-  size_t size_;
-  BlobFileWriter* blob_file_;
-  AnnotatedOperation* aop_;
+  const brillo::Blob& data_;
+
+  // The result of the work.
+  bool success_ = false;
+  InstallOperation::Type op_type_;
+  brillo::Blob op_blob_;
 
   DISALLOW_COPY_AND_ASSIGN(ChunkProcessor);
 };
 
 void ChunkProcessor::Run() {
-  if (!ProcessChunk()) {
-    LOG(ERROR) << "Error processing region at " << offset_ << " of size "
-               << size_;
-  }
+  success_ = diff_utils::GenerateBestFullOperation(
+      data_, version_, &op_blob_, &op_type_);
 }
 
-bool ChunkProcessor::ProcessChunk() {
-  brillo::Blob buffer_in_(size_);
-  brillo::Blob op_blob;
-  ssize_t bytes_read = -1;
-  TEST_AND_RETURN_FALSE(utils::PReadAll(
-      fd_, buffer_in_.data(), buffer_in_.size(), offset_, &bytes_read));
-  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size_));
-
-  InstallOperation::Type op_type;
-  TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
-      buffer_in_, version_, &op_blob, &op_type));
-
-  aop_->op.set_type(op_type);
-  TEST_AND_RETURN_FALSE(aop_->SetOperationBlob(op_blob, blob_file_));
+bool ChunkProcessor::StoreOperation(BlobFileWriter* blob_file,
+                                    AnnotatedOperation* aop) {
+  TEST_AND_RETURN_FALSE(success_);
+  aop->op.set_type(op_type_);
+  TEST_AND_RETURN_FALSE(aop->SetOperationBlob(op_blob_, blob_file));
+  // Release the compressed data as soon as it is stored.
+  op_blob_ = brillo::Blob();
   return true;
 }
 
@@ -136,30 +170,28 @@ bool FullUpdateGenerator::GenerateOperations(
   TEST_AND_RETURN_FALSE(full_chunk_size % config.block_size == 0);
 
   size_t chunk_blocks = full_chunk_size / config.block_size;
-  size_t max_threads = diff_utils::GetMaxThreads();
+  TaskScheduler* scheduler = TaskScheduler::Get();
   LOG(INFO) << "Compressing partition " << new_part.name << " from "
             << new_part.path << " splitting in chunks of " << chunk_blocks
             << " blocks (" << config.block_size << " bytes each) using "
-            << max_threads << " threads";
+            << scheduler->max_threads() << " threads";
 
   int in_fd = open(new_part.path.c_str(), O_RDONLY, 0);
   TEST_AND_RETURN_FALSE(in_fd >= 0);
   ScopedFdCloser in_fd_closer(&in_fd);
 
-  // We potentially have all the ChunkProcessors in memory but only
-  // |max_threads| will actually hold a block in memory while we process.
   size_t partition_blocks = new_part.size / config.block_size;
   size_t num_chunks = utils::DivRoundUp(partition_blocks, chunk_blocks);
   aops->resize(num_chunks);
-  vector<ChunkProcessor> chunk_processors;
-  chunk_processors.reserve(num_chunks);
   blob_file->IncTotalBlobs(num_chunks);
 
+  vector<size_t> chunk_sizes(num_chunks);
   for (size_t i = 0; i < num_chunks; ++i) {
     size_t start_block = i * chunk_blocks;
     // The last chunk could be smaller.
     size_t num_blocks =
         std::min(chunk_blocks, partition_blocks - i * chunk_blocks);
+    chunk_sizes[i] = num_blocks * config.block_size;
 
     // Preset all the static information about the operations. The
     // ChunkProcessor will set the rest.
@@ -169,29 +201,64 @@ bool FullUpdateGenerator::GenerateOperations(
     Extent* dst_extent = aop->op.add_dst_extents();
     dst_extent->set_start_block(start_block);
     dst_extent->set_num_blocks(num_blocks);
+  }
+
+  // The partition is processed in windows of consecutive chunks, so only two
+  // windows of data are in memory regardless of the partition size: the one
+  // being compressed and the next one, read at the same time. The blobs are
+  // stored in the order of the operations once a window is done.
+  size_t window_chunks = kWindowChunksPerThread * scheduler->max_threads();
+  auto window_sizes = [&](size_t first_chunk) {
+    size_t end_chunk = std::min(first_chunk + window_chunks, num_chunks);
+    return vector<size_t>(chunk_sizes.begin() + first_chunk,
+                          chunk_sizes.begin() + end_chunk);
+  };
+  vector<brillo::Blob> window;
+  vector<brillo::Blob> next_window;
+  WindowReader first_reader(in_fd, 0, window_sizes(0), &window);
+  first_reader.Run();
+  TEST_AND_RETURN_FALSE(first_reader.success());
 
-    chunk_processors.emplace_back(
-        config.version,
+  for (size_t first_chunk = 0; first_chunk < num_chunks;
+       first_chunk += window_chunks) {
+    vector<TaskScheduler::Task> tasks;
+
+    // Queue the read of the next window first, so it is done by the time the
+    // compressors need it.
+    size_t next_first_chunk = first_chunk + window_chunks;
+    bool has_next_window = next_first_chunk < num_chunks;
+    vector<size_t> next_window_sizes =
+        has_next_window ? window_sizes(next_first_chunk) : vector<size_t>();
+    // The reader holds the whole next window.
+    uint64_t next_window_size = std::accumulate(
+        next_window_sizes.begin(), next_window_sizes.end(), uint64_t{0});
+    WindowReader next_reader(
         in_fd,
-        static_cast<off_t>(start_block) * config.block_size,
-        num_blocks * config.block_size,
-        blob_file,
-        aop);
-  }
+        static_cast<off_t>(next_first_chunk * full_chunk_size),
+        std::move(next_window_sizes),
+        &next_window);
+    if (has_next_window)
+      tasks.push_back({&next_reader, next_window_size});
+
+    // Each chunk holds its compressed data until it's stored.
+    vector<ChunkProcessor> chunk_processors;
+    chunk_processors.reserve(window.size());
+    for (const brillo::Blob& chunk : window) {
+      chunk_processors.emplace_back(config.version, chunk);
+      tasks.push_back({&chunk_processors.back(), chunk.size()});
+    }
+    scheduler->RunTasks(tasks);
 
-  // Thread pool used for worker threads.
-  base::DelegateSimpleThreadPool thread_pool("full-update-generator",
-                                             max_threads);
-  thread_pool.Start();
-  for (ChunkProcessor& processor : chunk_processors)
-    thread_pool.AddWork(&processor);
-  thread_pool.JoinAll();
-
-  // All the operations must have a type set at this point. Otherwise, a
-  // ChunkProcessor failed to complete.
-  for (const AnnotatedOperation& aop : *aops) {
-    if (!aop.op.has_type())
-      return false;
+    for (size_t i = 0; i < chunk_processors.size(); ++i) {
+      AnnotatedOperation* aop = aops->data() + first_chunk + i;
+      if (!chunk_processors[i].StoreOperation(blob_file, aop)) {
+        LOG(ERROR) << "Error processing " << aop->name;
+        return false;
+      }
+    }
+    if (has_next_window)
+      TEST_AND_RETURN_FALSE(next_reader.success());
+    window.swap(next_window);
   }
   return true;
 }
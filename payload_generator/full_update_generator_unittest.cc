@@ -90,6 +90,29 @@ TEST_F(FullUpdateGeneratorTest, RunTest) {
   }
 }
 
+// Test that the blobs are stored in the order of the operations, even when the
+// partition is processed in several windows of chunks.
+TEST_F(FullUpdateGeneratorTest, BlobsStoredInOrderTest) {
+  brillo::Blob new_part(9 * 1024 * 1024);
+  FillWithData(&new_part);
+  new_part_conf.size = new_part.size();
+
+  EXPECT_TRUE(test_utils::WriteFileVector(new_part_conf.path, new_part));
+
+  EXPECT_TRUE(generator_.GenerateOperations(config_,
+                                            new_part_conf,  // this is ignored
+                                            new_part_conf,
+                                            blob_file_writer_.get(),
+                                            &aops));
+  uint64_t next_blob_offset = 0;
+  for (const AnnotatedOperation& aop : aops) {
+    ASSERT_TRUE(aop.op.has_data_offset());
+    EXPECT_EQ(next_blob_offset, aop.op.data_offset()) << aop.name;
+    next_blob_offset += aop.op.data_length();
+  }
+  EXPECT_EQ(static_cast<uint64_t>(out_blobs_length_), next_blob_offset);
+}
+
 // Test that if the chunk size is not a divisor of the image size, it handles
 // correctly the last chunk of the partition.
 TEST_F(FullUpdateGeneratorTest, ChunkSizeTooBig) {
@@ -43,6 +43,7 @@
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/payload_generator/payload_properties.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/task_scheduler.h"
 #include "update_engine/payload_generator/xz.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -454,6 +455,22 @@ int Main(int argc, char** argv) {
                 "Compression parameter passed to mkfs.erofs's -z option. "
                 "Example: lz4 lz4hc,9");
 
+  DEFINE_int32(max_threads,
+               0,
+               "The number of threads used to generate the payload, shared by "
+               "all the partitions (0 means one per CPU, and at least 4).");
+  DEFINE_uint64(max_memory,
+                0,
+                "The approximate memory in bytes the generator threads may "
+                "use for the data they are processing at the same time "
+                "(0 means no limit).");
+  DEFINE_string(partition_cache_dir,
+                "",
+                "If set, the operations generated for each partition are "
+                "stored in this directory and reused for partitions with the "
+                "same source and target images and settings. The deflates "
+                "located in zip and gzip files are cached there as well.");
+
   brillo::FlagHelper::Init(
       argc,
       argv,
@@ -572,6 +589,7 @@ int Main(int argc, char** argv) {
   payload_config.enable_vabc_xor = FLAGS_enable_vabc_xor;
   payload_config.enable_lz4diff = FLAGS_enable_lz4diff;
   payload_config.enable_zucchini = FLAGS_enable_zucchini;
+  payload_config.partition_cache_dir = FLAGS_partition_cache_dir;
 
   payload_config.ParseCompressorTypes(FLAGS_compressor_types);
 
@@ -646,6 +664,9 @@ int Main(int argc, char** argv) {
     CHECK(payload_config.target.LoadPostInstallConfig(store));
   }
 
+  CHECK_GE(FLAGS_max_threads, 0);
+  CHECK(TaskScheduler::SetGlobalLimits(FLAGS_max_threads, FLAGS_max_memory));
+
   // Use the default soft_chunk_size defined in the config.
   payload_config.hard_chunk_size = FLAGS_chunk_size;
   payload_config.block_size = kBlockSize;
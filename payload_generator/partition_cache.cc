@@ -0,0 +1,338 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_cache.h"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <set>
+#include <utility>
+
+#include <android-base/unique_fd.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_split.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Bump this whenever the entry format changes. Changes of the generated
+// operations are covered by the build fingerprint.
+const int kPartitionCacheVersion = 1;
+
+// Entries are laid out as follows, with the sizes stored as big-endian
+// uint64_t:
+//   - the size of the PartitionUpdate and the serialized PartitionUpdate,
+//     with the operations, the merge sequence and the COW size estimate. The
+//     data offsets of the operations are relative to the blobs;
+//   - the size of the names and the names of the operations, each followed
+//     by a '\0';
+//   - the blobs of the operations.
+
+// Appends to |fingerprint| the hash of the first |size| bytes of the file at
+// |path|, or nothing if |path| is empty.
+bool AppendFileHash(const string& label,
+                    const string& path,
+                    off_t size,
+                    string* fingerprint) {
+  string hash;
+  if (!path.empty()) {
+    brillo::Blob raw_hash;
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfFile(path, size, &raw_hash) == size);
+    hash = HexEncode(raw_hash);
+  }
+  *fingerprint += label + "=" + hash + "\n";
+  return true;
+}
+
+// Returns the hashes of the generator binary and of the shared libraries it
+// loaded, or an empty string on error.
+string ComputeBuildFingerprint() {
+  string maps;
+  if (!utils::ReadFile("/proc/self/maps", &maps)) {
+    LOG(ERROR) << "Failed to read the mappings of the generator.";
+    return "";
+  }
+  // Each line is "address perms offset dev inode path", keep the paths of
+  // the executable mappings.
+  std::set<string> paths;
+  for (const string& line : base::SplitString(
+           maps, "\n", base::KEEP_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    vector<string> fields = base::SplitString(
+        line, " ", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    size_t path_start = line.find('/');
+    if (fields.size() >= 6 && fields[1].find('x') != string::npos &&
+        path_start != string::npos) {
+      paths.insert(line.substr(path_start));
+    }
+  }
+  string result;
+  for (const string& path : paths) {
+    brillo::Blob raw_hash;
+    if (!HashCalculator::RawHashOfFile(path, &raw_hash)) {
+      LOG(ERROR) << "Failed to hash " << path;
+      return "";
+    }
+    result += "binary=" + HexEncode(raw_hash) + "\n";
+  }
+  return result;
+}
+
+// Reads exactly |size| bytes at |offset| of |fd| into |out|.
+bool ReadData(int fd, off_t offset, size_t size, void* out) {
+  ssize_t bytes_read = 0;
+  TEST_AND_RETURN_FALSE(utils::PReadAll(fd, out, size, offset, &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size));
+  return true;
+}
+
+// Reads a string stored by WriteSizedString() at |*offset| of |fd|, and
+// moves |*offset| past it.
+bool ReadSizedString(int fd, off_t* offset, string* out) {
+  uint64_t size_be = 0;
+  TEST_AND_RETURN_FALSE(ReadData(fd, *offset, sizeof(size_be), &size_be));
+  *offset += sizeof(size_be);
+  out->resize(be64toh(size_be));
+  TEST_AND_RETURN_FALSE(ReadData(fd, *offset, out->size(), out->data()));
+  *offset += out->size();
+  return true;
+}
+
+bool WriteSizedString(int fd, const string& data) {
+  uint64_t size_be = htobe64(data.size());
+  TEST_AND_RETURN_FALSE(utils::WriteAll(fd, &size_be, sizeof(size_be)));
+  TEST_AND_RETURN_FALSE(utils::WriteAll(fd, data.data(), data.size()));
+  return true;
+}
+
+}  // namespace
+
+// static
+const string& PartitionCache::GetBuildFingerprint() {
+  static const string fingerprint = ComputeBuildFingerprint();
+  return fingerprint;
+}
+
+// static
+bool PartitionCache::ComputeKey(const PayloadGenerationConfig& config,
+                                const PartitionConfig& old_part,
+                                const PartitionConfig& new_part,
+                                string* key) {
+  const string& build_fingerprint = GetBuildFingerprint();
+  TEST_AND_RETURN_FALSE(!build_fingerprint.empty());
+  string fingerprint = build_fingerprint;
+  fingerprint += base::StringPrintf(
+      "cache_version=%d\n"
+      "partition=%s\n"
+      "major_version=%" PRIu64
+      "\n"
+      "minor_version=%u\n"
+      "is_delta=%d\n"
+      "is_partial_update=%d\n"
+      "hard_chunk_size=%zd\n"
+      "soft_chunk_size=%zu\n"
+      "block_size=%zu\n"
+      "enable_vabc_xor=%d\n"
+      "enable_lz4diff=%d\n"
+      "enable_zucchini=%d\n"
+      "old_size=%" PRIu64
+      "\n"
+      "new_size=%" PRIu64
+      "\n"
+      "disable_fec_computation=%d\n",
+      kPartitionCacheVersion,
+      new_part.name.c_str(),
+      config.version.major,
+      config.version.minor,
+      config.is_delta,
+      config.is_partial_update,
+      config.hard_chunk_size,
+      config.soft_chunk_size,
+      config.block_size,
+      config.enable_vabc_xor,
+      config.enable_lz4diff,
+      config.enable_zucchini,
+      old_part.size,
+      new_part.size,
+      new_part.disable_fec_computation);
+  for (const auto& compressor : config.compressors) {
+    fingerprint += base::StringPrintf("compressor=%d\n",
+                                      static_cast<int>(compressor));
+  }
+  // The dynamic partition metadata decides whether the merge sequence and the
+  // COW size are computed, and how.
+  if (config.target.dynamic_partition_metadata) {
+    fingerprint += "dynamic_partition_metadata=" +
+                   HexEncode(config.target.dynamic_partition_metadata
+                                 ->SerializeAsString()) +
+                   "\n";
+  }
+  fingerprint +=
+      "erofs_compression_param=" +
+      HexEncode(new_part.erofs_compression_param.SerializeAsString()) + "\n";
+  TEST_AND_RETURN_FALSE(
+      AppendFileHash("old_image", old_part.path, old_part.size, &fingerprint));
+  TEST_AND_RETURN_FALSE(
+      AppendFileHash("new_image", new_part.path, new_part.size, &fingerprint));
+  // The mapfiles decide how the blocks are grouped into files.
+  for (const PartitionConfig* part : {&old_part, &new_part}) {
+    off_t mapfile_size = 0;
+    if (!part->mapfile_path.empty()) {
+      mapfile_size = utils::FileSize(part->mapfile_path);
+      TEST_AND_RETURN_FALSE(mapfile_size >= 0);
+    }
+    TEST_AND_RETURN_FALSE(
+        AppendFileHash(part == &old_part ? "old_mapfile" : "new_mapfile",
+                       part->mapfile_path,
+                       mapfile_size,
+                       &fingerprint));
+  }
+
+  *key = HashCalculator::SHA256Digest(fingerprint);
+  return true;
+}
+
+string PartitionCache::EntryPath(const string& key) const {
+  return dir_ + "/" + key;
+}
+
+bool PartitionCache::Load(const string& key,
+                          BlobFileWriter* blob_file,
+                          vector<AnnotatedOperation>* aops,
+                          vector<CowMergeOperation>* merge_sequence,
+                          size_t* cow_size) const {
+  const string path = EntryPath(key);
+  android::base::unique_fd fd(
+      HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (!fd.ok())
+    return false;
+
+  off_t blobs_offset = 0;
+  string serialized_partition;
+  string names;
+  PartitionUpdate partition;
+  TEST_AND_RETURN_FALSE(
+      ReadSizedString(fd.get(), &blobs_offset, &serialized_partition));
+  TEST_AND_RETURN_FALSE(partition.ParseFromString(serialized_partition));
+  TEST_AND_RETURN_FALSE(ReadSizedString(fd.get(), &blobs_offset, &names));
+
+  const off_t entry_size = utils::FileSize(fd.get());
+  TEST_AND_RETURN_FALSE(entry_size >= blobs_offset);
+  const uint64_t blobs_size = entry_size - blobs_offset;
+
+  // Every blob is read before any is stored in |blob_file|, so a bad entry
+  // leaves nothing behind.
+  vector<AnnotatedOperation> cached_aops(partition.operations_size());
+  vector<brillo::Blob> blobs(partition.operations_size());
+  size_t name_start = 0;
+  for (int i = 0; i < partition.operations_size(); i++) {
+    AnnotatedOperation& aop = cached_aops[i];
+    size_t name_end = names.find('\0', name_start);
+    TEST_AND_RETURN_FALSE(name_end != string::npos);
+    aop.name = names.substr(name_start, name_end - name_start);
+    name_start = name_end + 1;
+
+    aop.op = partition.operations(i);
+    if (!aop.op.has_data_length())
+      continue;
+    TEST_AND_RETURN_FALSE(aop.op.data_offset() <= blobs_size &&
+                          aop.op.data_length() <=
+                              blobs_size - aop.op.data_offset());
+    blobs[i].resize(aop.op.data_length());
+    TEST_AND_RETURN_FALSE(ReadData(fd.get(),
+                                   blobs_offset + aop.op.data_offset(),
+                                   blobs[i].size(),
+                                   blobs[i].data()));
+  }
+  TEST_AND_RETURN_FALSE(name_start == names.size());
+
+  for (size_t i = 0; i < cached_aops.size(); i++) {
+    if (cached_aops[i].op.has_data_length()) {
+      TEST_AND_RETURN_FALSE(
+          cached_aops[i].SetOperationBlob(blobs[i], blob_file));
+    }
+  }
+
+  *aops = std::move(cached_aops);
+  merge_sequence->assign(partition.merge_operations().begin(),
+                         partition.merge_operations().end());
+  *cow_size = partition.estimate_cow_size();
+  return true;
+}
+
+bool PartitionCache::Store(const string& key,
+                           const string& blobs_path,
+                           const vector<AnnotatedOperation>& aops,
+                           const vector<CowMergeOperation>& merge_sequence,
+                           size_t cow_size) const {
+  PartitionUpdate partition;
+  string names;
+  uint64_t blobs_size = 0;
+  for (const AnnotatedOperation& aop : aops) {
+    InstallOperation* op = partition.add_operations();
+    *op = aop.op;
+    if (op->has_data_length()) {
+      op->set_data_offset(blobs_size);
+      blobs_size += op->data_length();
+    }
+    names += aop.name;
+    names += '\0';
+  }
+  for (const CowMergeOperation& merge_op : merge_sequence) {
+    *partition.add_merge_operations() = merge_op;
+  }
+  partition.set_estimate_cow_size(cow_size);
+
+  android::base::unique_fd blobs_fd(
+      HANDLE_EINTR(open(blobs_path.c_str(), O_RDONLY | O_CLOEXEC)));
+  TEST_AND_RETURN_FALSE_ERRNO(blobs_fd.ok());
+  string tmp_path = EntryPath(key) + ".XXXXXX";
+  android::base::unique_fd fd(mkstemp(tmp_path.data()));
+  TEST_AND_RETURN_FALSE_ERRNO(fd.ok());
+  bool success = WriteSizedString(fd.get(), partition.SerializeAsString()) &&
+                 WriteSizedString(fd.get(), names);
+  for (auto it = aops.begin(); success && it != aops.end(); ++it) {
+    if (!it->op.has_data_length())
+      continue;
+    brillo::Blob blob(it->op.data_length());
+    success =
+        ReadData(
+            blobs_fd.get(), it->op.data_offset(), blob.size(), blob.data()) &&
+        utils::WriteAll(fd.get(), blob.data(), blob.size());
+  }
+  // Only complete entries are renamed into place.
+  if (!success || rename(tmp_path.c_str(), EntryPath(key).c_str()) != 0) {
+    PLOG(ERROR) << "Failed to store the cache entry " << EntryPath(key);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,84 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A PartitionCache keeps the result of generating the operations of a
+// partition in a directory, so a later payload with the same source and
+// target images for that partition doesn't have to generate them again.
+//
+// Each entry is a single file named after its key, which covers the build of
+// the generator, the contents of both images and every setting of the config
+// that affects the generated operations. Entries are written to a temporary
+// file and renamed, so several generators can share the same directory.
+class PartitionCache {
+ public:
+  explicit PartitionCache(const std::string& dir) : dir_(dir) {}
+
+  // Returns the fingerprint of the build of the generator, so entries written
+  // by another build of the generator, which may generate other data, are not
+  // used. It is computed once per process, and is empty on error.
+  static const std::string& GetBuildFingerprint();
+
+  // Computes in |key| the cache key of generating |new_part| from |old_part|
+  // with |config|. |old_part| has an empty path for full updates. This reads
+  // both images whole.
+  static bool ComputeKey(const PayloadGenerationConfig& config,
+                         const PartitionConfig& old_part,
+                         const PartitionConfig& new_part,
+                         std::string* key);
+
+  // Loads the entry for |key|, storing its blobs in |blob_file| once all of
+  // them are read. Returns false if there is no usable entry; the outputs are
+  // only set on success.
+  bool Load(const std::string& key,
+            BlobFileWriter* blob_file,
+            std::vector<AnnotatedOperation>* aops,
+            std::vector<CowMergeOperation>* merge_sequence,
+            size_t* cow_size) const;
+
+  // Stores the entry for |key|. The blobs of |aops| are read from the blob
+  // file at |blobs_path|.
+  bool Store(const std::string& key,
+             const std::string& blobs_path,
+             const std::vector<AnnotatedOperation>& aops,
+             const std::vector<CowMergeOperation>& merge_sequence,
+             size_t cow_size) const;
+
+ private:
+  std::string EntryPath(const std::string& key) const;
+
+  const std::string dir_;
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_CACHE_H_
@@ -0,0 +1,199 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_cache.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class PartitionCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(cache_dir_.CreateUniqueTempDir());
+    cache_ = std::make_unique<PartitionCache>(cache_dir_.GetPath().value());
+
+    brillo::Blob image(16 * kBlockSize);
+    test_utils::FillWithData(&image);
+    ASSERT_TRUE(test_utils::WriteFileVector(new_image_.path(), image));
+    new_part_.path = new_image_.path();
+    new_part_.size = image.size();
+  }
+
+  // Returns an operation writing |blob| to |dst_extent|, with the blob stored
+  // in |blob_file|.
+  AnnotatedOperation MakeOperation(const string& name,
+                                   const Extent& dst_extent,
+                                   const brillo::Blob& blob,
+                                   BlobFileWriter* blob_file) {
+    AnnotatedOperation aop;
+    aop.name = name;
+    aop.op.set_type(InstallOperation::REPLACE);
+    *aop.op.add_dst_extents() = dst_extent;
+    EXPECT_TRUE(aop.SetOperationBlob(blob, blob_file));
+    return aop;
+  }
+
+  base::ScopedTempDir cache_dir_;
+  std::unique_ptr<PartitionCache> cache_;
+
+  ScopedTempFile new_image_{"PartitionCacheTest-new.XXXXXX"};
+  PartitionConfig old_part_{"part"};
+  PartitionConfig new_part_{"part"};
+  PayloadGenerationConfig config_;
+};
+
+TEST_F(PartitionCacheTest, StoreAndLoadTest) {
+  ScopedTempFile blobs_file("PartitionCacheTest-blobs.XXXXXX", true);
+  off_t blobs_size = 0;
+  BlobFileWriter blob_file(blobs_file.fd(), &blobs_size);
+  // Store some unrelated blob first, so the offsets don't start at 0.
+  ASSERT_EQ(0, blob_file.StoreBlob(brillo::Blob(10, 'x')));
+
+  vector<AnnotatedOperation> aops;
+  aops.push_back(MakeOperation(
+      "file:0", ExtentForRange(0, 1), brillo::Blob(5, 'a'), &blob_file));
+  aops.push_back(MakeOperation(
+      "<zero>", ExtentForRange(3, 2), brillo::Blob(), &blob_file));
+  aops.push_back(MakeOperation(
+      "file:1", ExtentForRange(1, 2), brillo::Blob(7, 'b'), &blob_file));
+  vector<CowMergeOperation> merge_sequence(1);
+  merge_sequence[0].set_type(CowMergeOperation::COW_COPY);
+  *merge_sequence[0].mutable_src_extent() = ExtentForRange(8, 1);
+  *merge_sequence[0].mutable_dst_extent() = ExtentForRange(9, 1);
+
+  string key;
+  ASSERT_TRUE(PartitionCache::ComputeKey(config_, old_part_, new_part_, &key));
+  vector<AnnotatedOperation> loaded_aops;
+  vector<CowMergeOperation> loaded_merge_sequence;
+  size_t loaded_cow_size = 0;
+  EXPECT_FALSE(cache_->Load(key,
+                            &blob_file,
+                            &loaded_aops,
+                            &loaded_merge_sequence,
+                            &loaded_cow_size));
+  ASSERT_TRUE(
+      cache_->Store(key, blobs_file.path(), aops, merge_sequence, 12345));
+
+  ScopedTempFile new_blobs_file("PartitionCacheTest-new_blobs.XXXXXX", true);
+  off_t new_blobs_size = 0;
+  BlobFileWriter new_blob_file(new_blobs_file.fd(), &new_blobs_size);
+  ASSERT_TRUE(cache_->Load(key,
+                           &new_blob_file,
+                           &loaded_aops,
+                           &loaded_merge_sequence,
+                           &loaded_cow_size));
+  EXPECT_EQ(12345U, loaded_cow_size);
+  ASSERT_EQ(1U, loaded_merge_sequence.size());
+  EXPECT_EQ(merge_sequence[0].SerializeAsString(),
+            loaded_merge_sequence[0].SerializeAsString());
+
+  ASSERT_EQ(aops.size(), loaded_aops.size());
+  brillo::Blob new_blobs;
+  ASSERT_TRUE(utils::ReadFile(new_blobs_file.path(), &new_blobs));
+  for (size_t i = 0; i < aops.size(); i++) {
+    EXPECT_EQ(aops[i].name, loaded_aops[i].name);
+    EXPECT_EQ(aops[i].op.dst_extents(0), loaded_aops[i].op.dst_extents(0));
+    EXPECT_EQ(aops[i].op.data_length(), loaded_aops[i].op.data_length());
+    if (!aops[i].op.has_data_length()) {
+      EXPECT_FALSE(loaded_aops[i].op.has_data_offset());
+      continue;
+    }
+    // The blobs are stored again in the new blob file.
+    auto blob = new_blobs.begin() + loaded_aops[i].op.data_offset();
+    EXPECT_EQ(brillo::Blob(aops[i].op.data_length(), i == 0 ? 'a' : 'b'),
+              brillo::Blob(blob, blob + loaded_aops[i].op.data_length()));
+  }
+}
+
+TEST_F(PartitionCacheTest, LoadTruncatedEntryTest) {
+  ScopedTempFile blobs_file("PartitionCacheTest-blobs.XXXXXX", true);
+  off_t blobs_size = 0;
+  BlobFileWriter blob_file(blobs_file.fd(), &blobs_size);
+  vector<AnnotatedOperation> aops;
+  aops.push_back(MakeOperation(
+      "file:0", ExtentForRange(0, 1), brillo::Blob(5, 'a'), &blob_file));
+  aops.push_back(MakeOperation(
+      "file:1", ExtentForRange(1, 2), brillo::Blob(7, 'b'), &blob_file));
+  string key;
+  ASSERT_TRUE(PartitionCache::ComputeKey(config_, old_part_, new_part_, &key));
+  ASSERT_TRUE(cache_->Store(key, blobs_file.path(), aops, {}, 0));
+
+  // Drop the end of the last blob.
+  const string entry_path = cache_dir_.GetPath().value() + "/" + key;
+  brillo::Blob entry;
+  ASSERT_TRUE(utils::ReadFile(entry_path, &entry));
+  entry.resize(entry.size() - 1);
+  ASSERT_TRUE(test_utils::WriteFileVector(entry_path, entry));
+
+  // Nothing is stored in the blob file, not even the blob that could be read.
+  ScopedTempFile new_blobs_file("PartitionCacheTest-new_blobs.XXXXXX", true);
+  off_t new_blobs_size = 0;
+  BlobFileWriter new_blob_file(new_blobs_file.fd(), &new_blobs_size);
+  vector<AnnotatedOperation> loaded_aops;
+  vector<CowMergeOperation> loaded_merge_sequence;
+  size_t loaded_cow_size = 0;
+  EXPECT_FALSE(cache_->Load(key,
+                            &new_blob_file,
+                            &loaded_aops,
+                            &loaded_merge_sequence,
+                            &loaded_cow_size));
+  EXPECT_EQ(0, new_blobs_size);
+  EXPECT_TRUE(loaded_aops.empty());
+}
+
+TEST_F(PartitionCacheTest, KeyTest) {
+  string key;
+  ASSERT_TRUE(PartitionCache::ComputeKey(config_, old_part_, new_part_, &key));
+  string same_key;
+  ASSERT_TRUE(
+      PartitionCache::ComputeKey(config_, old_part_, new_part_, &same_key));
+  EXPECT_EQ(key, same_key);
+
+  // Changing a setting that affects the operations changes the key.
+  config_.enable_zucchini = !config_.enable_zucchini;
+  string config_key;
+  ASSERT_TRUE(
+      PartitionCache::ComputeKey(config_, old_part_, new_part_, &config_key));
+  EXPECT_NE(key, config_key);
+  config_.enable_zucchini = !config_.enable_zucchini;
+
+  // So does changing the image.
+  brillo::Blob image;
+  ASSERT_TRUE(utils::ReadFile(new_image_.path(), &image));
+  image[100]++;
+  ASSERT_TRUE(test_utils::WriteFileVector(new_image_.path(), image));
+  string image_key;
+  ASSERT_TRUE(
+      PartitionCache::ComputeKey(config_, old_part_, new_part_, &image_key));
+  EXPECT_NE(key, image_key);
+}
+
+}  // namespace chromeos_update_engine
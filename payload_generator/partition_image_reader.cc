@@ -0,0 +1,126 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_image_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+std::unique_ptr<PartitionImageReader> PartitionImageReader::Open(
+    const string& path) {
+  android::base::unique_fd fd(
+      HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (!fd.ok()) {
+    PLOG(ERROR) << "Failed to open " << path;
+    return nullptr;
+  }
+  return std::unique_ptr<PartitionImageReader>(
+      new PartitionImageReader(path, std::move(fd)));
+}
+
+PartitionImageReader::PartitionImageReader(const string& path,
+                                           android::base::unique_fd fd)
+    : path_(path), fd_(std::move(fd)) {
+  off_t size = lseek(fd_.get(), 0, SEEK_END);
+  if (size > 0) {
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_.get(), 0);
+    if (map != MAP_FAILED) {
+      map_ = static_cast<const uint8_t*>(map);
+      map_size_ = size;
+    } else {
+      PLOG(WARNING) << "Failed to map " << path_ << ", only reading from it";
+    }
+  }
+}
+
+PartitionImageReader::~PartitionImageReader() {
+  if (map_)
+    munmap(const_cast<uint8_t*>(map_), map_size_);
+}
+
+bool PartitionImageReader::ReadExtents(const vector<Extent>& extents,
+                                       brillo::Blob* out_data,
+                                       ssize_t out_data_size,
+                                       size_t block_size) const {
+  brillo::Blob data(out_data_size);
+  ssize_t bytes_read = 0;
+
+  for (const Extent& extent : extents) {
+    ssize_t bytes_read_this_iteration = 0;
+    ssize_t bytes = extent.num_blocks() * block_size;
+    TEST_LE(bytes_read + bytes, out_data_size);
+    TEST_AND_RETURN_FALSE(utils::PReadAll(fd_.get(),
+                                          data.data() + bytes_read,
+                                          bytes,
+                                          extent.start_block() * block_size,
+                                          &bytes_read_this_iteration));
+    TEST_AND_RETURN_FALSE(bytes_read_this_iteration == bytes);
+    bytes_read += bytes_read_this_iteration;
+  }
+  TEST_AND_RETURN_FALSE(out_data_size == bytes_read);
+  *out_data = std::move(data);
+  return true;
+}
+
+bool PartitionImageReader::MapExtents(const vector<Extent>& extents,
+                                      size_t block_size,
+                                      std::string_view* out_data) const {
+  if (!map_ || extents.empty())
+    return false;
+  uint64_t start_block = extents.front().start_block();
+  uint64_t end_block = start_block;
+  for (const Extent& extent : extents) {
+    if (extent.start_block() != end_block)
+      return false;
+    end_block += extent.num_blocks();
+  }
+  if (end_block * block_size > map_size_)
+    return false;
+  *out_data = ToStringView(map_ + start_block * block_size,
+                           (end_block - start_block) * block_size);
+  return true;
+}
+
+bool PartitionImage::ReadExtents(const vector<Extent>& extents,
+                                 brillo::Blob* out_data,
+                                 ssize_t out_data_size,
+                                 size_t block_size) const {
+  if (reader_)
+    return reader_->ReadExtents(extents, out_data, out_data_size, block_size);
+  return utils::ReadExtents(
+      path_, extents, out_data, out_data_size, block_size);
+}
+
+bool PartitionImage::MapExtents(const vector<Extent>& extents,
+                                size_t block_size,
+                                std::string_view* out_data) const {
+  return reader_ && reader_->MapExtents(extents, block_size, out_data);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,116 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_IMAGE_READER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_IMAGE_READER_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A PartitionImageReader keeps a partition image open for the whole payload
+// generation, so the many extent reads done by the generator threads don't
+// have to open and close the image every time. Reads use pread() and are safe
+// to issue concurrently from any thread.
+//
+// The image is also mapped read-only when possible, so contiguous data can be
+// used in place with MapExtents() instead of being copied to a buffer.
+class PartitionImageReader {
+ public:
+  // Opens the image at |path| read-only. Returns nullptr on error.
+  static std::unique_ptr<PartitionImageReader> Open(const std::string& path);
+
+  ~PartitionImageReader();
+
+  // Reads the blocks in |extents| into |out_data|, in order. Works like
+  // utils::ReadExtents(): exactly |out_data_size| bytes must be read.
+  bool ReadExtents(const std::vector<Extent>& extents,
+                   brillo::Blob* out_data,
+                   ssize_t out_data_size,
+                   size_t block_size) const;
+
+  // Stores in |out_data| a view of the blocks in |extents| in the mapped
+  // image, without copying them. This only works when the image is mapped and
+  // |extents| are contiguous once adjacent extents are stitched together;
+  // otherwise returns false and the data has to be read with ReadExtents().
+  // The view is valid as long as this reader is.
+  bool MapExtents(const std::vector<Extent>& extents,
+                  size_t block_size,
+                  std::string_view* out_data) const;
+
+  const std::string& path() const { return path_; }
+
+ private:
+  PartitionImageReader(const std::string& path, android::base::unique_fd fd);
+
+  const std::string path_;
+  const android::base::unique_fd fd_;
+
+  // The read-only mapping of the whole image, or nullptr if it couldn't be
+  // mapped.
+  const uint8_t* map_ = nullptr;
+  size_t map_size_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionImageReader);
+};
+
+// The image of a partition the generator reads extents from. Reads go through
+// the PartitionImageReader keeping the image open, if there is one, otherwise
+// the image is opened for each read. The reader isn't owned and must outlive
+// this object, it's usually the one of the PartitionConfig of the image.
+//
+// A PartitionImage can be implicitly created from a path, which reads without
+// a reader, so callers having only the path of an image can pass it.
+class PartitionImage {
+ public:
+  PartitionImage(const std::string& path)  // NOLINT(runtime/explicit)
+      : path_(path) {}
+  PartitionImage(const char* path)  // NOLINT(runtime/explicit)
+      : path_(path) {}
+  PartitionImage(const std::string& path, const PartitionImageReader* reader)
+      : path_(path), reader_(reader) {}
+
+  // Reads |extents| from the image like utils::ReadExtents().
+  bool ReadExtents(const std::vector<Extent>& extents,
+                   brillo::Blob* out_data,
+                   ssize_t out_data_size,
+                   size_t block_size) const;
+
+  // Like PartitionImageReader::MapExtents() on the reader. Returns false if
+  // there is no reader or the extents can't be mapped.
+  bool MapExtents(const std::vector<Extent>& extents,
+                  size_t block_size,
+                  std::string_view* out_data) const;
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+  const PartitionImageReader* reader_ = nullptr;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_IMAGE_READER_H_
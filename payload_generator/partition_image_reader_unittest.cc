@@ -0,0 +1,126 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_image_reader.h"
+
+#include <unistd.h>
+
+#include <string_view>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class PartitionImageReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    image_data_.resize(8 * kBlockSize);
+    test_utils::FillWithData(&image_data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(image_.path(), image_data_));
+  }
+
+  brillo::Blob Blocks(uint64_t start_block, uint64_t num_blocks) const {
+    auto begin = image_data_.begin() + start_block * kBlockSize;
+    return brillo::Blob(begin, begin + num_blocks * kBlockSize);
+  }
+
+  ScopedTempFile image_{"PartitionImageReaderTest-image.XXXXXX"};
+  brillo::Blob image_data_;
+};
+
+TEST_F(PartitionImageReaderTest, ReadExtentsTest) {
+  auto reader = PartitionImageReader::Open(image_.path());
+  ASSERT_NE(nullptr, reader);
+
+  brillo::Blob data;
+  EXPECT_TRUE(reader->ReadExtents({ExtentForRange(5, 2), ExtentForRange(1, 1)},
+                                  &data,
+                                  3 * kBlockSize,
+                                  kBlockSize));
+  brillo::Blob expected = Blocks(5, 2);
+  brillo::Blob second = Blocks(1, 1);
+  expected.insert(expected.end(), second.begin(), second.end());
+  EXPECT_EQ(expected, data);
+
+  // Reading past the end of the image fails.
+  EXPECT_FALSE(reader->ReadExtents(
+      {ExtentForRange(7, 2)}, &data, 2 * kBlockSize, kBlockSize));
+}
+
+TEST_F(PartitionImageReaderTest, MapExtentsTest) {
+  auto reader = PartitionImageReader::Open(image_.path());
+  ASSERT_NE(nullptr, reader);
+
+  // Adjacent extents are stitched together.
+  std::string_view data;
+  EXPECT_TRUE(reader->MapExtents(
+      {ExtentForRange(1, 2), ExtentForRange(3, 4)}, kBlockSize, &data));
+  EXPECT_EQ(ToStringView(Blocks(1, 6)), data);
+
+  EXPECT_TRUE(PartitionImage(image_.path(), reader.get())
+                  .MapExtents({ExtentForRange(0, 8)}, kBlockSize, &data));
+  EXPECT_EQ(ToStringView(image_data_), data);
+
+  // Extents with holes or out of order, or past the end of the image can't be
+  // mapped.
+  EXPECT_FALSE(reader->MapExtents(
+      {ExtentForRange(1, 2), ExtentForRange(4, 1)}, kBlockSize, &data));
+  EXPECT_FALSE(reader->MapExtents(
+      {ExtentForRange(4, 1), ExtentForRange(1, 2)}, kBlockSize, &data));
+  EXPECT_FALSE(reader->MapExtents({ExtentForRange(7, 2)}, kBlockSize, &data));
+
+  // Without a reader, nothing can be mapped.
+  EXPECT_FALSE(PartitionImage(image_.path())
+                   .MapExtents({ExtentForRange(0, 8)}, kBlockSize, &data));
+}
+
+TEST_F(PartitionImageReaderTest, OpenMissingImageTest) {
+  EXPECT_EQ(nullptr, PartitionImageReader::Open("/non/existent/image"));
+}
+
+TEST_F(PartitionImageReaderTest, PartitionImageReadsThroughReaderTest) {
+  auto reader = PartitionImageReader::Open(image_.path());
+  ASSERT_NE(nullptr, reader);
+  // The reader keeps serving the image it opened, even after the path is
+  // replaced by an empty file.
+  ASSERT_EQ(0, unlink(image_.path().c_str()));
+  ASSERT_TRUE(test_utils::WriteFileVector(image_.path(), {}));
+
+  brillo::Blob data;
+  EXPECT_TRUE(PartitionImage(image_.path(), reader.get())
+                  .ReadExtents({ExtentForRange(2, 3)},
+                               &data,
+                               3 * kBlockSize,
+                               kBlockSize));
+  EXPECT_EQ(Blocks(2, 3), data);
+
+  // Without a reader, the path is opened again.
+  EXPECT_FALSE(PartitionImage(image_.path())
+                   .ReadExtents({ExtentForRange(2, 3)},
+                                &data,
+                                3 * kBlockSize,
+                                kBlockSize));
+}
+
+}  // namespace chromeos_update_engine
@@ -76,6 +76,8 @@ bool PartitionConfig::ValidateExists() const {
 bool PartitionConfig::OpenFilesystem() {
   if (path.empty())
     return true;
+  image_reader = PartitionImageReader::Open(path);
+  TEST_AND_RETURN_FALSE(image_reader);
   fs_interface.reset();
   if (diff_utils::IsExtFilesystem(path)) {
     fs_interface = Ext2Filesystem::CreateFromFile(path);
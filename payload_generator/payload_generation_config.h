@@ -28,6 +28,7 @@
 
 #include "bsdiff/constants.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/payload_generator/partition_image_reader.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -98,7 +99,8 @@ struct PartitionConfig {
   bool ValidateExists() const;
 
   // Open then filesystem stored in this partition and stores it in
-  // |fs_interface|. Returns whether opening the filesystem worked.
+  // |fs_interface|. The image is also kept open in |image_reader| for the
+  // generator to read from. Returns whether opening the filesystem worked.
   bool OpenFilesystem();
 
   // The path to the partition file. This can be a regular file or a block
@@ -122,6 +124,15 @@ struct PartitionConfig {
   // files.
   std::unique_ptr<FilesystemInterface> fs_interface;
 
+  // The reader used by the generator to read blocks from |path|, shared by
+  // all the generator threads. Set by OpenFilesystem().
+  std::unique_ptr<PartitionImageReader> image_reader;
+
+  // Returns the image at |path|, read through |image_reader| if it's open.
+  PartitionImage image() const {
+    return PartitionImage(path, image_reader.get());
+  }
+
   std::string name;
 
   PostInstallConfig postinstall;
@@ -261,6 +272,12 @@ struct PayloadGenerationConfig {
   // Whether to enable zucchini ops
   bool enable_zucchini = true;
 
+  // The directory where the operations generated for each partition are
+  // cached, to reuse them when generating a payload with the same source and
+  // target images for a partition. The deflates located in zip and gzip files
+  // are cached there as well. Empty to not use a cache.
+  std::string partition_cache_dir;
+
   std::string security_patch_level;
 
   std::vector<bsdiff::CompressorType> compressors{
@@ -0,0 +1,161 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/task_scheduler.h"
+
+#include <algorithm>
+#include <string>
+
+#include <base/logging.h>
+
+#include "update_engine/payload_generator/delta_diff_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::mutex global_scheduler_mutex;
+TaskScheduler* global_scheduler = nullptr;
+size_t global_max_threads = 0;
+uint64_t global_max_memory = 0;
+
+}  // namespace
+
+TaskScheduler::TaskScheduler(size_t max_threads, uint64_t max_memory)
+    : max_threads_(max_threads), max_memory_(max_memory) {
+  CHECK_GT(max_threads_, 0U);
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+// static
+TaskScheduler* TaskScheduler::Get() {
+  std::lock_guard<std::mutex> lock(global_scheduler_mutex);
+  if (!global_scheduler) {
+    size_t max_threads = global_max_threads ? global_max_threads
+                                            : diff_utils::GetMaxThreads();
+    LOG(INFO) << "Running payload generation tasks on " << max_threads
+              << " threads"
+              << (global_max_memory
+                      ? " within " + std::to_string(global_max_memory) +
+                            " bytes of memory"
+                      : "");
+    // The scheduler lives until the process exits.
+    global_scheduler = new TaskScheduler(max_threads, global_max_memory);
+  }
+  return global_scheduler;
+}
+
+// static
+bool TaskScheduler::SetGlobalLimits(size_t max_threads, uint64_t max_memory) {
+  std::lock_guard<std::mutex> lock(global_scheduler_mutex);
+  if (global_scheduler) {
+    LOG(ERROR) << "The task scheduler limits can't be changed once in use.";
+    return false;
+  }
+  global_max_threads = max_threads;
+  global_max_memory = max_memory;
+  return true;
+}
+
+void TaskScheduler::RunTasks(const vector<Task>& tasks) {
+  if (tasks.empty())
+    return;
+
+  size_t pending = tasks.size();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (workers_.size() + 1 < max_threads_) {
+    workers_.emplace_back(&TaskScheduler::WorkerLoop, this);
+  }
+  const uint64_t first_sequence = next_sequence_;
+  for (const Task& task : tasks) {
+    queue_.push_back({task, &pending, next_sequence_++});
+  }
+  cv_.notify_all();
+
+  // Help with the queued tasks until ours are done. Besides ours, these are
+  // tasks queued after them, mostly by our own tasks, which the worker
+  // threads would be doing anyway. Earlier tasks are left to the workers,
+  // since they may take much longer than ours.
+  while (pending > 0) {
+    auto it = FindStartableLocked(first_sequence);
+    if (it != queue_.end()) {
+      RunLocked(it, &lock);
+    } else {
+      cv_.wait(lock);
+    }
+  }
+}
+
+std::deque<TaskScheduler::QueuedTask>::iterator
+TaskScheduler::FindStartableLocked(uint64_t min_sequence) {
+  // The queue is in sequence order.
+  auto it = std::lower_bound(queue_.begin(),
+                             queue_.end(),
+                             min_sequence,
+                             [](const QueuedTask& queued_task, uint64_t seq) {
+                               return queued_task.sequence < seq;
+                             });
+  if (max_memory_ == 0 || memory_in_use_ == 0)
+    return it;
+  return std::find_if(it, queue_.end(), [this](const QueuedTask& queued_task) {
+    return memory_in_use_ + queued_task.task.memory <= max_memory_;
+  });
+}
+
+void TaskScheduler::RunLocked(std::deque<QueuedTask>::iterator it,
+                              std::unique_lock<std::mutex>* lock) {
+  QueuedTask queued_task = *it;
+  queue_.erase(it);
+  memory_in_use_ += queued_task.task.memory;
+  lock->unlock();
+
+  queued_task.task.delegate->Run();
+
+  lock->lock();
+  memory_in_use_ -= queued_task.task.memory;
+  (*queued_task.pending)--;
+  cv_.notify_all();
+}
+
+void TaskScheduler::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto it = queue_.end();
+    cv_.wait(lock, [this, &it] {
+      if (stopping_)
+        return true;
+      it = FindStartableLocked(0);
+      return it != queue_.end();
+    });
+    if (stopping_)
+      return;
+    RunLocked(it, &lock);
+  }
+}
+
+}  // namespace chromeos_update_engine
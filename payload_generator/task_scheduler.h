@@ -0,0 +1,118 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_TASK_SCHEDULER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_TASK_SCHEDULER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/threading/simple_thread.h>
+
+namespace chromeos_update_engine {
+
+// A TaskScheduler runs the work of the payload generator on a fixed set of
+// threads shared by all the levels of work: partitions, files and chunks.
+//
+// Tasks are run in the order they are queued. A thread waiting in RunTasks()
+// runs its own queued tasks, and those queued after them, until its own tasks
+// are done, so a task can queue more tasks and wait for them without holding
+// a thread idle. It doesn't run the tasks queued before its own, such as the
+// other partitions of a payload, so they don't end up nested on its stack. At
+// most |max_threads| tasks run at the same time, counting the thread that
+// called RunTasks() from outside the scheduler.
+//
+// Each task declares roughly how much memory it needs. A task is only started
+// when it fits in |max_memory| together with the running tasks, or when no
+// other task holding memory is running. Tasks that don't fit are skipped in
+// favor of the next queued ones that do, so a large task only delays itself.
+// Tasks that call RunTasks() themselves must declare no memory, since they
+// hold it while waiting.
+class TaskScheduler {
+ public:
+  struct Task {
+    base::DelegateSimpleThread::Delegate* delegate;
+    // The approximate peak memory used by the task, in bytes.
+    uint64_t memory = 0;
+  };
+
+  // A |max_memory| of 0 means no memory limit. |max_threads| must be positive.
+  TaskScheduler(size_t max_threads, uint64_t max_memory);
+  ~TaskScheduler();
+
+  // Returns the scheduler shared by the whole process. It is created on first
+  // use with the limits passed to SetGlobalLimits(), or with
+  // diff_utils::GetMaxThreads() threads and no memory limit.
+  static TaskScheduler* Get();
+
+  // Sets the limits of the process-wide scheduler. Returns false if it is
+  // already in use.
+  static bool SetGlobalLimits(size_t max_threads, uint64_t max_memory);
+
+  // Runs all the |tasks| and returns once they are all done.
+  void RunTasks(const std::vector<Task>& tasks);
+
+  size_t max_threads() const { return max_threads_; }
+  uint64_t max_memory() const { return max_memory_; }
+
+ private:
+  struct QueuedTask {
+    Task task;
+    // The number of tasks of the RunTasks() call that queued this task which
+    // are not done yet.
+    size_t* pending;
+    // The position of the task in the order tasks were queued.
+    uint64_t sequence;
+  };
+
+  // Returns the first queued task that was queued at |min_sequence| or later
+  // and can be started now, or the end of |queue_| if there is none.
+  std::deque<QueuedTask>::iterator FindStartableLocked(uint64_t min_sequence);
+
+  // Runs the queued task at |it|. |lock| must be holding |mutex_|, and it is
+  // released while the task runs.
+  void RunLocked(std::deque<QueuedTask>::iterator it,
+                 std::unique_lock<std::mutex>* lock);
+
+  void WorkerLoop();
+
+  const size_t max_threads_;
+  const uint64_t max_memory_;
+
+  std::mutex mutex_;
+  // Signaled when a task is queued or done, or the workers have to stop.
+  std::condition_variable cv_;
+  std::deque<QueuedTask> queue_;
+  // The sequence of the next task queued.
+  uint64_t next_sequence_ = 0;
+  // The memory declared by the running tasks.
+  uint64_t memory_in_use_ = 0;
+  bool stopping_ = false;
+
+  // The worker threads, started on the first RunTasks() call. The caller of
+  // RunTasks() runs tasks as well, so there are |max_threads_| - 1 of them.
+  std::vector<std::thread> workers_;
+
+  DISALLOW_COPY_AND_ASSIGN(TaskScheduler);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_TASK_SCHEDULER_H_
@@ -0,0 +1,194 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/task_scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Keeps track of the tasks and memory in use at the same time.
+struct Usage {
+  void Start(uint64_t memory) {
+    size_t tasks = ++running_tasks;
+    uint64_t total_memory = running_memory += memory;
+    size_t max_tasks_seen = max_tasks.load();
+    while (tasks > max_tasks_seen &&
+           !max_tasks.compare_exchange_weak(max_tasks_seen, tasks)) {
+    }
+    uint64_t max_memory_seen = max_memory.load();
+    while (total_memory > max_memory_seen &&
+           !max_memory.compare_exchange_weak(max_memory_seen, total_memory)) {
+    }
+  }
+
+  void Finish(uint64_t memory) {
+    running_tasks--;
+    running_memory -= memory;
+    done_tasks++;
+  }
+
+  void StartNested() {
+    size_t nested_tasks = ++running_nested_tasks;
+    size_t max_nested_tasks_seen = max_nested_tasks.load();
+    while (nested_tasks > max_nested_tasks_seen &&
+           !max_nested_tasks.compare_exchange_weak(max_nested_tasks_seen,
+                                                   nested_tasks)) {
+    }
+  }
+
+  void FinishNested() { running_nested_tasks--; }
+
+  std::atomic<size_t> running_tasks{0};
+  std::atomic<uint64_t> running_memory{0};
+  std::atomic<size_t> max_tasks{0};
+  std::atomic<uint64_t> max_memory{0};
+  std::atomic<size_t> done_tasks{0};
+  std::atomic<size_t> running_nested_tasks{0};
+  std::atomic<size_t> max_nested_tasks{0};
+};
+
+class SleepTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  SleepTask(Usage* usage, uint64_t memory) : usage_(usage), memory_(memory) {}
+
+  void Run() override {
+    usage_->Start(memory_);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    usage_->Finish(memory_);
+  }
+
+ private:
+  Usage* usage_;
+  uint64_t memory_;
+};
+
+// Runs |num_children| SleepTasks on |scheduler| and waits for them.
+class NestedTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  NestedTask(TaskScheduler* scheduler, Usage* usage, size_t num_children)
+      : scheduler_(scheduler), usage_(usage), num_children_(num_children) {}
+
+  void Run() override {
+    usage_->StartNested();
+    vector<std::unique_ptr<SleepTask>> children;
+    vector<TaskScheduler::Task> tasks;
+    for (size_t i = 0; i < num_children_; i++) {
+      children.push_back(std::make_unique<SleepTask>(usage_, 10));
+      tasks.push_back({children.back().get(), 10});
+    }
+    scheduler_->RunTasks(tasks);
+    usage_->FinishNested();
+  }
+
+ private:
+  TaskScheduler* scheduler_;
+  Usage* usage_;
+  size_t num_children_;
+};
+
+}  // namespace
+
+class TaskSchedulerTest : public ::testing::Test {
+ protected:
+  // Runs |count| SleepTasks of |memory| bytes each on |scheduler|.
+  void RunSleepTasks(TaskScheduler* scheduler, size_t count, uint64_t memory) {
+    vector<std::unique_ptr<SleepTask>> delegates;
+    vector<TaskScheduler::Task> tasks;
+    for (size_t i = 0; i < count; i++) {
+      delegates.push_back(std::make_unique<SleepTask>(&usage_, memory));
+      tasks.push_back({delegates.back().get(), memory});
+    }
+    scheduler->RunTasks(tasks);
+  }
+
+  Usage usage_;
+};
+
+TEST_F(TaskSchedulerTest, RunsAllTasksTest) {
+  TaskScheduler scheduler(4, 0);
+  RunSleepTasks(&scheduler, 50, 0);
+  EXPECT_EQ(50U, usage_.done_tasks);
+  EXPECT_LE(usage_.max_tasks, 4U);
+  EXPECT_EQ(4U, scheduler.max_threads());
+}
+
+TEST_F(TaskSchedulerTest, SingleThreadRunsOnCallerTest) {
+  TaskScheduler scheduler(1, 0);
+  RunSleepTasks(&scheduler, 10, 0);
+  EXPECT_EQ(10U, usage_.done_tasks);
+  EXPECT_EQ(1U, usage_.max_tasks);
+}
+
+TEST_F(TaskSchedulerTest, MemoryLimitTest) {
+  TaskScheduler scheduler(8, 30);
+  RunSleepTasks(&scheduler, 40, 10);
+  EXPECT_EQ(40U, usage_.done_tasks);
+  EXPECT_LE(usage_.max_memory, 30U);
+
+  // A task bigger than the whole budget still runs, on its own.
+  usage_.max_memory = 0;
+  RunSleepTasks(&scheduler, 3, 50);
+  EXPECT_EQ(43U, usage_.done_tasks);
+  EXPECT_EQ(50U, usage_.max_memory);
+}
+
+TEST_F(TaskSchedulerTest, NestedTasksTest) {
+  // Even with a single thread, tasks waiting for their own tasks don't block
+  // the scheduler.
+  for (size_t max_threads : {1, 2, 8}) {
+    TaskScheduler scheduler(max_threads, 20);
+    vector<std::unique_ptr<NestedTask>> delegates;
+    vector<TaskScheduler::Task> tasks;
+    for (size_t i = 0; i < 5; i++) {
+      delegates.push_back(
+          std::make_unique<NestedTask>(&scheduler, &usage_, 6));
+      tasks.push_back({delegates.back().get(), 0});
+    }
+    usage_.done_tasks = 0;
+    scheduler.RunTasks(tasks);
+    EXPECT_EQ(30U, usage_.done_tasks);
+    EXPECT_LE(usage_.max_tasks, max_threads);
+    EXPECT_LE(usage_.max_memory, 20U);
+  }
+}
+
+TEST_F(TaskSchedulerTest, WaitingTaskRunsOnlyLaterTasksTest) {
+  // A task waiting for its own tasks doesn't run the other tasks queued
+  // before them, so on a single thread they are never nested.
+  TaskScheduler scheduler(1, 0);
+  vector<std::unique_ptr<NestedTask>> delegates;
+  vector<TaskScheduler::Task> tasks;
+  for (size_t i = 0; i < 4; i++) {
+    delegates.push_back(std::make_unique<NestedTask>(&scheduler, &usage_, 3));
+    tasks.push_back({delegates.back().get(), 0});
+  }
+  scheduler.RunTasks(tasks);
+  EXPECT_EQ(12U, usage_.done_tasks);
+  EXPECT_EQ(1U, usage_.max_nested_tasks);
+}
+
+}  // namespace chromeos_update_engine
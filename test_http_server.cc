@@ -76,8 +76,12 @@ struct HttpRequest {
   off_t start_offset{0};
   off_t end_offset{0};  // non-inclusive, zero indicates unspecified.
   HttpResponseCode return_code{kHttpResponseOk};
+  // Whether the connection is kept open for another request after responding.
+  bool keep_alive{false};
 };
 
+// Reads and parses the next request on |fd|. Returns false if the client
+// closed the connection instead.
 bool ParseRequest(int fd, HttpRequest* request) {
   string headers;
   do {
@@ -87,6 +91,8 @@ bool ParseRequest(int fd, HttpRequest* request) {
       perror("read");
       exit(RC_ERR_READ);
     }
+    if (r == 0)
+      return false;
     headers.append(buf, r);
   } while (!base::EndsWith(headers, EOL EOL, base::CompareCase::SENSITIVE));
 
@@ -183,14 +189,16 @@ ssize_t WriteString(int fd, const string& str) {
 ssize_t WriteHeaders(int fd,
                      const off_t start_offset,
                      const off_t end_offset,
-                     HttpResponseCode return_code) {
+                     HttpResponseCode return_code,
+                     bool keep_alive = false) {
   ssize_t written = 0, ret{};
 
   ret = WriteString(fd,
                     string("HTTP/1.1 ") + Itoa(return_code) + " " +
                         GetHttpResponseDescription(return_code) +
-                        EOL "Content-Type: application/octet-stream" EOL
-                            "Connection: close" EOL);
+                        EOL "Content-Type: application/octet-stream" EOL +
+                        (keep_alive ? "Connection: keep-alive" EOL
+                                    : "Connection: close" EOL));
   if (ret < 0)
     return -1;
   written += ret;
@@ -309,8 +317,11 @@ ssize_t HandleGet(int fd,
                  << ") exceeds total length (" << total_length
                  << "), generating error response ("
                  << kHttpResponseReqRangeNotSat << ")";
-    return WriteHeaders(
-        fd, total_length, total_length, kHttpResponseReqRangeNotSat);
+    return WriteHeaders(fd,
+                        total_length,
+                        total_length,
+                        kHttpResponseReqRangeNotSat,
+                        request.keep_alive);
   }
 
   // Obtain end offset, adjust to fit in total payload length and ensure it does
@@ -320,7 +331,8 @@ ssize_t HandleGet(int fd,
   if (end_offset < start_offset) {
     LOG(WARNING) << "end offset (" << end_offset << ") precedes start offset ("
                  << start_offset << "), generating error response";
-    return WriteHeaders(fd, 0, 0, kHttpResponseBadRequest);
+    return WriteHeaders(
+        fd, 0, 0, kHttpResponseBadRequest, request.keep_alive);
   }
   if (end_offset > total_length) {
     LOG(INFO) << "requested end offset (" << end_offset
@@ -332,8 +344,11 @@ ssize_t HandleGet(int fd,
   LOG(INFO) << "generating response header: range=" << start_offset << "-"
             << (end_offset - 1) << "/" << (end_offset - start_offset)
             << ", return code=" << request.return_code;
-  if ((ret = WriteHeaders(fd, start_offset, end_offset, request.return_code)) <
-      0)
+  if ((ret = WriteHeaders(fd,
+                          start_offset,
+                          end_offset,
+                          request.return_code,
+                          request.keep_alive)) < 0)
     return -1;
   LOG(INFO) << ret << " header bytes written";
   written += ret;
@@ -523,40 +538,53 @@ class UrlTerms {
   vector<string> terms;
 };
 
-void HandleConnection(int fd) {
-  HttpRequest request;
-  ParseRequest(fd, &request);
-
-  string& url = request.url;
+// Handles |request|. Returns whether the connection is kept open for another
+// request.
+bool HandleRequest(int fd, HttpRequest* request) {
+  string& url = request->url;
   LOG(INFO) << "pid(" << getpid() << "): handling url " << url;
   if (url == "/quitquitquit") {
     HandleQuit(fd);
   } else if (base::StartsWith(
                  url, "/download/", base::CompareCase::SENSITIVE)) {
     const UrlTerms terms(url, 2);
-    HandleGet(fd, request, terms.GetSizeT(1));
+    HandleGet(fd, *request, terms.GetSizeT(1));
+  } else if (base::StartsWith(
+                 url, "/keep-alive/download/", base::CompareCase::SENSITIVE)) {
+    // Same as /download/, but lets the client reuse the connection.
+    const UrlTerms terms(url, 3);
+    request->keep_alive = true;
+    return HandleGet(fd, *request, terms.GetSizeT(2)) >= 0;
   } else if (base::StartsWith(url, "/flaky/", base::CompareCase::SENSITIVE)) {
     const UrlTerms terms(url, 5);
     HandleGet(fd,
-              request,
+              *request,
               terms.GetSizeT(1),
               terms.GetSizeT(2),
               terms.GetInt(3),
               terms.GetInt(4));
   } else if (url.find("/redirect/") == 0) {
-    HandleRedirect(fd, request);
+    HandleRedirect(fd, *request);
   } else if (url == "/error") {
-    HandleError(fd, request);
+    HandleError(fd, *request);
   } else if (base::StartsWith(
                  url, "/error-if-offset/", base::CompareCase::SENSITIVE)) {
     const UrlTerms terms(url, 3);
-    HandleErrorIfOffset(fd, request, terms.GetSizeT(1), terms.GetInt(2));
+    HandleErrorIfOffset(fd, *request, terms.GetSizeT(1), terms.GetInt(2));
   } else if (url == "/echo-headers") {
-    HandleEchoHeaders(fd, request);
+    HandleEchoHeaders(fd, *request);
   } else if (url == "/hang") {
     HandleHang(fd);
   } else {
-    HandleDefault(fd, request);
+    HandleDefault(fd, *request);
+  }
+  return false;
+}
+
+void HandleConnection(int fd) {
+  HttpRequest request;
+  while (ParseRequest(fd, &request) && HandleRequest(fd, &request)) {
+    request = HttpRequest();
   }
 
   close(fd);